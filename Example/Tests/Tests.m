@@ -9,10 +9,159 @@
 #import <UIKit/UIKit.h>
 #import <XCTest/XCTest.h>
 #import "Particle-SDK.h"
+#import "ParticleEventMultiplexer.h"
+#import "EventSource.h"
+#import "EventSourceParser.h"
+#import "ParticleTimestamp.h"
+#import "ParticleJSON.h"
+#import "ParticleMockCloud.h"
+#import <mach/mach.h>
+#import <stdatomic.h>
 
 #define TEST_USER   @"testuser@particle.io"
 #define TEST_PASS   @"testpass"
 
+// path to a recorded SSE stream (raw bytes of a /v1/events response) used by the parser benchmark, synthetic stream is used if missing
+#define TEST_SSE_CAPTURE_PATH_ENV   @"PARTICLE_SSE_CAPTURE_PATH"
+
+// number of threads of the test process
+static NSUInteger TestThreadCount(void)
+{
+    thread_act_array_t threads;
+    mach_msg_type_number_t count = 0;
+    if (task_threads(mach_task_self(), &threads, &count) != KERN_SUCCESS)
+    {
+        return 0;
+    }
+    for (mach_msg_type_number_t i = 0; i < count; i++)
+    {
+        mach_port_deallocate(mach_task_self(), threads[i]);
+    }
+    vm_deallocate(mach_task_self(), (vm_address_t)threads, count * sizeof(thread_t));
+    return count;
+}
+
+// /v1/devices style response with the details of each device - every decoded field, nulls, escapes, unknown keys and platforms
+static NSData *TestDeviceListingJSON(NSUInteger deviceCount)
+{
+    NSArray *platformIds = @[@0, @6, @8, @10, @31, @82, @88, @103, @12];
+    NSMutableArray *listing = [NSMutableArray arrayWithCapacity:deviceCount];
+    for (NSUInteger i = 0; i < deviceCount; i++)
+    {
+        NSMutableDictionary *params = [@{@"id" : [NSString stringWithFormat:@"%024lx", (unsigned long)i],
+                                         @"name" : (i % 10) ? [NSString stringWithFormat:@"device_%lu", (unsigned long)i] : [NSString stringWithFormat:@"\"kitchen\" #%lu \u00e9", (unsigned long)i],
+                                         @"connected" : @(i % 3 == 0),
+                                         @"platform_id" : platformIds[i % platformIds.count],
+                                         @"product_id" : @(i % 7),
+                                         @"last_app" : [NSNull null],
+                                         @"last_ip_address" : [NSString stringWithFormat:@"10.0.%lu.%lu", (unsigned long)(i / 256 % 256), (unsigned long)(i % 256)],
+                                         @"last_heard" : [NSString stringWithFormat:@"2017-04-%02luT08:42:22.%03luZ", (unsigned long)(1 + i % 28), (unsigned long)(i % 1000)],
+                                         @"status" : @"normal",
+                                         @"cellular" : @(i % 2 == 1),
+                                         @"notes" : [NSNull null],
+                                         @"functions" : @[@"led", @"reset", @"digitalwrite"],
+                                         @"variables" : @{@"temp" : @"double", @"mode" : @"string"}} mutableCopy];
+        if (i % 2)
+        {
+            params[@"last_iccid"] = [NSString stringWithFormat:@"89314404000%09lu", (unsigned long)i];
+            params[@"imei"] = [NSString stringWithFormat:@"35%013lu", (unsigned long)i];
+        }
+        if (i % 100 == 0)
+        {
+            params[@"device_needs_update"] = @YES;
+        }
+        [listing addObject:params];
+    }
+    return [NSJSONSerialization dataWithJSONObject:listing options:0 error:nil];
+}
+
+// answers every request with a variable read response without touching the network
+@interface TestVariableResponseProtocol : NSURLProtocol
+@end
+
+static atomic_ulong TestVariableResponseCount; // requests answered
+
+@implementation TestVariableResponseProtocol
+
++(BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return YES;
+}
+
++(NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+-(void)startLoading
+{
+    atomic_fetch_add(&TestVariableResponseCount, 1);
+    NSData *body = [@"{\"cmd\":\"VarReturn\",\"name\":\"temp\",\"result\":41.9,\"coreInfo\":{\"connected\":true}}" dataUsingEncoding:NSUTF8StringEncoding];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Content-Type" : @"application/json"}];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [self.client URLProtocol:self didLoadData:body];
+    [self.client URLProtocolDidFinishLoading:self];
+}
+
+-(void)stopLoading
+{
+}
+
+@end
+
+
+// serves TestEventStreamBody as an event stream that stays open, in network sized chunks
+static NSData *TestEventStreamBody;
+
+@interface TestEventStreamProtocol : NSURLProtocol
+@end
+
+@implementation TestEventStreamProtocol
+
++(BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return YES;
+}
+
++(NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+-(void)startLoading
+{
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Content-Type" : @"text/event-stream"}];
+    [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    NSUInteger chunkSize = 16 * 1024;
+    for (NSUInteger offset = 0; offset < TestEventStreamBody.length; offset += chunkSize)
+    {
+        [self.client URLProtocol:self didLoadData:[TestEventStreamBody subdataWithRange:NSMakeRange(offset, MIN(chunkSize, TestEventStreamBody.length - offset))]];
+    }
+}
+
+-(void)stopLoading
+{
+}
+
+@end
+
+
+// records refresh: field change notifications
+@interface TestDeviceDelegate : NSObject <ParticleDeviceDelegate>
+@property (nonatomic) NSUInteger updateCount;
+@property (nonatomic) ParticleDeviceFields changedFields;
+@end
+
+@implementation TestDeviceDelegate
+
+-(void)particleDevice:(ParticleDevice *)device didUpdateFields:(ParticleDeviceFields)changedFields
+{
+    self.updateCount++;
+    self.changedFields = changedFields;
+}
+
+@end
+
 
 @interface Tests : XCTestCase
 
@@ -74,6 +223,1911 @@
     [self waitForExpectationsWithTimeout:5.0 handler:nil];
 }
 
+-(void)testEventNamePrefixMatching
+{
+    XCTAssertTrue(ParticleEventNameHasPrefix(@"temp/room1", @"temp"));
+    XCTAssertTrue(ParticleEventNameHasPrefix(@"temp/room1", nil));
+    XCTAssertTrue(ParticleEventNameHasPrefix(@"temp/room1", @""));
+    XCTAssertFalse(ParticleEventNameHasPrefix(@"humidity", @"temp"));
+    XCTAssertTrue(ParticleEventNameHasPrefix(@"spark/status", @"particle"), @"particle prefix should match spark system events");
+    XCTAssertTrue(ParticleEventNameHasPrefix(@"particle/status/safe-mode", @"spark"));
+}
+
+-(void)testEventStreamsAreSharedAndReferenceCounted
+{
+    ParticleEventMultiplexer *multiplexer = [[ParticleEventMultiplexer alloc] initWithBaseURL:[NSURL URLWithString:@"http://localhost:8080"]];
+    ParticleEventHandler handler = ^(ParticleEvent * _Nullable event, NSError * _Nullable error) {};
+
+    id tempID = [multiplexer subscribeToPath:@"/v1/devices/events" eventNamePrefix:@"temp" deviceID:nil serverFiltered:NO accessToken:@"token" handler:handler];
+    id deviceID = [multiplexer subscribeToPath:@"/v1/devices/events" eventNamePrefix:nil deviceID:@"53ff6e066667574824151267" serverFiltered:NO accessToken:@"token" handler:handler];
+    id systemID = [multiplexer subscribeToPath:@"/v1/devices/events" eventNamePrefix:@"particle" deviceID:nil serverFiltered:NO accessToken:@"token" handler:handler];
+    XCTAssertEqual(multiplexer.openStreamCount, 1, @"My devices subscriptions should share a single stream");
+
+    id firehoseID = [multiplexer subscribeToPath:@"/v1/events" eventNamePrefix:@"temp" deviceID:nil serverFiltered:YES accessToken:@"token" handler:handler];
+    id narrowFirehoseID = [multiplexer subscribeToPath:@"/v1/events" eventNamePrefix:@"temp/room1" deviceID:nil serverFiltered:YES accessToken:@"token" handler:handler];
+    XCTAssertEqual(multiplexer.openStreamCount, 2, @"Narrower prefix should join the covering firehose stream");
+
+    [multiplexer unsubscribeWithID:tempID];
+    [multiplexer unsubscribeWithID:deviceID];
+    XCTAssertEqual(multiplexer.openStreamCount, 2, @"Stream closed while still referenced");
+    [multiplexer unsubscribeWithID:systemID];
+    XCTAssertEqual(multiplexer.openStreamCount, 1);
+    XCTAssertFalse([multiplexer hasSubscriptionWithID:systemID]);
+
+    [multiplexer unsubscribeWithID:firehoseID];
+    [multiplexer unsubscribeWithID:narrowFirehoseID];
+    XCTAssertEqual(multiplexer.openStreamCount, 0);
+}
+
+-(void)testDeviceRegistryRefetchesOnlyChangedDevices
+{
+    ParticleDeviceRegistry *registry = [ParticleDeviceRegistry new];
+    NSDictionary *listing = @{@"id" : @"53ff6e066667574824151267", @"name" : @"renamed", @"connected" : @YES, @"last_heard" : @"2017-04-01T10:00:00.000Z"};
+    NSDictionary *details = @{@"id" : @"53ff6e066667574824151267", @"name" : @"garage", @"connected" : @YES, @"functions" : @[@"open"], @"variables" : @{@"temp" : @"double"}};
+
+    NSString *deviceID = listing[@"id"];
+    XCTAssertNil([registry cachedDetailParamsForListedDeviceID:deviceID], @"Never fetched device needs details");
+
+    [registry setDevice:[[ParticleDevice alloc] initWithParams:details] params:details detailed:YES];
+    XCTAssertEqual(registry.count, 1);
+    NSDictionary *cached = [registry cachedDetailParamsForListedDeviceID:deviceID];
+    XCTAssertEqualObjects(cached[@"functions"], @[@"open"]);
+    ParticleDevice *listedDevice = [[ParticleDevice alloc] initWithJSONData:[NSJSONSerialization dataWithJSONObject:listing options:0 error:nil] cloud:nil];
+    [listedDevice __setFunctionsAndVariablesWithDetailParams:cached];
+    XCTAssertEqualObjects(listedDevice.functions, @[@"open"]);
+    XCTAssertEqualObjects(listedDevice.variables, @{@"temp" : @"double"});
+    XCTAssertEqualObjects(listedDevice.name, @"renamed", @"Listing fields are newer than cached details");
+
+    // offline/online cycle might come with new firmware
+    ParticleEvent *online = [[ParticleEvent alloc] initWithEventDict:@{@"event" : @"spark/status", @"data" : @"online", @"coreid" : deviceID}];
+    [registry applySystemEvent:online];
+    XCTAssertNil([registry cachedDetailParamsForListedDeviceID:deviceID]);
+
+    [registry setDevice:[[ParticleDevice alloc] initWithParams:details] params:details detailed:YES];
+    XCTAssertNotNil([registry cachedDetailParamsForListedDeviceID:deviceID]);
+    ParticleEvent *appHash = [[ParticleEvent alloc] initWithEventDict:@{@"event" : @"spark/device/app-hash", @"data" : @"48ABD2D9", @"coreid" : deviceID}];
+    [registry applySystemEvent:appHash];
+    XCTAssertNil([registry cachedDetailParamsForListedDeviceID:deviceID]);
+    XCTAssertEqualObjects([registry deviceWithID:deviceID].appHash, @"48ABD2D9", @"System events are applied to the registered device");
+
+    [registry retainOnlyDevicesWithIDs:[NSSet set]];
+    XCTAssertEqual(registry.count, 0);
+    XCTAssertNil([registry deviceWithID:deviceID]);
+}
+
+-(void)testGetDevicesBoundedConcurrencyAndOrder
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    mockCloud.responseLatency = 0.1;
+    NSUInteger const onlineCount = 12;
+    NSUInteger const offlineCount = 3;
+    NSMutableDictionary<NSString *, NSDate *> *onlineLastHeard = [NSMutableDictionary new];
+    for (NSUInteger i = 0; i < onlineCount + offlineCount; i++)
+    {
+        NSString *deviceID = [NSString stringWithFormat:@"53ff6e0666675748241%05lu", (unsigned long)i];
+        [mockCloud addDeviceWithID:deviceID name:[NSString stringWithFormat:@"device%lu", (unsigned long)i] connected:(i < onlineCount) variables:nil functions:nil];
+        // listing order is not last heard order
+        NSDate *lastHeard = [NSDate dateWithTimeIntervalSinceNow:-60.0 * (1 + (i * 7) % (onlineCount + offlineCount))];
+        [mockCloud setLastHeard:lastHeard forDeviceWithID:deviceID];
+        if (i < onlineCount)
+        {
+            onlineLastHeard[deviceID] = lastHeard;
+        }
+    }
+    NSArray<NSString *> *onlineByLastHeard = [onlineLastHeard keysSortedByValueUsingComparator:^NSComparisonResult(NSDate *date1, NSDate *date2) {
+        return [date2 compare:date1];
+    }];
+
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    cloud.deviceSnapshotURL = nil;
+    cloud.maxConnectionsPerHost = 16; // device request limit is the one that applies
+    cloud.maxConcurrentDeviceRequests = 3;
+
+    NSMutableArray<NSString *> *onlineProgressIDs = [NSMutableArray new];
+    __block NSUInteger progressCount = 0;
+    __block BOOL completed = NO;
+    __block NSArray<ParticleDevice *> *fetchedDevices;
+    XCTestExpectation *devicesFetched = [self expectationWithDescription:@"devices"];
+    [cloud getDevicesWithProgress:^(ParticleDevice *device) {
+        XCTAssertTrue([NSThread isMainThread]);
+        XCTAssertFalse(completed, @"Progress reported after the completion");
+        progressCount++;
+        if (device.connected)
+        {
+            [onlineProgressIDs addObject:device.id];
+        }
+    } completion:^(NSArray<ParticleDevice *> *devices, NSError *error) {
+        XCTAssertTrue([NSThread isMainThread]);
+        XCTAssertNil(error);
+        completed = YES;
+        fetchedDevices = devices;
+        [devicesFetched fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.2]]; // late progress would show up now
+
+    XCTAssertEqual(progressCount, onlineCount + offlineCount);
+    XCTAssertEqual(fetchedDevices.count, onlineCount + offlineCount);
+    XCTAssertEqual(mockCloud.requestCount, 1 + onlineCount);
+    XCTAssertEqual(mockCloud.maxConcurrentRequestCount, 3);
+
+    // details are queried most recently heard first - the first round of requests completes first
+    XCTAssertEqual(onlineProgressIDs.count, onlineCount);
+    XCTAssertEqualObjects([NSSet setWithArray:[onlineProgressIDs subarrayWithRange:NSMakeRange(0, 3)]], [NSSet setWithArray:[onlineByLastHeard subarrayWithRange:NSMakeRange(0, 3)]]);
+
+    // results too
+    for (NSUInteger i = 1; i < fetchedDevices.count; i++)
+    {
+        XCTAssertNotEqual([fetchedDevices[i - 1].lastHeard compare:fetchedDevices[i].lastHeard], NSOrderedAscending);
+    }
+}
+
+// reads variableName count times in a row, completion gets the number of failed reads
+-(void)readVariable:(NSString *)variableName ofDevice:(ParticleDevice *)device times:(NSUInteger)count completion:(void (^)(NSUInteger failedReads))completion
+{
+    if (count == 0)
+    {
+        completion(0);
+        return;
+    }
+    [device getVariable:variableName completion:^(id result, NSError *error) {
+        [self readVariable:variableName ofDevice:device times:count - 1 completion:^(NSUInteger failedReads) {
+            completion(failedReads + (error != nil));
+        }];
+    }];
+}
+
+-(void)testSharedConnectionPoolVariableReads
+{
+    ParticleCloud *cloud = [ParticleCloud sharedInstance];
+    NSURLSessionConfiguration *previousConfiguration = cloud.sessionConfiguration;
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[TestVariableResponseProtocol class]];
+    cloud.sessionConfiguration = configuration;
+
+    NSUInteger const deviceCount = 1000, readsPerDevice = 10;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    NSMutableArray<ParticleDevice *> *devices = [NSMutableArray arrayWithCapacity:deviceCount];
+    for (NSUInteger i = 0; i < deviceCount; i++)
+    {
+        NSDictionary *params = @{@"id" : [NSString stringWithFormat:@"53ff6e0666675748241%05lu", (unsigned long)i], @"connected" : @YES, @"variables" : @{@"temp" : @"double"}};
+        [devices addObject:[[ParticleDevice alloc] initWithParams:params]];
+    }
+    CFAbsoluteTime creationElapsed = CFAbsoluteTimeGetCurrent() - start;
+
+    // devices read concurrently, each device one read after the other - concurrent reads of a variable would share a request
+    XCTestExpectation *readsDone = [self expectationWithDescription:@"variable reads"];
+    __block NSUInteger remainingDevices = deviceCount;
+    __block NSUInteger failedReads = 0;
+    unsigned long requestCount = atomic_load(&TestVariableResponseCount);
+    start = CFAbsoluteTimeGetCurrent();
+    for (ParticleDevice *device in devices)
+    {
+        [self readVariable:@"temp" ofDevice:device times:readsPerDevice completion:^(NSUInteger failed) {
+            failedReads += failed;
+            if (--remainingDevices == 0)
+            {
+                [readsDone fulfill];
+            }
+        }];
+    }
+    [self waitForExpectationsWithTimeout:120 handler:nil];
+    CFAbsoluteTime readsElapsed = CFAbsoluteTimeGetCurrent() - start;
+    requestCount = atomic_load(&TestVariableResponseCount) - requestCount;
+
+    NSLog(@"Shared connection pool: %lu devices created in %.1f ms, %lu variable reads (%lu requests) in %.3f s (%.0f requests/s)",
+          (unsigned long)deviceCount, creationElapsed * 1000.0, (unsigned long)(deviceCount * readsPerDevice), requestCount, readsElapsed, requestCount / readsElapsed);
+    XCTAssertEqual(failedReads, 0);
+    XCTAssertEqual(requestCount, deviceCount * readsPerDevice);
+
+    cloud.sessionConfiguration = previousConfiguration;
+}
+
+-(void)testMockCloudRoundTrip
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:@{@"temp" : @41.9} functions:@[@"open"]];
+    [mockCloud addDeviceWithID:@"25002a001147353230333635" name:@"porch" connected:NO variables:nil functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertEqualObjects(cloud.baseURL, mockCloud.baseURL);
+
+    XCTestExpectation *devicesFetched = [self expectationWithDescription:@"devices"];
+    __block ParticleDevice *garage;
+    [cloud getDevices:^(NSArray<ParticleDevice *> *devices, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(devices.count, 2);
+        for (ParticleDevice *device in devices)
+        {
+            if (device.connected)
+            {
+                garage = device;
+            }
+        }
+        [devicesFetched fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqualObjects(garage.functions, @[@"open"]);
+    XCTAssertEqualObjects(garage.variables[@"temp"], @"double");
+
+    XCTestExpectation *variableRead = [self expectationWithDescription:@"variable"];
+    [garage getVariable:@"temp" completion:^(id result, NSError *error) {
+        XCTAssertEqualObjects(result, @41.9);
+        [variableRead fulfill];
+    }];
+    XCTestExpectation *functionCalled = [self expectationWithDescription:@"function"];
+    mockCloud.functionHandler = ^NSInteger(NSString *deviceID, NSString *functionName, NSString *argument) {
+        return [argument isEqualToString:@"now"] ? 42 : -1;
+    };
+    [garage callFunction:@"open" withArguments:@[@"now"] completion:^(NSNumber *result, NSError *error) {
+        XCTAssertEqualObjects(result, @42);
+        [functionCalled fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.requestCount, 4);
+
+    // event stream
+    XCTAssertTrue([cloud injectSessionAccessToken:mockCloud.accessToken]);
+    XCTestExpectation *eventReceived = [self expectationWithDescription:@"event"];
+    id subscriptionID = [cloud subscribeToMyDevicesEventsWithPrefix:@"door" handler:^(ParticleEvent *event, NSError *error) {
+        XCTAssertEqualObjects(event.event, @"door/open");
+        XCTAssertEqualObjects(event.data, @"garage");
+        XCTAssertEqualObjects(event.deviceID, @"53ff6e066667574824151267");
+        [eventReceived fulfill];
+    }];
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(0.5 * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+        [mockCloud publishEventWithName:@"not/matching" data:nil deviceID:@"53ff6e066667574824151267"];
+        [mockCloud publishEventWithName:@"door/open" data:@"garage" deviceID:@"53ff6e066667574824151267"];
+    });
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    [cloud unsubscribeFromEventWithID:subscriptionID];
+    [cloud logout];
+}
+
+-(void)testDeviceSnapshotColdStart
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    mockCloud.responseLatency = 0.02;
+    NSUInteger const deviceCount = 200;
+    for (NSUInteger i = 0; i < deviceCount; i++)
+    {
+        [mockCloud addDeviceWithID:[NSString stringWithFormat:@"53ff6e0666675748241%05lu", (unsigned long)i] name:[NSString stringWithFormat:@"device%lu", (unsigned long)i] connected:(i % 2 == 0) variables:@{@"temp" : @41.9} functions:@[@"open"]];
+    }
+    NSURL *snapshotURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"%@-devices.snapshot", [NSUUID UUID].UUIDString]]];
+
+    // previous launch - devices are fetched and saved
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertTrue([cloud injectSessionAccessToken:mockCloud.accessToken]);
+    cloud.deviceSnapshotURL = snapshotURL;
+    XCTestExpectation *devicesFetched = [self expectationWithDescription:@"devices"];
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    [cloud getDevices:^(NSArray<ParticleDevice *> *devices, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(devices.count, deviceCount);
+        [devicesFetched fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    CFAbsoluteTime fetchElapsed = CFAbsoluteTimeGetCurrent() - start;
+    [cloud.deviceRegistry synchronizeSnapshot];
+    NSNumber *snapshotSize;
+    XCTAssertTrue([snapshotURL getResourceValue:&snapshotSize forKey:NSURLFileSizeKey error:nil]);
+
+    // cold start - devices are available before any request
+    NSUInteger requestCount = mockCloud.requestCount;
+    start = CFAbsoluteTimeGetCurrent();
+    ParticleCloud *relaunchedCloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertTrue([relaunchedCloud injectSessionAccessToken:mockCloud.accessToken]);
+    relaunchedCloud.deviceSnapshotURL = snapshotURL;
+    ParticleDevice *firstDevice = [relaunchedCloud.deviceRegistry deviceWithID:@"53ff6e066667574824100000"];
+    CFAbsoluteTime coldStartElapsed = CFAbsoluteTimeGetCurrent() - start;
+    XCTAssertEqual(mockCloud.requestCount, requestCount, @"Restoring devices should not hit the network");
+    XCTAssertEqual(relaunchedCloud.deviceRegistry.count, deviceCount);
+    XCTAssertEqualObjects(firstDevice.name, @"device0");
+    XCTAssertTrue(firstDevice.connected);
+    XCTAssertEqualObjects(firstDevice.functions, @[@"open"]);
+    XCTAssertEqualObjects(firstDevice.variables[@"temp"], @"double");
+    XCTAssertNotNil(firstDevice.lastHeard);
+    XCTAssertNotNil([relaunchedCloud.deviceRegistry listingValidators][@"ETag"]);
+
+    NSData *snapshotData = [NSData dataWithContentsOfURL:snapshotURL];
+    XCTAssertEqual([snapshotData rangeOfData:[mockCloud.accessToken dataUsingEncoding:NSUTF8StringEncoding] options:0 range:NSMakeRange(0, snapshotData.length)].location, NSNotFound, @"Snapshot should not contain the access token");
+
+    // a session injected with another token is not restored another user's devices, their snapshot is dropped
+    ParticleCloud *otherCloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertTrue([otherCloud injectSessionAccessToken:@"a1b2c3d4e5f6a1b2c3d4e5f6a1b2c3d4e5f6a1b2"]);
+    otherCloud.deviceSnapshotURL = snapshotURL;
+    XCTAssertNil([otherCloud.deviceRegistry deviceWithID:@"53ff6e066667574824100000"]);
+    XCTAssertEqual(otherCloud.deviceRegistry.count, 0);
+    XCTAssertEqual(mockCloud.requestCount, requestCount);
+    [otherCloud.deviceRegistry synchronizeSnapshot];
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:snapshotURL.path]);
+
+    NSLog(@"Device snapshot: %lu devices restored in %.2f ms from %@ bytes, getDevices took %.1f ms",
+          (unsigned long)deviceCount, coldStartElapsed * 1000.0, snapshotSize, fetchElapsed * 1000.0);
+
+    // background refresh - unchanged listing is revalidated (304 keeps the restored listing), online devices refetched
+    NSArray *restoredListing = [relaunchedCloud.deviceRegistry listing];
+    XCTestExpectation *devicesRefreshed = [self expectationWithDescription:@"refresh"];
+    [relaunchedCloud getDevices:^(NSArray<ParticleDevice *> *devices, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(devices.count, deviceCount);
+        [devicesRefreshed fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    XCTAssertEqual([relaunchedCloud.deviceRegistry listing], restoredListing);
+    XCTAssertEqual(mockCloud.requestCount - requestCount, 1 + deviceCount / 2);
+
+    // changed listing is fetched again
+    [mockCloud setConnected:NO forDeviceWithID:@"53ff6e066667574824100000"];
+    XCTestExpectation *devicesChanged = [self expectationWithDescription:@"changed"];
+    [relaunchedCloud getDevices:^(NSArray<ParticleDevice *> *devices, NSError *error) {
+        XCTAssertNil(error);
+        [devicesChanged fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    XCTAssertNotEqual([relaunchedCloud.deviceRegistry listing], restoredListing);
+    XCTAssertFalse([relaunchedCloud.deviceRegistry deviceWithID:@"53ff6e066667574824100000"].connected);
+
+    // injecting the same token again (as apps do at every launch) keeps the snapshot
+    requestCount = mockCloud.requestCount;
+    XCTAssertTrue([relaunchedCloud injectSessionAccessToken:mockCloud.accessToken]);
+    XCTAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:snapshotURL.path]);
+    XCTAssertNotNil([relaunchedCloud.deviceRegistry deviceWithID:@"53ff6e066667574824100000"]);
+    XCTAssertFalse([relaunchedCloud.deviceRegistry deviceWithID:@"53ff6e066667574824100000"].connected);
+    XCTAssertEqual(relaunchedCloud.deviceRegistry.count, deviceCount);
+    XCTAssertEqual(mockCloud.requestCount, requestCount);
+
+    [relaunchedCloud logout];
+    [relaunchedCloud.deviceRegistry synchronizeSnapshot];
+    XCTAssertFalse([[NSFileManager defaultManager] fileExistsAtPath:snapshotURL.path], @"Snapshot should be deleted on logout");
+    [cloud logout];
+}
+
+-(void)testConditionalDeviceRequestsReuseDevices
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    NSUInteger const deviceCount = 2000;
+    for (NSUInteger i = 0; i < deviceCount; i++)
+    {
+        [mockCloud addDeviceWithID:[NSString stringWithFormat:@"53ff6e0666675748241%05lu", (unsigned long)i] name:[NSString stringWithFormat:@"device%lu", (unsigned long)i] connected:(i % 10 == 0) variables:@{@"temp" : @41.9} functions:@[@"open", @"close"]];
+    }
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    cloud.deviceSnapshotURL = nil;
+    cloud.maxConcurrentDeviceRequests = 0;
+
+    __block NSArray<ParticleDevice *> *fetchedDevices;
+    XCTestExpectation *devicesFetched = [self expectationWithDescription:@"devices"];
+    [cloud getDevices:^(NSArray<ParticleDevice *> *devices, NSError *error) {
+        XCTAssertNil(error);
+        fetchedDevices = devices;
+        [devicesFetched fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    XCTAssertEqual(fetchedDevices.count, deviceCount);
+    ParticleDeviceRequestCacheStats *fetchStats = [cloud deviceRequestCacheStats];
+    XCTAssertEqual(fetchStats.requestCount, 1 + deviceCount / 10);
+    XCTAssertEqual(fetchStats.notModifiedCount, 0);
+
+    // nothing changed - listing revalidated with one empty 304, the same device instances come back
+    __block NSArray<ParticleDevice *> *refreshedDevices;
+    XCTestExpectation *devicesRefreshed = [self expectationWithDescription:@"refresh"];
+    [cloud getDevices:^(NSArray<ParticleDevice *> *devices, NSError *error) {
+        XCTAssertNil(error);
+        refreshedDevices = devices;
+        [devicesRefreshed fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    XCTAssertEqual(refreshedDevices.count, deviceCount);
+    XCTAssertEqualObjects([NSSet setWithArray:[refreshedDevices valueForKey:@"id"]], [NSSet setWithArray:[fetchedDevices valueForKey:@"id"]]);
+    for (ParticleDevice *device in refreshedDevices)
+    {
+        XCTAssertEqual(device, [cloud.deviceRegistry deviceWithID:device.id], @"Unchanged listing should reuse the parsed devices");
+    }
+    ParticleDeviceRequestCacheStats *refreshStats = [cloud deviceRequestCacheStats];
+    XCTAssertEqual(refreshStats.requestCount - fetchStats.requestCount, 1);
+    XCTAssertEqual(refreshStats.notModifiedCount, 1);
+    XCTAssertEqual(refreshStats.bytesReceived, fetchStats.bytesReceived, @"304 should not carry a body");
+    XCTAssertGreaterThan(refreshStats.bytesSaved, 0);
+
+    // device details revalidated - same instance
+    NSString *onlineID = @"53ff6e066667574824100000";
+    ParticleDevice *online = [cloud.deviceRegistry deviceWithID:onlineID];
+    XCTestExpectation *deviceRevalidated = [self expectationWithDescription:@"device"];
+    [cloud getDevice:onlineID completion:^(ParticleDevice *device, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(device, online);
+        XCTAssertEqualObjects(device.functions, (@[@"open", @"close"]));
+        [deviceRevalidated fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual([cloud deviceRequestCacheStats].notModifiedCount, 2);
+
+    // changed device details are downloaded and parsed again
+    [mockCloud setValue:@"on" forVariable:@"mode" deviceID:onlineID];
+    XCTestExpectation *deviceChanged = [self expectationWithDescription:@"changed"];
+    [cloud getDevice:onlineID completion:^(ParticleDevice *device, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertNotEqual(device, online);
+        XCTAssertEqualObjects(device.variables[@"mode"], @"string");
+        [deviceChanged fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    ParticleDeviceRequestCacheStats *stats = [cloud deviceRequestCacheStats];
+    XCTAssertEqual(stats.notModifiedCount, 2);
+    XCTAssertEqual(stats.revalidationCount, 3);
+
+    // details dropped while the revalidation is out - the 304 has nothing to revalidate, details are fetched again
+    mockCloud.responseLatency = 0.2;
+    XCTestExpectation *deviceRefetched = [self expectationWithDescription:@"refetched"];
+    [cloud getDevice:onlineID completion:^(ParticleDevice *device, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqualObjects(device.id, onlineID);
+        XCTAssertEqualObjects(device.variables[@"mode"], @"string");
+        [deviceRefetched fulfill];
+    }];
+    [cloud.deviceRegistry removeAllDevices];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual([cloud deviceRequestCacheStats].notModifiedCount, 3);
+
+    // registry is updated without a completion block too
+    mockCloud.responseLatency = 0;
+    [cloud.deviceRegistry removeAllDevices];
+    [cloud getDevice:onlineID completion:nil];
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(ParticleCloud *evaluatedCloud, NSDictionary *bindings) {
+        return ([evaluatedCloud.deviceRegistry deviceWithID:onlineID] != nil);
+    }] evaluatedWithObject:cloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    NSLog(@"Conditional device requests, %lu devices: full fetch %llu bytes, refresh %llu bytes (saved %llu), %@",
+          (unsigned long)deviceCount, fetchStats.bytesReceived, refreshStats.bytesReceived - fetchStats.bytesReceived, refreshStats.bytesSaved, stats);
+}
+
+-(void)testDeviceRefreshUpdatesOnlyChangedFields
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    NSString *deviceID = @"53ff6e066667574824151267";
+    [mockCloud addDeviceWithID:deviceID name:@"garage" connected:YES variables:@{@"temp" : @41.9} functions:@[@"open"]];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    cloud.deviceSnapshotURL = nil;
+
+    XCTestExpectation *deviceFetched = [self expectationWithDescription:@"device"];
+    __block ParticleDevice *garage;
+    [cloud getDevice:deviceID completion:^(ParticleDevice *device, NSError *error) {
+        garage = device;
+        [deviceFetched fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    TestDeviceDelegate *delegate = [TestDeviceDelegate new];
+    garage.delegate = delegate;
+    NSArray *functions = garage.functions;
+
+    // new variable - only the variables change, refresh must not rename the device
+    [mockCloud setValue:@"on" forVariable:@"mode" deviceID:deviceID];
+    NSUInteger requestCount = mockCloud.requestCount;
+    XCTestExpectation *refreshed = [self expectationWithDescription:@"refresh"];
+    [garage refresh:^(NSError *error) {
+        XCTAssertNil(error);
+        [refreshed fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.requestCount - requestCount, 1, @"Refresh should not send a rename request");
+    XCTAssertEqual(delegate.updateCount, 1);
+    XCTAssertEqual(delegate.changedFields, ParticleDeviceFieldVariables);
+    XCTAssertEqualObjects(garage.variables[@"mode"], @"string");
+    XCTAssertEqualObjects(garage.name, @"garage");
+    XCTAssertEqual(garage.functions, functions, @"Unchanged fields should keep their values");
+
+    // nothing changed - no notification
+    XCTestExpectation *refreshedAgain = [self expectationWithDescription:@"refresh again"];
+    [garage refresh:^(NSError *error) {
+        XCTAssertNil(error);
+        [refreshedAgain fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(delegate.updateCount, 1);
+}
+
+-(void)testGetVariableCoalescingAndCache
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    mockCloud.responseLatency = 0.2;
+    [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:@{@"temp" : @41.9} functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    ParticleDevice *device = [[ParticleDevice alloc] initWithParams:@{@"id" : @"53ff6e066667574824151267", @"connected" : @YES} cloud:cloud];
+
+    // concurrent reads share one request
+    for (int i = 0; i < 10; i++)
+    {
+        XCTestExpectation *read = [self expectationWithDescription:[NSString stringWithFormat:@"read %d", i]];
+        [device getVariable:@"temp" completion:^(id result, NSError *error) {
+            XCTAssertEqualObjects(result, @41.9);
+            [read fulfill];
+        }];
+    }
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.requestCount, 1);
+    XCTAssertEqual(device.variableCacheMisses, 1);
+    XCTAssertEqual(device.variableReadsCoalesced, 9);
+
+    // fresh values come from cache
+    device.variableCacheTTL = 60;
+    [mockCloud setValue:@42.5 forVariable:@"temp" deviceID:device.id];
+    XCTestExpectation *miss = [self expectationWithDescription:@"miss"];
+    [device getVariable:@"temp" completion:^(id result, NSError *error) {
+        XCTAssertEqualObjects(result, @42.5);
+        [miss fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    [mockCloud setValue:@43 forVariable:@"temp" deviceID:device.id];
+    XCTestExpectation *hit = [self expectationWithDescription:@"hit"];
+    ParticleVariableRead *cachedRead = [device getVariable:@"temp" completion:^(id result, NSError *error) {
+        XCTAssertEqualObjects(result, @42.5);
+        [hit fulfill];
+    }];
+    XCTAssertNil(cachedRead.task, @"Cached values should not need a request");
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.requestCount, 2);
+    XCTAssertEqual(device.variableCacheHits, 1);
+
+    // per variable override
+    [device setCacheTTL:0 forVariable:@"temp"];
+    XCTestExpectation *uncached = [self expectationWithDescription:@"uncached"];
+    [device getVariable:@"temp" completion:^(id result, NSError *error) {
+        XCTAssertEqualObjects(result, @43);
+        [uncached fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.requestCount, 3);
+
+    // cancelling one of the calls sharing a request fails only that call
+    XCTestExpectation *cancelled = [self expectationWithDescription:@"cancelled"];
+    ParticleVariableRead *cancelledRead = [device getVariable:@"temp" completion:^(id result, NSError *error) {
+        XCTAssertNil(result);
+        XCTAssertEqual(error.code, NSURLErrorCancelled);
+        [cancelled fulfill];
+    }];
+    XCTestExpectation *kept = [self expectationWithDescription:@"kept"];
+    ParticleVariableRead *keptRead = [device getVariable:@"temp" completion:^(id result, NSError *error) {
+        XCTAssertEqualObjects(result, @43);
+        [kept fulfill];
+    }];
+    XCTAssertNotEqual(cancelledRead, keptRead);
+    XCTAssertNotNil(keptRead.task);
+    XCTAssertEqual(cancelledRead.task, keptRead.task);
+    [cancelledRead cancel];
+    XCTAssertTrue(cancelledRead.finished);
+    XCTAssertFalse(keptRead.finished);
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.requestCount, 4);
+    XCTAssertEqual(keptRead.task.state, NSURLSessionTaskStateCompleted);
+    XCTAssertTrue(keptRead.finished);
+
+    // last call cancelled - the shared request goes with it, the next call starts a new one
+    XCTestExpectation *allCancelled = [self expectationWithDescription:@"all cancelled"];
+    [[device getVariable:@"temp" completion:^(id result, NSError *error) {
+        XCTAssertEqual(error.code, NSURLErrorCancelled);
+        [allCancelled fulfill];
+    }] cancel];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTestExpectation *fresh = [self expectationWithDescription:@"fresh"];
+    [device getVariable:@"temp" completion:^(id result, NSError *error) {
+        XCTAssertEqualObjects(result, @43);
+        [fresh fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+-(void)testGetVariablesBatchLatency
+{
+    NSMutableDictionary *variables = [NSMutableDictionary new];
+    for (int i = 0; i < 12; i++)
+    {
+        variables[[NSString stringWithFormat:@"var%d", i]] = @(i);
+    }
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    mockCloud.responseLatency = 0.05; // cellular-ish round trip
+    [mockCloud addDeviceWithID:@"25002a001147353230333635" name:@"dashboard" connected:YES variables:variables functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    NSMutableDictionary *variableTypes = [NSMutableDictionary new];
+    for (NSString *name in variables)
+    {
+        variableTypes[name] = @"int32";
+    }
+    ParticleDevice *device = [[ParticleDevice alloc] initWithParams:@{@"id" : @"25002a001147353230333635", @"connected" : @YES, @"variables" : variableTypes} cloud:cloud];
+
+    // sequential getVariable: calls
+    NSMutableDictionary *sequentialResults = [NSMutableDictionary new];
+    NSDate *start = [NSDate date];
+    for (NSString *name in variables)
+    {
+        XCTestExpectation *read = [self expectationWithDescription:name];
+        [device getVariable:name completion:^(id result, NSError *error) {
+            sequentialResults[name] = result;
+            [read fulfill];
+        }];
+        [self waitForExpectationsWithTimeout:5 handler:nil];
+    }
+    NSTimeInterval sequentialTime = -[start timeIntervalSinceNow];
+
+    // batch read
+    XCTestExpectation *batch = [self expectationWithDescription:@"batch"];
+    __block NSDictionary *batchResults;
+    start = [NSDate date];
+    [device getAllVariables:^(NSDictionary *results, NSDictionary *errors) {
+        XCTAssertEqual(errors.count, 0);
+        batchResults = results;
+        [batch fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    NSTimeInterval batchTime = -[start timeIntervalSinceNow];
+
+    NSLog(@"12 variables: sequential getVariable %.0f ms, getVariables (%lu in flight) %.0f ms", sequentialTime * 1000, (unsigned long)device.maxConcurrentVariableReads, batchTime * 1000);
+    XCTAssertEqualObjects(batchResults, variables);
+    XCTAssertEqualObjects(sequentialResults, variables);
+    XCTAssertLessThan(batchTime, sequentialTime);
+
+    // offline device - remaining reads are not sent
+    [mockCloud setConnected:NO forDeviceWithID:device.id];
+    NSUInteger requestCount = mockCloud.requestCount;
+    device.maxConcurrentVariableReads = 1;
+    XCTestExpectation *offline = [self expectationWithDescription:@"offline"];
+    [device getAllVariables:^(NSDictionary *results, NSDictionary *errors) {
+        XCTAssertEqual(results.count, 0);
+        XCTAssertEqual(errors.count, 12);
+        [offline fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.requestCount, requestCount + 1);
+}
+
+-(void)testFleetFunctionCall
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    mockCloud.responseLatency = 0.01;
+    NSMutableArray *deviceIDs = [NSMutableArray new];
+    for (int i = 0; i < 50; i++)
+    {
+        NSString *deviceID = [NSString stringWithFormat:@"25002a0011473532303336%02x", i];
+        [mockCloud addDeviceWithID:deviceID name:nil connected:(i % 10 != 0) variables:nil functions:@[@"setMode"]];
+        [deviceIDs addObject:deviceID];
+    }
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+
+    // arguments checked once, nothing sent
+    XCTestExpectation *rejected = [self expectationWithDescription:@"rejected"];
+    NSString *longArgument = [@"" stringByPaddingToLength:64 withString:@"x" startingAtIndex:0];
+    [cloud callFunction:@"setMode" withArguments:@[longArgument] onDeviceIDs:deviceIDs maxConcurrentCalls:8 timeout:5 progress:nil completion:^(ParticleFunctionCallSummary *summary, NSError *error) {
+        XCTAssertNil(summary);
+        XCTAssertEqual(error.code, 1000);
+        [rejected fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.requestCount, 0);
+
+    XCTestExpectation *called = [self expectationWithDescription:@"called"];
+    __block NSUInteger progressCount = 0;
+    [cloud callFunction:@"setMode" withArguments:@[@"eco"] onDeviceIDs:deviceIDs maxConcurrentCalls:8 timeout:5 progress:^(ParticleFunctionCallResult *result) {
+        progressCount++;
+    } completion:^(ParticleFunctionCallSummary *summary, NSError *error) {
+        XCTAssertNil(error);
+        XCTAssertEqual(summary.results.count, 50);
+        XCTAssertEqual(summary.succeededCount, 45);
+        XCTAssertEqual(summary.failedCount, 5);
+        XCTAssertTrue((summary.latencyP50 <= summary.latencyP90) && (summary.latencyP90 <= summary.latencyP99) && (summary.latencyP99 <= summary.latencyMax));
+        NSLog(@"%@", summary);
+        [called fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+    XCTAssertEqual(progressCount, 50);
+
+    // unanswered calls are cancelled after the timeout
+    mockCloud.responseLatency = 1;
+    XCTestExpectation *timedOut = [self expectationWithDescription:@"timed out"];
+    [cloud callFunction:@"setMode" withArguments:nil onDeviceIDs:[deviceIDs subarrayWithRange:NSMakeRange(1, 3)] maxConcurrentCalls:0 timeout:0.1 progress:nil completion:^(ParticleFunctionCallSummary *summary, NSError *error) {
+        XCTAssertEqual(summary.timedOutCount, 3);
+        XCTAssertLessThan(summary.duration, 1);
+        [timedOut fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+}
+
+-(void)testEventStreamReconnectResumesFromLastEventID
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    mockCloud.sendsEventIDs = YES;
+    mockCloud.eventStreamRetryInterval = 0.05;
+    [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:nil functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertTrue([cloud injectSessionAccessToken:mockCloud.accessToken]);
+
+    NSMutableArray<NSString *> *received = [NSMutableArray new];
+    NSMutableArray<NSError *> *streamErrors = [NSMutableArray new];
+    __block XCTestExpectation *expectation;
+    __block NSUInteger expectedCount = 0;
+    id subscriptionID = [cloud subscribeToMyDevicesEventsWithPrefix:@"test" handler:^(ParticleEvent *event, NSError *error) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (error)
+            {
+                [streamErrors addObject:error];
+                return;
+            }
+            [received addObject:event.data];
+            if (received.count == expectedCount)
+            {
+                [expectation fulfill];
+            }
+        });
+    }];
+    // system events and test subscriptions share the my devices stream
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    expectation = [self expectationWithDescription:@"first event"];
+    expectedCount = 1;
+    [mockCloud publishEventWithName:@"test/event" data:@"1" deviceID:@"53ff6e066667574824151267"];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    // events published while the stream is down are replayed after the Last-Event-ID reconnect
+    expectation = [self expectationWithDescription:@"resumed events"];
+    expectedCount = 3;
+    [mockCloud dropEventStreams];
+    [mockCloud publishEventWithName:@"test/event" data:@"2" deviceID:@"53ff6e066667574824151267"];
+    [mockCloud publishEventWithName:@"test/event" data:@"3" deviceID:@"53ff6e066667574824151267"];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqualObjects(received, (@[@"1", @"2", @"3"]));
+    XCTAssertEqual(streamErrors.count, 0); // lost connection is recovered, only the stats show it
+
+    ParticleEventSubscriptionStats *stats = [cloud statsForEventListenerID:subscriptionID];
+    NSLog(@"%@", stats);
+    XCTAssertEqual(stats.reconnectCount, 1);
+    XCTAssertEqual(stats.missedEventCount, 0);
+    XCTAssertGreaterThan(stats.lastRecoveryTime, 0);
+    XCTAssertLessThan(stats.lastRecoveryTime, 1); // honors retry: 50 ms instead of the 1 s default
+
+    // without history the cloud can't resume - the gap is reported
+    mockCloud.eventHistoryLength = 0;
+    expectation = [self expectationWithDescription:@"events after gap"];
+    expectedCount = 4;
+    [mockCloud dropEventStreams];
+    [mockCloud publishEventWithName:@"test/event" data:@"lost" deviceID:@"53ff6e066667574824151267"];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    [mockCloud publishEventWithName:@"test/event" data:@"4" deviceID:@"53ff6e066667574824151267"];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqualObjects(received.lastObject, @"4");
+    XCTAssertEqual([cloud statsForEventListenerID:subscriptionID].missedEventCount, 1);
+
+    [cloud unsubscribeFromEventWithID:subscriptionID];
+    [cloud logout];
+}
+
+-(void)testRejectedEventStreamIsReopenedForNewSubscriptions
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:nil functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+
+    // system events stream is rejected for the token and stops for good - its subscriptions get the error
+    XCTAssertTrue([cloud injectSessionAccessToken:@"expired-token"]);
+    XCTestExpectation *rejected = [self expectationWithDescription:@"rejected"];
+    id rejectedSubscriptionID = [cloud subscribeToMyDevicesEventsWithPrefix:@"window" handler:^(ParticleEvent *event, NSError *error) {
+        XCTAssertNil(event);
+        XCTAssertEqual(error.code, NSURLErrorUserAuthenticationRequired);
+        [rejected fulfill];
+    }];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"rejectedEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.openEventStreamCount, 0);
+
+    // a new subscription on the same stream reconnects it instead of joining the dead one
+    mockCloud.accessToken = @"expired-token";
+    __block XCTestExpectation *eventReceived;
+    id subscriptionID = [cloud subscribeToMyDevicesEventsWithPrefix:@"door" handler:^(ParticleEvent *event, NSError *error) {
+        if (event)
+        {
+            XCTAssertEqualObjects(event.event, @"door/open");
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [eventReceived fulfill];
+            });
+        }
+    }];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    eventReceived = [self expectationWithDescription:@"event"];
+    [mockCloud publishEventWithName:@"door/open" data:@"garage" deviceID:@"53ff6e066667574824151267"];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(mockCloud.rejectedEventStreamCount, 1);
+
+    [cloud unsubscribeFromEventWithID:rejectedSubscriptionID];
+    [cloud unsubscribeFromEventWithID:subscriptionID];
+    [cloud logout];
+}
+
+-(void)testEventStreamThreadCountWith100Subscriptions
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:nil functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertTrue([cloud injectSessionAccessToken:mockCloud.accessToken]);
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    NSUInteger baselineThreadCount = TestThreadCount();
+
+    // public event streams are filtered in the cloud - one stream per prefix when not capped
+    cloud.maxServerFilteredEventStreams = 0;
+    NSMutableArray<NSString *> *eventNames = [NSMutableArray new];
+    NSMutableArray *subscriptionIDs = [NSMutableArray new];
+    XCTestExpectation *allReceived = [self expectationWithDescription:@"events"];
+    allReceived.expectedFulfillmentCount = 100;
+    for (int i = 0; i < 100; i++)
+    {
+        NSString *eventName = [NSString stringWithFormat:@"sensor-%03d", i];
+        [eventNames addObject:eventName];
+        [subscriptionIDs addObject:[cloud subscribeToAllEventsWithPrefix:eventName handler:^(ParticleEvent *event, NSError *error) {
+            [allReceived fulfill];
+        }]];
+    }
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 101"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+
+    for (NSString *eventName in eventNames)
+    {
+        [mockCloud publishEventWithName:eventName data:nil deviceID:@"53ff6e066667574824151267"];
+    }
+    [self waitForExpectationsWithTimeout:10 handler:nil];
+
+    // streams are read by one session queue - no thread is pinned per stream
+    NSUInteger threadCount = TestThreadCount();
+    NSLog(@"threads: %lu before, %lu with 100 open event streams", (unsigned long)baselineThreadCount, (unsigned long)threadCount);
+    XCTAssertLessThan(threadCount, baselineThreadCount + 16);
+
+    for (id subscriptionID in subscriptionIDs)
+    {
+        [cloud unsubscribeFromEventWithID:subscriptionID];
+    }
+    [cloud logout];
+}
+
+-(void)testEventRoutingServerPushdownAndPrefixTrie
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:nil functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertTrue([cloud injectSessionAccessToken:mockCloud.accessToken]);
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    // filters are pushed to the cloud up to the cap, then merged into one stream filtered by the common prefix
+    cloud.maxServerFilteredEventStreams = 4;
+    NSMutableArray *subscriptionIDs = [NSMutableArray new];
+    NSMutableDictionary<NSString *, NSNumber *> *received = [NSMutableDictionary new];
+    XCTestExpectation *allReceived = [self expectationWithDescription:@"public events"];
+    allReceived.expectedFulfillmentCount = 5;
+    for (int i = 0; i < 5; i++)
+    {
+        NSString *prefix = [NSString stringWithFormat:@"sensor-%03d", i];
+        [subscriptionIDs addObject:[cloud subscribeToAllEventsWithPrefix:prefix handler:^(ParticleEvent *event, NSError *error) {
+            XCTAssertTrue([event.event hasPrefix:prefix]);
+            @synchronized (received) {
+                received[prefix] = @(received[prefix].integerValue + 1);
+            }
+            [allReceived fulfill];
+        }]];
+    }
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 2"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    for (int i = 0; i < 5; i++)
+    {
+        [mockCloud publishEventWithName:[NSString stringWithFormat:@"sensor-%03d/reading", i] data:@"41.9" deviceID:@"53ff6e066667574824151267"];
+    }
+    [mockCloud publishEventWithName:@"sensor-010" data:nil deviceID:@"53ff6e066667574824151267"];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    XCTAssertEqual(received.count, 5);
+    for (id subscriptionID in subscriptionIDs)
+    {
+        [cloud unsubscribeFromEventWithID:subscriptionID];
+    }
+
+    // "particle" prefixes still match spark/* system events when matched on the client
+    XCTestExpectation *statusReceived = [self expectationWithDescription:@"status"];
+    id statusID = [cloud subscribeToMyDevicesEventsWithPrefix:@"particle/status" handler:^(ParticleEvent *event, NSError *error) {
+        XCTAssertEqualObjects(event.event, @"spark/status");
+        [statusReceived fulfill];
+    }];
+    [mockCloud setConnected:NO forDeviceWithID:@"53ff6e066667574824151267"];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    [cloud unsubscribeFromEventWithID:statusID];
+
+    // routing cost with thousands of prefixes registered on one stream
+    NSUInteger const prefixCount = 5000, eventCount = 2000;
+    XCTestExpectation *routed = [self expectationWithDescription:@"routed"];
+    routed.expectedFulfillmentCount = eventCount;
+    [subscriptionIDs removeAllObjects];
+    for (NSUInteger i = 0; i < prefixCount; i++)
+    {
+        [subscriptionIDs addObject:[cloud subscribeToMyDevicesEventsWithPrefix:[NSString stringWithFormat:@"sensor-%04lu/", (unsigned long)i] handler:^(ParticleEvent *event, NSError *error) {
+            [routed fulfill];
+        }]];
+    }
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < eventCount; i++)
+    {
+        [mockCloud publishEventWithName:[NSString stringWithFormat:@"sensor-%04lu/reading", (unsigned long)arc4random_uniform(prefixCount)] data:@"41.9" deviceID:@"53ff6e066667574824151267"];
+    }
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+    NSLog(@"routed %lu events over %lu prefixes in %.0f ms (%.1f us/event end to end)", (unsigned long)eventCount, (unsigned long)prefixCount, elapsed * 1000, elapsed * 1e6 / eventCount);
+
+    for (id subscriptionID in subscriptionIDs)
+    {
+        [cloud unsubscribeFromEventWithID:subscriptionID];
+    }
+    [cloud logout];
+}
+
+-(void)testMergedEventStreamDeliversEventsOnce
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:nil functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertTrue([cloud injectSessionAccessToken:mockCloud.accessToken]);
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    cloud.maxServerFilteredEventStreams = 2;
+    NSMutableDictionary<NSString *, NSNumber *> *received = [NSMutableDictionary new];
+    NSMutableArray *subscriptionIDs = [NSMutableArray new];
+    for (int i = 0; i < 2; i++)
+    {
+        [subscriptionIDs addObject:[cloud subscribeToAllEventsWithPrefix:[NSString stringWithFormat:@"sensor-%03d", i] handler:^(ParticleEvent *event, NSError *error) {
+            @synchronized (received) {
+                received[event.data] = @(received[event.data].integerValue + 1);
+            }
+        }]];
+    }
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 3"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    // events keep arriving on the filtered streams while the merged stream opens and takes over their subscriptions
+    __block atomic_bool publishing = YES;
+    __block atomic_ulong published = 0;
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        for (unsigned long i = 0; atomic_load(&publishing); i++)
+        {
+            [mockCloud publishEventWithName:[NSString stringWithFormat:@"sensor-%03lu/reading", i % 2] data:[NSString stringWithFormat:@"%lu", i] deviceID:@"53ff6e066667574824151267"];
+            atomic_fetch_add(&published, 1);
+            [NSThread sleepForTimeInterval:0.001];
+        }
+    });
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    [subscriptionIDs addObject:[cloud subscribeToAllEventsWithPrefix:@"sensor-002" handler:^(ParticleEvent *event, NSError *error) {}]];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 2"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+    atomic_store(&publishing, NO);
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    NSUInteger receivedCount = 0;
+    while ((receivedCount < atomic_load(&published)) && ([deadline timeIntervalSinceNow] > 0))
+    {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+        @synchronized (received) {
+            receivedCount = received.count;
+        }
+    }
+    @synchronized (received) {
+        XCTAssertEqual(received.count, atomic_load(&published));
+        for (NSString *data in received)
+        {
+            XCTAssertEqual(received[data].integerValue, 1, @"event %@ delivered %@ times", data, received[data]);
+        }
+    }
+
+    for (id subscriptionID in subscriptionIDs)
+    {
+        [cloud unsubscribeFromEventWithID:subscriptionID];
+    }
+    [cloud logout];
+}
+
+-(void)testEventJournalAppendReplayAndRolloff
+{
+    NSURL *directoryURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:[NSUUID UUID].UUIDString] isDirectory:YES];
+    NSError *error;
+    ParticleEventJournal *journal = [[ParticleEventJournal alloc] initWithDirectoryURL:directoryURL error:&error];
+    XCTAssertNotNil(journal, @"%@", error);
+    journal.maxSegmentSize = 64 * 1024;
+    journal.maxJournalSize = 256 * 1024;
+
+    // ~170 bytes a record - rolls over to a new segment every ~380 events, the oldest roll off
+    NSUInteger const eventCount = 5000;
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < eventCount; i++)
+    {
+        NSString *payload = [NSString stringWithFormat:@"{\"data\":\"%lu\",\"ttl\":\"60\",\"published_at\":\"2017-03-01T12:00:00.000Z\",\"coreid\":\"53ff6e06666757482415126%lu\"}", (unsigned long)i, (unsigned long)(i % 2)];
+        [journal appendEventWithName:@"temp" deviceID:[NSString stringWithFormat:@"53ff6e06666757482415126%lu", (unsigned long)(i % 2)] payload:[payload dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    CFAbsoluteTime appendElapsed = CFAbsoluteTimeGetCurrent() - start;
+    [journal synchronize];
+    NSLog(@"journal: %lu appends in %.1f ms on the caller, %lu segments", (unsigned long)eventCount, appendElapsed * 1000, (unsigned long)journal.segmentCount);
+    XCTAssertGreaterThan(journal.startOffset, 0, @"oldest segments should have rolled off");
+    XCTAssertLessThanOrEqual(journal.endOffset - journal.startOffset, 256 * 1024 + 64 * 1024);
+
+    __block NSUInteger replayed = 0;
+    __block NSInteger lastData = -1;
+    __block unsigned long long resumeOffset = 0;
+    [journal replayEventsFromOffset:0 deviceID:nil handler:^(ParticleEvent *event, unsigned long long nextOffset, BOOL *stop) {
+        XCTAssertEqualObjects(event.event, @"temp");
+        XCTAssertGreaterThan(event.data.integerValue, lastData, @"events should replay in order");
+        lastData = event.data.integerValue;
+        if (++replayed == 100)
+        {
+            resumeOffset = nextOffset;
+        }
+    }];
+    XCTAssertEqual(lastData, (NSInteger)eventCount - 1);
+    NSUInteger journaledCount = replayed;
+
+    // resume after the 100th event, filter by device
+    __block NSUInteger resumed = 0;
+    [journal replayEventsFromOffset:resumeOffset deviceID:nil handler:^(ParticleEvent *event, unsigned long long nextOffset, BOOL *stop) {
+        resumed++;
+    }];
+    XCTAssertEqual(resumed, journaledCount - 100);
+    __block NSUInteger deviceEvents = 0;
+    [journal replayEventsFromOffset:0 deviceID:@"53ff6e066667574824151261" handler:^(ParticleEvent *event, unsigned long long nextOffset, BOOL *stop) {
+        XCTAssertEqualObjects(event.deviceID, @"53ff6e066667574824151261");
+        deviceEvents++;
+    }];
+    XCTAssertEqualWithAccuracy(deviceEvents, journaledCount / 2, 1);
+    __block NSUInteger futureEvents = 0;
+    [journal replayEventsSinceDate:[NSDate dateWithTimeIntervalSinceNow:60] deviceID:nil handler:^(ParticleEvent *event, unsigned long long nextOffset, BOOL *stop) {
+        futureEvents++;
+    }];
+    XCTAssertEqual(futureEvents, 0);
+
+    // reopening rebuilds the index from the segment files
+    unsigned long long endOffset = journal.endOffset;
+    journal = nil;
+    journal = [[ParticleEventJournal alloc] initWithDirectoryURL:directoryURL error:&error];
+    XCTAssertEqual(journal.endOffset, endOffset);
+    __block NSUInteger reopenedCount = 0;
+    [journal replayEventsSinceDate:[NSDate distantPast] deviceID:nil handler:^(ParticleEvent *event, unsigned long long nextOffset, BOOL *stop) {
+        reopenedCount++;
+    }];
+    XCTAssertEqual(reopenedCount, journaledCount);
+
+    // journaling a subscription
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:nil functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertTrue([cloud injectSessionAccessToken:mockCloud.accessToken]);
+    XCTestExpectation *received = [self expectationWithDescription:@"events"];
+    received.expectedFulfillmentCount = 10;
+    id subscriptionID = [cloud subscribeToMyDevicesEventsWithPrefix:@"door" handler:^(ParticleEvent *event, NSError *error) {
+        [received fulfill];
+    }];
+    XCTAssertTrue([cloud setEventJournal:journal forEventListenerID:subscriptionID]);
+    // a second subscription matching the same events shares the journal - each event is still journaled once
+    id sharedJournalID = [cloud subscribeToMyDevicesEventsWithPrefix:@"do" handler:^(ParticleEvent *event, NSError *error) {}];
+    XCTAssertTrue([cloud setEventJournal:journal forEventListenerID:sharedJournalID]);
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    for (int i = 0; i < 10; i++)
+    {
+        [mockCloud publishEventWithName:@"door" data:[NSString stringWithFormat:@"%d", i] deviceID:@"53ff6e066667574824151267"];
+    }
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    __block NSUInteger doorEvents = 0;
+    [journal replayEventsFromOffset:endOffset deviceID:@"53ff6e066667574824151267" handler:^(ParticleEvent *event, unsigned long long nextOffset, BOOL *stop) {
+        XCTAssertEqualObjects(event.event, @"door");
+        XCTAssertEqualObjects(event.data, ([NSString stringWithFormat:@"%lu", (unsigned long)doorEvents]));
+        doorEvents++;
+    }];
+    XCTAssertEqual(doorEvents, 10);
+
+    [cloud unsubscribeFromEventWithID:sharedJournalID];
+    [cloud unsubscribeFromEventWithID:subscriptionID];
+    [cloud logout];
+    [[NSFileManager defaultManager] removeItemAtURL:directoryURL error:nil];
+}
+
+-(void)testEventStoreWindowQueriesAndFootprint
+{
+    ParticleEventStore *store = [[ParticleEventStore alloc] initWithRetentionInterval:3600];
+    NSUInteger const eventCount = 50000, deviceCount = 50;
+    NSTimeInterval const base = 1488369600; // 2017-03-01 12:00:00Z, one event every 50 ms
+    NSArray<NSString *> *names = @[@"temp", @"temp/outside", @"humidity", @"spark/status"];
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < eventCount; i++)
+    {
+        ParticleEvent *event = [[ParticleEvent alloc] initWithEventDict:@{@"event" : names[i % names.count],
+                                                                          @"data" : [NSString stringWithFormat:@"%.1f", 20 + (i % 100) / 10.0],
+                                                                          @"ttl" : @"60",
+                                                                          @"coreid" : [NSString stringWithFormat:@"53ff6e0666675748241512%02lu", (unsigned long)(i % deviceCount)]}];
+        event.time = [NSDate dateWithTimeIntervalSince1970:base + i * 0.05];
+        [store addEvent:event];
+    }
+    CFAbsoluteTime ingestElapsed = CFAbsoluteTimeGetCurrent() - start;
+    XCTAssertEqual(store.count, eventCount);
+    NSLog(@"event store: %lu events ingested in %.0f ms, %.1f bytes/event (%lu bytes)", (unsigned long)eventCount, ingestElapsed * 1000, (double)store.memoryFootprint / eventCount, (unsigned long)store.memoryFootprint);
+    XCTAssertLessThan(store.memoryFootprint, eventCount * 64, @"Columns should take a fraction of ParticleEvent objects");
+
+    // device 7 only publishes "temp/outside" and "spark/status" (7 % 4 == 3, 57 % 4 == 1) - every 50th event
+    NSDate *from = [NSDate dateWithTimeIntervalSince1970:base + 99.99];
+    NSDate *to = [NSDate dateWithTimeIntervalSince1970:base + 200.01];
+    start = CFAbsoluteTimeGetCurrent();
+    NSArray<ParticleEvent *> *events = [store eventsWithDeviceID:@"53ff6e066667574824151207" eventNamePrefix:@"temp" from:from to:to];
+    NSLog(@"event store: window query in %.2f ms", (CFAbsoluteTimeGetCurrent() - start) * 1000);
+    NSUInteger expected = 0;
+    for (NSUInteger i = 2000; i <= 4000; i++)
+    {
+        expected += ((i % deviceCount == 7) && ([names[i % names.count] hasPrefix:@"temp"])) ? 1 : 0;
+    }
+    XCTAssertEqual(events.count, expected);
+    for (ParticleEvent *event in events)
+    {
+        XCTAssertEqualObjects(event.event, @"temp/outside");
+        XCTAssertEqualObjects(event.deviceID, @"53ff6e066667574824151207");
+        XCTAssertTrue([event.time compare:from] != NSOrderedAscending && [event.time compare:to] != NSOrderedDescending);
+        XCTAssertNotNil(event.data);
+    }
+    XCTAssertEqual([store countOfEventsWithDeviceID:nil eventNamePrefix:@"particle" from:nil to:nil], eventCount / names.count, @"particle prefix should match spark system events");
+    XCTAssertEqual([store countOfEventsWithDeviceID:@"unknown" eventNamePrefix:nil from:nil to:nil], 0);
+
+    // late event is inserted in time order, events more than an hour older than the newest are evicted
+    ParticleEvent *late = [[ParticleEvent alloc] initWithEventDict:@{@"event" : @"late", @"data" : @"1", @"coreid" : @"53ff6e066667574824151267"}];
+    late.time = [NSDate dateWithTimeIntervalSince1970:base + 150.0125];
+    [store addEvent:late];
+    XCTAssertEqualObjects([store eventsWithDeviceID:nil eventNamePrefix:@"late" from:nil to:nil].firstObject.time, late.time);
+    ParticleEvent *newest = [[ParticleEvent alloc] initWithEventDict:@{@"event" : @"temp", @"data" : @"25", @"coreid" : @"53ff6e066667574824151267"}];
+    newest.time = [NSDate dateWithTimeIntervalSince1970:base + 3600 + 1000.025];
+    [store addEvent:newest];
+    XCTAssertEqual([store countOfEventsWithDeviceID:nil eventNamePrefix:nil from:nil to:[NSDate dateWithTimeIntervalSince1970:base + 999]], 0);
+    XCTAssertEqual(store.count, eventCount - 20001 + 1);
+}
+
+-(void)testConcurrentSubscribeUnsubscribeWhileStreaming
+{
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:nil functions:nil];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    XCTAssertTrue([cloud injectSessionAccessToken:mockCloud.accessToken]);
+
+    // keeps the shared stream open while other subscriptions come and go
+    __block NSUInteger anchorReceived = 0;
+    id anchorID = [cloud subscribeToMyDevicesEventsWithPrefix:@"temp" handler:^(ParticleEvent *event, NSError *error) {
+        @synchronized (self) {
+            anchorReceived++;
+        }
+    }];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    __block atomic_bool publishing = YES;
+    dispatch_group_t publisher = dispatch_group_create();
+    dispatch_group_async(publisher, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        while (atomic_load(&publishing))
+        {
+            [mockCloud publishEventWithName:@"temp" data:@"41.9" deviceID:@"53ff6e066667574824151267"];
+            usleep(200);
+        }
+    });
+
+    // 16 threads subscribing and unsubscribing on the stream being routed
+    dispatch_apply(16, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t thread) {
+        for (int i = 0; i < 200; i++)
+        {
+            id subscriptionID = [cloud subscribeToMyDevicesEventsWithPrefix:(i % 2) ? @"temp" : nil handler:^(ParticleEvent *event, NSError *error) {
+                XCTAssertNil(error);
+            }];
+            XCTAssertNotNil(subscriptionID);
+            [cloud unsubscribeFromEventWithID:subscriptionID];
+        }
+    });
+
+    atomic_store(&publishing, NO);
+    dispatch_group_wait(publisher, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual(mockCloud.openEventStreamCount, 1);
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(id object, NSDictionary *bindings) {
+        @synchronized (self) {
+            return (anchorReceived > 0);
+        }
+    }] evaluatedWithObject:self handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    // same for the handler lists of a single EventSource while it delivers
+    NSUInteger const eventCount = 20000;
+    NSMutableData *body = [NSMutableData new];
+    for (NSUInteger i = 0; i < eventCount; i++)
+    {
+        [body appendData:[@"event: temp\ndata: {\"data\":\"41.9\"}\n\n" dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    TestEventStreamBody = body;
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[TestEventStreamProtocol class]];
+    EventSourceSession *session = [[EventSourceSession alloc] initWithConfiguration:configuration];
+    EventSource *source = [EventSource eventSourceWithURL:[NSURL URLWithString:@"https://stream.particle.invalid/v1/events"] timeoutInterval:300 queue:dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0) session:session];
+    // registered before the stream opens, must see every event whatever the other handlers do
+    __block atomic_ulong synchronousReceived = 0, asynchronousReceived = 0;
+    [source addEventListener:MessageEvent handler:^(Event *event) {
+        atomic_fetch_add(&synchronousReceived, 1);
+    } synchronous:YES];
+    [source addEventListener:MessageEvent handler:^(Event *event) {
+        atomic_fetch_add(&asynchronousReceived, 1);
+    } synchronous:NO];
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + 30;
+    dispatch_apply(16, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t thread) {
+        // churn at least until the whole stream is delivered
+        for (int i = 0; (i < 200) || ((atomic_load(&asynchronousReceived) < eventCount) && (CFAbsoluteTimeGetCurrent() < deadline)); i++)
+        {
+            // captures a value so every handler is a distinct block
+            EventSourceEventHandler handler = [^(Event *event) { (void)thread; } copy];
+            [source addEventListener:MessageEvent handler:handler synchronous:(i % 2)];
+            [source removeEventListener:MessageEvent handler:handler];
+        }
+    });
+    XCTAssertEqual(atomic_load(&synchronousReceived), eventCount);
+    XCTAssertEqual(atomic_load(&asynchronousReceived), eventCount);
+    [source close];
+
+    [cloud unsubscribeFromEventWithID:anchorID];
+    [cloud logout];
+}
+
+// publishes events (@[name, data] pairs) while the handler is stuck on a first event, returns the data of all delivered events
+-(NSArray<NSString *> *)deliveredEventsWithQueueDepth:(NSUInteger)queueDepth overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy events:(NSArray<NSArray<NSString *> *> *)events stats:(ParticleEventSubscriptionStats **)stats
+{
+    NSString *deviceID = @"53ff6e066667574824151267";
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    [mockCloud addDeviceWithID:deviceID name:@"garage" connected:YES variables:nil functions:nil];
+    ParticleEventMultiplexer *multiplexer = [[ParticleEventMultiplexer alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+
+    NSMutableArray<NSString *> *received = [NSMutableArray new];
+    dispatch_semaphore_t started = dispatch_semaphore_create(0);
+    dispatch_semaphore_t gate = dispatch_semaphore_create(0);
+    id subscriptionID = [multiplexer subscribeToPath:@"/v1/devices/events" eventNamePrefix:@"queue" deviceID:nil serverFiltered:NO accessToken:mockCloud.accessToken queueDepth:queueDepth overflowPolicy:overflowPolicy handler:^(ParticleEvent *event, NSError *error) {
+        if (!event)
+        {
+            return;
+        }
+        @synchronized (received) {
+            [received addObject:event.data];
+        }
+        if ([event.data isEqualToString:@"first"])
+        {
+            dispatch_semaphore_signal(started);
+            dispatch_semaphore_wait(gate, DISPATCH_TIME_FOREVER);
+        }
+    }];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    [mockCloud publishEventWithName:@"queue/first" data:@"first" deviceID:deviceID];
+    XCTAssertEqual(dispatch_semaphore_wait(started, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(5 * NSEC_PER_SEC))), 0);
+    for (NSArray<NSString *> *event in events)
+    {
+        [mockCloud publishEventWithName:event[0] data:event[1] deviceID:deviceID];
+    }
+
+    // every event is queued, dropped or coalesced - except with the block policy, which stops reading the stream once the queue is full
+    NSUInteger settledCount = (overflowPolicy == ParticleEventOverflowPolicyBlock) ? queueDepth : events.count;
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(ParticleEventMultiplexer *evaluatedMultiplexer, NSDictionary *bindings) {
+        ParticleEventSubscriptionStats *current = [evaluatedMultiplexer statsForSubscriptionWithID:subscriptionID];
+        return (current.queuedCount + current.droppedCount + current.coalescedCount == settledCount);
+    }] evaluatedWithObject:multiplexer handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    [NSThread sleepForTimeInterval:0.2]; // nothing more arrives while the handler is stuck
+    ParticleEventSubscriptionStats *stuckStats = [multiplexer statsForSubscriptionWithID:subscriptionID];
+    XCTAssertEqual(stuckStats.deliveredCount, 1);
+    XCTAssertEqual(stuckStats.queuedCount, MIN(queueDepth, events.count));
+    XCTAssertEqual(stuckStats.queuedCount + stuckStats.droppedCount + stuckStats.coalescedCount, settledCount);
+
+    // handler catches up - the queue drains (and a blocked stream reader resumes)
+    dispatch_semaphore_signal(gate);
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(ParticleEventMultiplexer *evaluatedMultiplexer, NSDictionary *bindings) {
+        ParticleEventSubscriptionStats *current = [evaluatedMultiplexer statsForSubscriptionWithID:subscriptionID];
+        @synchronized (received) {
+            return ((current.queuedCount == 0) && (received.count == 1 + events.count - current.droppedCount - current.coalescedCount));
+        }
+    }] evaluatedWithObject:multiplexer handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    *stats = [multiplexer statsForSubscriptionWithID:subscriptionID];
+    [multiplexer unsubscribeWithID:subscriptionID];
+    @synchronized (received) {
+        return [received copy];
+    }
+}
+
+-(void)testEventQueueDropOldestPolicy
+{
+    ParticleEventSubscriptionStats *stats;
+    NSArray *received = [self deliveredEventsWithQueueDepth:2 overflowPolicy:ParticleEventOverflowPolicyDropOldest events:@[@[@"queue/a", @"1"], @[@"queue/a", @"2"], @[@"queue/a", @"3"], @[@"queue/a", @"4"]] stats:&stats];
+    XCTAssertEqualObjects(received, (@[@"first", @"3", @"4"]));
+    XCTAssertEqual(stats.droppedCount, 2);
+    XCTAssertEqual(stats.coalescedCount, 0);
+    XCTAssertEqual(stats.deliveredCount, 3);
+    XCTAssertEqual(stats.maxQueuedCount, 2);
+}
+
+-(void)testEventQueueDropNewestPolicy
+{
+    ParticleEventSubscriptionStats *stats;
+    NSArray *received = [self deliveredEventsWithQueueDepth:2 overflowPolicy:ParticleEventOverflowPolicyDropNewest events:@[@[@"queue/a", @"1"], @[@"queue/a", @"2"], @[@"queue/a", @"3"], @[@"queue/a", @"4"]] stats:&stats];
+    XCTAssertEqualObjects(received, (@[@"first", @"1", @"2"]));
+    XCTAssertEqual(stats.droppedCount, 2);
+    XCTAssertEqual(stats.coalescedCount, 0);
+    XCTAssertEqual(stats.deliveredCount, 3);
+    XCTAssertEqual(stats.maxQueuedCount, 2);
+}
+
+-(void)testEventQueueCoalescePolicy
+{
+    // latest event per device and name replaces the queued one in place
+    ParticleEventSubscriptionStats *stats;
+    NSArray *received = [self deliveredEventsWithQueueDepth:2 overflowPolicy:ParticleEventOverflowPolicyCoalesce events:@[@[@"queue/a", @"a1"], @[@"queue/b", @"b1"], @[@"queue/a", @"a2"], @[@"queue/a", @"a3"]] stats:&stats];
+    XCTAssertEqualObjects(received, (@[@"first", @"a3", @"b1"]));
+    XCTAssertEqual(stats.coalescedCount, 2);
+    XCTAssertEqual(stats.droppedCount, 0);
+    XCTAssertEqual(stats.deliveredCount, 3);
+
+    // more distinct keys than queue slots - oldest is dropped
+    received = [self deliveredEventsWithQueueDepth:2 overflowPolicy:ParticleEventOverflowPolicyCoalesce events:@[@[@"queue/a", @"a1"], @[@"queue/b", @"b1"], @[@"queue/c", @"c1"]] stats:&stats];
+    XCTAssertEqualObjects(received, (@[@"first", @"b1", @"c1"]));
+    XCTAssertEqual(stats.coalescedCount, 0);
+    XCTAssertEqual(stats.droppedCount, 1);
+}
+
+-(void)testEventQueueBlockPolicy
+{
+    // stream reader waits on the full queue until the handler catches up - nothing is lost
+    ParticleEventSubscriptionStats *stats;
+    NSArray *received = [self deliveredEventsWithQueueDepth:2 overflowPolicy:ParticleEventOverflowPolicyBlock events:@[@[@"queue/a", @"1"], @[@"queue/a", @"2"], @[@"queue/a", @"3"], @[@"queue/a", @"4"], @[@"queue/a", @"5"]] stats:&stats];
+    XCTAssertEqualObjects(received, (@[@"first", @"1", @"2", @"3", @"4", @"5"]));
+    XCTAssertEqual(stats.droppedCount, 0);
+    XCTAssertEqual(stats.coalescedCount, 0);
+    XCTAssertEqual(stats.deliveredCount, 6);
+    XCTAssertEqual(stats.maxQueuedCount, 2);
+}
+
+-(void)testBatchedEventDelivery
+{
+    NSString *deviceID = @"53ff6e066667574824151267";
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    [mockCloud addDeviceWithID:deviceID name:@"garage" connected:YES variables:nil functions:nil];
+    ParticleEventMultiplexer *multiplexer = [[ParticleEventMultiplexer alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+
+    NSMutableArray<NSArray<NSString *> *> *sizeBatches = [NSMutableArray new];
+    id sizeID = [multiplexer subscribeToPath:@"/v1/devices/events" eventNamePrefix:@"size" deviceID:nil serverFiltered:NO accessToken:mockCloud.accessToken maxBatchSize:4 maxLatency:60 batchHandler:^(NSArray<ParticleEvent *> *events, NSError *error) {
+        @synchronized (sizeBatches) {
+            [sizeBatches addObject:[events valueForKey:@"data"]];
+        }
+    }];
+    NSMutableArray<NSArray<NSString *> *> *latencyBatches = [NSMutableArray new];
+    id latencyID = [multiplexer subscribeToPath:@"/v1/devices/events" eventNamePrefix:@"latency" deviceID:nil serverFiltered:NO accessToken:mockCloud.accessToken maxBatchSize:100 maxLatency:0.5 batchHandler:^(NSArray<ParticleEvent *> *events, NSError *error) {
+        @synchronized (latencyBatches) {
+            [latencyBatches addObject:[events valueForKey:@"data"]];
+        }
+    }];
+    [self expectationForPredicate:[NSPredicate predicateWithFormat:@"openEventStreamCount == 1"] evaluatedWithObject:mockCloud handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+
+    // full batches are delivered right away (long before their 60 s latency bound), in stream order
+    for (NSUInteger i = 1; i <= 8; i++)
+    {
+        [mockCloud publishEventWithName:@"size/event" data:[NSString stringWithFormat:@"%lu", (unsigned long)i] deviceID:deviceID];
+    }
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(NSMutableArray *batches, NSDictionary *bindings) {
+        @synchronized (batches) {
+            return (batches.count == 2);
+        }
+    }] evaluatedWithObject:sizeBatches handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    @synchronized (sizeBatches) {
+        XCTAssertEqualObjects(sizeBatches, (@[@[@"1", @"2", @"3", @"4"], @[@"5", @"6", @"7", @"8"]]));
+    }
+
+    // a partial batch is delivered once its first event is maxLatency old
+    for (NSUInteger i = 1; i <= 3; i++)
+    {
+        [mockCloud publishEventWithName:@"latency/event" data:[NSString stringWithFormat:@"%lu", (unsigned long)i] deviceID:deviceID];
+    }
+    [self expectationForPredicate:[NSPredicate predicateWithBlock:^BOOL(NSMutableArray *batches, NSDictionary *bindings) {
+        @synchronized (batches) {
+            return (batches.count == 1);
+        }
+    }] evaluatedWithObject:latencyBatches handler:nil];
+    [self waitForExpectationsWithTimeout:5 handler:nil];
+    @synchronized (latencyBatches) {
+        XCTAssertEqualObjects(latencyBatches, (@[@[@"1", @"2", @"3"]]));
+    }
+
+    // unsubscribing drops the pending batch - its latency timer delivers nothing
+    [mockCloud publishEventWithName:@"latency/event" data:@"4" deviceID:deviceID];
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:5];
+    while (([multiplexer statsForSubscriptionWithID:latencyID].deliveredCount < 4) && ([deadline timeIntervalSinceNow] > 0))
+    {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    XCTAssertEqual([multiplexer statsForSubscriptionWithID:latencyID].deliveredCount, 4);
+    [multiplexer unsubscribeWithID:latencyID];
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:1]];
+    @synchronized (latencyBatches) {
+        XCTAssertEqual(latencyBatches.count, 1);
+    }
+
+    [multiplexer unsubscribeWithID:sizeID];
+}
+
+#pragma mark Event stream parser
+
+-(NSData *)sampleEventStream
+{
+    NSMutableString *stream = [NSMutableString stringWithString:@":ok\n\n"];
+    [stream appendString:@"event: temp\ndata: {\"data\":\"41.9\",\"ttl\":\"60\",\"published_at\":\"2015-01-13T01:23:12.269Z\",\"coreid\":\"53ff6e066667574824151267\"}\n\n"];
+    [stream appendString:@"retry: 2500\r\nid: 17\r\nevent: spark/status\r\ndata: {\"data\":\"online\",\"ttl\":\"60\",\"published_at\":\"2016-07-13T06:20:07.300Z\",\"coreid\":\"25002a001147353230333635\"}\r\n\r\n"];
+    [stream appendString:@"event:multi\rdata:line1\rdata: line2\r\r"];
+    [stream appendString:@": comment between events\nevent: no-space\ndata:{}\n\n"];
+    [stream appendString:@"event: unicode\ndata: {\"data\":\"\u00e9\u00e8 \u2603\"}\n\n"];
+    [stream appendString:@"event: unterminated\ndata: never dispatched"];
+    return [stream dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+-(NSArray<Event *> *)parseEventStream:(NSData *)stream chunkSize:(NSUInteger (^)(void))nextChunkSize parser:(EventSourceParser *)parser
+{
+    NSMutableArray *events = [NSMutableArray new];
+    parser.eventHandler = ^(Event *event) {
+        [events addObject:event];
+    };
+
+    const uint8_t *bytes = stream.bytes;
+    NSUInteger offset = 0;
+    while (offset < stream.length)
+    {
+        NSUInteger length = MIN(MAX(nextChunkSize(), 1), stream.length - offset);
+        // copy every chunk so the parser cannot rely on bytes of previous chunks staying around
+        [parser parseData:[NSData dataWithBytes:bytes + offset length:length]];
+        offset += length;
+    }
+    return events;
+}
+
+-(void)testEventStreamParserChunkBoundaries
+{
+    NSData *stream = [self sampleEventStream];
+    EventSourceParser *wholeParser = [EventSourceParser new];
+    __block NSTimeInterval retryInterval = 0;
+    wholeParser.retryHandler = ^(NSTimeInterval interval) {
+        retryInterval = interval;
+    };
+    NSArray<Event *> *expected = [self parseEventStream:stream chunkSize:^NSUInteger{ return stream.length; } parser:wholeParser];
+
+    XCTAssertEqual(expected.count, 5);
+    XCTAssertEqualObjects(expected[0].name, @"temp");
+    XCTAssertNil(expected[0].id);
+    XCTAssertEqualObjects(expected[1].name, @"spark/status");
+    XCTAssertEqualObjects(expected[1].id, @"17");
+    XCTAssertEqualObjects(expected[2].data, [@"line1\nline2" dataUsingEncoding:NSUTF8StringEncoding]);
+    XCTAssertEqualObjects(expected[3].data, [@"{}" dataUsingEncoding:NSUTF8StringEncoding]);
+    XCTAssertEqualObjects(expected[4].id, @"17", @"Last event ID should persist across events");
+    XCTAssertEqualWithAccuracy(retryInterval, 2.5, 0.001);
+
+    // byte at a time replay
+    NSArray<Event *> *byteEvents = [self parseEventStream:stream chunkSize:^NSUInteger{ return 1; } parser:[EventSourceParser new]];
+    XCTAssertEqual(byteEvents.count, expected.count);
+
+    // random chunking fuzz
+    srand48(1234);
+    for (int run = 0; run < 500; run++)
+    {
+        NSArray<Event *> *events = [self parseEventStream:stream chunkSize:^NSUInteger{ return (NSUInteger)(drand48() * 40); } parser:[EventSourceParser new]];
+        XCTAssertEqual(events.count, expected.count, @"Chunking changed number of events (run %d)", run);
+        for (NSUInteger i = 0; (i < events.count) && (i < expected.count); i++)
+        {
+            XCTAssertEqualObjects(events[i].name, expected[i].name);
+            XCTAssertEqualObjects(events[i].data, expected[i].data);
+            XCTAssertEqualObjects(events[i].id, expected[i].id);
+        }
+    }
+}
+
+-(void)testEventStreamParserThroughput
+{
+    NSData *stream;
+    NSString *capturePath = [NSProcessInfo processInfo].environment[TEST_SSE_CAPTURE_PATH_ENV];
+    if (capturePath)
+    {
+        stream = [NSData dataWithContentsOfFile:capturePath options:NSDataReadingMappedIfSafe error:nil];
+    }
+    if (!stream)
+    {
+        NSLog(@"No SSE capture at $%@, benchmarking synthetic firehose stream", TEST_SSE_CAPTURE_PATH_ENV);
+        NSData *sample = [self sampleEventStream];
+        NSMutableData *synthetic = [NSMutableData new];
+        for (int i = 0; i < 20000; i++)
+        {
+            [synthetic appendData:sample];
+            [synthetic appendBytes:"\n\n" length:2]; // terminate the trailing partial event of the sample
+        }
+        stream = synthetic;
+    }
+
+    [self measureBlock:^{
+        EventSourceParser *parser = [EventSourceParser new];
+        parser.eventHandler = ^(Event *event) {};
+
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        const uint8_t *bytes = stream.bytes;
+        NSUInteger chunkSize = 1400; // about one TCP segment per network chunk
+        for (NSUInteger offset = 0; offset < stream.length; offset += chunkSize)
+        {
+            [parser parseBytes:bytes + offset length:MIN(chunkSize, stream.length - offset)];
+        }
+        CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+
+        NSLog(@"SSE parser: %.1f MB/s, %.0f events/s (%llu events, %llu bytes)",
+              parser.bytesParsed / elapsed / (1024.0 * 1024.0), parser.eventsParsed / elapsed, parser.eventsParsed, parser.bytesParsed);
+    }];
+}
+
+-(void)testEventSourceDeliveryThroughput
+{
+    NSUInteger eventCount = 50000;
+    NSMutableData *body = [NSMutableData new];
+    for (NSUInteger i = 0; i < eventCount; i++)
+    {
+        [body appendData:[[NSString stringWithFormat:@"event: temp\ndata: {\"data\":\"%lu\",\"ttl\":\"60\",\"published_at\":\"2017-03-01T12:00:00.000Z\",\"coreid\":\"53ff6e066667574824151267\"}\n\n", (unsigned long)i] dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    TestEventStreamBody = body;
+
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = @[[TestEventStreamProtocol class]];
+    EventSourceSession *session = [[EventSourceSession alloc] initWithConfiguration:configuration];
+
+    // 4 handlers per event - delivered with one queue hop per event
+    dispatch_queue_t queue = dispatch_queue_create("io.particle.tests.delivery", DISPATCH_QUEUE_SERIAL);
+    EventSource *source = [EventSource eventSourceWithURL:[NSURL URLWithString:@"https://stream.particle.invalid/v1/events"] timeoutInterval:300 queue:queue session:session];
+    __block NSUInteger delivered = 0;
+    XCTestExpectation *allDelivered = [self expectationWithDescription:@"delivered"];
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    for (int i = 0; i < 4; i++)
+    {
+        [source onMessage:^(Event *event) {
+            if (++delivered == eventCount * 4)
+            {
+                [allDelivered fulfill];
+            }
+        }];
+    }
+    [self waitForExpectationsWithTimeout:30 handler:nil];
+    CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+    [source close];
+
+    NSLog(@"EventSource delivery: %.0f events/s to 4 handlers (%lu events in %.0f ms)", eventCount / elapsed, (unsigned long)eventCount, elapsed * 1000);
+}
+
+#pragma mark Event decoding
+
+-(void)testLazyEventDecodingMatchesDictionaryDecoding
+{
+    NSArray<NSString *> *payloads = @[
+        @"{\"data\":\"41.9\",\"ttl\":\"60\",\"published_at\":\"2015-01-13T01:23:12.269Z\",\"coreid\":\"53ff6e066667574824151267\"}",
+        @" { \"coreid\" : \"25002a001147353230333635\" , \"published_at\" : \"2016-07-13T06:20:07.300Z\" , \"ttl\" : 60 , \"data\" : null } ",
+        @"{\"data\":\"quote \\\" backslash \\\\ newline \\n snowman \\u2603\",\"ttl\":\"60\",\"published_at\":\"2015-01-13T01:23:12.269Z\",\"coreid\":\"53ff6e066667574824151267\"}",
+        @"{\"data\":\"\u00e9\u00e8 \u2603\",\"coreid\":\"53ff6e066667574824151267\",\"extra\":true}",
+        @"{\"data\":\"\",\"ttl\":\"\",\"coreid\":\"\"}",
+        @"{}",
+    ];
+
+    for (NSString *payloadString in payloads)
+    {
+        NSData *payload = [payloadString dataUsingEncoding:NSUTF8StringEncoding];
+        NSMutableDictionary *eventDict = [[NSJSONSerialization JSONObjectWithData:payload options:0 error:nil] mutableCopy];
+        eventDict[@"event"] = @"test";
+        ParticleEvent *expected = [[ParticleEvent alloc] initWithEventDict:eventDict];
+        ParticleEvent *lazy = [[ParticleEvent alloc] initWithEventName:@"test" payload:payload];
+
+        XCTAssertNotNil(lazy, @"%@", payloadString);
+        XCTAssertEqualObjects(lazy.event, expected.event, @"%@", payloadString);
+        XCTAssertEqualObjects(lazy.deviceID, expected.deviceID, @"%@", payloadString);
+        XCTAssertEqualObjects(lazy.time, expected.time, @"%@", payloadString);
+        XCTAssertEqual(lazy.ttl, expected.ttl, @"%@", payloadString);
+        if ([eventDict[@"data"] isKindOfClass:[NSString class]])
+        {
+            XCTAssertEqualObjects(lazy.data, expected.data, @"%@", payloadString);
+        }
+        else
+        {
+            XCTAssertNil(lazy.data, @"%@", payloadString);
+        }
+    }
+
+    // anything but a flat envelope is left to the dictionary path
+    for (NSString *payloadString in @[@"{\"data\":{\"nested\":1}}", @"[1,2]", @"{\"data\":\"unterminated}", @"{\"data\":\"a\"} trailing", @""])
+    {
+        XCTAssertNil([[ParticleEvent alloc] initWithEventName:@"test" payload:[payloadString dataUsingEncoding:NSUTF8StringEncoding]], @"%@", payloadString);
+    }
+}
+
+-(void)testEventDecodingPerformance
+{
+    NSUInteger const count = 100000;
+    NSMutableArray<NSData *> *payloads = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        NSString *payload = [NSString stringWithFormat:@"{\"data\":\"Temp1 is %lu F\",\"ttl\":\"60\",\"published_at\":\"2015-01-13T01:23:12.269Z\",\"coreid\":\"53ff6e06666757482415%04lu\"}", (unsigned long)i, (unsigned long)(i % 10000)];
+        [payloads addObject:[payload dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+
+    // typical subscription filter only looks at event name and device ID
+    [self measureBlock:^{
+        NSUInteger matches = 0;
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        for (NSData *payload in payloads)
+        {
+            @autoreleasepool {
+                NSMutableDictionary *eventDict = [[NSJSONSerialization JSONObjectWithData:payload options:0 error:nil] mutableCopy];
+                eventDict[@"event"] = @"temp";
+                ParticleEvent *event = [[ParticleEvent alloc] initWithEventDict:eventDict];
+                matches += ([event.event hasPrefix:@"te"] && [event.deviceID hasSuffix:@"0"]);
+            }
+        }
+        CFAbsoluteTime dictionaryElapsed = CFAbsoluteTimeGetCurrent() - start;
+
+        start = CFAbsoluteTimeGetCurrent();
+        for (NSData *payload in payloads)
+        {
+            @autoreleasepool {
+                ParticleEvent *event = [[ParticleEvent alloc] initWithEventName:@"temp" payload:payload];
+                matches += ([event.event hasPrefix:@"te"] && [event.deviceID hasSuffix:@"0"]);
+            }
+        }
+        CFAbsoluteTime lazyElapsed = CFAbsoluteTimeGetCurrent() - start;
+
+        NSLog(@"Event decoding: dictionary %.2f us/event, lazy %.2f us/event (%.1fx, %lu matches)",
+              dictionaryElapsed * 1e6 / count, lazyElapsed * 1e6 / count, dictionaryElapsed / lazyElapsed, (unsigned long)matches);
+    }];
+}
+
+#pragma mark Timestamps
+
+-(void)testTimestampParsingCorpus
+{
+    // timestamp : expected seconds since 1970, NSNull = not accepted by the fast parser
+    NSArray<NSArray *> *corpus = @[
+        @[@"2015-04-18T08:42:22.127Z",      @1429346542.127],
+        @[@"1970-01-01T00:00:00.000Z",      @0],
+        @[@"1969-12-31T23:59:59.500Z",      @-0.5],
+        @[@"2015-04-18T08:42:22Z",          @1429346542],                   // missing millis
+        @[@"2015-04-18T08:42:22.1Z",        @1429346542.1],
+        @[@"2015-04-18T08:42:22.123456Z",   @1429346542.123456],
+        @[@"2015-04-18T08:42:22.127+00:00", @1429346542.127],
+        @[@"2015-04-18T10:42:22.127+02:00", @1429346542.127],
+        @[@"2015-04-18T03:12:22.127-0530",  @1429346542.127],
+        @[@"2015-04-18T09:42:22.127+01",    @1429346542.127],
+        @[@"2016-12-31T23:59:60Z",          @1483228800],                   // leap second rolls over like POSIX time
+        @[@"2016-02-29T12:00:00.000Z",      @1456747200],                   // leap day
+        @[@"2000-02-29T00:00:00.000Z",      @951782400],
+        @[@"2015-02-29T00:00:00.000Z",      [NSNull null]],
+        @[@"1900-02-29T00:00:00.000Z",      [NSNull null]],
+        @[@"2015-13-01T00:00:00.000Z",      [NSNull null]],
+        @[@"2015-04-18T24:00:00.000Z",      [NSNull null]],
+        @[@"2015-04-18T08:42:22.Z",         [NSNull null]],
+        @[@"2015-04-18T08:42:22.127",       [NSNull null]],                 // no offset
+        @[@"2015-04-18 08:42:22.127Z",      [NSNull null]],
+        @[@"2015-04-18T08:42:22.127Zjunk",  [NSNull null]],
+        @[@"",                              [NSNull null]],
+    ];
+
+    for (NSArray *entry in corpus)
+    {
+        NSString *timestamp = entry[0];
+        NSTimeInterval timeInterval = 0;
+        BOOL parsed = ParticleTimestampParse(timestamp.UTF8String, strlen(timestamp.UTF8String), &timeInterval);
+        if ([entry[1] isKindOfClass:[NSNull class]])
+        {
+            XCTAssertFalse(parsed, @"%@", timestamp);
+        }
+        else
+        {
+            XCTAssertTrue(parsed, @"%@", timestamp);
+            XCTAssertEqualWithAccuracy(timeInterval, [entry[1] doubleValue], 0.000001, @"%@", timestamp);
+            XCTAssertEqualWithAccuracy([ParticleDateFromTimestamp(timestamp) timeIntervalSince1970], [entry[1] doubleValue], 0.000001, @"%@", timestamp);
+        }
+    }
+
+    // cloud format must agree with NSDateFormatter
+    NSDateFormatter *formatter = [NSDateFormatter new];
+    formatter.dateFormat = @"yyyy-MM-dd'T'HH:mm:ss.SSSZ";
+    formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+    formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+    srand48(42);
+    for (int i = 0; i < 1000; i++)
+    {
+        NSDate *date = [NSDate dateWithTimeIntervalSince1970:floor(drand48() * 4102444800.0 * 1000.0) / 1000.0];
+        NSString *timestamp = [[formatter stringFromDate:date] stringByReplacingOccurrencesOfString:@"+0000" withString:@"Z"];
+        XCTAssertEqualWithAccuracy([ParticleDateFromTimestamp(timestamp) timeIntervalSince1970], [[formatter dateFromString:timestamp] timeIntervalSince1970], 0.0005, @"%@", timestamp);
+        XCTAssertEqualObjects(ParticleTimestampFromDate(ParticleDateFromTimestamp(timestamp)), timestamp);
+    }
+
+    XCTAssertEqualObjects(ParticleTimestampFromDate([NSDate dateWithTimeIntervalSince1970:1429346542.127]), @"2015-04-18T08:42:22.127Z");
+    XCTAssertEqualObjects(ParticleTimestampFromDate([NSDate dateWithTimeIntervalSince1970:-0.5]), @"1969-12-31T23:59:59.500Z");
+    XCTAssertEqualObjects(ParticleTimestampFromDate([NSDate dateWithTimeIntervalSince1970:1456747199.9996]), @"2016-02-29T12:00:00.000Z");
+    XCTAssertNil(ParticleTimestampFromDate([NSDate dateWithTimeIntervalSince1970:253402300800.0]), @"Past year 9999");
+    XCTAssertNil(ParticleTimestampFromDate(nil));
+
+    XCTAssertNil(ParticleDateFromTimestamp(nil));
+    XCTAssertNil(ParticleDateFromTimestamp(@"not a date"));
+}
+
+-(void)testTimestampParsingPerformance
+{
+    NSUInteger const count = 1000000;
+    char timestamps[16][32];
+    for (int i = 0; i < 16; i++)
+    {
+        snprintf(timestamps[i], sizeof(timestamps[i]), "20%02d-%02d-%02dT%02d:%02d:%02d.%03dZ", 10 + i, 1 + i % 12, 1 + i, i, 3 * i, 59 - i, 7 * i);
+    }
+
+    [self measureBlock:^{
+        NSTimeInterval sum = 0, timeInterval;
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        for (NSUInteger i = 0; i < count; i++)
+        {
+            const char *timestamp = timestamps[i & 15];
+            if (ParticleTimestampParse(timestamp, 24, &timeInterval))
+            {
+                sum += timeInterval;
+            }
+        }
+        CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+        NSLog(@"Timestamp parser: %lu timestamps in %.3f s, %.1f ns/timestamp (checksum %.0f)", (unsigned long)count, elapsed, elapsed * 1e9 / count, sum);
+    }];
+}
+
+#pragma mark Device decoding
+
+-(void)testDeviceDecodingFromJSONBytes
+{
+    NSUInteger const deviceCount = 5000;
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    cloud.deviceSnapshotURL = nil;
+
+    NSData *data = TestDeviceListingJSON(deviceCount);
+    ParticleJSONValue listing;
+    XCTAssertEqual(ParticleJSONScanValue(data.bytes, data.length, &listing), data.length);
+    NSMutableArray<NSData *> *elements = [NSMutableArray arrayWithCapacity:deviceCount];
+    XCTAssertTrue(ParticleJSONEnumerateArray(listing, ^(ParticleJSONValue element, BOOL *stop) {
+        [elements addObject:[NSData dataWithBytesNoCopy:(void *)element.bytes length:element.length freeWhenDone:NO]];
+    }));
+    XCTAssertEqual(elements.count, deviceCount);
+    XCTAssertEqualObjects(ParticleJSONObject(listing), [NSJSONSerialization JSONObjectWithData:data options:0 error:nil]);
+
+    // both initializers decode the same device
+    NSArray *params = [NSJSONSerialization JSONObjectWithData:data options:0 error:nil];
+    for (NSUInteger i = 0; i < deviceCount; i++)
+    {
+        ParticleDevice *expected = [[ParticleDevice alloc] initWithParams:params[i] cloud:cloud];
+        ParticleDevice *device = [[ParticleDevice alloc] initWithJSONData:elements[i] cloud:cloud];
+        XCTAssertEqualObjects(device.id, expected.id);
+        XCTAssertEqualObjects(device.name, expected.name);
+        XCTAssertEqual(device.connected, expected.connected);
+        XCTAssertEqualObjects(device.functions, expected.functions);
+        XCTAssertEqualObjects(device.variables, expected.variables);
+        XCTAssertEqual(device.platformId, expected.platformId);
+        XCTAssertEqual(device.type, expected.type);
+        XCTAssertEqual(device.productId, expected.productId);
+        XCTAssertEqualObjects(device.lastIccid, expected.lastIccid);
+        XCTAssertEqualObjects(device.imei, expected.imei);
+        XCTAssertEqualObjects(device.status, expected.status);
+        XCTAssertEqualObjects(device.lastIPAdress, expected.lastIPAdress);
+        XCTAssertNil(device.lastApp);
+        XCTAssertEqualObjects(device.lastHeard, expected.lastHeard);
+        XCTAssertEqual(device.requiresUpdate, expected.requiresUpdate);
+    }
+    ParticleDevice *device = [[ParticleDevice alloc] initWithJSONData:elements[4] cloud:cloud];
+    XCTAssertEqual(device.type, ParticleDeviceTypeRaspberryPi);
+    device = [[ParticleDevice alloc] initWithJSONData:elements[8] cloud:cloud];
+    XCTAssertEqual(device.type, ParticleDeviceTypeUnknown);
+    XCTAssertEqual(device.platformId, (NSUInteger)12);
+    device = [[ParticleDevice alloc] initWithJSONData:elements[10] cloud:cloud];
+    XCTAssertEqualObjects(device.name, @"\"kitchen\" #10 \u00e9");
+    XCTAssertTrue(device.requiresUpdate == NO);
+    XCTAssertNil([[ParticleDevice alloc] initWithJSONData:[@"{\"id\":\"53ff\",\"name\":" dataUsingEncoding:NSUTF8StringEncoding] cloud:cloud]);
+    XCTAssertNil([[ParticleDevice alloc] initWithJSONData:[@"[]" dataUsingEncoding:NSUTF8StringEncoding] cloud:cloud]);
+
+    [self measureBlock:^{
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        @autoreleasepool {
+            for (NSDictionary *deviceParams in [NSJSONSerialization JSONObjectWithData:data options:0 error:nil])
+            {
+                (void)[[ParticleDevice alloc] initWithParams:deviceParams cloud:cloud];
+            }
+        }
+        CFAbsoluteTime dictionaryElapsed = CFAbsoluteTimeGetCurrent() - start;
+
+        start = CFAbsoluteTimeGetCurrent();
+        @autoreleasepool {
+            ParticleJSONValue value;
+            ParticleJSONScanValue(data.bytes, data.length, &value);
+            ParticleJSONEnumerateArray(value, ^(ParticleJSONValue element, BOOL *stop) {
+                (void)[[ParticleDevice alloc] initWithJSONData:[NSData dataWithBytesNoCopy:(void *)element.bytes length:element.length freeWhenDone:NO] cloud:cloud];
+            });
+        }
+        CFAbsoluteTime bytesElapsed = CFAbsoluteTimeGetCurrent() - start;
+
+        NSLog(@"Device decoding: NSJSONSerialization + initWithParams %.2f us/device, initWithJSONData %.2f us/device (%.1fx, %lu devices, %lu bytes)",
+              dictionaryElapsed * 1e6 / deviceCount, bytesElapsed * 1e6 / deviceCount, dictionaryElapsed / bytesElapsed, (unsigned long)deviceCount, (unsigned long)data.length);
+    }];
+}
+
+-(void)testStreamingDeviceListing
+{
+    // chunks split elements at any byte - same elements, only the element being received is buffered
+    NSUInteger const deviceCount = 5000;
+    NSData *data = TestDeviceListingJSON(deviceCount);
+    NSArray *expected = [NSJSONSerialization JSONObjectWithData:data options:0 error:nil];
+    for (NSNumber *chunkSize in @[@1, @7, @4096])
+    {
+        ParticleJSONArrayParser *parser = [ParticleJSONArrayParser new];
+        NSMutableArray *elements = [NSMutableArray arrayWithCapacity:deviceCount];
+        parser.elementHandler = ^(NSData *element) {
+            [elements addObject:[NSJSONSerialization JSONObjectWithData:element options:0 error:nil] ?: [NSNull null]];
+        };
+        for (NSUInteger offset = 0; offset < data.length; offset += chunkSize.unsignedIntegerValue)
+        {
+            XCTAssertTrue([parser parseBytes:(const uint8_t *)data.bytes + offset length:MIN(chunkSize.unsignedIntegerValue, data.length - offset)]);
+        }
+        XCTAssertTrue(parser.finished);
+        XCTAssertEqualObjects(elements, expected);
+        XCTAssertLessThan(parser.maxBufferedLength, (NSUInteger)1024, @"Buffered bytes should not grow with the listing");
+    }
+
+    NSMutableArray *scalars = [NSMutableArray new];
+    ParticleJSONArrayParser *parser = [ParticleJSONArrayParser new];
+    parser.elementHandler = ^(NSData *element) {
+        [scalars addObject:[[NSString alloc] initWithData:element encoding:NSUTF8StringEncoding]];
+    };
+    XCTAssertTrue([parser parseData:[@" [ 12 ,\"a,]\\\"\",true\n,{\"b\":[1,{}]}] " dataUsingEncoding:NSUTF8StringEncoding]]);
+    XCTAssertTrue(parser.finished);
+    XCTAssertEqualObjects(scalars, (@[@"12", @"\"a,]\\\"\"", @"true", @"{\"b\":[1,{}]}"]));
+    XCTAssertFalse([[ParticleJSONArrayParser new] parseData:[@"{\"error\":\"invalid_token\"}" dataUsingEncoding:NSUTF8StringEncoding]]);
+    XCTAssertFalse([[ParticleJSONArrayParser new] parseData:[@"[1,]" dataUsingEncoding:NSUTF8StringEncoding]]);
+
+    // getDevices creates devices as the listing downloads
+    ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+    mockCloud.responseChunkSize = 4096;
+    for (NSUInteger i = 0; i < deviceCount; i++)
+    {
+        [mockCloud addDeviceWithID:[NSString stringWithFormat:@"53ff6e0666675748241%05lu", (unsigned long)i] name:[NSString stringWithFormat:@"device%lu", (unsigned long)i] connected:NO variables:@{} functions:@[]];
+    }
+    ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+    cloud.deviceSnapshotURL = nil;
+
+    __block NSUInteger progressCount = 0;
+    __block NSUInteger progressCountAtCompletion = 0;
+    __block NSArray<ParticleDevice *> *fetchedDevices;
+    XCTestExpectation *devicesFetched = [self expectationWithDescription:@"devices"];
+    [cloud getDevicesWithProgress:^(ParticleDevice *device) {
+        XCTAssertTrue([NSThread isMainThread]);
+        progressCount++;
+    } completion:^(NSArray<ParticleDevice *> *devices, NSError *error) {
+        XCTAssertNil(error);
+        progressCountAtCompletion = progressCount;
+        fetchedDevices = devices;
+        [devicesFetched fulfill];
+    }];
+    [self waitForExpectationsWithTimeout:60 handler:nil];
+    XCTAssertEqual(fetchedDevices.count, deviceCount);
+    XCTAssertEqual(progressCountAtCompletion, deviceCount);
+    XCTAssertEqual(cloud.deviceRegistry.count, deviceCount);
+    XCTAssertEqual([cloud.deviceRegistry listing].count, deviceCount);
+    XCTAssertEqualObjects([cloud.deviceRegistry deviceWithID:@"53ff6e066667574824100042"].name, @"device42");
+}
 
 /*
 - (void)testPerformanceExample {
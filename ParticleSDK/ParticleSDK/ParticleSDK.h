@@ -17,5 +17,8 @@ FOUNDATION_EXPORT const unsigned char ParticleSDKVersionString[];
 #import <ParticleSDK/ParticleCloud.h>
 #import <ParticleSDK/ParticleDevice.h>
 #import <ParticleSDK/ParticleEvent.h>
+#import <ParticleSDK/ParticleDeviceRegistry.h>
+#import <ParticleSDK/ParticleEventJournal.h>
+#import <ParticleSDK/ParticleEventStore.h>
 
 
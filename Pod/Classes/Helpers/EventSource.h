@@ -22,6 +22,8 @@ typedef enum {
 /// Describes an Event received from an EventSource
 @interface Event : NSObject <NSCopying>
 
+/// The ID of the Event (last event ID set by the EventSource)
+@property (nonatomic, strong) NSString *id;
 /// The name of the Event
 @property (nonatomic, strong) NSString *name;
 /// The data received from the EventSource
@@ -29,8 +31,9 @@ typedef enum {
 
 /// The current state of the connection to the EventSource
 @property (nonatomic, assign) EventState readyState;
-/// Provides details of any errors with the connection to the EventSource
-@property (nonatomic, strong) NSError *error; // unused
+/// Provides details of any errors with the connection to the EventSource - with readyState kEventStateConnecting if the
+/// EventSource reconnects, kEventStateClosed if it stopped for good (rejected by the server or out of retries)
+@property (nonatomic, strong) NSError *error;
 
 @end
 
@@ -40,6 +43,25 @@ typedef void (^EventSourceEventHandler)(Event *event);
 
 // ---------------------------------------------------------------------------------------------------------------------
 
+/// URL session shared by event sources - all their streams are read by one session with one serial delegate queue,
+/// so the number of threads does not grow with the number of open streams.
+@interface EventSourceSession : NSObject
+
+/// Session with the default configuration used by event sources created without a session.
++ (instancetype)sharedSession;
+
+/// Creates a new session for event sources.
+///
+/// @param configuration Session configuration (e.g. with custom protocolClasses), nil for the default configuration.
+- (instancetype)initWithConfiguration:(NSURLSessionConfiguration *)configuration;
+
+/// Queue all stream data of the session is parsed on.
+@property (nonatomic, strong, readonly) NSOperationQueue *delegateQueue;
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
 /// Connect to and receive Server-Sent Events (SSEs).
 @interface EventSource : NSObject
 
@@ -49,6 +71,11 @@ typedef void (^EventSourceEventHandler)(Event *event);
 /// @param timeoutInterval The request timeout interval in seconds. See <tt>NSURLRequest</tt> for more details. Default: 5 minutes.
 + (instancetype)eventSourceWithURL:(NSURL *)URL timeoutInterval:(NSTimeInterval)timeoutInterval queue:(dispatch_queue_t)queue;
 
+/// Returns a new instance of EventSource with the specified URL, reading the stream with the specified session.
+///
+/// @param session The session to read the stream with, nil for <tt>EventSourceSession sharedSession</tt>.
++ (instancetype)eventSourceWithURL:(NSURL *)URL timeoutInterval:(NSTimeInterval)timeoutInterval queue:(dispatch_queue_t)queue session:(EventSourceSession *)session;
+
 
 /// Creates a new instance of EventSource with the specified URL.
 ///
@@ -56,6 +83,11 @@ typedef void (^EventSourceEventHandler)(Event *event);
 /// @param timeoutInterval The request timeout interval in seconds. See <tt>NSURLRequest</tt> for more details. Default: 5 minutes.
 - (instancetype)initWithURL:(NSURL *)URL timeoutInterval:(NSTimeInterval)timeoutInterval queue:(dispatch_queue_t)queue;
 
+/// Creates a new instance of EventSource with the specified URL, reading the stream with the specified session.
+///
+/// @param session The session to read the stream with, nil for <tt>EventSourceSession sharedSession</tt>.
+- (instancetype)initWithURL:(NSURL *)URL timeoutInterval:(NSTimeInterval)timeoutInterval queue:(dispatch_queue_t)queue session:(EventSourceSession *)session;
+
 
 
 /// Registers an event handler for the Message event.
@@ -74,15 +106,41 @@ typedef void (^EventSourceEventHandler)(Event *event);
 - (void)onOpen:(EventSourceEventHandler)handler;
 
 /// Registers an event handler for a named event.
+/// All handlers of an event run one after another in a single block on the EventSource queue (one queue hop per event).
 ///
 /// @param eventName The name of the event you registered.
 /// @param handler The handler for the Message event.
 - (void)addEventListener:(NSString *)eventName handler:(EventSourceEventHandler)handler;
+
+/// Registers an event handler for a named event.
+///
+/// @param eventName The name of the event you registered.
+/// @param handler The handler for the event.
+/// @param synchronous YES to call the handler on the session delegate queue reading the stream instead of the EventSource queue,
+///                    in stream order with the synchronous handlers of other events (e.g. errors after the events before them).
+///                    A blocking synchronous handler stops the streams of its session from being read (backpressure).
+- (void)addEventListener:(NSString *)eventName handler:(EventSourceEventHandler)handler synchronous:(BOOL)synchronous;
 - (void)removeEventListener:(NSString *)eventName handler:(EventSourceEventHandler)handler;
 
-/// Closes the connection to the EventSource.
+/// Closes the connection to the EventSource. Safe to call from any thread - no event is dispatched to handlers after it returns,
+/// the connection is cancelled on the session delegate queue.
 - (void)close;
 
+/// Consecutive failed reconnect attempts after which the EventSource gives up, 0 to never give up. Default: 10.
+/// Reconnects back off exponentially (with jitter) from the server's retry: interval, the count restarts once a reconnect succeeds.
+@property (nonatomic, assign) NSUInteger maxRetries;
+
+/// YES once the EventSource stopped for good - closed, rejected by the server (4xx) or gave up after maxRetries reconnects.
+@property (nonatomic, readonly, getter=isClosed) BOOL closed;
+
+/// Number of times the connection was lost and re-established.
+@property (nonatomic, readonly) NSUInteger reconnectCount;
+/// Seconds from losing the connection to it being open again, for the last reconnect.
+@property (nonatomic, readonly) NSTimeInterval lastRecoveryTime;
+/// Events the server skipped across reconnects, detected from gaps in numeric event IDs - assumes the server numbers
+/// the events of a stream consecutively (stays 0 if the server sends no IDs).
+@property (nonatomic, readonly) unsigned long long missedEventCount;
+
 @end
 
 // ---------------------------------------------------------------------------------------------------------------------
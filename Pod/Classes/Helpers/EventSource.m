@@ -10,80 +10,264 @@
 
 
 #import "EventSource.h"
+#import "EventSourceParser.h"
 
-static float const ES_RETRY_INTERVAL = 1.0;
+static NSTimeInterval const ES_RETRY_INTERVAL = 1.0;        // reconnect backoff base until the server sets one with retry:
+static NSTimeInterval const ES_MAX_RETRY_INTERVAL = 60.0;   // reconnect backoff cap
+static NSUInteger const ES_MAX_RETRIES = 10;
+static NSInteger const ES_MAX_CONNECTIONS_PER_HOST = 1024;   // every open stream holds its own HTTP/1.1 connection
 
-static NSString *const ESKeyValueDelimiter = @": ";
-static NSString *const ESEventSeparatorLFLF = @"\n\n";
-static NSString *const ESEventSeparatorCRCR = @"\r\r";
-static NSString *const ESEventSeparatorCRLFCRLF = @"\r\n\r\n";
-static NSString *const ESEventKeyValuePairSeparator = @"\n";
-static NSString *const ESEventDataKey = @"data";
-static NSString *const ESEventEventKey = @"event";
+// ---------------------------------------------------------------------------------------------------------------------
+
+@interface EventSource ()
+
+- (void)task:(NSURLSessionDataTask *)task didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition disposition))completionHandler;
+- (void)task:(NSURLSessionDataTask *)task didReceiveData:(NSData *)data;
+- (void)task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error;
+
+@end
+
+// Routes session callbacks to the event source of each task. Separate from EventSourceSession because
+// NSURLSession retains its delegate until invalidated - EventSourceSession invalidates the session when released.
+@interface EventSourceSessionDelegate : NSObject <NSURLSessionDataDelegate>
+
+@property (nonatomic, strong) NSMapTable<NSURLSessionTask *, EventSource *> *sources;
+
+@end
+
+@implementation EventSourceSessionDelegate
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _sources = [NSMapTable strongToWeakObjectsMapTable];
+    }
+    return self;
+}
+
+- (EventSource *)sourceForTask:(NSURLSessionTask *)task
+{
+    @synchronized (self) {
+        return [self.sources objectForKey:task];
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition disposition))completionHandler
+{
+    EventSource *source = [self sourceForTask:dataTask];
+    if (source) {
+        [source task:dataTask didReceiveResponse:response completionHandler:completionHandler];
+    } else {
+        completionHandler(NSURLSessionResponseCancel);
+    }
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data
+{
+    [[self sourceForTask:dataTask] task:dataTask didReceiveData:data];
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error
+{
+    EventSource *source = [self sourceForTask:task];
+    @synchronized (self) {
+        [self.sources removeObjectForKey:task];
+    }
+    [source task:task didCompleteWithError:error];
+}
 
-@interface EventSource () <NSURLConnectionDelegate, NSURLConnectionDataDelegate> { ///<, NSURLSessionDataDelegate> {
-    BOOL wasClosed;
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask willCacheResponse:(NSCachedURLResponse *)proposedResponse completionHandler:(void (^)(NSCachedURLResponse *cachedResponse))completionHandler
+{
+    completionHandler(nil);
 }
 
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+@interface EventSourceSession ()
+
+@property (nonatomic, strong) NSURLSession *session;
+@property (nonatomic, strong) EventSourceSessionDelegate *sessionDelegate;
+@property (nonatomic, strong, readwrite) NSOperationQueue *delegateQueue;
+
+@end
+
+@implementation EventSourceSession
+
++ (instancetype)sharedSession
+{
+    static EventSourceSession *sharedSession = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedSession = [[EventSourceSession alloc] initWithConfiguration:nil];
+    });
+    return sharedSession;
+}
+
+- (instancetype)initWithConfiguration:(NSURLSessionConfiguration *)configuration
+{
+    self = [super init];
+    if (self) {
+        NSURLSessionConfiguration *streamConfiguration = [configuration copy] ?: [NSURLSessionConfiguration defaultSessionConfiguration];
+        streamConfiguration.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+        streamConfiguration.URLCache = nil;
+        streamConfiguration.HTTPMaximumConnectionsPerHost = ES_MAX_CONNECTIONS_PER_HOST;
+
+        // one serial queue parses all streams of the session, keeps per stream event order
+        _delegateQueue = [NSOperationQueue new];
+        _delegateQueue.maxConcurrentOperationCount = 1;
+        _delegateQueue.name = @"io.particle.eventsource";
+
+        _sessionDelegate = [EventSourceSessionDelegate new];
+        _session = [NSURLSession sessionWithConfiguration:streamConfiguration delegate:_sessionDelegate delegateQueue:_delegateQueue];
+    }
+    return self;
+}
+
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request eventSource:(EventSource *)eventSource
+{
+    NSURLSessionDataTask *task = [self.session dataTaskWithRequest:request];
+    @synchronized (self.sessionDelegate) {
+        [self.sessionDelegate.sources setObject:eventSource forKey:task];
+    }
+    return task;
+}
+
+- (void)dealloc
+{
+    [_session invalidateAndCancel];
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+@interface EventSource ()
+
+// set by close on any thread, everything else below is only touched on the session delegate queue
+@property (atomic, assign) BOOL wasClosed;
 @property (nonatomic, strong) NSURL *eventURL;
-@property (nonatomic, strong) NSURLConnection *eventSource;
+@property (nonatomic, strong) EventSourceSession *session;
 @property (nonatomic, strong) NSURLSessionDataTask *eventSourceTask;
-@property (nonatomic, strong) NSMutableDictionary *listeners;
+// copy-on-write - replaced (never mutated) when handlers are added or removed, so delivery uses them without copying
+@property (atomic, copy) NSDictionary<NSString *, NSArray<EventSourceEventHandler> *> *listeners;
+@property (atomic, copy) NSDictionary<NSString *, NSArray<EventSourceEventHandler> *> *synchronousListeners;
 @property (nonatomic, assign) NSTimeInterval timeoutInterval;
 @property (nonatomic, assign) NSTimeInterval retryInterval;
 @property (nonatomic, strong) id lastEventID;
 @property (nonatomic, strong) dispatch_queue_t queue;
-@property (nonatomic) NSInteger retries;
-@property (atomic, strong) Event *event;
+@property (nonatomic) NSUInteger retries;
+@property (nonatomic, strong) EventSourceParser *parser;
+
+@property (nonatomic, readwrite) NSUInteger reconnectCount;
+@property (nonatomic, readwrite) NSTimeInterval lastRecoveryTime;
+@property (nonatomic, readwrite) unsigned long long missedEventCount;
+@property (nonatomic) NSTimeInterval disconnectTime;            // system uptime the connection was lost at, 0 while connected
+@property (nonatomic, strong) NSString *resumedFromEventID;     // last event ID before a reconnect, until the first event after it
 
 
 - (void)open;
 
 @end
 
+// numeric event ID value, NO if the ID is not a plain decimal number
+static BOOL ESEventIDNumber(NSString *eventID, unsigned long long *number)
+{
+    if (eventID.length == 0) {
+        return NO;
+    }
+    NSScanner *scanner = [NSScanner scannerWithString:eventID];
+    return [scanner scanUnsignedLongLong:number] && scanner.isAtEnd;
+}
+
 @implementation EventSource
 
 
 + (instancetype)eventSourceWithURL:(NSURL *)URL timeoutInterval:(NSTimeInterval)timeoutInterval queue:(dispatch_queue_t)queue
 {
-    return [[EventSource alloc] initWithURL:URL timeoutInterval:timeoutInterval queue:queue];
+    return [[EventSource alloc] initWithURL:URL timeoutInterval:timeoutInterval queue:queue session:nil];
+}
+
++ (instancetype)eventSourceWithURL:(NSURL *)URL timeoutInterval:(NSTimeInterval)timeoutInterval queue:(dispatch_queue_t)queue session:(EventSourceSession *)session
+{
+    return [[EventSource alloc] initWithURL:URL timeoutInterval:timeoutInterval queue:queue session:session];
 }
 
 
 - (instancetype)initWithURL:(NSURL *)URL timeoutInterval:(NSTimeInterval)timeoutInterval queue:(dispatch_queue_t)queue
+{
+    return [self initWithURL:URL timeoutInterval:timeoutInterval queue:queue session:nil];
+}
+
+- (instancetype)initWithURL:(NSURL *)URL timeoutInterval:(NSTimeInterval)timeoutInterval queue:(dispatch_queue_t)queue session:(EventSourceSession *)session
 {
     self = [super init];
     if (self) {
-        _listeners = [NSMutableDictionary dictionary];
+        _session = session ?: [EventSourceSession sharedSession];
+        _listeners = @{};
+        _synchronousListeners = @{};
         _eventURL = URL;
         _timeoutInterval = timeoutInterval;
         _retryInterval = ES_RETRY_INTERVAL;
         _queue = queue;
         _retries = 0;
+        _maxRetries = ES_MAX_RETRIES;
         
-        dispatch_time_t popTime = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_retryInterval * NSEC_PER_SEC));
-        dispatch_after(popTime, queue, ^(void){
-            [self open];
-        });
+        __weak EventSource *weakSelf = self;
+        _parser = [EventSourceParser new];
+        _parser.eventHandler = ^(Event *event) {
+            [weakSelf dispatchMessageEvent:event];
+        };
+        _parser.retryHandler = ^(NSTimeInterval retryInterval) {
+            weakSelf.retryInterval = retryInterval;
+        };
         
-        self.event = [Event new];
+        [self open];
     }
     return self;
 }
 
 - (void)addEventListener:(NSString *)eventName handler:(EventSourceEventHandler)handler
 {
-    if (self.listeners[eventName] == nil) {
-        [self.listeners setObject:[NSMutableArray array] forKey:eventName];
+    [self addEventListener:eventName handler:handler synchronous:NO];
+}
+
+- (void)addEventListener:(NSString *)eventName handler:(EventSourceEventHandler)handler synchronous:(BOOL)synchronous
+{
+    @synchronized (self) {
+        NSDictionary *listeners = synchronous ? self.synchronousListeners : self.listeners;
+        NSMutableDictionary *updatedListeners = [listeners mutableCopy];
+        updatedListeners[eventName] = [(listeners[eventName] ?: @[]) arrayByAddingObject:[handler copy]];
+        if (synchronous) {
+            self.synchronousListeners = updatedListeners;
+        } else {
+            self.listeners = updatedListeners;
+        }
     }
-    
-    [self.listeners[eventName] addObject:handler];
 }
 
 - (void)removeEventListener:(NSString *)eventName handler:(EventSourceEventHandler)handler
 {
-    if (self.listeners[eventName])
-        [self.listeners[eventName] removeObject:handler];
+    @synchronized (self) {
+        self.listeners = [EventSource listeners:self.listeners removingHandler:handler forEventName:eventName];
+        self.synchronousListeners = [EventSource listeners:self.synchronousListeners removingHandler:handler forEventName:eventName];
+    }
+}
+
++ (NSDictionary *)listeners:(NSDictionary *)listeners removingHandler:(EventSourceEventHandler)handler forEventName:(NSString *)eventName
+{
+    NSArray *handlers = listeners[eventName];
+    if (![handlers containsObject:handler]) {
+        return listeners;
+    }
+    
+    NSMutableArray *updatedHandlers = [handlers mutableCopy];
+    [updatedHandlers removeObject:handler];
+    NSMutableDictionary *updatedListeners = [listeners mutableCopy];
+    updatedListeners[eventName] = (updatedHandlers.count > 0) ? [updatedHandlers copy] : nil;
+    return updatedListeners;
 }
 
 
@@ -105,166 +289,223 @@ static NSString *const ESEventEventKey = @"event";
 
 - (void)open
 {
-    wasClosed = NO;
+    // stream state is only touched on the session delegate queue, next to the stream callbacks
+    __weak EventSource *weakSelf = self;
+    [self.session.delegateQueue addOperationWithBlock:^{
+        [weakSelf openStream];
+    }];
+}
+
+- (void)openStream
+{
+    if (self.wasClosed) {
+        return;
+    }
+    [self.parser reset]; // drop partial event of a previous connection
     NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:self.eventURL cachePolicy:NSURLRequestReloadIgnoringCacheData timeoutInterval:self.timeoutInterval];
 
     [request setHTTPMethod:@"GET"];
-    
-    self.eventSource = [[NSURLConnection alloc] initWithRequest:request delegate:self startImmediately:YES];
-//    self.eventSourceTask = [[NSURLSession sharedSession] dataTaskWithRequest:request];
-//    [self.eventSourceTask resume];
-    
-    
-    if (![NSThread isMainThread]) {
-        CFRunLoopRun();
+    [request setValue:@"text/event-stream" forHTTPHeaderField:@"Accept"];
+    if (self.lastEventID) {
+        // resume where the previous connection stopped
+        [request setValue:self.lastEventID forHTTPHeaderField:@"Last-Event-ID"];
     }
+    
+    self.eventSourceTask = [self.session dataTaskWithRequest:request eventSource:self];
+    [self.eventSourceTask resume];
+}
+
+- (BOOL)isClosed
+{
+    return self.wasClosed;
 }
 
 - (void)close
 {
 //    NSLog(@"eventSource %@ closed",self.description);
     
-    wasClosed = YES;
-    [self.eventSource cancel];
-//    [self.eventSourceTask cancel];
+    // stops delivery right away, the stream state itself is torn down on the delegate queue reading it
+    self.wasClosed = YES;
+    NSOperationQueue *delegateQueue = self.session.delegateQueue;
+    if ([NSOperationQueue currentQueue] == delegateQueue) {
+        [self closeStream];
+    } else {
+        [delegateQueue addOperationWithBlock:^{
+            [self closeStream];
+        }];
+    }
+}
+
+- (void)closeStream
+{
+    [self.eventSourceTask cancel];
+    self.eventSourceTask = nil;
     self.queue = nil;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 
 
-- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response
+- (void)task:(NSURLSessionDataTask *)task didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition disposition))completionHandler
 {
 //    NSLog(@"eventSource %@ didReceiveResponse %@",self.description,response.description);
     
+    if ((task != self.eventSourceTask) || (self.wasClosed)) {
+        completionHandler(NSURLSessionResponseCancel);
+        return;
+    }
+    
     NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
     if (httpResponse.statusCode == 200) {
         // Opened
+        if (self.disconnectTime > 0) {
+            self.reconnectCount++;
+            self.lastRecoveryTime = [NSProcessInfo processInfo].systemUptime - self.disconnectTime;
+            self.resumedFromEventID = self.lastEventID;
+            self.disconnectTime = 0;
+        }
+        self.retries = 0;
+
         Event *e = [Event new];
         e.readyState = kEventStateOpen;
         
         // TODO: remove this? (open/close/etc)
-        NSArray *openHandlers = self.listeners[OpenEvent];
-        for (EventSourceEventHandler handler in openHandlers) {
-            dispatch_async(self.queue, ^{
-                handler(e);
-            });
-        }
+        [self dispatchEvent:e toListenersForEventName:OpenEvent];
     }
     else
     {
         NSLog(@"Error opening event stream, code %ld",(long)httpResponse.statusCode);
+        if ((httpResponse.statusCode >= 400) && (httpResponse.statusCode < 500) && (httpResponse.statusCode != 408) && (httpResponse.statusCode != 429)) {
+            // request itself is rejected (e.g. expired access token) - reconnecting won't help
+            self.wasClosed = YES;
+            completionHandler(NSURLSessionResponseCancel);
+            [self dispatchErrorEvent:[NSError errorWithDomain:NSURLErrorDomain
+                                                         code:NSURLErrorUserAuthenticationRequired
+                                                     userInfo:@{ NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Event stream rejected with HTTP status %ld", (long)httpResponse.statusCode] }]];
+            return;
+        }
     }
+    
+    completionHandler(NSURLSessionResponseAllow);
 }
 
-- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error
+- (void)task:(NSURLSessionDataTask *)task didReceiveData:(NSData *)data
 {
-//    NSLog(@"eventSource %@ didFailWithError %@",self.description,error.description);
+//    NSLog(@"eventSource %@ didReceiveData %@",self.description,data.description);
     
-    Event *e = [Event new];
-    e.readyState = kEventStateClosed;
-    e.error = error;
+    if (task != self.eventSourceTask) {
+        return;
+    }
     
-    NSArray *errorHandlers = self.listeners[ErrorEvent];
-    for (EventSourceEventHandler handler in errorHandlers) {
-        dispatch_async(self.queue, ^{
-            handler(e);
-        });
+    // chunks may end anywhere in a line or event - parser keeps the partial bytes until the rest arrives
+    [self.parser parseData:data];
+}
+
+- (void)task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error
+{
+    if ((task != self.eventSourceTask) || (self.wasClosed)) {
+        return;
     }
     
-    dispatch_time_t popTime = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.retryInterval * NSEC_PER_SEC));
-    dispatch_after(popTime, self.queue, ^(void) {
-        if (self.retries < 5) {
-//            NSLog(@"connection retries %d",self.retries);
-            self.retries++;
-            [self open];
-        }
-        
-    });
+//    NSLog(@"eventSource %@ didCompleteWithError %@",self.description,error.description);
+    
+    // reconnect first - the error then tells whether the stream is reconnecting or gave up
+    [self scheduleReconnect];
+    [self dispatchErrorEvent:error ?: [NSError errorWithDomain:@""
+                                                          code:kEventStateClosed
+                                                      userInfo:@{ NSLocalizedDescriptionKey: @"Connection with the event source was closed." }]];
 }
 
-- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data
+- (void)dispatchMessageEvent:(Event *)event
 {
-//    NSLog(@"eventSource %@ didReceiveData %@",self.description,data.description);
+    if (self.resumedFromEventID) {
+        unsigned long long previousID, currentID;
+        if ((ESEventIDNumber(self.resumedFromEventID, &previousID)) && (ESEventIDNumber(event.id, &currentID)) && (currentID > previousID + 1)) {
+            self.missedEventCount += currentID - previousID - 1;
+        }
+        self.resumedFromEventID = nil;
+    }
+    self.lastEventID = event.id;
+    
+    if (self.wasClosed) {
+        return;
+    }
     
-    NSString *eventString = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
-    eventString = [eventString stringByTrimmingCharactersInSet:[NSCharacterSet newlineCharacterSet]];
-    NSArray *components = [eventString componentsSeparatedByString:ESEventKeyValuePairSeparator];
+    [self dispatchEvent:event toListenersForEventName:MessageEvent];
+}
 
-    self.event.readyState = kEventStateOpen;
+// synchronous handlers run right here on the session delegate queue, in stream order with each other whatever the event,
+// the others with a single hop per event - all of them in one block on the EventSource queue
+- (void)dispatchEvent:(Event *)event toListenersForEventName:(NSString *)eventName
+{
+    for (EventSourceEventHandler handler in self.synchronousListeners[eventName]) {
+        handler(event);
+    }
     
-    for (NSString *component in components) {
-        if (component.length == 0) {
-            continue;
-        }
-        
-        NSInteger index = [component rangeOfString:ESKeyValueDelimiter].location;
-        if (index == NSNotFound || index == (component.length - 2)) {
-            continue;
-        }
-        
-        NSString *key = [component substringToIndex:index];
-        NSString *value = [component substringFromIndex:index + ESKeyValueDelimiter.length];
-        
-        
-        if ([key isEqualToString:ESEventEventKey])
-        {
-            self.event.name = value;
-        } else if ([key isEqualToString:ESEventDataKey])
-        {
-            self.event.data = [value dataUsingEncoding:NSUTF8StringEncoding];
-        }
-        
-        if ((self.event.name) && (self.event.data))
-        {
-            NSArray *messageHandlers = self.listeners[MessageEvent];
-            __block Event *sendEvent = [self.event copy]; // to prevent race conditions where loop continues iterating sending duplicate events to handler callback
-            for (EventSourceEventHandler handler in messageHandlers) {
-                dispatch_async(self.queue, ^{
-                    handler(sendEvent);
-                });
-            }
-            self.event = [Event new];
+    NSArray<EventSourceEventHandler> *handlers = self.listeners[eventName];
+    dispatch_queue_t queue = self.queue;
+    if ((handlers.count == 0) || (!queue)) {
+        return;
+    }
+    
+    dispatch_async(queue, ^{
+        for (EventSourceEventHandler handler in handlers) {
+            handler(event);
         }
-     }
+    });
 }
 
+- (void)dispatchErrorEvent:(NSError *)error
+{
+    Event *e = [Event new];
+    e.readyState = self.wasClosed ? kEventStateClosed : kEventStateConnecting; // stopped for good or reconnecting
+    e.error = error;
+    
+    [self dispatchEvent:e toListenersForEventName:ErrorEvent];
+}
 
-- (void)connectionDidFinishLoading:(NSURLConnection *)connection
+- (void)scheduleReconnect
 {
-    if (wasClosed) {
+    dispatch_queue_t queue = self.queue;
+    if ((self.wasClosed) || (!queue)) {
         return;
     }
     
-//    NSLog(@"eventSource %@ connectionDidFinishLoading",self.description);
-    
-    Event *e = [Event new];
-    e.readyState = kEventStateClosed;
-    e.error = [NSError errorWithDomain:@""
-                                  code:e.readyState
-                              userInfo:@{ NSLocalizedDescriptionKey: @"Connection with the event source was closed." }];
+    if (self.disconnectTime == 0) {
+        self.disconnectTime = [NSProcessInfo processInfo].systemUptime;
+    }
     
-    NSArray *errorHandlers = self.listeners[ErrorEvent];
-    for (EventSourceEventHandler handler in errorHandlers) {
-        dispatch_async(self.queue, ^{
-            handler(e);
-        });
+    if ((self.maxRetries > 0) && (self.retries >= self.maxRetries)) {
+        NSLog(@"Event stream reconnect failed %lu times, giving up", (unsigned long)self.retries);
+        self.wasClosed = YES;
+        return;
     }
     
-    dispatch_time_t popTime = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.retryInterval * NSEC_PER_SEC));
-    dispatch_after(popTime, self.queue, ^(void) {
-        if (self.retries < 5) {
-//            NSLog(@"connectionDidFinishLoading retries %d",self.retries);
-            self.retries++;
-            [self open];
+    NSTimeInterval delay = [self reconnectDelay];
+    self.retries++;
+    
+    __weak EventSource *weakSelf = self;
+    dispatch_time_t popTime = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC));
+    dispatch_after(popTime, queue, ^(void) {
+        EventSource *strongSelf = weakSelf;
+        if ((strongSelf) && (!strongSelf.wasClosed)) {
+            [strongSelf open];
         }
-        
     });
+}
 
+- (NSTimeInterval)reconnectDelay
+{
+    // exponential backoff from the server requested interval, the random half keeps many clients dropped
+    // together (e.g. by a cloud restart) from reconnecting in lockstep
+    NSTimeInterval maxDelay = MAX(ES_MAX_RETRY_INTERVAL, self.retryInterval);
+    NSTimeInterval delay = MIN(self.retryInterval * pow(2, MIN(self.retries, 16)), maxDelay);
+    return delay / 2 + (delay / 2) * arc4random_uniform(1001) / 1000.0;
 }
 
 -(void)dealloc {
-    [self close];
+    // nothing reads the stream state anymore - the delegate only holds the source weakly
+    [_eventSourceTask cancel];
 }
 
 @end
@@ -288,10 +529,10 @@ static NSString *const ESEventEventKey = @"event";
             break;
     }
     
-    return [NSString stringWithFormat:@"<%@: readyState: %@; event: %@; data: %@>",
+    return [NSString stringWithFormat:@"<%@: readyState: %@; id: %@; event: %@; data: %@>",
             [self class],
             state,
-//            self.id,
+            self.id,
             self.name,
             self.data];
 
@@ -301,6 +542,7 @@ static NSString *const ESEventEventKey = @"event";
 {
     Event *copy = [[Event allocWithZone:zone] init];
     
+    copy.id = self.id;
     copy.name = self.name;
     copy.data = self.data;
     copy.readyState = self.readyState;
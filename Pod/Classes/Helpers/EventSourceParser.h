@@ -0,0 +1,46 @@
+//
+//  EventSourceParser.h
+//  Server-Sent Events for iOS and Mac
+//
+//  Incremental Server-Sent Events stream parser for EventSource
+//  Copyright (c) 2017 Particle. MIT license.
+//
+
+#import <Foundation/Foundation.h>
+
+@class Event;
+
+typedef void (^EventSourceParserEventHandler)(Event *event);
+typedef void (^EventSourceParserRetryHandler)(NSTimeInterval retryInterval);
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/// Parses a Server-Sent Events byte stream chunk by chunk.
+///
+/// Network chunks may split lines and events at any byte - bytes of an incomplete line are kept between chunks
+/// and an event is dispatched only once its blank line terminator arrives. Lines are found with memchr on the raw
+/// chunk bytes, LF, CR and CRLF line endings are supported. Handles the event, data, id and retry fields and ignores comments.
+@interface EventSourceParser : NSObject
+
+/// Called for every complete event, on the thread calling parseData:
+@property (nonatomic, copy) EventSourceParserEventHandler eventHandler;
+/// Called when the stream sets a new reconnection time with a retry: field
+@property (nonatomic, copy) EventSourceParserRetryHandler retryHandler;
+/// Last event ID set by the stream with an id: field, persists across events
+@property (nonatomic, copy) NSString *lastEventID;
+
+/// Total bytes fed into the parser
+@property (nonatomic, readonly) unsigned long long bytesParsed;
+/// Total events dispatched by the parser
+@property (nonatomic, readonly) unsigned long long eventsParsed;
+
+/// Parse the next chunk of the stream
+- (void)parseData:(NSData *)data;
+
+/// Parse the next chunk of the stream from a raw buffer
+- (void)parseBytes:(const uint8_t *)bytes length:(NSUInteger)length;
+
+/// Discard any partially received line or event, e.g. when the connection is re-opened. lastEventID is kept.
+- (void)reset;
+
+@end
@@ -0,0 +1,210 @@
+//
+//  EventSourceParser.m
+//  Server-Sent Events for iOS and Mac
+//
+//  Incremental Server-Sent Events stream parser for EventSource
+//  Copyright (c) 2017 Particle. MIT license.
+//
+
+#import "EventSourceParser.h"
+#import "EventSource.h"
+#include <string.h>
+
+static NSUInteger const ES_PARSER_INITIAL_LINE_CAPACITY = 1024;
+
+static uint8_t const ESLineFeed = '\n';
+static uint8_t const ESCarriageReturn = '\r';
+static uint8_t const ESFieldDelimiter = ':';
+static uint8_t const ESSpace = ' ';
+
+// field name comparison against a string literal without creating an NSString per line
+#define ES_FIELD_IS(field, length, literal) (((length) == sizeof(literal) - 1) && (memcmp((field), (literal), sizeof(literal) - 1) == 0))
+
+@interface EventSourceParser () {
+    uint8_t *_lineBuffer;       // bytes of a line split across chunks
+    NSUInteger _lineLength;
+    NSUInteger _lineCapacity;
+    BOOL _skipLeadingLF;        // previous chunk ended with CR - a leading LF in the next chunk completes a CRLF line ending
+}
+
+@property (nonatomic, strong) NSString *eventName;
+@property (nonatomic, strong) NSMutableData *eventData;
+@property (nonatomic, readwrite) unsigned long long bytesParsed;
+@property (nonatomic, readwrite) unsigned long long eventsParsed;
+
+@end
+
+@implementation EventSourceParser
+
+- (void)parseData:(NSData *)data
+{
+    // NSData might be backed by several non contiguous regions, parse them in place
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        [self parseBytes:bytes length:byteRange.length];
+    }];
+}
+
+- (void)parseBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    if (length == 0) {
+        return;
+    }
+
+    self.bytesParsed += length;
+
+    const uint8_t *p = bytes;
+    const uint8_t *end = bytes + length;
+
+    if (_skipLeadingLF) {
+        _skipLeadingLF = NO;
+        if (*p == ESLineFeed) {
+            p++;
+        }
+    }
+
+    while (p < end) {
+        NSUInteger remaining = end - p;
+        const uint8_t *lf = memchr(p, ESLineFeed, remaining);
+        const uint8_t *cr = memchr(p, ESCarriageReturn, lf ? (NSUInteger)(lf - p) : remaining);
+        const uint8_t *eol = cr ?: lf;
+
+        if (!eol) {
+            // incomplete line - keep its bytes until the rest arrives with the next chunk
+            [self appendToLineBuffer:p length:remaining];
+            break;
+        }
+
+        if (_lineLength > 0) {
+            [self appendToLineBuffer:p length:eol - p];
+            NSUInteger lineLength = _lineLength;
+            _lineLength = 0;
+            [self processLine:_lineBuffer length:lineLength];
+        } else {
+            [self processLine:p length:eol - p];
+        }
+
+        p = eol + 1;
+        if (*eol == ESCarriageReturn) {
+            if (p < end) {
+                if (*p == ESLineFeed) {
+                    p++;
+                }
+            } else {
+                _skipLeadingLF = YES;
+            }
+        }
+    }
+}
+
+- (void)reset
+{
+    _lineLength = 0;
+    _skipLeadingLF = NO;
+    self.eventName = nil;
+    self.eventData = nil;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+- (void)appendToLineBuffer:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    if (length == 0) {
+        return;
+    }
+
+    if (_lineLength + length > _lineCapacity) {
+        NSUInteger capacity = MAX(_lineCapacity, ES_PARSER_INITIAL_LINE_CAPACITY);
+        while (capacity < _lineLength + length) {
+            capacity *= 2;
+        }
+        _lineBuffer = reallocf(_lineBuffer, capacity);
+        if (!_lineBuffer) {
+            _lineLength = 0;
+            _lineCapacity = 0;
+            return;
+        }
+        _lineCapacity = capacity;
+    }
+
+    memcpy(_lineBuffer + _lineLength, bytes, length);
+    _lineLength += length;
+}
+
+- (void)processLine:(const uint8_t *)line length:(NSUInteger)length
+{
+    if (length == 0) {
+        // blank line terminates the event
+        [self dispatchEvent];
+        return;
+    }
+
+    if (line[0] == ESFieldDelimiter) {
+        // comment (e.g. ":ok" sent by the cloud when the stream opens)
+        return;
+    }
+
+    const uint8_t *delimiter = memchr(line, ESFieldDelimiter, length);
+    NSUInteger fieldLength = delimiter ? (NSUInteger)(delimiter - line) : length;
+    const uint8_t *value = delimiter ? delimiter + 1 : line + length;
+    NSUInteger valueLength = length - (value - line);
+    if ((valueLength > 0) && (*value == ESSpace)) {
+        value++;
+        valueLength--;
+    }
+
+    if (ES_FIELD_IS(line, fieldLength, "data")) {
+        if (self.eventData) {
+            [self.eventData appendBytes:&ESLineFeed length:1];
+        } else {
+            self.eventData = [NSMutableData dataWithCapacity:valueLength];
+        }
+        [self.eventData appendBytes:value length:valueLength];
+    } else if (ES_FIELD_IS(line, fieldLength, "event")) {
+        self.eventName = [[NSString alloc] initWithBytes:value length:valueLength encoding:NSUTF8StringEncoding];
+    } else if (ES_FIELD_IS(line, fieldLength, "id")) {
+        if (!memchr(value, 0, valueLength)) {
+            self.lastEventID = [[NSString alloc] initWithBytes:value length:valueLength encoding:NSUTF8StringEncoding];
+        }
+    } else if (ES_FIELD_IS(line, fieldLength, "retry")) {
+        unsigned long long milliseconds = 0;
+        for (NSUInteger i = 0; i < valueLength; i++) {
+            if ((value[i] < '0') || (value[i] > '9')) {
+                return; // ignore non digit retry values
+            }
+            milliseconds = milliseconds * 10 + (value[i] - '0');
+        }
+        if ((valueLength > 0) && (self.retryHandler)) {
+            self.retryHandler(milliseconds / 1000.0);
+        }
+    }
+}
+
+- (void)dispatchEvent
+{
+    NSMutableData *data = self.eventData;
+    NSString *name = self.eventName;
+    self.eventData = nil;
+    self.eventName = nil;
+
+    if (!data) {
+        return;
+    }
+
+    Event *event = [Event new];
+    event.readyState = kEventStateOpen;
+    event.id = self.lastEventID;
+    event.name = name;
+    event.data = data;
+
+    self.eventsParsed++;
+    if (self.eventHandler) {
+        self.eventHandler(event);
+    }
+}
+
+- (void)dealloc
+{
+    free(_lineBuffer);
+}
+
+@end
@@ -0,0 +1,113 @@
+//
+//  ParticleJSON.h
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(uint8_t, ParticleJSONType) {
+    ParticleJSONTypeString,
+    ParticleJSONTypeNumber,
+    ParticleJSONTypeTrue,
+    ParticleJSONTypeFalse,
+    ParticleJSONTypeNull,
+    ParticleJSONTypeArray,
+    ParticleJSONTypeObject,
+};
+
+/**
+ *  JSON value located in a UTF-8 buffer, nothing is decoded until asked for
+ */
+typedef struct {
+    const uint8_t *bytes;   // string contents without the quotes, arrays and objects including their brackets
+    NSUInteger length;
+    ParticleJSONType type;
+    BOOL escaped;           // string has escape sequences
+} ParticleJSONValue;
+
+/**
+ *  Locate the JSON value at the start of bytes (leading whitespace allowed). Arrays and objects are skipped by matching
+ *  brackets outside strings, their contents are checked when enumerated.
+ *
+ *  @return number of bytes up to the end of the value, 0 if bytes do not start with a complete value
+ */
+extern NSUInteger ParticleJSONScanValue(const uint8_t *bytes, NSUInteger length, ParticleJSONValue *value);
+
+/**
+ *  Call block for each member of an object value, in order
+ *
+ *  @return NO if the object is malformed (block may have been called for members before the error)
+ */
+extern BOOL ParticleJSONEnumerateObject(ParticleJSONValue object, void (NS_NOESCAPE ^block)(ParticleJSONValue key, ParticleJSONValue value, BOOL *stop));
+
+/**
+ *  Call block for each element of an array value, in order
+ *
+ *  @return NO if the array is malformed
+ */
+extern BOOL ParticleJSONEnumerateArray(ParticleJSONValue array, void (NS_NOESCAPE ^block)(ParticleJSONValue element, BOOL *stop));
+
+/**
+ *  String value decoded, escape sequences included
+ *
+ *  @return nil if value is not a string or is malformed
+ */
+extern NSString * _Nullable ParticleJSONString(ParticleJSONValue value);
+
+/**
+ *  Value as the NSString/NSNumber/NSNull/NSArray/NSDictionary NSJSONSerialization would create for it
+ *
+ *  @return nil if value is malformed
+ */
+extern id _Nullable ParticleJSONObject(ParticleJSONValue value);
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ *  Splits a JSON array received in chunks (e.g. a response body as it downloads) into its elements.
+ *
+ *  Chunks may split elements at any byte - only the bytes of the element being received are kept between chunks,
+ *  every element is handed out as soon as its last byte arrives. Elements are delimited, not validated.
+ */
+@interface ParticleJSONArrayParser : NSObject
+
+/**
+ *  Called for every complete element with a copy of its bytes, on the thread calling parseData:
+ */
+@property (nonatomic, copy, nullable) void (^elementHandler)(NSData *element);
+
+/**
+ *  Closing bracket of the array was parsed
+ */
+@property (nonatomic, readonly) BOOL finished;
+
+/**
+ *  Input is not a JSON array, further input is ignored
+ */
+@property (nonatomic, readonly) BOOL failed;
+
+/**
+ *  Number of elements handed out
+ */
+@property (nonatomic, readonly) NSUInteger elementCount;
+
+/**
+ *  Largest number of bytes kept between chunks
+ */
+@property (nonatomic, readonly) NSUInteger maxBufferedLength;
+
+/**
+ *  Parse the next chunk of the array
+ *
+ *  @return NO if the input is not a JSON array
+ */
+-(BOOL)parseData:(NSData *)data;
+-(BOOL)parseBytes:(const uint8_t *)bytes length:(NSUInteger)length;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,578 @@
+//
+//  ParticleJSON.m
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import "ParticleJSON.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#define PARTICLE_JSON_MAX_NUMBER_LENGTH 63
+
+static inline const uint8_t *ParticleJSONSkipWhitespace(const uint8_t *p, const uint8_t *end)
+{
+    while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\n') || (*p == '\r')))
+    {
+        p++;
+    }
+    return p;
+}
+
+// p at the opening quote, returns the position after the closing quote, NULL if the string is not terminated
+static inline const uint8_t * _Nullable ParticleJSONSkipString(const uint8_t *p, const uint8_t *end, BOOL *escaped)
+{
+    p++;
+    while (p < end)
+    {
+        if (*p == '"')
+        {
+            return p + 1;
+        }
+        if (*p == '\\')
+        {
+            *escaped = YES;
+            p++;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static inline BOOL ParticleJSONIsLiteral(const uint8_t *p, const uint8_t *end, const char *literal, NSUInteger length)
+{
+    return ((NSUInteger)(end - p) >= length) && (memcmp(p, literal, length) == 0);
+}
+
+NSUInteger ParticleJSONScanValue(const uint8_t *bytes, NSUInteger length, ParticleJSONValue *value)
+{
+    const uint8_t *end = bytes + length;
+    const uint8_t *p = ParticleJSONSkipWhitespace(bytes, end);
+    if (p == end)
+    {
+        return 0;
+    }
+
+    value->escaped = NO;
+    switch (*p)
+    {
+        case '"':
+        {
+            const uint8_t *next = ParticleJSONSkipString(p, end, &value->escaped);
+            if (!next)
+            {
+                return 0;
+            }
+            value->type = ParticleJSONTypeString;
+            value->bytes = p + 1;
+            value->length = next - p - 2;
+            return next - bytes;
+        }
+
+        case '{':
+        case '[':
+        {
+            const uint8_t *start = p;
+            NSUInteger depth = 0;
+            while (p < end)
+            {
+                switch (*p)
+                {
+                    case '"':
+                    {
+                        BOOL escaped = NO;
+                        p = ParticleJSONSkipString(p, end, &escaped);
+                        if (!p)
+                        {
+                            return 0;
+                        }
+                        continue;
+                    }
+                    case '{':
+                    case '[':
+                        depth++;
+                        break;
+                    case '}':
+                    case ']':
+                        if (--depth == 0)
+                        {
+                            value->type = (*start == '{') ? ParticleJSONTypeObject : ParticleJSONTypeArray;
+                            value->bytes = start;
+                            value->length = p + 1 - start;
+                            return p + 1 - bytes;
+                        }
+                        break;
+                }
+                p++;
+            }
+            return 0;
+        }
+
+        case 't':
+            value->type = ParticleJSONTypeTrue;
+            value->length = 4;
+            break;
+
+        case 'f':
+            value->type = ParticleJSONTypeFalse;
+            value->length = 5;
+            break;
+
+        case 'n':
+            value->type = ParticleJSONTypeNull;
+            value->length = 4;
+            break;
+
+        default:
+        {
+            if ((*p != '-') && ((*p < '0') || (*p > '9')))
+            {
+                return 0;
+            }
+            const uint8_t *start = p;
+            while ((p < end) && (((*p >= '0') && (*p <= '9')) || (*p == '-') || (*p == '+') || (*p == '.') || (*p == 'e') || (*p == 'E')))
+            {
+                p++;
+            }
+            value->type = ParticleJSONTypeNumber;
+            value->bytes = start;
+            value->length = p - start;
+            return p - bytes;
+        }
+    }
+
+    // literals
+    static const char *const literals[] = { [ParticleJSONTypeTrue] = "true", [ParticleJSONTypeFalse] = "false", [ParticleJSONTypeNull] = "null" };
+    if (!ParticleJSONIsLiteral(p, end, literals[value->type], value->length))
+    {
+        return 0;
+    }
+    value->bytes = p;
+    return p + value->length - bytes;
+}
+
+BOOL ParticleJSONEnumerateObject(ParticleJSONValue object, void (NS_NOESCAPE ^block)(ParticleJSONValue key, ParticleJSONValue value, BOOL *stop))
+{
+    if ((object.type != ParticleJSONTypeObject) || (object.length < 2))
+    {
+        return NO;
+    }
+
+    const uint8_t *end = object.bytes + object.length - 1; // closing brace
+    const uint8_t *p = ParticleJSONSkipWhitespace(object.bytes + 1, end);
+    if (p == end)
+    {
+        return YES;
+    }
+
+    BOOL stop = NO;
+    while (YES)
+    {
+        ParticleJSONValue key, value;
+        NSUInteger length = ParticleJSONScanValue(p, end - p, &key);
+        if ((length == 0) || (key.type != ParticleJSONTypeString))
+        {
+            return NO;
+        }
+        p = ParticleJSONSkipWhitespace(p + length, end);
+        if ((p == end) || (*p != ':'))
+        {
+            return NO;
+        }
+        p++;
+        length = ParticleJSONScanValue(p, end - p, &value);
+        if (length == 0)
+        {
+            return NO;
+        }
+
+        block(key, value, &stop);
+        if (stop)
+        {
+            return YES;
+        }
+
+        p = ParticleJSONSkipWhitespace(p + length, end);
+        if (p == end)
+        {
+            return YES;
+        }
+        if (*p != ',')
+        {
+            return NO;
+        }
+        p = ParticleJSONSkipWhitespace(p + 1, end);
+    }
+}
+
+BOOL ParticleJSONEnumerateArray(ParticleJSONValue array, void (NS_NOESCAPE ^block)(ParticleJSONValue element, BOOL *stop))
+{
+    if ((array.type != ParticleJSONTypeArray) || (array.length < 2))
+    {
+        return NO;
+    }
+
+    const uint8_t *end = array.bytes + array.length - 1;
+    const uint8_t *p = ParticleJSONSkipWhitespace(array.bytes + 1, end);
+    if (p == end)
+    {
+        return YES;
+    }
+
+    BOOL stop = NO;
+    while (YES)
+    {
+        ParticleJSONValue element;
+        NSUInteger length = ParticleJSONScanValue(p, end - p, &element);
+        if (length == 0)
+        {
+            return NO;
+        }
+
+        block(element, &stop);
+        if (stop)
+        {
+            return YES;
+        }
+
+        p = ParticleJSONSkipWhitespace(p + length, end);
+        if (p == end)
+        {
+            return YES;
+        }
+        if (*p != ',')
+        {
+            return NO;
+        }
+        p = ParticleJSONSkipWhitespace(p + 1, end);
+    }
+}
+
+NSString * _Nullable ParticleJSONString(ParticleJSONValue value)
+{
+    if (value.type != ParticleJSONTypeString)
+    {
+        return nil;
+    }
+    if (!value.escaped)
+    {
+        return [[NSString alloc] initWithBytes:value.bytes length:value.length encoding:NSUTF8StringEncoding];
+    }
+
+    // rare - let NSJSONSerialization deal with \uXXXX, surrogate pairs etc.
+    NSData *quoted = [NSData dataWithBytesNoCopy:(void *)(value.bytes - 1) length:value.length + 2 freeWhenDone:NO];
+    id string = [NSJSONSerialization JSONObjectWithData:quoted options:NSJSONReadingAllowFragments error:nil];
+    return [string isKindOfClass:[NSString class]] ? string : nil;
+}
+
+static NSNumber * _Nullable ParticleJSONNumber(ParticleJSONValue value)
+{
+    if (value.length > PARTICLE_JSON_MAX_NUMBER_LENGTH)
+    {
+        return nil;
+    }
+    char number[PARTICLE_JSON_MAX_NUMBER_LENGTH + 1];
+    memcpy(number, value.bytes, value.length);
+    number[value.length] = 0;
+
+    char *end;
+    if ((!memchr(number, '.', value.length)) && (!memchr(number, 'e', value.length)) && (!memchr(number, 'E', value.length)))
+    {
+        errno = 0;
+        long long integer = strtoll(number, &end, 10);
+        if ((*end == 0) && (errno == 0))
+        {
+            return @(integer);
+        }
+    }
+    double real = strtod(number, &end);
+    return (*end == 0) ? @(real) : nil;
+}
+
+id _Nullable ParticleJSONObject(ParticleJSONValue value)
+{
+    switch (value.type)
+    {
+        case ParticleJSONTypeString:
+            return ParticleJSONString(value);
+
+        case ParticleJSONTypeNumber:
+            return ParticleJSONNumber(value);
+
+        case ParticleJSONTypeTrue:
+            return @YES;
+
+        case ParticleJSONTypeFalse:
+            return @NO;
+
+        case ParticleJSONTypeNull:
+            return [NSNull null];
+
+        case ParticleJSONTypeArray:
+        {
+            NSMutableArray *array = [NSMutableArray new];
+            __block BOOL valid = YES;
+            if (!ParticleJSONEnumerateArray(value, ^(ParticleJSONValue element, BOOL *stop) {
+                id object = ParticleJSONObject(element);
+                if (!object)
+                {
+                    valid = NO;
+                    *stop = YES;
+                    return;
+                }
+                [array addObject:object];
+            }))
+            {
+                return nil;
+            }
+            return valid ? array : nil;
+        }
+
+        case ParticleJSONTypeObject:
+        {
+            NSMutableDictionary *dictionary = [NSMutableDictionary new];
+            __block BOOL valid = YES;
+            if (!ParticleJSONEnumerateObject(value, ^(ParticleJSONValue key, ParticleJSONValue member, BOOL *stop) {
+                NSString *name = ParticleJSONString(key);
+                id object = ParticleJSONObject(member);
+                if ((!name) || (!object))
+                {
+                    valid = NO;
+                    *stop = YES;
+                    return;
+                }
+                dictionary[name] = object;
+            }))
+            {
+                return nil;
+            }
+            return valid ? dictionary : nil;
+        }
+    }
+    return nil;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+typedef NS_ENUM(uint8_t, ParticleJSONArrayParserState) {
+    ParticleJSONArrayParserStateStart,          // before the opening bracket
+    ParticleJSONArrayParserStateFirstElement,   // first element or the closing bracket of an empty array
+    ParticleJSONArrayParserStateElement,        // element after a comma
+    ParticleJSONArrayParserStateInElement,
+    ParticleJSONArrayParserStateAfterElement,   // comma or the closing bracket
+    ParticleJSONArrayParserStateFinished,
+    ParticleJSONArrayParserStateFailed,
+};
+
+static inline BOOL ParticleJSONIsWhitespace(uint8_t c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+@implementation ParticleJSONArrayParser {
+    ParticleJSONArrayParserState _state;
+    NSMutableData *_pending;    // bytes of the current element from previous chunks
+    NSUInteger _depth;          // brackets open in the current element, 0 for strings and scalars
+    BOOL _inString;
+    BOOL _escape;
+}
+
+-(instancetype)init
+{
+    if (self = [super init])
+    {
+        _pending = [NSMutableData new];
+    }
+    return self;
+}
+
+-(BOOL)finished
+{
+    return _state == ParticleJSONArrayParserStateFinished;
+}
+
+-(BOOL)failed
+{
+    return _state == ParticleJSONArrayParserStateFailed;
+}
+
+-(BOOL)parseData:(NSData *)data
+{
+    __block BOOL parsed = YES;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        parsed = [self parseBytes:bytes length:byteRange.length];
+        *stop = !parsed;
+    }];
+    return parsed;
+}
+
+-(BOOL)parseBytes:(const uint8_t *)bytes length:(NSUInteger)length
+{
+    const uint8_t *p = bytes;
+    const uint8_t *end = bytes + length;
+    const uint8_t *elementStart = (_state == ParticleJSONArrayParserStateInElement) ? bytes : NULL;
+
+    while ((p < end) && (_state != ParticleJSONArrayParserStateFailed))
+    {
+        if (_state != ParticleJSONArrayParserStateInElement)
+        {
+            p = ParticleJSONSkipWhitespace(p, end);
+            if (p == end)
+            {
+                break;
+            }
+        }
+
+        switch (_state)
+        {
+            case ParticleJSONArrayParserStateStart:
+                _state = (*p == '[') ? ParticleJSONArrayParserStateFirstElement : ParticleJSONArrayParserStateFailed;
+                p++;
+                break;
+
+            case ParticleJSONArrayParserStateFirstElement:
+            case ParticleJSONArrayParserStateElement:
+                if (*p == ']')
+                {
+                    _state = (_state == ParticleJSONArrayParserStateFirstElement) ? ParticleJSONArrayParserStateFinished : ParticleJSONArrayParserStateFailed;
+                    p++;
+                    break;
+                }
+                if ((*p == ',') || (*p == '}') || (*p == ':'))
+                {
+                    _state = ParticleJSONArrayParserStateFailed;
+                    break;
+                }
+                elementStart = p;
+                _depth = ((*p == '{') || (*p == '[')) ? 1 : 0;
+                _inString = (*p == '"');
+                _escape = NO;
+                _state = ParticleJSONArrayParserStateInElement;
+                if ((_depth) || (_inString))
+                {
+                    p++;
+                }
+                break;
+
+            case ParticleJSONArrayParserStateInElement:
+            {
+                BOOL complete = NO;
+                while ((p < end) && (!complete))
+                {
+                    uint8_t c = *p;
+                    if (_inString)
+                    {
+                        if (_escape)
+                        {
+                            _escape = NO;
+                        }
+                        else if (c == '\\')
+                        {
+                            _escape = YES;
+                        }
+                        else if (c == '"')
+                        {
+                            _inString = NO;
+                            complete = (_depth == 0);
+                        }
+                        p++;
+                    }
+                    else if (_depth == 0)
+                    {
+                        // number or literal, ends at the delimiter after it
+                        if ((c == ',') || (c == ']') || (ParticleJSONIsWhitespace(c)))
+                        {
+                            complete = YES;
+                        }
+                        else
+                        {
+                            p++;
+                        }
+                    }
+                    else
+                    {
+                        if (c == '"')
+                        {
+                            _inString = YES;
+                        }
+                        else if ((c == '{') || (c == '['))
+                        {
+                            _depth++;
+                        }
+                        else if ((c == '}') || (c == ']'))
+                        {
+                            complete = (--_depth == 0);
+                        }
+                        p++;
+                    }
+                }
+                if (complete)
+                {
+                    [self handleElementFrom:elementStart to:p];
+                    elementStart = NULL;
+                    _state = ParticleJSONArrayParserStateAfterElement;
+                }
+                break;
+            }
+
+            case ParticleJSONArrayParserStateAfterElement:
+                if (*p == ',')
+                {
+                    _state = ParticleJSONArrayParserStateElement;
+                }
+                else
+                {
+                    _state = (*p == ']') ? ParticleJSONArrayParserStateFinished : ParticleJSONArrayParserStateFailed;
+                }
+                p++;
+                break;
+
+            case ParticleJSONArrayParserStateFinished:
+                _state = ParticleJSONArrayParserStateFailed; // trailing garbage
+                break;
+
+            case ParticleJSONArrayParserStateFailed:
+                break;
+        }
+    }
+
+    if (_state == ParticleJSONArrayParserStateFailed)
+    {
+        _pending.length = 0;
+        return NO;
+    }
+
+    // element continues in the next chunk
+    if (elementStart)
+    {
+        [_pending appendBytes:elementStart length:end - elementStart];
+        _maxBufferedLength = MAX(_maxBufferedLength, _pending.length);
+    }
+    return YES;
+}
+
+-(void)handleElementFrom:(const uint8_t *)start to:(const uint8_t *)end
+{
+    NSData *element;
+    if (_pending.length > 0)
+    {
+        [_pending appendBytes:start length:end - start];
+        element = [_pending copy];
+        _pending = [NSMutableData new]; // do not keep the capacity of a large element around
+    }
+    else
+    {
+        element = [NSData dataWithBytes:start length:end - start];
+    }
+
+    _elementCount++;
+    if (self.elementHandler)
+    {
+        self.elementHandler(element);
+    }
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
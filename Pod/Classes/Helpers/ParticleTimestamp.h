@@ -0,0 +1,53 @@
+//
+//  ParticleTimestamp.h
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Parse a cloud timestamp ("2015-04-18T08:42:22.127Z") to seconds since 1970 without allocating.
+ *  Accepts yyyy-MM-ddTHH:mm:ss with optional fractional seconds (any number of digits) and a Z, +HH:mm, +HHmm or +HH offset.
+ *  A leap second (ss = 60) maps to the first second of the next minute, like POSIX time.
+ *
+ *  @param bytes        UTF-8 timestamp bytes, need not be NUL terminated
+ *  @param length       Number of bytes
+ *  @param timeInterval Parsed seconds since 1970 UTC
+ *  @return NO if the bytes are not exactly in this format
+ */
+extern BOOL ParticleTimestampParse(const char *bytes, NSUInteger length, NSTimeInterval *timeInterval);
+
+/**
+ *  Cloud timestamp to NSDate, uses ParticleTimestampParse and falls back to a cached per-thread NSDateFormatter for other shapes
+ *
+ *  @return date, nil if timestamp is nil or cannot be parsed
+ */
+extern NSDate * _Nullable ParticleDateFromTimestamp(NSString * _Nullable timestamp);
+
+/**
+ *  ParticleDateFromTimestamp for raw UTF-8 bytes, e.g. a value inside a received payload
+ */
+extern NSDate * _Nullable ParticleDateFromTimestampBytes(const char *bytes, NSUInteger length);
+
+#define PARTICLE_TIMESTAMP_LENGTH 24 // "2015-04-18T08:42:22.127Z"
+
+/**
+ *  Format seconds since 1970 as a cloud timestamp ("2015-04-18T08:42:22.127Z") without allocating, the counterpart of
+ *  ParticleTimestampParse. Rounds to the millisecond, years past 9999 (or before 0) are not representable.
+ *
+ *  @param timeInterval Seconds since 1970 UTC
+ *  @param bytes        Receives PARTICLE_TIMESTAMP_LENGTH UTF-8 bytes, not NUL terminated
+ *  @return NO if the year is out of range
+ */
+extern BOOL ParticleTimestampFormat(NSTimeInterval timeInterval, char bytes[PARTICLE_TIMESTAMP_LENGTH]);
+
+/**
+ *  Cloud timestamp of a date, nil if date is nil or out of range
+ */
+extern NSString * _Nullable ParticleTimestampFromDate(NSDate * _Nullable date);
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,268 @@
+//
+//  ParticleTimestamp.m
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import "ParticleTimestamp.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+static NSString *const kParticleTimestampFormatterKey = @"io.particle.timestampFormatter";
+
+static inline BOOL ParticleTimestampDigits(const char *p, NSUInteger count, int *value)
+{
+    int result = 0;
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        if ((p[i] < '0') || (p[i] > '9'))
+        {
+            return NO;
+        }
+        result = result * 10 + (p[i] - '0');
+    }
+    *value = result;
+    return YES;
+}
+
+static inline BOOL ParticleTimestampIsLeapYear(int year)
+{
+    return ((year % 4 == 0) && (year % 100 != 0)) || (year % 400 == 0);
+}
+
+// days since 1970-01-01 of a proleptic Gregorian date
+static int64_t ParticleTimestampDaysFromCivil(int year, int month, int day)
+{
+    int64_t y = year - (month <= 2);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yearOfEra = y - era * 400;
+    int64_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+// proleptic Gregorian date of days since 1970-01-01, inverse of ParticleTimestampDaysFromCivil
+static void ParticleTimestampCivilFromDays(int64_t days, int *year, int *month, int *day)
+{
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t dayOfEra = days - era * 146097;
+    int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int64_t monthIndex = (5 * dayOfYear + 2) / 153; // March based
+    *day = (int)(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+    *month = (int)(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+    *year = (int)(yearOfEra + era * 400 + (*month <= 2));
+}
+
+static inline void ParticleTimestampPutDigits(char *p, NSUInteger count, int value)
+{
+    for (NSUInteger i = count; i > 0; i--)
+    {
+        p[i - 1] = '0' + (value % 10);
+        value /= 10;
+    }
+}
+
+BOOL ParticleTimestampParse(const char *bytes, NSUInteger length, NSTimeInterval *timeInterval)
+{
+    static int const daysInMonth[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    // yyyy-MM-ddTHH:mm:ss is 19 bytes, offset at least 1 more
+    if (length < 20)
+    {
+        return NO;
+    }
+
+    const char *p = bytes;
+    int year, month, day, hour, minute, second;
+    if ((!ParticleTimestampDigits(p, 4, &year)) || (p[4] != '-') ||
+        (!ParticleTimestampDigits(p + 5, 2, &month)) || (p[7] != '-') ||
+        (!ParticleTimestampDigits(p + 8, 2, &day)) || (p[10] != 'T') ||
+        (!ParticleTimestampDigits(p + 11, 2, &hour)) || (p[13] != ':') ||
+        (!ParticleTimestampDigits(p + 14, 2, &minute)) || (p[16] != ':') ||
+        (!ParticleTimestampDigits(p + 17, 2, &second)))
+    {
+        return NO;
+    }
+
+    if ((month < 1) || (month > 12) || (day < 1) || (hour > 23) || (minute > 59) || (second > 60))
+    {
+        return NO;
+    }
+    int monthDays = ((month == 2) && (ParticleTimestampIsLeapYear(year))) ? 29 : daysInMonth[month - 1];
+    if (day > monthDays)
+    {
+        return NO;
+    }
+
+    const char *end = bytes + length;
+    p += 19;
+
+    // fractional seconds
+    double fraction = 0;
+    if (*p == '.')
+    {
+        p++;
+        uint64_t fractionDigits = 0;
+        uint64_t scale = 1;
+        const char *fractionStart = p;
+        while ((p < end) && (*p >= '0') && (*p <= '9'))
+        {
+            if (scale < 1000000000000ULL) // digits beyond picoseconds do not change a double
+            {
+                fractionDigits = fractionDigits * 10 + (*p - '0');
+                scale *= 10;
+            }
+            p++;
+        }
+        if (p == fractionStart)
+        {
+            return NO;
+        }
+        fraction = (double)fractionDigits / (double)scale;
+    }
+
+    // offset
+    if (p == end)
+    {
+        return NO;
+    }
+    int offsetSeconds = 0;
+    if (*p == 'Z')
+    {
+        p++;
+    }
+    else if ((*p == '+') || (*p == '-'))
+    {
+        int sign = (*p == '-') ? -1 : 1;
+        int offsetHours, offsetMinutes = 0;
+        p++;
+        if ((end - p < 2) || (!ParticleTimestampDigits(p, 2, &offsetHours)))
+        {
+            return NO;
+        }
+        p += 2;
+        if ((p < end) && (*p == ':'))
+        {
+            p++;
+        }
+        if (p < end)
+        {
+            if ((end - p < 2) || (!ParticleTimestampDigits(p, 2, &offsetMinutes)))
+            {
+                return NO;
+            }
+            p += 2;
+        }
+        if ((offsetHours > 23) || (offsetMinutes > 59))
+        {
+            return NO;
+        }
+        offsetSeconds = sign * (offsetHours * 3600 + offsetMinutes * 60);
+    }
+    else
+    {
+        return NO;
+    }
+
+    if (p != end)
+    {
+        return NO;
+    }
+
+    int64_t seconds = ParticleTimestampDaysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offsetSeconds;
+    *timeInterval = (NSTimeInterval)seconds + fraction;
+    return YES;
+}
+
+BOOL ParticleTimestampFormat(NSTimeInterval timeInterval, char bytes[PARTICLE_TIMESTAMP_LENGTH])
+{
+    // 0000-01-01 and 10000-01-01 in milliseconds since 1970
+    double milliseconds = round(timeInterval * 1000.0); // dates parsed from timestamps are a little off their millisecond
+    if ((!(milliseconds >= -62167219200000.0)) || (milliseconds >= 253402300800000.0))
+    {
+        return NO;
+    }
+
+    int64_t totalMilliseconds = (int64_t)milliseconds;
+    int64_t days = (totalMilliseconds >= 0 ? totalMilliseconds : totalMilliseconds - 86399999) / 86400000;
+    int64_t millisecondOfDay = totalMilliseconds - days * 86400000;
+    int year, month, day;
+    ParticleTimestampCivilFromDays(days, &year, &month, &day);
+
+    int secondOfDay = (int)(millisecondOfDay / 1000);
+    ParticleTimestampPutDigits(bytes, 4, year);
+    bytes[4] = '-';
+    ParticleTimestampPutDigits(bytes + 5, 2, month);
+    bytes[7] = '-';
+    ParticleTimestampPutDigits(bytes + 8, 2, day);
+    bytes[10] = 'T';
+    ParticleTimestampPutDigits(bytes + 11, 2, secondOfDay / 3600);
+    bytes[13] = ':';
+    ParticleTimestampPutDigits(bytes + 14, 2, (secondOfDay / 60) % 60);
+    bytes[16] = ':';
+    ParticleTimestampPutDigits(bytes + 17, 2, secondOfDay % 60);
+    bytes[19] = '.';
+    ParticleTimestampPutDigits(bytes + 20, 3, (int)(millisecondOfDay % 1000));
+    bytes[23] = 'Z';
+    return YES;
+}
+
+NSString * _Nullable ParticleTimestampFromDate(NSDate * _Nullable date)
+{
+    char bytes[PARTICLE_TIMESTAMP_LENGTH];
+    if ((!date) || (!ParticleTimestampFormat(date.timeIntervalSince1970, bytes)))
+    {
+        return nil;
+    }
+    return [[NSString alloc] initWithBytes:bytes length:PARTICLE_TIMESTAMP_LENGTH encoding:NSUTF8StringEncoding];
+}
+
+static NSDate * _Nullable ParticleDateFromTimestampWithFormatter(NSString *timestamp)
+{
+    // NSDateFormatter is expensive to create and not thread safe - keep one per thread
+    NSMutableDictionary *threadDictionary = [NSThread currentThread].threadDictionary;
+    NSDateFormatter *formatter = threadDictionary[kParticleTimestampFormatterKey];
+    if (!formatter)
+    {
+        formatter = [[NSDateFormatter alloc] init];
+        [formatter setDateFormat:@"yyyy-MM-dd'T'HH:mm:ss.SSSZ"];
+        NSLocale *posix = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+        [formatter setLocale:posix];
+        threadDictionary[kParticleTimestampFormatterKey] = formatter;
+    }
+    return [formatter dateFromString:timestamp];
+}
+
+NSDate * _Nullable ParticleDateFromTimestamp(NSString * _Nullable timestamp)
+{
+    if (!timestamp)
+    {
+        return nil;
+    }
+
+    NSTimeInterval timeInterval;
+    const char *bytes = timestamp.UTF8String;
+    if ((bytes) && (ParticleTimestampParse(bytes, strlen(bytes), &timeInterval)))
+    {
+        return [NSDate dateWithTimeIntervalSince1970:timeInterval];
+    }
+
+    return ParticleDateFromTimestampWithFormatter(timestamp);
+}
+
+NSDate * _Nullable ParticleDateFromTimestampBytes(const char *bytes, NSUInteger length)
+{
+    NSTimeInterval timeInterval;
+    if (ParticleTimestampParse(bytes, length, &timeInterval))
+    {
+        return [NSDate dateWithTimeIntervalSince1970:timeInterval];
+    }
+
+    NSString *timestamp = [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+    return timestamp ? ParticleDateFromTimestampWithFormatter(timestamp) : nil;
+}
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,142 @@
+//
+//  ParticleMockCloud.h
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NSInteger (^ParticleMockCloudFunctionHandler)(NSString *deviceID, NSString *functionName, NSString * _Nullable argument);
+
+/**
+ *  In-process stand-in for the Particle cloud REST API and event streams, for repeatable offline performance and soak tests.
+ *  Requests to baseURL are answered by an NSURLProtocol inside the app process - no sockets, no real cloud.
+ *
+ *  Serves oauth/token, device list/info (ETag revalidated), variables, functions, rename/unclaim, event publishing and
+ *  the /v1/events, /v1/devices/events and /v1/devices/:id/events event streams.
+ *
+ *      ParticleMockCloud *mockCloud = [ParticleMockCloud new];
+ *      [mockCloud addDeviceWithID:@"53ff6e066667574824151267" name:@"garage" connected:YES variables:@{@"temp" : @41.9} functions:@[@"open"]];
+ *      ParticleCloud *cloud = [[ParticleCloud alloc] initWithBaseURL:mockCloud.baseURL sessionConfiguration:mockCloud.sessionConfiguration];
+ */
+@interface ParticleMockCloud : NSObject
+
+/**
+ *  Base URL of this mock cloud, unique per instance
+ */
+@property (nonatomic, strong, readonly) NSURL *baseURL;
+
+/**
+ *  Session configuration routing baseURL requests to this mock, pass to ParticleCloud initWithBaseURL:sessionConfiguration:
+ */
+@property (nonatomic, strong, readonly) NSURLSessionConfiguration *sessionConfiguration;
+
+/**
+ *  Simulated round trip time of every REST request (default 0)
+ */
+@property (nonatomic) NSTimeInterval responseLatency;
+
+/**
+ *  Size of the chunks REST response bodies are delivered in, 0 (default) for the whole body at once
+ */
+@property (nonatomic) NSUInteger responseChunkSize;
+
+/**
+ *  Access token handed out by oauth/token (default "mock-access-token"), event streams opened with another one are
+ *  rejected with 401 like an expired token
+ */
+@property (nonatomic, copy) NSString *accessToken;
+
+/**
+ *  Called for function calls, returns the function return value (default: every function returns 1)
+ */
+@property (nonatomic, copy, nullable) ParticleMockCloudFunctionHandler functionHandler;
+
+/**
+ *  Number of REST requests served so far
+ */
+@property (nonatomic, readonly) NSUInteger requestCount;
+
+/**
+ *  Largest number of REST requests the mock was answering at the same time (see responseLatency)
+ */
+@property (nonatomic, readonly) NSUInteger maxConcurrentRequestCount;
+
+/**
+ *  Number of currently open event streams
+ */
+@property (nonatomic, readonly) NSUInteger openEventStreamCount;
+
+/**
+ *  Number of event streams rejected so far for their access token
+ */
+@property (nonatomic, readonly) NSUInteger rejectedEventStreamCount;
+
+/**
+ *  Send an id: field with every event (a cloud wide sequence number) and resume streams opened with a Last-Event-ID header
+ *  by replaying the newer events still in the event history (default NO, like the Particle cloud)
+ */
+@property (nonatomic) BOOL sendsEventIDs;
+
+/**
+ *  Number of most recent events kept for Last-Event-ID resume (default 1000), 0 to lose events published while a stream is down
+ */
+@property (nonatomic) NSUInteger eventHistoryLength;
+
+/**
+ *  Reconnection time sent with a retry: field when an event stream opens, 0 (default) to send none
+ */
+@property (nonatomic) NSTimeInterval eventStreamRetryInterval;
+
+/**
+ *  Add a device claimed by the mock user
+ *
+ *  @param deviceID  Device ID
+ *  @param name      Device name
+ *  @param connected Device online state
+ *  @param variables Variable names and current values (NSString or NSNumber)
+ *  @param functions Function names
+ */
+-(void)addDeviceWithID:(NSString *)deviceID
+                  name:(nullable NSString *)name
+             connected:(BOOL)connected
+             variables:(nullable NSDictionary<NSString *, id> *)variables
+             functions:(nullable NSArray<NSString *> *)functions;
+
+-(void)removeDeviceWithID:(NSString *)deviceID;
+
+/**
+ *  Change device online state, publishes a spark/status system event like the cloud does
+ */
+-(void)setConnected:(BOOL)connected forDeviceWithID:(NSString *)deviceID;
+
+/**
+ *  Change the time the cloud last heard from the device (set to the current time by addDeviceWithID: and setConnected:)
+ */
+-(void)setLastHeard:(NSDate *)lastHeard forDeviceWithID:(NSString *)deviceID;
+
+/**
+ *  Change current value of a device variable
+ */
+-(void)setValue:(id)value forVariable:(NSString *)variableName deviceID:(NSString *)deviceID;
+
+/**
+ *  Publish an event to all open event streams it matches
+ *
+ *  @param eventName Event name
+ *  @param data      Event payload
+ *  @param deviceID  Publishing device ID
+ */
+-(void)publishEventWithName:(NSString *)eventName data:(nullable NSString *)data deviceID:(NSString *)deviceID;
+
+/**
+ *  End all open event streams like a dropped connection would, clients are expected to reconnect
+ */
+-(void)dropEventStreams;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,700 @@
+//
+//  ParticleMockCloud.m
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import "ParticleMockCloud.h"
+#include <time.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+static NSString *const kParticleMockCloudDefaultAccessToken = @"mock-access-token";
+static NSString *const kParticleMockCloudAPIDeviceID = @"001"; // coreid of events published through the API
+
+@class ParticleMockCloudURLProtocol;
+
+@interface ParticleMockCloud ()
+
+@property (nonatomic, strong, readwrite) NSURL *baseURL;
+@property (nonatomic, readwrite) NSUInteger requestCount;
+@property (nonatomic, readwrite) NSUInteger rejectedEventStreamCount;
+@property (nonatomic, readwrite) NSUInteger maxConcurrentRequestCount;
+@property (nonatomic) NSUInteger activeRequestCount;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSMutableDictionary *> *devices;        // listing params by device ID
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSMutableDictionary *> *variableValues; // variable values by device ID
+@property (nonatomic, strong) NSMutableArray<ParticleMockCloudURLProtocol *> *eventStreams;
+@property (nonatomic, strong) NSMutableArray<NSDictionary *> *eventHistory;                         // @{id, name, coreid, message}
+@property (nonatomic) unsigned long long lastEventID;
+@property (nonatomic) NSUInteger devicesVersion;                                                      // device listing ETag, bumped on every device change
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *deviceVersions;            // device details ETags by device ID
+
++(nullable ParticleMockCloud *)mockCloudForHost:(NSString *)host;
+-(void)handleRequestForProtocol:(ParticleMockCloudURLProtocol *)protocol;
+-(void)removeEventStream:(ParticleMockCloudURLProtocol *)protocol;
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+@interface ParticleMockCloudURLProtocol : NSURLProtocol
+
+@property (nonatomic, strong) NSThread *clientThread;
+@property (nonatomic, copy) NSArray<NSString *> *clientModes;
+@property (nonatomic, weak) ParticleMockCloud *mockCloud;
+@property (nonatomic) BOOL stopped;
+
+// event stream filter
+@property (nonatomic, strong, nullable) NSString *eventNamePrefix;
+@property (nonatomic, strong, nullable) NSString *deviceID;
+@property (nonatomic) BOOL myDevicesOnly;
+
+-(void)performOnClientThread:(dispatch_block_t)block;
+-(void)respondWithStatusCode:(NSInteger)statusCode JSONObject:(id)object;
+-(void)respondWithStatusCode:(NSInteger)statusCode headerFields:(NSDictionary<NSString *, NSString *> *)headerFields JSONObject:(nullable id)object;
+-(void)startEventStreamWithData:(NSData *)data;
+-(void)sendData:(NSData *)data;
+-(void)finishLoading;
+
+@end
+
+@implementation ParticleMockCloudURLProtocol
+
++(BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return ([ParticleMockCloud mockCloudForHost:request.URL.host] != nil);
+}
+
++(NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+-(void)startLoading
+{
+    // client callbacks must happen on the thread (and run loop modes) loading started on
+    self.clientThread = [NSThread currentThread];
+    NSString *mode = [NSRunLoop currentRunLoop].currentMode;
+    self.clientModes = ((mode) && (![mode isEqualToString:NSDefaultRunLoopMode])) ? @[NSDefaultRunLoopMode, mode] : @[NSDefaultRunLoopMode];
+
+    self.mockCloud = [ParticleMockCloud mockCloudForHost:self.request.URL.host];
+    if (!self.mockCloud)
+    {
+        [self.client URLProtocol:self didFailWithError:[NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotConnectToHost userInfo:nil]];
+        return;
+    }
+
+    [self.mockCloud handleRequestForProtocol:self];
+}
+
+-(void)stopLoading
+{
+    self.stopped = YES;
+    [self.mockCloud removeEventStream:self];
+}
+
+-(void)performOnClientThread:(dispatch_block_t)block
+{
+    [self performSelector:@selector(runClientBlock:) onThread:self.clientThread withObject:[block copy] waitUntilDone:NO modes:self.clientModes];
+}
+
+-(void)runClientBlock:(dispatch_block_t)block
+{
+    if (!self.stopped)
+    {
+        block();
+    }
+}
+
+-(void)respondWithStatusCode:(NSInteger)statusCode JSONObject:(id)object
+{
+    [self respondWithStatusCode:statusCode headerFields:@{} JSONObject:object];
+}
+
+-(void)respondWithStatusCode:(NSInteger)statusCode headerFields:(NSDictionary<NSString *, NSString *> *)headerFields JSONObject:(nullable id)object
+{
+    NSData *body = object ? [NSJSONSerialization dataWithJSONObject:object options:0 error:nil] : [NSData data];
+    NSMutableDictionary *allHeaderFields = [@{@"Content-Type" : @"application/json; charset=utf-8"} mutableCopy];
+    [allHeaderFields addEntriesFromDictionary:headerFields];
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:allHeaderFields];
+    NSUInteger chunkSize = self.mockCloud.responseChunkSize ?: MAX(body.length, 1);
+    [self performOnClientThread:^{
+        [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+        for (NSUInteger offset = 0; offset < body.length; offset += chunkSize)
+        {
+            [self.client URLProtocol:self didLoadData:[body subdataWithRange:NSMakeRange(offset, MIN(chunkSize, body.length - offset))]];
+        }
+        [self.client URLProtocolDidFinishLoading:self];
+    }];
+}
+
+-(void)startEventStreamWithData:(NSData *)data
+{
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Content-Type" : @"text/event-stream"}];
+    [self performOnClientThread:^{
+        [self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+        [self.client URLProtocol:self didLoadData:data];
+    }];
+}
+
+-(void)sendData:(NSData *)data
+{
+    [self performOnClientThread:^{
+        [self.client URLProtocol:self didLoadData:data];
+    }];
+}
+
+-(void)finishLoading
+{
+    [self performOnClientThread:^{
+        [self.client URLProtocolDidFinishLoading:self];
+    }];
+}
+
+-(NSData *)requestBody
+{
+    if (self.request.HTTPBody)
+    {
+        return self.request.HTTPBody;
+    }
+
+    // NSURLSession hands the body over as a stream
+    NSMutableData *body = [NSMutableData new];
+    NSInputStream *stream = self.request.HTTPBodyStream;
+    if (stream)
+    {
+        uint8_t buffer[4096];
+        NSInteger length;
+        [stream open];
+        while ((length = [stream read:buffer maxLength:sizeof(buffer)]) > 0)
+        {
+            [body appendBytes:buffer length:length];
+        }
+        [stream close];
+    }
+    return body;
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+static NSMapTable<NSString *, ParticleMockCloud *> *ParticleMockClouds; // by host, guarded by the ParticleMockCloud class
+
+static NSDictionary<NSString *, NSString *> *ParticleMockCloudFormParameters(NSString * _Nullable form)
+{
+    NSMutableDictionary *params = [NSMutableDictionary new];
+    for (NSString *pair in [form componentsSeparatedByString:@"&"])
+    {
+        NSRange separator = [pair rangeOfString:@"="];
+        if ((pair.length == 0) || (separator.location == NSNotFound))
+        {
+            continue;
+        }
+        NSString *key = [[pair substringToIndex:separator.location] stringByReplacingOccurrencesOfString:@"+" withString:@" "];
+        NSString *value = [[pair substringFromIndex:separator.location + 1] stringByReplacingOccurrencesOfString:@"+" withString:@" "];
+        params[key.stringByRemovingPercentEncoding ?: key] = value.stringByRemovingPercentEncoding ?: value;
+    }
+    return params;
+}
+
+static NSString *ParticleMockCloudTimestamp(NSDate *date)
+{
+    // "2015-04-18T08:42:22.127Z"
+    NSTimeInterval timeInterval = date.timeIntervalSince1970;
+    time_t seconds = (time_t)floor(timeInterval);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    return [NSString stringWithFormat:@"%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday,
+            utc.tm_hour, utc.tm_min, utc.tm_sec, (int)((timeInterval - seconds) * 1000.0)];
+}
+
+@implementation ParticleMockCloud
+
++(void)initialize
+{
+    if (self == [ParticleMockCloud class])
+    {
+        ParticleMockClouds = [NSMapTable strongToWeakObjectsMapTable];
+    }
+}
+
++(nullable ParticleMockCloud *)mockCloudForHost:(NSString *)host
+{
+    @synchronized (self) {
+        return [ParticleMockClouds objectForKey:host.lowercaseString];
+    }
+}
+
+-(instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _accessToken = kParticleMockCloudDefaultAccessToken;
+        _devices = [NSMutableDictionary new];
+        _variableValues = [NSMutableDictionary new];
+        _deviceVersions = [NSMutableDictionary new];
+        _eventStreams = [NSMutableArray new];
+        _eventHistory = [NSMutableArray new];
+        _eventHistoryLength = 1000;
+
+        NSString *host = [NSString stringWithFormat:@"mock-%@.particle.invalid", [NSUUID UUID].UUIDString].lowercaseString;
+        _baseURL = [NSURL URLWithString:[NSString stringWithFormat:@"https://%@", host]];
+        @synchronized ([ParticleMockCloud class]) {
+            [ParticleMockClouds setObject:self forKey:host];
+        }
+    }
+    return self;
+}
+
+-(NSURLSessionConfiguration *)sessionConfiguration
+{
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.protocolClasses = [@[[ParticleMockCloudURLProtocol class]] arrayByAddingObjectsFromArray:configuration.protocolClasses ?: @[]];
+    return configuration;
+}
+
+-(NSUInteger)openEventStreamCount
+{
+    @synchronized (self) {
+        return self.eventStreams.count;
+    }
+}
+
+-(void)setEventHistoryLength:(NSUInteger)eventHistoryLength
+{
+    @synchronized (self) {
+        _eventHistoryLength = eventHistoryLength;
+        if (self.eventHistory.count > eventHistoryLength)
+        {
+            [self.eventHistory removeObjectsInRange:NSMakeRange(0, self.eventHistory.count - eventHistoryLength)];
+        }
+    }
+}
+
+#pragma mark Devices
+
+-(void)addDeviceWithID:(NSString *)deviceID
+                  name:(nullable NSString *)name
+             connected:(BOOL)connected
+             variables:(nullable NSDictionary<NSString *, id> *)variables
+             functions:(nullable NSArray<NSString *> *)functions
+{
+    NSMutableDictionary *device = [@{@"id" : deviceID,
+                                     @"name" : name ?: [NSNull null],
+                                     @"connected" : @(connected),
+                                     @"last_heard" : ParticleMockCloudTimestamp([NSDate date]),
+                                     @"last_app" : [NSNull null],
+                                     @"last_ip_address" : @"127.0.0.1",
+                                     @"platform_id" : @6,
+                                     @"product_id" : @6,
+                                     @"status" : @"normal",
+                                     @"functions" : functions ?: @[]} mutableCopy];
+
+    @synchronized (self) {
+        self.devices[deviceID] = device;
+        self.variableValues[deviceID] = [variables mutableCopy] ?: [NSMutableDictionary new];
+        [self deviceDidChange:deviceID];
+    }
+}
+
+-(void)removeDeviceWithID:(NSString *)deviceID
+{
+    @synchronized (self) {
+        [self.devices removeObjectForKey:deviceID];
+        [self.variableValues removeObjectForKey:deviceID];
+        [self deviceDidChange:deviceID];
+    }
+}
+
+-(void)setConnected:(BOOL)connected forDeviceWithID:(NSString *)deviceID
+{
+    @synchronized (self) {
+        NSMutableDictionary *device = self.devices[deviceID];
+        if (!device)
+        {
+            return;
+        }
+        device[@"connected"] = @(connected);
+        device[@"last_heard"] = ParticleMockCloudTimestamp([NSDate date]);
+        [self deviceDidChange:deviceID];
+    }
+
+    [self publishEventWithName:@"spark/status" data:connected ? @"online" : @"offline" deviceID:deviceID];
+}
+
+-(void)setLastHeard:(NSDate *)lastHeard forDeviceWithID:(NSString *)deviceID
+{
+    @synchronized (self) {
+        NSMutableDictionary *device = self.devices[deviceID];
+        if (!device)
+        {
+            return;
+        }
+        device[@"last_heard"] = ParticleMockCloudTimestamp(lastHeard);
+        [self deviceDidChange:deviceID];
+    }
+}
+
+-(void)setValue:(id)value forVariable:(NSString *)variableName deviceID:(NSString *)deviceID
+{
+    @synchronized (self) {
+        self.variableValues[deviceID][variableName] = value;
+        [self deviceDidChange:deviceID];
+    }
+}
+
+// lock must be held
+-(void)deviceDidChange:(NSString *)deviceID
+{
+    self.devicesVersion++;
+    self.deviceVersions[deviceID] = @(self.devicesVersion);
+}
+
+#pragma mark Events
+
+-(void)publishEventWithName:(NSString *)eventName data:(nullable NSString *)data deviceID:(NSString *)deviceID
+{
+    NSDictionary *payload = @{@"data" : data ?: [NSNull null],
+                              @"ttl" : @"60",
+                              @"published_at" : ParticleMockCloudTimestamp([NSDate date]),
+                              @"coreid" : deviceID};
+    NSString *json = [[NSString alloc] initWithData:[NSJSONSerialization dataWithJSONObject:payload options:0 error:nil] encoding:NSUTF8StringEncoding];
+
+    NSMutableArray<ParticleMockCloudURLProtocol *> *streams = [NSMutableArray new];
+    NSData *message;
+    @synchronized (self) {
+        unsigned long long eventID = ++self.lastEventID;
+        NSString *idField = self.sendsEventIDs ? [NSString stringWithFormat:@"id: %llu\n", eventID] : @"";
+        message = [[NSString stringWithFormat:@"%@event: %@\ndata: %@\n\n", idField, eventName, json] dataUsingEncoding:NSUTF8StringEncoding];
+
+        if (self.eventHistoryLength > 0)
+        {
+            [self.eventHistory addObject:@{@"id" : @(eventID), @"name" : eventName, @"coreid" : deviceID, @"message" : message}];
+            if (self.eventHistory.count > self.eventHistoryLength)
+            {
+                [self.eventHistory removeObjectsInRange:NSMakeRange(0, self.eventHistory.count - self.eventHistoryLength)];
+            }
+        }
+
+        for (ParticleMockCloudURLProtocol *stream in self.eventStreams)
+        {
+            if ([self stream:stream acceptsEventWithName:eventName deviceID:deviceID])
+            {
+                [streams addObject:stream];
+            }
+        }
+    }
+
+    for (ParticleMockCloudURLProtocol *stream in streams)
+    {
+        [stream sendData:message];
+    }
+}
+
+// lock must be held
+-(BOOL)stream:(ParticleMockCloudURLProtocol *)stream acceptsEventWithName:(NSString *)eventName deviceID:(NSString *)deviceID
+{
+    return !(((stream.eventNamePrefix) && (![eventName hasPrefix:stream.eventNamePrefix])) ||
+             ((stream.deviceID) && (![stream.deviceID isEqualToString:deviceID])) ||
+             ((stream.myDevicesOnly) && (!self.devices[deviceID])));
+}
+
+-(void)dropEventStreams
+{
+    NSArray<ParticleMockCloudURLProtocol *> *streams;
+    @synchronized (self) {
+        streams = [self.eventStreams copy];
+        [self.eventStreams removeAllObjects];
+    }
+
+    for (ParticleMockCloudURLProtocol *stream in streams)
+    {
+        [stream finishLoading];
+    }
+}
+
+-(void)removeEventStream:(ParticleMockCloudURLProtocol *)protocol
+{
+    @synchronized (self) {
+        [self.eventStreams removeObjectIdenticalTo:protocol];
+    }
+}
+
+#pragma mark Request routing
+
+-(void)handleRequestForProtocol:(ParticleMockCloudURLProtocol *)protocol
+{
+    NSURLRequest *request = protocol.request;
+    NSString *method = request.HTTPMethod.uppercaseString ?: @"GET";
+    NSMutableArray<NSString *> *path = [request.URL.pathComponents mutableCopy];
+    [path removeObject:@"/"];
+
+    // event streams: v1/events[/prefix], v1/devices/events[/prefix], v1/devices/:id/events[/prefix]
+    if (([method isEqualToString:@"GET"]) && (path.count >= 2) && ([path[0] isEqualToString:@"v1"]))
+    {
+        NSUInteger eventsIndex = NSNotFound;
+        if ([path[1] isEqualToString:@"events"])
+        {
+            eventsIndex = 1;
+        }
+        else if ([path[1] isEqualToString:@"devices"])
+        {
+            if ((path.count >= 3) && ([path[2] isEqualToString:@"events"]))
+            {
+                eventsIndex = 2;
+            }
+            else if ((path.count >= 4) && ([path[3] isEqualToString:@"events"]))
+            {
+                eventsIndex = 3;
+            }
+        }
+
+        if (eventsIndex != NSNotFound)
+        {
+            [self startEventStreamForProtocol:protocol path:path eventsIndex:eventsIndex];
+            return;
+        }
+    }
+
+    NSMutableDictionary *params = [ParticleMockCloudFormParameters(request.URL.query) mutableCopy];
+    [params addEntriesFromDictionary:ParticleMockCloudFormParameters([[NSString alloc] initWithData:[protocol requestBody] encoding:NSUTF8StringEncoding])];
+
+    NSInteger statusCode = 200;
+    NSMutableDictionary<NSString *, NSString *> *headerFields = [NSMutableDictionary new];
+    id response;
+    @synchronized (self) {
+        self.requestCount++;
+        self.activeRequestCount++;
+        self.maxConcurrentRequestCount = MAX(self.maxConcurrentRequestCount, self.activeRequestCount);
+        response = [self responseForRequest:request method:method path:path params:params headerFields:headerFields statusCode:&statusCode];
+    }
+
+    if (self.responseLatency > 0)
+    {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.responseLatency * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [self requestDidFinish];
+            [protocol respondWithStatusCode:statusCode headerFields:headerFields JSONObject:response];
+        });
+    }
+    else
+    {
+        [self requestDidFinish];
+        [protocol respondWithStatusCode:statusCode headerFields:headerFields JSONObject:response];
+    }
+}
+
+-(void)requestDidFinish
+{
+    @synchronized (self) {
+        self.activeRequestCount--;
+    }
+}
+
+-(void)startEventStreamForProtocol:(ParticleMockCloudURLProtocol *)protocol path:(NSArray<NSString *> *)path eventsIndex:(NSUInteger)eventsIndex
+{
+    if (eventsIndex + 1 < path.count)
+    {
+        // prefix may contain slashes (spark/status)
+        protocol.eventNamePrefix = [[path subarrayWithRange:NSMakeRange(eventsIndex + 1, path.count - eventsIndex - 1)] componentsJoinedByString:@"/"];
+    }
+    if (eventsIndex == 3)
+    {
+        protocol.deviceID = path[2];
+    }
+    protocol.myDevicesOnly = (eventsIndex == 2);
+
+    NSString *accessToken = ParticleMockCloudFormParameters(protocol.request.URL.query)[@"access_token"];
+    @synchronized (self) {
+        if (![accessToken isEqualToString:self.accessToken])
+        {
+            self.rejectedEventStreamCount++;
+            accessToken = nil;
+        }
+    }
+    if (!accessToken)
+    {
+        [protocol respondWithStatusCode:401 JSONObject:@{@"error" : @"invalid_token", @"error_description" : @"The access token provided is invalid."}];
+        return;
+    }
+
+    NSMutableData *data = [[@":ok\n\n" dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    @synchronized (self) {
+        if (self.eventStreamRetryInterval > 0)
+        {
+            [data appendData:[[NSString stringWithFormat:@"retry: %llu\n\n", (unsigned long long)(self.eventStreamRetryInterval * 1000)] dataUsingEncoding:NSUTF8StringEncoding]];
+        }
+
+        // resume - replay newer events the stream would have received
+        NSString *lastEventID = [protocol.request valueForHTTPHeaderField:@"Last-Event-ID"];
+        if ((self.sendsEventIDs) && (lastEventID))
+        {
+            unsigned long long resumeID = strtoull(lastEventID.UTF8String, NULL, 10);
+            for (NSDictionary *event in self.eventHistory)
+            {
+                if (([event[@"id"] unsignedLongLongValue] > resumeID) && ([self stream:protocol acceptsEventWithName:event[@"name"] deviceID:event[@"coreid"]]))
+                {
+                    [data appendData:event[@"message"]];
+                }
+            }
+        }
+
+        [self.eventStreams addObject:protocol];
+    }
+    [protocol startEventStreamWithData:data];
+}
+
+// lock must be held, returns nil for a response without body
+-(nullable id)responseForRequest:(NSURLRequest *)request method:(NSString *)method path:(NSArray<NSString *> *)path params:(NSDictionary<NSString *, NSString *> *)params headerFields:(NSMutableDictionary<NSString *, NSString *> *)headerFields statusCode:(NSInteger *)statusCode
+{
+    // POST /oauth/token
+    if ((path.count == 2) && ([path[0] isEqualToString:@"oauth"]) && ([path[1] isEqualToString:@"token"]))
+    {
+        return @{@"token_type" : @"bearer", @"access_token" : self.accessToken, @"expires_in" : @7776000, @"refresh_token" : @"mock-refresh-token"};
+    }
+
+    if ((path.count < 2) || (![path[0] isEqualToString:@"v1"]) || (![path[1] isEqualToString:@"devices"]))
+    {
+        *statusCode = 404;
+        return @{@"ok" : @NO, @"error" : @"Not found"};
+    }
+
+    // GET /v1/devices
+    if (path.count == 2)
+    {
+        if ([self request:request matchesETag:[NSString stringWithFormat:@"\"%lu\"", (unsigned long)self.devicesVersion] headerFields:headerFields])
+        {
+            *statusCode = 304;
+            return nil;
+        }
+
+        NSMutableArray *listing = [NSMutableArray new];
+        for (NSDictionary *device in self.devices.allValues)
+        {
+            NSMutableDictionary *deviceListing = [device mutableCopy];
+            [deviceListing removeObjectForKey:@"functions"];
+            [listing addObject:deviceListing];
+        }
+        return listing;
+    }
+
+    // POST /v1/devices/events
+    if ((path.count == 3) && ([path[2] isEqualToString:@"events"]) && ([method isEqualToString:@"POST"]))
+    {
+        NSString *name = params[@"name"];
+        NSString *data = params[@"data"];
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            [self publishEventWithName:name data:data deviceID:kParticleMockCloudAPIDeviceID];
+        });
+        return @{@"ok" : @YES};
+    }
+
+    NSString *deviceID = path[2];
+    NSMutableDictionary *device = self.devices[deviceID];
+    if (!device)
+    {
+        *statusCode = 403;
+        return @{@"ok" : @NO, @"error" : @"Permission Denied", @"info" : @"I didn't recognize that device name or ID"};
+    }
+    BOOL connected = [device[@"connected"] boolValue];
+
+    if (path.count == 3)
+    {
+        // PUT /v1/devices/:id (rename)
+        if ([method isEqualToString:@"PUT"])
+        {
+            if (params[@"name"])
+            {
+                device[@"name"] = params[@"name"];
+                [self deviceDidChange:deviceID];
+            }
+            return @{@"id" : deviceID, @"name" : device[@"name"], @"ok" : @YES};
+        }
+
+        // DELETE /v1/devices/:id (unclaim)
+        if ([method isEqualToString:@"DELETE"])
+        {
+            [self.devices removeObjectForKey:deviceID];
+            [self.variableValues removeObjectForKey:deviceID];
+            [self deviceDidChange:deviceID];
+            return @{@"ok" : @YES};
+        }
+
+        // GET /v1/devices/:id
+        if ([self request:request matchesETag:[NSString stringWithFormat:@"\"%@-%@\"", deviceID, self.deviceVersions[deviceID]] headerFields:headerFields])
+        {
+            *statusCode = 304;
+            return nil;
+        }
+        NSMutableDictionary *info = [device mutableCopy];
+        NSMutableDictionary *variableTypes = [NSMutableDictionary new];
+        [self.variableValues[deviceID] enumerateKeysAndObjectsUsingBlock:^(NSString *name, id value, BOOL *stop) {
+            if ([value isKindOfClass:[NSString class]])
+            {
+                variableTypes[name] = @"string";
+            }
+            else
+            {
+                variableTypes[name] = (strcmp([value objCType], @encode(double)) == 0) || (strcmp([value objCType], @encode(float)) == 0) ? @"double" : @"int32";
+            }
+        }];
+        info[@"variables"] = connected ? variableTypes : [NSNull null];
+        info[@"functions"] = connected ? device[@"functions"] : [NSNull null];
+        return info;
+    }
+
+    if (path.count == 4)
+    {
+        NSString *name = path[3];
+
+        // POST /v1/devices/:id/:function
+        if ([method isEqualToString:@"POST"])
+        {
+            if (![device[@"functions"] containsObject:name])
+            {
+                *statusCode = 404;
+                return @{@"ok" : @NO, @"error" : @"Function not found"};
+            }
+            NSInteger returnValue = 1;
+            if ((connected) && (self.functionHandler))
+            {
+                returnValue = self.functionHandler(deviceID, name, params[@"args"] ?: params[@"arg"]);
+            }
+            return @{@"id" : deviceID, @"name" : device[@"name"], @"connected" : @(connected), @"return_value" : @(returnValue)};
+        }
+
+        // GET /v1/devices/:id/:variable
+        id value = self.variableValues[deviceID][name];
+        if (!value)
+        {
+            *statusCode = 404;
+            return @{@"ok" : @NO, @"error" : @"Variable not found"};
+        }
+        NSMutableDictionary *coreInfo = [@{@"deviceID" : deviceID, @"connected" : @(connected), @"last_heard" : device[@"last_heard"]} mutableCopy];
+        return @{@"cmd" : @"VarReturn", @"name" : name, @"result" : value, @"coreInfo" : coreInfo};
+    }
+
+    *statusCode = 404;
+    return @{@"ok" : @NO, @"error" : @"Not found"};
+}
+
+// sets the ETag response header, YES if the request revalidates a response with the same ETag
+-(BOOL)request:(NSURLRequest *)request matchesETag:(NSString *)etag headerFields:(NSMutableDictionary<NSString *, NSString *> *)headerFields
+{
+    headerFields[@"ETag"] = etag;
+    return [[request valueForHTTPHeaderField:@"If-None-Match"] isEqualToString:etag];
+}
+
+-(void)dealloc
+{
+    for (ParticleMockCloudURLProtocol *stream in self.eventStreams)
+    {
+        [stream finishLoading];
+    }
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
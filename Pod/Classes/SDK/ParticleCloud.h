@@ -20,12 +20,39 @@
 #import <Foundation/Foundation.h>
 #import "ParticleDevice.h"
 #import "ParticleEvent.h"
+#import "ParticleDeviceRegistry.h"
+#import "ParticleEventJournal.h"
+#import "ParticleEventStore.h"
 
 
 NS_ASSUME_NONNULL_BEGIN
 
 extern NSString *const kParticleAPIBaseURL;
 
+@class AFHTTPSessionManager;
+
+/**
+ *  Counters snapshot of the device list and device details requests (getDevices/getDevice). Responses are revalidated with
+ *  their ETag/Last-Modified - an unchanged response comes back as an empty 304 and the devices created from it are reused.
+ */
+@interface ParticleDeviceRequestCacheStats : NSObject
+
+@property (nonatomic, readonly) NSUInteger requestCount;            // requests sent
+@property (nonatomic, readonly) NSUInteger revalidationCount;       // requests sent with the validators of a cached response
+@property (nonatomic, readonly) NSUInteger notModifiedCount;        // cached response still valid (304)
+@property (nonatomic, readonly) double hitRatio;                    // notModifiedCount / requestCount
+@property (nonatomic, readonly) unsigned long long bytesReceived;   // response bytes downloaded
+@property (nonatomic, readonly) unsigned long long bytesSaved;      // response bytes the 304s did not download again
+
+// Internal use
+-(instancetype)initWithRequestCount:(NSUInteger)requestCount
+                  revalidationCount:(NSUInteger)revalidationCount
+                   notModifiedCount:(NSUInteger)notModifiedCount
+                      bytesReceived:(unsigned long long)bytesReceived
+                         bytesSaved:(unsigned long long)bytesSaved;
+
+@end
+
 @interface ParticleCloud : NSObject
 
 /**
@@ -56,12 +83,65 @@ extern NSString *const kParticleAPIBaseURL;
 @property (nonatomic, nullable, strong) NSString *oAuthClientSecret;
 
 /**
- *  Singleton instance of ParticleCloud class
+ *  Devices of the logged in user as of the last getDevices call, kept up to date with device system events - query without network I/O.
+ *  getDevices refetches details (functions, variables) only of online devices which changed state since they were last fetched.
+ */
+@property (nonatomic, strong, readonly) ParticleDeviceRegistry *deviceRegistry;
+
+/**
+ *  File the device registry is saved to, restored from on first access after launch so the device list of the previous
+ *  launch is available before getDevices returns (default Caches/ParticleSDK/<host>-devices.snapshot), nil to not persist devices.
+ *  The snapshot is deleted on logout and when a session of another user finds it, injecting a session of the same user keeps it.
+ */
+@property (nonatomic, strong, nullable) NSURL *deviceSnapshotURL;
+
+/**
+ *  Maximum number of device detail requests getDevices keeps in flight at once (default 6), 0 for no limit.
+ *  Keeps large accounts from flooding the connection and tripping cloud rate limits.
+ */
+@property (nonatomic) NSUInteger maxConcurrentDeviceRequests;
+
+/**
+ *  Maximum number of cloud filtered public event streams (one per subscribeToAllEventsWithPrefix: prefix) kept open (default 16), 0 for no limit.
+ *  Past it subscriptions with a common name prefix share one stream filtered by that prefix and are matched on the client.
+ */
+@property (nonatomic) NSUInteger maxServerFilteredEventStreams;
+
+/**
+ *  Maximum number of simultaneous connections to the cloud (default 4). The connection pool is shared by ParticleCloud and
+ *  all ParticleDevice instances, connections are kept alive and reused, over HTTP/2 requests are multiplexed on one connection.
+ */
+@property (nonatomic) NSUInteger maxConnectionsPerHost;
+
+/**
+ *  Session configuration the shared connection pool and event streams are created with (default: NSURLSessionConfiguration defaultSessionConfiguration)
+ *  Setting it or maxConnectionsPerHost starts a new pool, requests already in flight and open event streams stay on the previous one.
+ */
+@property (nonatomic, copy, null_resettable) NSURLSessionConfiguration *sessionConfiguration;
+
+/**
+ *  Singleton instance of ParticleCloud class, talks to the Particle cloud at kParticleAPIBaseURL
  *
  *  @return initialized ParticleCloud singleton
  */
 + (instancetype)sharedInstance;
 
+/**
+ *  Initialize a ParticleCloud instance for a specific cloud endpoint, e.g. an on-premise cloud or a local mock cloud
+ *  Devices returned by this instance send their requests through it. Its session is kept in memory only - the session
+ *  saved in the keychain belongs to sharedInstance and is neither restored, overwritten nor removed by other instances.
+ *
+ *  @param baseURL              Cloud API base URL (scheme and host, e.g. https://api.particle.io)
+ *  @param sessionConfiguration Session configuration of the HTTP transport, e.g. with protocolClasses injecting a custom transport, nil for default
+ *  @return initialized ParticleCloud instance
+ */
+-(nullable instancetype)initWithBaseURL:(NSURL *)baseURL sessionConfiguration:(nullable NSURLSessionConfiguration *)sessionConfiguration NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Cloud API base URL this instance talks to
+ */
+@property (nonatomic, strong, readonly) NSURL *baseURL;
+
 #pragma mark User onboarding functions
 // --------------------------------------------------------------------------------------------------------------------------------------------------------
 // User onboarding functions
@@ -214,9 +294,22 @@ extern NSString *const kParticleAPIBaseURL;
  */
 -(NSURLSessionDataTask *)getDevices:(nullable void (^)(NSArray<ParticleDevice *> * _Nullable particleDevices, NSError * _Nullable error))completion;
 
+/**
+ *  Get an array of instances of all user's claimed devices, reporting every device as soon as it is resolved
+ *  The device list is decoded device by device while it downloads, details of online devices are queried most recently heard first,
+ *  at most maxConcurrentDeviceRequests at a time
+ *
+ *  @param progress   Called on the main thread for each device once its instance is ready - offline/unchanged devices as the device list downloads, online devices as their details arrive
+ *  @param completion Completion block with all device instances ordered by last heard (most recent first) in case of success or with NSError object if failure
+ *  @return NSURLSessionDataTask task for requested network access
+ */
+-(NSURLSessionDataTask *)getDevicesWithProgress:(nullable void (^)(ParticleDevice *device))progress
+                                     completion:(nullable void (^)(NSArray<ParticleDevice *> * _Nullable particleDevices, NSError * _Nullable error))completion;
+
 /**
  *  Get a specific device instance by its deviceID. If the device is offline the instance will contain only partial information the cloud has cached, 
  *  notice that the the request might also take quite some time to complete for offline devices.
+ *  If the device details did not change since they were last fetched the registry's device instance is returned.
  *
  *  @param deviceID   required deviceID
  *  @param completion Completion block with first arguemnt as the device instance in case of success or with second argument NSError object if operation failed
@@ -225,6 +318,26 @@ extern NSString *const kParticleAPIBaseURL;
 -(NSURLSessionDataTask *)getDevice:(NSString *)deviceID
                         completion:(nullable void (^)(ParticleDevice * _Nullable device, NSError * _Nullable error))completion;
 
+/**
+ *  Call the same function on many devices, at most maxConcurrentCalls calls in flight at once.
+ *  Arguments are validated once up front - if they are too long no call is made and completion gets the error.
+ *
+ *  @param functionName         Function name
+ *  @param args                 Array of arguments to pass to the function on every device, see ParticleDevice callFunction:withArguments:completion:
+ *  @param deviceIDs            IDs of the devices to call the function on
+ *  @param maxConcurrentCalls   Maximum number of calls in flight at once, 0 for no limit
+ *  @param timeout              Seconds after which an unanswered call is cancelled and reported as timed out, 0 for the default request timeout
+ *  @param progress             Called on the main thread with every device result as soon as it arrives
+ *  @param completion           Called on the main thread when all calls finished with the results summary, or with an NSError object if the calls could not be made
+ */
+-(void)callFunction:(NSString *)functionName
+      withArguments:(nullable NSArray *)args
+        onDeviceIDs:(NSArray<NSString *> *)deviceIDs
+ maxConcurrentCalls:(NSUInteger)maxConcurrentCalls
+            timeout:(NSTimeInterval)timeout
+           progress:(nullable void (^)(ParticleFunctionCallResult *result))progress
+         completion:(nullable void (^)(ParticleFunctionCallSummary * _Nullable summary, NSError * _Nullable error))completion;
+
 // Not available yet
 //-(void)publishEvent:(NSString *)eventName data:(NSData *)data;
 
@@ -280,7 +393,7 @@ extern NSString *const kParticleAPIBaseURL;
 /**
  *  Subscribe to the firehose of public events, plus private events published by devices one owns
  *
- *  @param eventHandler ParticleEventHandler event handler method - receiving NSDictionary argument which contains keys: event (name), data (payload), ttl (time to live), published_at (date/time emitted), coreid (device ID). Second argument is NSError object in case error occured in parsing the event payload.
+ *  @param eventHandler ParticleEventHandler event handler method - receiving NSDictionary argument which contains keys: event (name), data (payload), ttl (time to live), published_at (date/time emitted), coreid (device ID). Second argument is NSError object in case error occured in parsing the event payload or the event stream stopped for good (rejected by the cloud or out of reconnect retries, lost connections being reconnected show only in the subscription stats), in order with the events before it.
  *  @param eventNamePrefix    Filter only events that match name eventName, if nil is passed any event will trigger eventHandler
  *  @return eventListenerID function will return an id type object as the eventListener registration unique ID - keep and pass this object to the unsubscribe method in order to remove this event listener
  */
@@ -294,6 +407,35 @@ extern NSString *const kParticleAPIBaseURL;
  */
 -(nullable id)subscribeToMyDevicesEventsWithPrefix:(nullable NSString *)eventNamePrefix handler:(nullable ParticleEventHandler)eventHandler;
 
+/**
+ *  Subscribe to the firehose of public events, plus private events published by devices one owns - events are delivered in batches.
+ *  Use for high rate subscriptions to coalesce UI updates or database writes, event order within the stream is kept.
+ *
+ *  @param eventNamePrefix  Filter only events that match name eventNamePrefix, if nil is passed any event will trigger eventHandler
+ *  @param maxBatchSize     Maximum number of events in a batch, a full batch is delivered immediately (e.g. 64)
+ *  @param maxLatency       Maximum time in seconds an event waits in a batch that is not full yet (e.g. 0.05)
+ *  @param batchHandler     Event batch handler receiving an array of events in stream order, or NSError object in case of an error
+ *  @return eventListenerID function will return an id type object as the eventListener registration unique ID - keep and pass this object to the unsubscribe method in order to remove this event listener
+ */
+-(nullable id)subscribeToAllEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                maxBatchSize:(NSUInteger)maxBatchSize
+                                  maxLatency:(NSTimeInterval)maxLatency
+                                batchHandler:(nullable ParticleEventBatchHandler)batchHandler;
+
+/**
+ *  Subscribe to all events, public and private, published by devices one owns - events are delivered in batches.
+ *
+ *  @param eventNamePrefix  Filter only events that match name eventNamePrefix, for exact match pass whole string, if nil/empty string is passed any event will trigger eventHandler
+ *  @param maxBatchSize     Maximum number of events in a batch, a full batch is delivered immediately (e.g. 64)
+ *  @param maxLatency       Maximum time in seconds an event waits in a batch that is not full yet (e.g. 0.05)
+ *  @param batchHandler     Event batch handler receiving an array of events in stream order, or NSError object in case of an error
+ *  @return eventListenerID function will return an id type object as the eventListener registration unique ID - keep and pass this object to the unsubscribe method in order to remove this event listener
+ */
+-(nullable id)subscribeToMyDevicesEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                      maxBatchSize:(NSUInteger)maxBatchSize
+                                        maxLatency:(NSTimeInterval)maxLatency
+                                      batchHandler:(nullable ParticleEventBatchHandler)batchHandler;
+
 
 
 /**
@@ -308,10 +450,80 @@ extern NSString *const kParticleAPIBaseURL;
 -(nullable id)subscribeToDeviceEventsWithPrefix:(nullable NSString *)eventNamePrefix deviceID:(NSString *)deviceID handler:(nullable ParticleEventHandler)eventHandler;
 
 
+/**
+ *  Subscribe to the firehose of public events, plus private events published by devices one owns, with a bounded delivery queue.
+ *  Use when the handler might be slower than the event stream (e.g. writes to disk) so undelivered events cannot pile up in memory.
+ *
+ *  @param eventNamePrefix  Filter only events that match name eventNamePrefix, if nil is passed any event will trigger eventHandler
+ *  @param queueDepth       Maximum number of events waiting for the handler, 0 for unbounded
+ *  @param overflowPolicy   What to do with a new event when the queue is full: drop oldest/newest, coalesce per device and event name or block the stream
+ *  @param eventHandler     Event handler function that accepts the event payload dictionary and an NSError object in case of an error
+ *  @return eventListenerID function will return an id type object as the eventListener registration unique ID - keep and pass this object to the unsubscribe method in order to remove this event listener
+ */
+-(nullable id)subscribeToAllEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                  queueDepth:(NSUInteger)queueDepth
+                              overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy
+                                     handler:(nullable ParticleEventHandler)eventHandler;
+
+/**
+ *  Subscribe to all events, public and private, published by devices one owns, with a bounded delivery queue.
+ *
+ *  @param eventNamePrefix  Filter only events that match name eventNamePrefix, for exact match pass whole string, if nil/empty string is passed any event will trigger eventHandler
+ *  @param queueDepth       Maximum number of events waiting for the handler, 0 for unbounded
+ *  @param overflowPolicy   What to do with a new event when the queue is full: drop oldest/newest, coalesce per device and event name or block the stream
+ *  @param eventHandler     Event handler function that accepts the event payload dictionary and an NSError object in case of an error
+ *  @return eventListenerID function will return an id type object as the eventListener registration unique ID - keep and pass this object to the unsubscribe method in order to remove this event listener
+ */
+-(nullable id)subscribeToMyDevicesEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                        queueDepth:(NSUInteger)queueDepth
+                                    overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy
+                                           handler:(nullable ParticleEventHandler)eventHandler;
+
+/**
+ *  Subscribe to events from one specific device with a bounded delivery queue.
+ *
+ *  @param eventNamePrefix  Filter only events that match name eventNamePrefix, for exact match pass whole string, if nil/empty string is passed any event will trigger eventHandler
+ *  @param deviceID         Specific device ID. If user has this device claimed the private & public events will be received, otherwise public events only are received.
+ *  @param queueDepth       Maximum number of events waiting for the handler, 0 for unbounded
+ *  @param overflowPolicy   What to do with a new event when the queue is full: drop oldest/newest, coalesce per device and event name or block the stream
+ *  @param eventHandler     Event handler function that accepts the event payload dictionary and an NSError object in case of an error
+ *  @return eventListenerID function will return an id type object as the eventListener registration unique ID - keep and pass this object to the unsubscribe method in order to remove this event listener
+ */
+-(nullable id)subscribeToDeviceEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                       deviceID:(NSString *)deviceID
+                                     queueDepth:(NSUInteger)queueDepth
+                                 overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy
+                                        handler:(nullable ParticleEventHandler)eventHandler;
+
+/**
+ *  Get delivery counters of an event subscription: queued, delivered, dropped and coalesced events
+ *
+ *  @param eventListenerID The eventListener registration unique ID returned by the subscribe method
+ *  @return subscription stats snapshot, nil if no such subscription
+ */
+-(nullable ParticleEventSubscriptionStats *)statsForEventListenerID:(id)eventListenerID;
+
+/**
+ *  Get conditional request counters of the device list and device details requests: cache hit ratio and bytes saved
+ *
+ *  @return counters snapshot since the cloud instance was created
+ */
+-(ParticleDeviceRequestCacheStats *)deviceRequestCacheStats;
+
+/**
+ *  Journal every event matching an event subscription to disk as it arrives, for replay later (see ParticleEventJournal).
+ *  Events are journaled before they enter the subscription delivery queue, so events the overflow policy drops are journaled too.
+ *
+ *  @param journal          Journal to append to, nil to stop journaling. A journal can be shared by several subscriptions.
+ *  @param eventListenerID  The eventListener registration unique ID returned by the subscribe method
+ *  @return NO if no such subscription
+ */
+-(BOOL)setEventJournal:(nullable ParticleEventJournal *)journal forEventListenerID:(id)eventListenerID;
+
 // ADD: subscribe to product events...
 
 /**
- *  Unsubscribe from event/events.
+ *  Unsubscribe from event/events. All subscriptions share the underlying event streams, a stream is closed once no subscription uses it anymore.
  *
  *  @param eventListenerID The eventListener registration unique ID returned by the subscribe method which you want to cancel
  */
@@ -335,6 +547,9 @@ extern NSString *const kParticleAPIBaseURL;
                                    completion:(nullable ParticleCompletionBlock)completion;
 
 
+// Internal use
+-(AFHTTPSessionManager *)__sessionManager;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -11,57 +11,249 @@
 #import "ParticleSession.h"
 //#import "ParticleUser.h"
 #import <AFNetworking/AFNetworking.h>
-#import <EventSource.h>
 #import "ParticleEvent.h"
+#import "ParticleEventMultiplexer.h"
+#import "ParticleJSON.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
 #define GLOBAL_API_TIMEOUT_INTERVAL     31.0f
+#define DEFAULT_MAX_CONCURRENT_DEVICE_REQUESTS  6
+#define DEFAULT_MAX_CONNECTIONS_PER_HOST        4
 
 NSString *const kParticleAPIBaseURL = @"https://api.particle.io";
-NSString *const kEventListenersDictEventSourceKey = @"eventSource";
-NSString *const kEventListenersDictHandlerKey = @"eventHandler";
-NSString *const kEventListenersDictIDKey = @"id";
 
 static NSString *const kDefaultoAuthClientId = @"particle";
 static NSString *const kDefaultoAuthClientSecret = @"particle";
 
+@implementation ParticleDeviceRequestCacheStats
+
+-(instancetype)initWithRequestCount:(NSUInteger)requestCount
+                  revalidationCount:(NSUInteger)revalidationCount
+                   notModifiedCount:(NSUInteger)notModifiedCount
+                      bytesReceived:(unsigned long long)bytesReceived
+                         bytesSaved:(unsigned long long)bytesSaved
+{
+    if (self = [super init])
+    {
+        _requestCount = requestCount;
+        _revalidationCount = revalidationCount;
+        _notModifiedCount = notModifiedCount;
+        _bytesReceived = bytesReceived;
+        _bytesSaved = bytesSaved;
+    }
+
+    return self;
+}
+
+-(double)hitRatio
+{
+    return (self.requestCount > 0) ? (double)self.notModifiedCount / self.requestCount : 0;
+}
+
+-(NSString *)description
+{
+    return [NSString stringWithFormat:@"<DeviceRequestCacheStats: requests: %lu, revalidated: %lu, not modified: %lu (%.0f%%), received: %llu bytes, saved: %llu bytes>",
+            (unsigned long)self.requestCount, (unsigned long)self.revalidationCount, (unsigned long)self.notModifiedCount, self.hitRatio * 100.0, self.bytesReceived, self.bytesSaved];
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// GET whose JSON array response is handed out element by element as it downloads - AFNetworking keeps whole response
+// bodies in memory until the request completes. Bodies of failed responses are kept for the error.
+@interface ParticleCloudStreamTask : NSObject
+
+@property (nonatomic, strong) ParticleJSONArrayParser *parser;
+@property (nonatomic, strong, nullable) NSHTTPURLResponse *response;
+@property (nonatomic, strong, nullable) NSMutableData *errorData;
+@property (nonatomic, copy) void (^completion)(ParticleCloudStreamTask *completedTask, NSError * _Nullable error); // on the stream queue
+
+@end
+
+@implementation ParticleCloudStreamTask
+@end
+
+// Routes session callbacks to the stream task of each data task. Separate from ParticleCloud because
+// NSURLSession retains its delegate until invalidated.
+@interface ParticleCloudStreamDelegate : NSObject <NSURLSessionDataDelegate>
+
+@property (nonatomic, strong) NSMapTable<NSURLSessionTask *, ParticleCloudStreamTask *> *streamTasks;
+
+@end
+
+@implementation ParticleCloudStreamDelegate
+
+-(instancetype)init
+{
+    if (self = [super init])
+    {
+        _streamTasks = [NSMapTable strongToStrongObjectsMapTable];
+    }
+    return self;
+}
+
+-(void)addStreamTask:(ParticleCloudStreamTask *)streamTask forTask:(NSURLSessionTask *)task
+{
+    @synchronized (self) {
+        [self.streamTasks setObject:streamTask forKey:task];
+    }
+}
+
+-(nullable ParticleCloudStreamTask *)streamTaskForTask:(NSURLSessionTask *)task
+{
+    @synchronized (self) {
+        return [self.streamTasks objectForKey:task];
+    }
+}
+
+-(void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition disposition))completionHandler
+{
+    ParticleCloudStreamTask *streamTask = [self streamTaskForTask:dataTask];
+    streamTask.response = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+    if ((streamTask.response.statusCode < 200) || (streamTask.response.statusCode > 299))
+    {
+        streamTask.errorData = [NSMutableData new];
+    }
+    completionHandler(streamTask ? NSURLSessionResponseAllow : NSURLSessionResponseCancel);
+}
+
+-(void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data
+{
+    ParticleCloudStreamTask *streamTask = [self streamTaskForTask:dataTask];
+    if (streamTask.errorData)
+    {
+        [streamTask.errorData appendData:data];
+    }
+    else if (![streamTask.parser parseData:data])
+    {
+        [dataTask cancel]; // not a JSON array, completes with the parser failed
+    }
+}
+
+-(void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(nullable NSError *)error
+{
+    ParticleCloudStreamTask *streamTask;
+    @synchronized (self) {
+        streamTask = [self.streamTasks objectForKey:task];
+        [self.streamTasks removeObjectForKey:task];
+    }
+    streamTask.completion(streamTask, error);
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// devices of a /v1/devices listing, built up as the listed devices are processed
+@interface ParticleDeviceListing : NSObject
+
+@property (nonatomic, strong) NSMutableArray<NSData *> *elements;              // JSON of each listed device, becomes the registry listing
+@property (nonatomic, strong) NSMutableArray<ParticleDevice *> *queryDeviceList; // listed online devices to query the details of
+@property (nonatomic, strong) NSMutableSet<NSString *> *listedDeviceIDs;
+@property (nonatomic, strong) NSMutableArray<ParticleDevice *> *deviceList;
+
+@end
+
+@implementation ParticleDeviceListing
+
+-(instancetype)init
+{
+    if (self = [super init])
+    {
+        _elements = [NSMutableArray new];
+        _queryDeviceList = [NSMutableArray new];
+        _listedDeviceIDs = [NSMutableSet new];
+        _deviceList = [NSMutableArray new];
+    }
+    return self;
+}
+
+@end
+
+// id and connected fields of a listed device, without decoding the rest of it. nil for the <null> device listings
+// that sometimes come from the /v1/devices API call.
+static NSString * _Nullable ParticleListedDeviceID(NSData *element, BOOL *connected)
+{
+    __block NSString *deviceID = nil;
+    __block BOOL deviceConnected = NO;
+    ParticleJSONValue object;
+    if ((ParticleJSONScanValue(element.bytes, element.length, &object) == 0) || (object.type != ParticleJSONTypeObject))
+    {
+        return nil;
+    }
+    ParticleJSONEnumerateObject(object, ^(ParticleJSONValue key, ParticleJSONValue value, BOOL *stop) {
+        if ((key.length == 2) && (memcmp(key.bytes, "id", 2) == 0))
+        {
+            deviceID = ParticleJSONString(value);
+        }
+        else if ((key.length == 9) && (memcmp(key.bytes, "connected", 9) == 0))
+        {
+            id connectedValue = ParticleJSONObject(value);
+            deviceConnected = ([connectedValue isKindOfClass:[NSNumber class]] || [connectedValue isKindOfClass:[NSString class]]) && ([connectedValue boolValue]);
+        }
+    });
+    *connected = deviceConnected;
+    return deviceID;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
 @interface ParticleCloud () <ParticleSessionDelegate>
 
-@property (nonatomic, strong, nonnull) NSURL* baseURL;
+@property (nonatomic, strong, nonnull, readwrite) NSURL* baseURL;
 @property (nonatomic, strong, nullable) ParticleSession* session;
+@property (nonatomic) BOOL persistentSession;                                   // session kept in the keychain, sharedInstance only
 //@property (nonatomic, strong, nullable) ParticleUser* user;
 @property (nonatomic, strong, nonnull) AFHTTPSessionManager *manager;
+@property (nonatomic, strong, nonnull) NSURLSession *streamSession;             // device listings, see ParticleCloudStreamTask
+@property (nonatomic, strong, nonnull) ParticleCloudStreamDelegate *streamDelegate;
 
-@property (nonatomic, strong, nonnull) NSMutableDictionary *eventListenersDict;
+@property (nonatomic, strong, nonnull) ParticleEventMultiplexer *eventMultiplexer;
 
-@property (nonatomic, strong) NSMapTable *devicesMapTable;
+@property (nonatomic, strong, nonnull) ParticleDeviceRegistry *deviceRegistry;
 @property (nonatomic, strong) id systemEventsListenerId;
 @end
 
 
-@implementation ParticleCloud
+@implementation ParticleCloud {
+    // device list/details conditional request counters, guarded by self
+    NSUInteger _deviceRequestCount;
+    NSUInteger _deviceRevalidationCount;
+    NSUInteger _deviceNotModifiedCount;
+    unsigned long long _deviceBytesReceived;
+    unsigned long long _deviceBytesSaved;
+}
 
 #pragma mark Class initialization and singleton instancing
 
 + (instancetype)sharedInstance;
 {
-    // TODO: no singleton, initializer gets: CloudConnection, CloudEndpoint (URL) to allow private cloud, dependency injection
+    // other cloud endpoints (private cloud, mock cloud) use their own instance - see initWithBaseURL:sessionConfiguration:
     static ParticleCloud *sharedInstance = nil;
     @synchronized(self) {
         if (sharedInstance == nil)
         {
             sharedInstance = [[self alloc] init];
+            // only the shared instance owns the keychain session, other instances must not log in with (or log out) its user
+            sharedInstance.persistentSession = YES;
+            [sharedInstance restoreSavedSession];
         }
     }
     return sharedInstance;
 }
 
 - (instancetype)init
+{
+    return [self initWithBaseURL:[NSURL URLWithString:kParticleAPIBaseURL] sessionConfiguration:nil];
+}
+
+-(nullable instancetype)initWithBaseURL:(NSURL *)baseURL sessionConfiguration:(nullable NSURLSessionConfiguration *)sessionConfiguration
 {
     self = [super init];
     if (self) {
-        self.baseURL = [NSURL URLWithString:kParticleAPIBaseURL];
+        self.baseURL = baseURL;
         if (!self.baseURL)
         {
             return nil;
@@ -72,32 +264,109 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
         self.oAuthClientId = kDefaultoAuthClientId;
         self.oAuthClientSecret = kDefaultoAuthClientSecret;
 
-        // try to restore session (user and access token)
-//        self.user = [[ParticleUser alloc] initWithSavedSession];
-        self.session = [[ParticleSession alloc] initWithSavedSession];
-        if (self.session)
-        {
-            self.session.delegate = self;
-        }
-        
-        // Init HTTP manager
-        self.manager = [[AFHTTPSessionManager alloc] initWithBaseURL:self.baseURL];
-        self.manager.responseSerializer = [AFJSONResponseSerializer serializer];
-        [self.manager.requestSerializer setTimeoutInterval:GLOBAL_API_TIMEOUT_INTERVAL];
+        // Init HTTP manager - shared with all ParticleDevice instances
+        _maxConnectionsPerHost = DEFAULT_MAX_CONNECTIONS_PER_HOST;
+        _sessionConfiguration = [sessionConfiguration copy] ?: [NSURLSessionConfiguration defaultSessionConfiguration];
+        [self resetSessionManager];
         if (!self.manager)
         {
             return nil;
         }
 
-        // init event listeners internal dictionary
-        self.eventListenersDict = [NSMutableDictionary new];
-        if (self.session.accessToken) {
-            [self subscribeToDevicesSystemEvents];
-        }
+        self.deviceRegistry = [ParticleDeviceRegistry new];
+        self.deviceRegistry.cloud = self;
+        NSURL *cachesURL = [[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask].firstObject;
+        self.deviceRegistry.snapshotURL = [[cachesURL URLByAppendingPathComponent:@"ParticleSDK"] URLByAppendingPathComponent:[NSString stringWithFormat:@"%@-devices.snapshot", self.baseURL.host ?: @"localhost"]];
+        self.maxConcurrentDeviceRequests = DEFAULT_MAX_CONCURRENT_DEVICE_REQUESTS;
+
+        // init event subscriptions multiplexer, all subscriptions share the streams it opens
+        self.eventMultiplexer = [[ParticleEventMultiplexer alloc] initWithBaseURL:self.baseURL sessionConfiguration:self.sessionConfiguration];
     }
     return self;
 }
 
+-(void)restoreSavedSession
+{
+    // try to restore session (user and access token)
+//    self.user = [[ParticleUser alloc] initWithSavedSession];
+    self.session = [[ParticleSession alloc] initWithSavedSession];
+    if (self.session)
+    {
+        self.session.delegate = self;
+    }
+    
+    if (self.session.accessToken) {
+        [self subscribeToDevicesSystemEvents];
+    }
+}
+
+
+#pragma mark Shared connection pool
+
+-(void)setMaxConnectionsPerHost:(NSUInteger)maxConnectionsPerHost
+{
+    _maxConnectionsPerHost = maxConnectionsPerHost;
+    [self resetSessionManager];
+}
+
+-(void)setSessionConfiguration:(nullable NSURLSessionConfiguration *)sessionConfiguration
+{
+    _sessionConfiguration = [sessionConfiguration copy] ?: [NSURLSessionConfiguration defaultSessionConfiguration];
+    [self resetSessionManager];
+    self.eventMultiplexer.sessionConfiguration = self.sessionConfiguration;
+}
+
+-(NSUInteger)maxServerFilteredEventStreams
+{
+    return self.eventMultiplexer.maxServerFilteredStreams;
+}
+
+-(void)setMaxServerFilteredEventStreams:(NSUInteger)maxServerFilteredEventStreams
+{
+    self.eventMultiplexer.maxServerFilteredStreams = maxServerFilteredEventStreams;
+}
+
+-(nullable NSURL *)deviceSnapshotURL
+{
+    return self.deviceRegistry.snapshotURL;
+}
+
+-(void)setDeviceSnapshotURL:(nullable NSURL *)deviceSnapshotURL
+{
+    self.deviceRegistry.snapshotURL = deviceSnapshotURL;
+}
+
+-(void)resetSessionManager
+{
+    NSURLSessionConfiguration *configuration = [self.sessionConfiguration copy];
+    configuration.HTTPMaximumConnectionsPerHost = MAX(self.maxConnectionsPerHost, 1);
+
+    AFHTTPSessionManager *manager = [[AFHTTPSessionManager alloc] initWithBaseURL:self.baseURL sessionConfiguration:configuration];
+    manager.responseSerializer = [AFJSONResponseSerializer serializer];
+    [manager.requestSerializer setTimeoutInterval:GLOBAL_API_TIMEOUT_INTERVAL];
+
+    AFHTTPSessionManager *previousManager = self.manager;
+    self.manager = manager;
+    [previousManager invalidateSessionCancelingTasks:NO]; // let requests in flight finish, releases the session afterwards
+
+    // one serial queue decodes the streamed responses
+    NSOperationQueue *streamQueue = [NSOperationQueue new];
+    streamQueue.maxConcurrentOperationCount = 1;
+    streamQueue.name = @"io.particle.cloud.stream";
+    if (!self.streamDelegate)
+    {
+        self.streamDelegate = [ParticleCloudStreamDelegate new];
+    }
+    NSURLSession *previousStreamSession = self.streamSession;
+    self.streamSession = [NSURLSession sessionWithConfiguration:configuration delegate:self.streamDelegate delegateQueue:streamQueue];
+    [previousStreamSession finishTasksAndInvalidate];
+}
+
+-(AFHTTPSessionManager *)__sessionManager
+{
+    return self.manager;
+}
+
 
 #pragma mark Getter functions
 
@@ -108,8 +377,8 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
 
 -(BOOL)injectSessionAccessToken:(NSString * _Nonnull)accessToken
 {
-    [self logout];
-    self.session = [[ParticleSession alloc] initWithToken:accessToken];
+    [self endSession];
+    self.session = [[ParticleSession alloc] initWithToken:accessToken expiryDate:nil refreshToken:nil persistent:self.persistentSession];
     if (self.session) {
         self.session.delegate = self;
         [self subscribeToDevicesSystemEvents];
@@ -119,8 +388,8 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
 
 -(BOOL)injectSessionAccessToken:(NSString *)accessToken withExpiryDate:(NSDate *)expiryDate
 {
-    [self logout];
-    self.session = [[ParticleSession alloc] initWithToken:accessToken andExpiryDate:expiryDate];
+    [self endSession];
+    self.session = [[ParticleSession alloc] initWithToken:accessToken expiryDate:expiryDate refreshToken:nil persistent:self.persistentSession];
     if (self.session) {
         self.session.delegate = self;
         [self subscribeToDevicesSystemEvents];
@@ -130,8 +399,8 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
 
 -(BOOL)injectSessionAccessToken:(NSString *)accessToken withExpiryDate:(NSDate *)expiryDate andRefreshToken:(nonnull NSString *)refreshToken
 {
-    [self logout];
-    self.session = [[ParticleSession alloc] initWithToken:accessToken withExpiryDate:expiryDate withRefreshToken:refreshToken];
+    [self endSession];
+    self.session = [[ParticleSession alloc] initWithToken:accessToken expiryDate:expiryDate refreshToken:refreshToken persistent:self.persistentSession];
     if (self.session) {
         self.session.delegate = self;
         [self subscribeToDevicesSystemEvents];
@@ -204,7 +473,7 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
         if (self.session.username)
             responseDict[@"username"] = self.session.username;
         
-        self.session = [[ParticleSession alloc] initWithNewSession:responseDict];
+        self.session = [[ParticleSession alloc] initWithNewSession:responseDict persistent:self.persistentSession];
         if (self.session) // login was successful
         {
 //            NSLog(@"New session created using refresh token");
@@ -244,7 +513,7 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
         NSMutableDictionary *responseDict = [responseObject mutableCopy];
 
         responseDict[@"username"] = user;
-        self.session = [[ParticleSession alloc] initWithNewSession:responseDict];
+        self.session = [[ParticleSession alloc] initWithNewSession:responseDict persistent:self.persistentSession];
         if (self.session) // login was successful
         {
             self.session.delegate = self;
@@ -386,7 +655,7 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
                                       
                                       responseDict[@"username"] = username;
                                       
-                                      self.session = [[ParticleSession alloc] initWithNewSession:responseDict];
+                                      self.session = [[ParticleSession alloc] initWithNewSession:responseDict persistent:self.persistentSession];
                                       
                                       if (self.session) // customer login was successful
                                       {
@@ -438,6 +707,15 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
 {
     [self.session removeSession];
     [self unsubscribeToDevicesSystemEvents];
+    [self.deviceRegistry removeAllDevices];
+}
+
+// session is about to be replaced - unlike logout the device snapshot stays for the next session, restored if it is the same user's
+-(void)endSession
+{
+    [self.deviceRegistry unloadAllDevices];
+    [self.session removeSession];
+    [self unsubscribeToDevicesSystemEvents];
 }
 
 -(NSURLSessionDataTask *)claimDevice:(NSString *)deviceID completion:(nullable ParticleCompletionBlock)completion
@@ -486,6 +764,13 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
 
 -(NSURLSessionDataTask *)getDevice:(NSString *)deviceID
                         completion:(nullable void (^)(ParticleDevice * _Nullable device, NSError * _Nullable error))completion
+{
+    return [self getDevice:deviceID validators:[self.deviceRegistry detailValidatorsForDeviceID:deviceID] completion:completion];
+}
+
+-(NSURLSessionDataTask *)getDevice:(NSString *)deviceID
+                        validators:(nullable NSDictionary *)validators
+                        completion:(nullable void (^)(ParticleDevice * _Nullable device, NSError * _Nullable error))completion
 {
     if (self.session.accessToken) {
         NSString *authorization = [NSString stringWithFormat:@"Bearer %@",self.session.accessToken];
@@ -493,156 +778,506 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
     }
 
     NSString *urlPath = [NSString stringWithFormat:@"/v1/devices/%@",deviceID];
-    
-    NSURLSessionDataTask *task = [self.manager GET:urlPath parameters:nil progress:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
+
+    NSURLSessionDataTask *task = [self conditionalGET:urlPath validators:validators completion:^(NSHTTPURLResponse * _Nullable serverResponse, id  _Nullable responseObject, NSDictionary * _Nullable newValidators, BOOL notModified, NSError * _Nullable error)
     {
-         if (completion)
-         {
-             NSMutableDictionary *responseDict = responseObject;
-             ParticleDevice *device = [[ParticleDevice alloc] initWithParams:responseDict];
-             
-             if (device) { // new 0.5.0 local storage of devices for reporting system events
-                 if (!self.devicesMapTable) {
-                     self.devicesMapTable = [NSMapTable mapTableWithKeyOptions:NSMapTableStrongMemory valueOptions:NSMapTableObjectPointerPersonality]; // let the user decide when to release ParticleDevice objects
-                 }
-                 [self.devicesMapTable setObject:device forKey:device.id];
-             }
-             
-             if (completion)
-             {
+        if (notModified)
+        {
+            // details unchanged - no new instance
+            ParticleDevice *device = [self.deviceRegistry revalidatedDeviceWithID:deviceID];
+            if (device)
+            {
+                if (completion)
+                {
+                    completion(device, nil);
+                }
+            }
+            else
+            {
+                // cached details were dropped while the request was out (e.g. logout) - nothing left to revalidate
+                [self getDevice:deviceID validators:nil completion:completion];
+            }
+            return;
+        }
+
+        if (!error)
+        {
+            NSMutableDictionary *responseDict = responseObject;
+            ParticleDevice *device = [[ParticleDevice alloc] initWithParams:responseDict cloud:self];
+
+            if (device) { // new 0.5.0 local storage of devices for reporting system events
+                [self.deviceRegistry setDevice:device detailParams:responseDict validators:newValidators];
+            }
+
+            if (completion)
+            {
                 completion(device, nil);
-             }
-             
-         }
-    } failure:^(NSURLSessionDataTask * _Nullable task, NSError * _Nonnull error)
-    {
-         // check type of error?
-        
-        NSHTTPURLResponse *serverResponse = (NSHTTPURLResponse *)task.response;
+            }
+            return;
+        }
+
+        // check type of error?
         if (completion)
         {
             completion(nil, [NSError errorWithDomain:error.domain code:serverResponse.statusCode userInfo:error.userInfo]);
         }
-        
+
         NSData *errorData = error.userInfo[AFNetworkingOperationFailingURLResponseDataErrorKey];
         if (errorData)
         {
             NSDictionary *serializedFailedBody = [NSJSONSerialization JSONObjectWithData:errorData options:kNilOptions error:nil];
-            NSLog(@"! getDevice %@ Failed (status code %d): %@",task.originalRequest.URL,(int)serverResponse.statusCode,serializedFailedBody);
+            NSLog(@"! getDevice %@ Failed (status code %d): %@",serverResponse.URL,(int)serverResponse.statusCode,serializedFailedBody);
         }
     }];
-    
+
     return task;
 }
 
 
 -(NSURLSessionDataTask *)getDevices:(nullable void (^)(NSArray<ParticleDevice *> * _Nullable particleDevices, NSError * _Nullable error))completion
+{
+    return [self getDevicesWithProgress:nil completion:completion];
+}
+
+
+-(NSURLSessionDataTask *)getDevicesWithProgress:(nullable void (^)(ParticleDevice *device))progress
+                                     completion:(nullable void (^)(NSArray<ParticleDevice *> * _Nullable particleDevices, NSError * _Nullable error))completion
 {
     if (self.session.accessToken) {
         NSString *authorization = [NSString stringWithFormat:@"Bearer %@", self.session.accessToken];
         [self.manager.requestSerializer setValue:authorization forHTTPHeaderField:@"Authorization"];
     }
-    
-    NSURLSessionDataTask *task = [self.manager GET:@"/v1/devices" parameters:nil progress:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
-    {
-        
-         if (completion)
-         {
-             
-             NSArray *responseList = responseObject;
-             NSMutableArray *queryDeviceIDList = [[NSMutableArray alloc] init];
-             __block NSMutableArray *deviceList = [[NSMutableArray alloc] init];
-             __block NSError *deviceError = nil;
-             // analyze
-             for (NSDictionary *deviceDict in responseList)
-             {
-                 if (deviceDict[@"id"])   // ignore <null> device listings that sometimes return from /v1/devices API call
-                 {
-                     if (![deviceDict[@"id"] isKindOfClass:[NSNull class]])
-                     {
-                         if ([deviceDict[@"connected"] boolValue]==YES) // do inquiry only for online devices (otherwise we waste time on request timeouts and get no new info)
-                         {
-                             // if it's online then add it to the query list so we can get additional information about it
-                             [queryDeviceIDList addObject:deviceDict[@"id"]];
-                         }
-                         else
-                         {
-                             // if it's offline just make an instance for it with the limited data with have
-                             ParticleDevice *device = [[ParticleDevice alloc] initWithParams:deviceDict];
-                             [deviceList addObject:device];
-                             
-                             if (device) { // new 0.5.0 local storage of devices for reporting system events
-                                 if (!self.devicesMapTable) {
-                                     self.devicesMapTable = [NSMapTable mapTableWithKeyOptions:NSMapTableStrongMemory valueOptions:NSMapTableObjectPointerPersonality]; // let the user decide when to release ParticleDevice objects
-                                 }
-                                 [self.devicesMapTable setObject:device forKey:device.id];
-                             }
-
-                         }
-                     }
-                     
-                 }
-             }
-             
-             // iterate thru deviceList and create ParticleDevice instances through query
-             __block dispatch_group_t group = dispatch_group_create();
-             
-             for (NSString *deviceID in queryDeviceIDList)
-             {
-                 dispatch_group_enter(group);
-                 [self getDevice:deviceID completion:^(ParticleDevice *device, NSError *error) {
-                     if ((!error) && (device))
-                         [deviceList addObject:device];
-                     
-                     if ((error) && (!deviceError)) // if there wasn't an error before cache it
-                         deviceError = error;
-                     
-                     dispatch_group_leave(group);
-                 }];
-             }
-             
-             // call user's completion block on main thread after all concurrent GET requests finished and ParticleDevice instances created
-             dispatch_group_notify(group, dispatch_get_main_queue(), ^{
-                 if (completion)
-                 {
-                     if (deviceError && (deviceList.count==0)) // empty list? error? report it
-                     {
-                         completion(nil, deviceError);
-                     }
-                     else if (deviceList.count > 0)  // if some devices reported error but some not, then return at least the ones that didn't report error, ditch error
-                     {
-                         completion(deviceList, nil);
-                     }
-                     else
-                     {
-                         completion(nil, nil);
-                     }
-                 }
-             });
-             
-             
-             
-         }
-    } failure:^(NSURLSessionDataTask * _Nullable task, NSError * _Nonnull error)
+
+    // revalidate the listing the registry already has (last fetched or restored from the snapshot)
+    NSDictionary *validators = [self.deviceRegistry listingValidators];
+
+    // devices are created as their JSON arrives, only the bytes of the device being received are buffered
+    ParticleDeviceListing *listing = [ParticleDeviceListing new];
+    NSURLSessionDataTask *task = [self conditionalGET:@"/v1/devices" validators:validators elementHandler:^(NSData *element) {
+        [listing.elements addObject:element];
+        [self addListedDevice:element toListing:listing notModified:NO progress:progress];
+    } completion:^(NSHTTPURLResponse * _Nullable serverResponse, NSDictionary * _Nullable newValidators, BOOL notModified, NSError * _Nullable error)
     {
+        if (notModified)
+        {
+            for (NSData *element in [self.deviceRegistry listing])
+            {
+                [self addListedDevice:element toListing:listing notModified:YES progress:progress];
+            }
+        }
+        else if (!error)
+        {
+            [self.deviceRegistry setListing:listing.elements validators:newValidators];
+        }
+
+        if ((notModified) || (!error))
+        {
+            [self finishDeviceListing:listing progress:progress completion:completion];
+            return;
+        }
+
         // check type of error?
-        NSHTTPURLResponse *serverResponse = (NSHTTPURLResponse *)task.response;
         if (completion)
         {
             completion(nil, [NSError errorWithDomain:error.domain code:serverResponse.statusCode userInfo:error.userInfo]);
         }
-        
+
         NSData *errorData = error.userInfo[AFNetworkingOperationFailingURLResponseDataErrorKey];
         if (errorData)
         {
             NSDictionary *serializedFailedBody = [NSJSONSerialization JSONObjectWithData:errorData options:kNilOptions error:nil];
-            NSLog(@"! getDevices %@ Failed (status code %d): %@",task.originalRequest.URL,(int)serverResponse.statusCode,serializedFailedBody);
+            NSLog(@"! getDevices %@ Failed (status code %d): %@",serverResponse.URL,(int)serverResponse.statusCode,serializedFailedBody);
         }
     }];
-    
+
+    return task;
+}
+
+// create the device of a /v1/devices listing element unless it is online and the registry has no valid details of it -
+// those are queried by finishDeviceListing:. An unchanged listing (notModified) reuses the registry devices created from it.
+// Called on the stream queue while the listing downloads, progress is called on the main thread.
+-(void)addListedDevice:(NSData *)element
+             toListing:(ParticleDeviceListing *)listing
+           notModified:(BOOL)notModified
+              progress:(nullable void (^)(ParticleDevice *device))progress
+{
+    BOOL connected = NO;
+    NSString *deviceID = ParticleListedDeviceID(element, &connected);
+    if (!deviceID)
+    {
+        return;
+    }
+    [listing.listedDeviceIDs addObject:deviceID];
+
+    NSDictionary *cachedParams = nil;
+    if (connected) // do inquiry only for online devices (otherwise we waste time on request timeouts and get no new info)
+    {
+        // skip the inquiry if the registry has details that no system event invalidated since
+        cachedParams = [self.deviceRegistry cachedDetailParamsForListedDeviceID:deviceID];
+        if (!cachedParams)
+        {
+            // if it's online then add it to the query list so we can get additional information about it
+            ParticleDevice *listedDevice = [[ParticleDevice alloc] initWithJSONData:element cloud:self];
+            if (listedDevice)
+            {
+                [listing.queryDeviceList addObject:listedDevice];
+            }
+            return;
+        }
+    }
+
+    ParticleDevice *device = notModified ? [self.deviceRegistry deviceWithID:deviceID] : nil;
+    if (!device)
+    {
+        // if it's offline (or unchanged) just make an instance for it with the data we have - the listing is newer than
+        // the cached details for everything but the function and variable lists it does not include
+        device = [[ParticleDevice alloc] initWithJSONData:element cloud:self];
+        if ((device) && (cachedParams))
+        {
+            [device __setFunctionsAndVariablesWithDetailParams:cachedParams];
+            [self.deviceRegistry setDevice:device params:cachedParams detailed:YES];
+        }
+        else if (device)
+        {
+            [self.deviceRegistry setDevice:device paramsJSON:element];
+        }
+    }
+
+    if (device)
+    {
+        [listing.deviceList addObject:device];
+        if (progress)
+        {
+            if ([NSThread isMainThread])
+            {
+                progress(device);
+            }
+            else
+            {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    progress(device);
+                });
+            }
+        }
+    }
+}
+
+// listing complete - query details of the online devices that need them, then complete with all devices
+-(void)finishDeviceListing:(ParticleDeviceListing *)listing
+                  progress:(nullable void (^)(ParticleDevice *device))progress
+                completion:(nullable void (^)(NSArray<ParticleDevice *> * _Nullable particleDevices, NSError * _Nullable error))completion
+{
+    NSMutableArray<ParticleDevice *> *queryDeviceList = listing.queryDeviceList;
+    NSMutableSet *listedDeviceIDs = listing.listedDeviceIDs;
+    NSMutableArray *deviceList = listing.deviceList;
+    __block NSError *deviceError = nil;
+
+    // devices missing from the listing are no longer claimed by the user
+    [self.deviceRegistry retainOnlyDevicesWithIDs:listedDeviceIDs];
+
+    // most recently active devices first - both for the query order and the results
+    NSComparator lastHeardDescending = ^NSComparisonResult(NSDate * _Nullable lastHeard1, NSDate * _Nullable lastHeard2) {
+        if (lastHeard1 == lastHeard2) return NSOrderedSame;
+        if (!lastHeard1) return NSOrderedDescending;
+        if (!lastHeard2) return NSOrderedAscending;
+        return [lastHeard2 compare:lastHeard1];
+    };
+    NSComparator deviceLastHeardDescending = ^NSComparisonResult(ParticleDevice *device1, ParticleDevice *device2) {
+        return lastHeardDescending(device1.lastHeard, device2.lastHeard);
+    };
+    [queryDeviceList sortUsingComparator:deviceLastHeardDescending];
+    [deviceList sortUsingComparator:deviceLastHeardDescending];
+
+    // call user's completion block on main thread after all GET requests finished and ParticleDevice instances created
+    void (^finish)(void) = ^{
+        [deviceList sortUsingComparator:deviceLastHeardDescending];
+        if (completion)
+        {
+            if (deviceError && (deviceList.count==0)) // empty list? error? report it
+            {
+                completion(nil, deviceError);
+            }
+            else if (deviceList.count > 0)  // if some devices reported error but some not, then return at least the ones that didn't report error, ditch error
+            {
+                completion(deviceList, nil);
+            }
+            else
+            {
+                completion(nil, nil);
+            }
+        }
+    };
+
+    if (queryDeviceList.count == 0)
+    {
+        finish();
+        return;
+    }
+
+    // query online devices at most maxConcurrentDeviceRequests at a time, each finished request starts the next one
+    // (request completion blocks run on the main queue, so the counters below are not shared between threads)
+    NSUInteger maxConcurrentRequests = (self.maxConcurrentDeviceRequests > 0) ? self.maxConcurrentDeviceRequests : queryDeviceList.count;
+    __block NSUInteger nextQueryIndex = 0;
+    __block NSUInteger pendingQueries = queryDeviceList.count;
+    __block void (^queryNextDevice)(void);
+    queryNextDevice = ^{
+        if (nextQueryIndex >= queryDeviceList.count)
+        {
+            return;
+        }
+        NSString *deviceID = queryDeviceList[nextQueryIndex++].id;
+        [self getDevice:deviceID completion:^(ParticleDevice *device, NSError *error) {
+            if ((!error) && (device))
+            {
+                [deviceList addObject:device];
+                if (progress)
+                {
+                    progress(device);
+                }
+            }
+
+            if ((error) && (!deviceError)) // if there wasn't an error before cache it
+                deviceError = error;
+
+            if (--pendingQueries == 0)
+            {
+                queryNextDevice = nil; // break the block retain cycle
+                finish();
+            }
+            else
+            {
+                queryNextDevice();
+            }
+        }];
+    };
+
+    for (NSUInteger i = 0; i < MIN(maxConcurrentRequests, queryDeviceList.count); i++)
+    {
+        queryNextDevice();
+    }
+}
+
+
+
+// GET revalidating a cached response with its validators (ETag, Last-Modified and size, nil if nothing cached), completion reports
+// notModified if the cached response is still valid, otherwise the response with its validators (nil if the server sent none)
+-(NSURLSessionDataTask *)conditionalGET:(NSString *)path
+                             validators:(nullable NSDictionary *)validators
+                             completion:(void (^)(NSHTTPURLResponse * _Nullable serverResponse, id _Nullable responseObject, NSDictionary * _Nullable newValidators, BOOL notModified, NSError * _Nullable error))completion
+{
+    NSMutableURLRequest *request = [self conditionalRequestForPath:path validators:validators];
+
+    __block NSURLSessionDataTask *task = [self.manager dataTaskWithRequest:request completionHandler:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject, NSError * _Nullable error)
+    {
+        NSHTTPURLResponse *serverResponse = [response isKindOfClass:[NSHTTPURLResponse class]] ? (NSHTTPURLResponse *)response : nil;
+        BOOL notModified = NO;
+        NSDictionary *newValidators = [self countConditionalResponse:serverResponse validators:validators bytesReceived:task.countOfBytesReceived error:error notModified:&notModified];
+        task = nil;
+
+        completion(serverResponse, notModified ? nil : responseObject, newValidators, notModified, error);
+    }];
+    [task resume];
+
+    return task;
+}
+
+// conditionalGET:validators:completion: of a JSON array, elementHandler is called with the JSON of each array element as soon as it
+// downloads (on the stream queue). The response body is never held in memory as a whole.
+-(NSURLSessionDataTask *)conditionalGET:(NSString *)path
+                             validators:(nullable NSDictionary *)validators
+                         elementHandler:(void (^)(NSData *element))elementHandler
+                             completion:(void (^)(NSHTTPURLResponse * _Nullable serverResponse, NSDictionary * _Nullable newValidators, BOOL notModified, NSError * _Nullable error))completion
+{
+    NSMutableURLRequest *request = [self conditionalRequestForPath:path validators:validators];
+
+    ParticleCloudStreamTask *streamTask = [ParticleCloudStreamTask new];
+    streamTask.parser = [ParticleJSONArrayParser new];
+    streamTask.parser.elementHandler = elementHandler;
+    __block NSURLSessionDataTask *task = [self.streamSession dataTaskWithRequest:request];
+    streamTask.completion = ^(ParticleCloudStreamTask *completedTask, NSError * _Nullable error) {
+        NSHTTPURLResponse *serverResponse = completedTask.response;
+        NSMutableDictionary *userInfo = [NSMutableDictionary new];
+        userInfo[NSURLErrorFailingURLErrorKey] = serverResponse.URL;
+        userInfo[AFNetworkingOperationFailingURLResponseErrorKey] = serverResponse;
+
+        // same errors AFNetworking reports for unacceptable status codes and undecodable bodies
+        if ((!error) && (completedTask.errorData))
+        {
+            userInfo[NSLocalizedDescriptionKey] = [NSString stringWithFormat:@"Request failed: %@ (%ld)", [NSHTTPURLResponse localizedStringForStatusCode:serverResponse.statusCode], (long)serverResponse.statusCode];
+            userInfo[AFNetworkingOperationFailingURLResponseDataErrorKey] = completedTask.errorData;
+            error = [NSError errorWithDomain:AFURLResponseSerializationErrorDomain code:NSURLErrorBadServerResponse userInfo:userInfo];
+        }
+        else if ((completedTask.parser.failed) || ((!error) && (!completedTask.parser.finished)))
+        {
+            userInfo[NSLocalizedDescriptionKey] = @"Request failed: response is not a JSON array";
+            error = [NSError errorWithDomain:AFURLResponseSerializationErrorDomain code:NSURLErrorCannotDecodeContentData userInfo:userInfo];
+        }
+
+        BOOL notModified = NO;
+        NSDictionary *newValidators = [self countConditionalResponse:serverResponse validators:validators bytesReceived:task.countOfBytesReceived error:error notModified:&notModified];
+        task = nil;
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completion(serverResponse, newValidators, notModified, notModified ? nil : error);
+        });
+    };
+    [self.streamDelegate addStreamTask:streamTask forTask:task];
+    [task resume];
+
     return task;
 }
 
+-(NSMutableURLRequest *)conditionalRequestForPath:(NSString *)path validators:(nullable NSDictionary *)validators
+{
+    NSMutableURLRequest *request = [self.manager.requestSerializer requestWithMethod:@"GET" URLString:[NSURL URLWithString:path relativeToURL:self.manager.baseURL].absoluteString parameters:nil error:nil];
+    request.cachePolicy = NSURLRequestReloadIgnoringLocalCacheData; // 304s must reach us, not be answered from the URL cache
+    if (self.accessToken)
+    {
+        // not left to the shared serializer, a concurrent login clears its Authorization header
+        [request setValue:[NSString stringWithFormat:@"Bearer %@", self.accessToken] forHTTPHeaderField:@"Authorization"];
+    }
+    if (validators[@"ETag"])
+    {
+        [request setValue:validators[@"ETag"] forHTTPHeaderField:@"If-None-Match"];
+    }
+    if (validators[@"Last-Modified"])
+    {
+        [request setValue:validators[@"Last-Modified"] forHTTPHeaderField:@"If-Modified-Since"];
+    }
+    return request;
+}
+
+// update the device request counters with a conditional request response, returns the validators of the response
+-(nullable NSDictionary *)countConditionalResponse:(nullable NSHTTPURLResponse *)serverResponse
+                                        validators:(nullable NSDictionary *)validators
+                                     bytesReceived:(int64_t)countOfBytesReceived
+                                             error:(nullable NSError *)error
+                                       notModified:(BOOL *)notModified
+{
+    BOOL revalidation = ((validators[@"ETag"]) || (validators[@"Last-Modified"]));
+    *notModified = (revalidation) && (serverResponse.statusCode == 304);
+    unsigned long long bytesReceived = (unsigned long long)MAX(countOfBytesReceived, 0);
+
+    NSMutableDictionary *newValidators = nil;
+    NSString *etag = serverResponse.allHeaderFields[@"ETag"];
+    NSString *lastModified = serverResponse.allHeaderFields[@"Last-Modified"];
+    if ((!error) && ((etag) || (lastModified)))
+    {
+        newValidators = [@{@"Content-Length" : @(bytesReceived)} mutableCopy];
+        newValidators[@"ETag"] = etag;
+        newValidators[@"Last-Modified"] = lastModified;
+    }
+
+    @synchronized (self) {
+        _deviceRequestCount++;
+        _deviceRevalidationCount += revalidation;
+        _deviceNotModifiedCount += *notModified;
+        _deviceBytesReceived += bytesReceived;
+        _deviceBytesSaved += *notModified ? [validators[@"Content-Length"] unsignedLongLongValue] : 0;
+    }
+
+    return newValidators;
+}
+
+-(void)callFunction:(NSString *)functionName
+      withArguments:(nullable NSArray *)args
+        onDeviceIDs:(NSArray<NSString *> *)deviceIDs
+ maxConcurrentCalls:(NSUInteger)maxConcurrentCalls
+            timeout:(NSTimeInterval)timeout
+           progress:(nullable void (^)(ParticleFunctionCallResult *result))progress
+         completion:(nullable void (^)(ParticleFunctionCallSummary * _Nullable summary, NSError * _Nullable error))completion
+{
+    // same arguments for every device - validate them once
+    NSError *argumentError = nil;
+    NSString *argument = [ParticleDevice __functionArgumentWithArguments:args error:&argumentError];
+    NSArray<NSString *> *callDeviceIDs = [NSOrderedSet orderedSetWithArray:deviceIDs].array;
+    NSMutableArray<ParticleFunctionCallResult *> *results = [NSMutableArray arrayWithCapacity:callDeviceIDs.count];
+    NSTimeInterval startTime = [NSProcessInfo processInfo].systemUptime;
+
+    if ((argumentError) || (callDeviceIDs.count == 0))
+    {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (completion)
+            {
+                completion(argumentError ? nil : [[ParticleFunctionCallSummary alloc] initWithResults:results duration:0], argumentError);
+            }
+        });
+        return;
+    }
+
+    // call at most maxConcurrentCalls devices at a time, each finished call starts the next one
+    // (calls are started, completed and timed out on the main queue, so the counters below are not shared between threads)
+    NSUInteger maxCalls = (maxConcurrentCalls > 0) ? maxConcurrentCalls : callDeviceIDs.count;
+    __block NSUInteger nextCallIndex = 0;
+    __block NSUInteger pendingCalls = callDeviceIDs.count;
+    __block void (^callNextDevice)(void);
+    callNextDevice = ^{
+        if (nextCallIndex >= callDeviceIDs.count)
+        {
+            return;
+        }
+        NSString *deviceID = callDeviceIDs[nextCallIndex++];
+        ParticleDevice *device = [self.deviceRegistry deviceWithID:deviceID] ?: [[ParticleDevice alloc] initWithParams:@{@"id" : deviceID} cloud:self];
+        NSTimeInterval callStartTime = [NSProcessInfo processInfo].systemUptime;
+
+        __block BOOL finished = NO;
+        void (^finishCall)(NSNumber * _Nullable, NSError * _Nullable, BOOL) = ^(NSNumber * _Nullable returnValue, NSError * _Nullable error, BOOL timedOut) {
+            if (finished) // cancelled call reporting back after its timeout
+            {
+                return;
+            }
+            finished = YES;
+
+            ParticleFunctionCallResult *result = [[ParticleFunctionCallResult alloc] initWithDeviceID:deviceID
+                                                                                          returnValue:returnValue
+                                                                                                error:error
+                                                                                             timedOut:timedOut
+                                                                                              latency:[NSProcessInfo processInfo].systemUptime - callStartTime];
+            [results addObject:result];
+            if (progress)
+            {
+                progress(result);
+            }
+
+            if (--pendingCalls == 0)
+            {
+                callNextDevice = nil; // break the block retain cycle
+                if (completion)
+                {
+                    completion([[ParticleFunctionCallSummary alloc] initWithResults:results duration:[NSProcessInfo processInfo].systemUptime - startTime], nil);
+                }
+            }
+            else
+            {
+                callNextDevice();
+            }
+        };
+
+        NSURLSessionDataTask *task = [device __callFunction:functionName argument:argument completion:^(NSNumber * _Nullable returnValue, NSError * _Nullable error) {
+            finishCall(returnValue, error, NO);
+        }];
+
+        if (timeout > 0)
+        {
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+                if (!finished)
+                {
+                    [task cancel];
+                    finishCall(nil, [self makeErrorWithDescription:@"Function call timed out" code:1011], YES);
+                }
+            });
+        }
+    };
+
+    // start the calls on the main queue too, so the counters are never touched by the calling thread
+    dispatch_async(dispatch_get_main_queue(), ^{
+        for (NSUInteger i = 0; i < MIN(maxCalls, callDeviceIDs.count); i++)
+        {
+            callNextDevice();
+        }
+    });
+}
+
 
 
 -(NSURLSessionDataTask *)generateClaimCode:(nullable void(^)(NSString * _Nullable claimCode, NSArray * _Nullable userClaimedDeviceIDs, NSError * _Nullable error))completion
@@ -866,148 +1501,157 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
 
 #pragma mark Events subsystem implementation
 
--(nullable id)subscribeToEventWithURL:(NSURL *)url handler:(nullable ParticleEventHandler)eventHandler
+-(nullable id)subscribeToPath:(NSString *)path
+               eventNamePrefix:(nullable NSString *)eventNamePrefix
+                      deviceID:(nullable NSString *)deviceID
+                serverFiltered:(BOOL)serverFiltered
+                    queueDepth:(NSUInteger)queueDepth
+                overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy
+                       handler:(nullable ParticleEventHandler)eventHandler
 {
     if (!self.accessToken)
     {
-        eventHandler(nil, [self makeErrorWithDescription:@"No active access token" code:1008]);
+        if (eventHandler)
+        {
+            eventHandler(nil, [self makeErrorWithDescription:@"No active access token" code:1008]);
+        }
         return nil;
     }
 
-    // TODO: add eventHandler + source to an internal dictionary so it will be removeable later by calling removeEventListener on saved Source
-    EventSource *source = [EventSource eventSourceWithURL:url timeoutInterval:300.0f queue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0)];
-    
-    //    if (eventName == nil)
-    //        eventName = @"no_name";
-    
-    // - event example -
-    // event: Temp
-    // data: {"data":"Temp1 is 41.900002 F, Temp2 is $f F","ttl":"60","published_at":"2015-01-13T01:23:12.269Z","coreid":"53ff6e066667574824151267"}
-    
-    //    [source addEventListener:@"" handler:^(Event *event) { //event name
-//    [source onMessage:
-    
-     EventSourceEventHandler handler = ^void(Event *event) {
+    ParticleEventHandler handler = ^(ParticleEvent * _Nullable event, NSError * _Nullable error) {
         if (eventHandler)
         {
-            if (event.error)
-                eventHandler(nil, event.error);
-            else
-            {
-                // deserialize event payload into dictionary
-                NSError *error;
-                NSDictionary *jsonDict;
-                NSMutableDictionary *eventDict;
-                if (event.data)
-                {
-                    jsonDict = [NSJSONSerialization JSONObjectWithData:event.data options:0 error:&error];
-                    eventDict = [jsonDict mutableCopy];
-                }
-                
-                if ((eventDict) && (!error))
-                {
-                    if (event.name)
-                    {
-                        eventDict[@"event"] = event.name; // add event name to dict
-                    }
-                    ParticleEvent *particleEvent = [[ParticleEvent alloc] initWithEventDict:eventDict];
-                    eventHandler(particleEvent ,nil); // callback with parsed data
-                }
-                else if (error)
-                {
-                    eventHandler(nil, error);
-                }
-            }
+            eventHandler(event, error);
         }
-        
     };
-    
-    [source onMessage:handler]; // bind the handler
-    
-    id eventListenerID = [NSUUID UUID]; // create the eventListenerID
-    self.eventListenersDict[eventListenerID] = @{kEventListenersDictHandlerKey : handler,
-                                                 kEventListenersDictEventSourceKey : source}; // save it in the internal dictionary for future unsubscribing
-    
-    return eventListenerID;
-    
+
+    return [self.eventMultiplexer subscribeToPath:path eventNamePrefix:eventNamePrefix deviceID:deviceID serverFiltered:serverFiltered accessToken:self.accessToken queueDepth:queueDepth overflowPolicy:overflowPolicy handler:handler];
 }
 
 
--(void)unsubscribeFromEventWithID:(id)eventListenerID
+-(nullable id)subscribeToPath:(NSString *)path
+               eventNamePrefix:(nullable NSString *)eventNamePrefix
+                serverFiltered:(BOOL)serverFiltered
+                  maxBatchSize:(NSUInteger)maxBatchSize
+                    maxLatency:(NSTimeInterval)maxLatency
+                  batchHandler:(nullable ParticleEventBatchHandler)batchHandler
 {
-    NSDictionary *eventListenerDict = [self.eventListenersDict objectForKey:eventListenerID];
-    if (eventListenerDict)
+    if (!self.accessToken)
     {
-        EventSource *source = [eventListenerDict objectForKey:kEventListenersDictEventSourceKey];
-        EventSourceEventHandler handler = [eventListenerDict objectForKey:kEventListenersDictHandlerKey];
-        [source removeEventListener:MessageEvent handler:handler];
-        [source close];
-        [self.eventListenersDict removeObjectForKey:eventListenerID];
+        if (batchHandler)
+        {
+            batchHandler(nil, [self makeErrorWithDescription:@"No active access token" code:1008]);
+        }
+        return nil;
     }
+
+    ParticleEventBatchHandler handler = ^(NSArray<ParticleEvent *> * _Nullable events, NSError * _Nullable error) {
+        if (batchHandler)
+        {
+            batchHandler(events, error);
+        }
+    };
+
+    return [self.eventMultiplexer subscribeToPath:path eventNamePrefix:eventNamePrefix deviceID:nil serverFiltered:serverFiltered accessToken:self.accessToken maxBatchSize:maxBatchSize maxLatency:maxLatency batchHandler:handler];
+}
+
+
+-(void)unsubscribeFromEventWithID:(id)eventListenerID
+{
+    [self.eventMultiplexer unsubscribeWithID:eventListenerID];
 }
 
 
 -(nullable id)subscribeToAllEventsWithPrefix:(nullable NSString *)eventNamePrefix handler:(nullable ParticleEventHandler)eventHandler
 {
-    // GET /v1/events[/:event_name]
-    NSString *endpoint;
-    if ((!eventNamePrefix) || [eventNamePrefix isEqualToString:@""])
-    {
-        endpoint = [NSString stringWithFormat:@"%@/v1/events", self.baseURL];
-    }
-    else
-    {
-        // URL encode name prefix
-        NSCharacterSet *set = [NSCharacterSet URLHostAllowedCharacterSet];
-        NSString *encodedEventPrefix = [eventNamePrefix stringByAddingPercentEncodingWithAllowedCharacters:set];
+    return [self subscribeToAllEventsWithPrefix:eventNamePrefix queueDepth:0 overflowPolicy:ParticleEventOverflowPolicyDropOldest handler:eventHandler];
+}
 
-        endpoint = [NSString stringWithFormat:@"%@/v1/events/%@?access_token=%@", self.baseURL, encodedEventPrefix, self.accessToken];
-    }
-    
-    return [self subscribeToEventWithURL:[NSURL URLWithString:endpoint] handler:eventHandler];
+
+-(nullable id)subscribeToAllEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                  queueDepth:(NSUInteger)queueDepth
+                              overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy
+                                     handler:(nullable ParticleEventHandler)eventHandler
+{
+    // GET /v1/events[/:event_name]
+    // public firehose cannot be widened client side - filter in the cloud, share streams with a covering prefix
+    return [self subscribeToPath:@"/v1/events" eventNamePrefix:eventNamePrefix deviceID:nil serverFiltered:YES queueDepth:queueDepth overflowPolicy:overflowPolicy handler:eventHandler];
 }
 
 
 -(nullable id)subscribeToMyDevicesEventsWithPrefix:(nullable NSString *)eventNamePrefix handler:(nullable ParticleEventHandler)eventHandler
 {
-    // GET /v1/devices/events[/:event_name]
-    NSString *endpoint;
-    if ((!eventNamePrefix) || [eventNamePrefix isEqualToString:@""])
-    {
-        // TODO: check
-        endpoint = [NSString stringWithFormat:@"%@/v1/devices/events?access_token=%@", self.baseURL, self.accessToken];
-    }
-    else
-    {
-        // URL encode name prefix
-        NSCharacterSet *set = [NSCharacterSet URLHostAllowedCharacterSet];
-        NSString *encodedEventPrefix = [eventNamePrefix stringByAddingPercentEncodingWithAllowedCharacters:set];
-       
-        endpoint = [NSString stringWithFormat:@"%@/v1/devices/events/%@?access_token=%@", self.baseURL, encodedEventPrefix, self.accessToken];
-    }
-    
-    return [self subscribeToEventWithURL:[NSURL URLWithString:endpoint] handler:eventHandler];
-    
+    return [self subscribeToMyDevicesEventsWithPrefix:eventNamePrefix queueDepth:0 overflowPolicy:ParticleEventOverflowPolicyDropOldest handler:eventHandler];
+}
+
+-(nullable id)subscribeToMyDevicesEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                        queueDepth:(NSUInteger)queueDepth
+                                    overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy
+                                           handler:(nullable ParticleEventHandler)eventHandler
+{
+    // GET /v1/devices/events - single shared stream, prefix matched locally
+    return [self subscribeToPath:@"/v1/devices/events" eventNamePrefix:eventNamePrefix deviceID:nil serverFiltered:NO queueDepth:queueDepth overflowPolicy:overflowPolicy handler:eventHandler];
+}
+
+-(nullable id)subscribeToAllEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                maxBatchSize:(NSUInteger)maxBatchSize
+                                  maxLatency:(NSTimeInterval)maxLatency
+                                batchHandler:(nullable ParticleEventBatchHandler)batchHandler
+{
+    return [self subscribeToPath:@"/v1/events" eventNamePrefix:eventNamePrefix serverFiltered:YES maxBatchSize:maxBatchSize maxLatency:maxLatency batchHandler:batchHandler];
+}
+
+
+-(nullable id)subscribeToMyDevicesEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                      maxBatchSize:(NSUInteger)maxBatchSize
+                                        maxLatency:(NSTimeInterval)maxLatency
+                                      batchHandler:(nullable ParticleEventBatchHandler)batchHandler
+{
+    return [self subscribeToPath:@"/v1/devices/events" eventNamePrefix:eventNamePrefix serverFiltered:NO maxBatchSize:maxBatchSize maxLatency:maxLatency batchHandler:batchHandler];
 }
 
 -(nullable id)subscribeToDeviceEventsWithPrefix:(nullable NSString *)eventNamePrefix deviceID:(NSString *)deviceID handler:(nullable ParticleEventHandler)eventHandler
 {
-    // GET /v1/devices/:device_id/events[/:event_name]
-    NSString *endpoint;
-    if ((!eventNamePrefix) || [eventNamePrefix isEqualToString:@""])
+    return [self subscribeToDeviceEventsWithPrefix:eventNamePrefix deviceID:deviceID queueDepth:0 overflowPolicy:ParticleEventOverflowPolicyDropOldest handler:eventHandler];
+}
+
+-(nullable id)subscribeToDeviceEventsWithPrefix:(nullable NSString *)eventNamePrefix
+                                       deviceID:(NSString *)deviceID
+                                     queueDepth:(NSUInteger)queueDepth
+                                 overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy
+                                        handler:(nullable ParticleEventHandler)eventHandler
+{
+    if ([self.deviceRegistry deviceWithID:deviceID])
     {
-        endpoint = [NSString stringWithFormat:@"%@/v1/devices/%@/events?access_token=%@", self.baseURL, deviceID, self.accessToken];
+        // claimed device - its events ride the shared /v1/devices/events stream
+        return [self subscribeToPath:@"/v1/devices/events" eventNamePrefix:eventNamePrefix deviceID:deviceID serverFiltered:NO queueDepth:queueDepth overflowPolicy:overflowPolicy handler:eventHandler];
     }
-    else
-    {
-        // URL encode name prefix
-        NSCharacterSet *set = [NSCharacterSet URLHostAllowedCharacterSet];
-        NSString *encodedEventPrefix = [eventNamePrefix stringByAddingPercentEncodingWithAllowedCharacters:set];
 
-        endpoint = [NSString stringWithFormat:@"%@/v1/devices/%@/events/%@?access_token=%@", self.baseURL, deviceID, encodedEventPrefix, self.accessToken];
+    // GET /v1/devices/:device_id/events - device might not be claimed by user (public events only), one shared stream per device
+    NSString *path = [NSString stringWithFormat:@"/v1/devices/%@/events", deviceID];
+    return [self subscribeToPath:path eventNamePrefix:eventNamePrefix deviceID:deviceID serverFiltered:NO queueDepth:queueDepth overflowPolicy:overflowPolicy handler:eventHandler];
+}
+
+
+-(nullable ParticleEventSubscriptionStats *)statsForEventListenerID:(id)eventListenerID
+{
+    return [self.eventMultiplexer statsForSubscriptionWithID:eventListenerID];
+}
+
+-(ParticleDeviceRequestCacheStats *)deviceRequestCacheStats
+{
+    @synchronized (self) {
+        return [[ParticleDeviceRequestCacheStats alloc] initWithRequestCount:_deviceRequestCount
+                                                           revalidationCount:_deviceRevalidationCount
+                                                            notModifiedCount:_deviceNotModifiedCount
+                                                               bytesReceived:_deviceBytesReceived
+                                                                  bytesSaved:_deviceBytesSaved];
     }
-    
-    return [self subscribeToEventWithURL:[NSURL URLWithString:endpoint] handler:eventHandler];
+}
+
+-(BOOL)setEventJournal:(nullable ParticleEventJournal *)journal forEventListenerID:(id)eventListenerID
+{
+    return [self.eventMultiplexer setJournal:journal forSubscriptionWithID:eventListenerID];
 }
 
 
@@ -1060,16 +1704,13 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
 
 -(void)subscribeToDevicesSystemEvents {
     
+    [self unsubscribeToDevicesSystemEvents];
     __weak ParticleCloud *weakSelf = self;
     self.systemEventsListenerId = [self subscribeToMyDevicesEventsWithPrefix:@"particle" handler:^(ParticleEvent * _Nullable event, NSError * _Nullable error) {
 
         if (!error) {
-//            NSLog(@"--> devicesMapTable got %d entries",weakSelf.devicesMapTable.count); // debug
-            ParticleDevice *device = [weakSelf.devicesMapTable objectForKey:event.deviceID];
-            if (device) {
-//                NSLog(@"* Device %@ (%@) got system event %@:%@",device.name,device.id,event.event,event.data); // debug
-                [device __receivedSystemEvent:event];
-            }
+            // keep registry up to date in between getDevices calls, marks devices whose details need refetching
+            [weakSelf.deviceRegistry applySystemEvent:event];
         } else {
             NSLog(@"! ParticleCloud could not subscribe to devices system events %@",error.localizedDescription);
         }
@@ -1080,12 +1721,14 @@ static NSString *const kDefaultoAuthClientSecret = @"particle";
 -(void)unsubscribeToDevicesSystemEvents {
     if (self.systemEventsListenerId) {
         [self unsubscribeFromEventWithID:self.systemEventsListenerId];
+        self.systemEventsListenerId = nil;
     }
 }
 
 
 -(void)dealloc {
     [self unsubscribeToDevicesSystemEvents];
+    [_streamSession finishTasksAndInvalidate]; // the session retains its delegate until invalidated
 }
 
 @end
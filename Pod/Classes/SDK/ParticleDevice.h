@@ -51,12 +51,39 @@ typedef NS_ENUM(NSInteger, ParticleDeviceSystemEvent) {
     ParticleDeviceSystemEventSafeModeUpdater
 };
 
+/**
+ *  ParticleDevice properties updated by refresh:, bitmask
+ */
+typedef NS_OPTIONS(NSUInteger, ParticleDeviceFields) {
+    ParticleDeviceFieldName             = 1 << 0,
+    ParticleDeviceFieldConnected        = 1 << 1,
+    ParticleDeviceFieldFunctions        = 1 << 2,
+    ParticleDeviceFieldVariables        = 1 << 3,
+    ParticleDeviceFieldLastApp          = 1 << 4,
+    ParticleDeviceFieldLastHeard        = 1 << 5,
+    ParticleDeviceFieldLastIPAddress    = 1 << 6,
+    ParticleDeviceFieldLastIccid        = 1 << 7,
+    ParticleDeviceFieldImei             = 1 << 8,
+    ParticleDeviceFieldPlatformId       = 1 << 9,  // and type
+    ParticleDeviceFieldProductId        = 1 << 10,
+    ParticleDeviceFieldStatus           = 1 << 11,
+    ParticleDeviceFieldRequiresUpdate   = 1 << 12,
+};
+
 @class ParticleDevice;
+@class ParticleCloud;
+@class ParticleVariableRead;
 
 @protocol ParticleDeviceDelegate <NSObject>
 
 @optional
 -(void)particleDevice:(ParticleDevice *)device didReceiveSystemEvent:(ParticleDeviceSystemEvent)event;
+/**
+ *  refresh: found properties changed in the cloud, called before the refresh completion block and only if something changed
+ *
+ *  @param changedFields properties that got new values
+ */
+-(void)particleDevice:(ParticleDevice *)device didUpdateFields:(ParticleDeviceFields)changedFields;
 
 @end
 
@@ -106,18 +133,75 @@ typedef NS_ENUM(NSInteger, ParticleDeviceSystemEvent) {
 @property (nonatomic, readonly) BOOL requiresUpdate;
 @property (nonatomic, readonly) ParticleDeviceType type;
 
--(nullable instancetype)initWithParams:(NSDictionary *)params NS_DESIGNATED_INITIALIZER;
+-(nullable instancetype)initWithParams:(NSDictionary *)params;
+// Internal use - device sends its requests through cloud, nil for ParticleCloud sharedInstance
+-(nullable instancetype)initWithParams:(NSDictionary *)params cloud:(nullable ParticleCloud *)cloud NS_DESIGNATED_INITIALIZER;
+// Internal use - decode the device straight from the bytes of its JSON object (e.g. a /v1/devices element), nil if malformed
+-(nullable instancetype)initWithJSONData:(NSData *)data cloud:(nullable ParticleCloud *)cloud NS_DESIGNATED_INITIALIZER;
 -(instancetype)init __attribute__((unavailable("Must use initWithParams:")));
 
 @property (nonatomic, strong) id <ParticleDeviceDelegate> delegate;
 
 /**
  *  Retrieve a variable value from the device
+ *  Concurrent calls for the same variable share a single cloud request, values not older than the variable cache TTL are served without a request.
  *
  *  @param variableName Variable name
  *  @param completion   Completion block to be called when function completes with the variable value retrieved (as id/AnyObject) or NSError object in case on an error
+ *  @return read of this call - cancelling it fails only this call (NSURLErrorCancelled), the cloud request shared with concurrent calls is cancelled once none of them waits for it
+ */
+-(ParticleVariableRead *)getVariable:(NSString *)variableName completion:(nullable void(^)(id _Nullable result, NSError* _Nullable error))completion;
+
+/**
+ *  Retrieve several variable values from the device, at most maxConcurrentVariableReads requests in flight at once over the cloud shared connections.
+ *  Reads go through getVariable: so they share in-flight requests and cached values with it.
+ *  Once the device reports it is not connected the remaining variables fail with the same error without further requests.
+ *
+ *  @param variableNames Variable names
+ *  @param completion    Completion block called on the main thread when all reads finished with the values read and errors of failed reads, keyed by variable name
+ */
+-(void)getVariables:(NSArray<NSString *> *)variableNames completion:(nullable void(^)(NSDictionary<NSString *, id> *results, NSDictionary<NSString *, NSError *> *errors))completion;
+
+/**
+ *  Retrieve values of all variables listed in the variables property, see getVariables:completion:
  */
--(NSURLSessionDataTask *)getVariable:(NSString *)variableName completion:(nullable void(^)(id _Nullable result, NSError* _Nullable error))completion;
+-(void)getAllVariables:(nullable void(^)(NSDictionary<NSString *, id> *results, NSDictionary<NSString *, NSError *> *errors))completion;
+
+/**
+ *  Maximum number of variable requests getVariables: keeps in flight at once (default 4), 0 for no limit
+ */
+@property (nonatomic) NSUInteger maxConcurrentVariableReads;
+
+/**
+ *  Maximum age in seconds of a variable value getVariable: serves from cache instead of querying the device, 0 (default) disables caching
+ */
+@property (nonatomic) NSTimeInterval variableCacheTTL;
+
+/**
+ *  Override variableCacheTTL for a single variable
+ *
+ *  @param ttl          Maximum cached value age in seconds, 0 to never cache this variable, negative to fall back to variableCacheTTL
+ *  @param variableName Variable name
+ */
+-(void)setCacheTTL:(NSTimeInterval)ttl forVariable:(NSString *)variableName;
+
+/**
+ *  Drop all cached variable values, next getVariable: calls query the device
+ */
+-(void)clearVariableCache;
+
+/**
+ *  getVariable: calls served from cache
+ */
+@property (nonatomic, readonly) NSUInteger variableCacheHits;
+/**
+ *  getVariable: calls that joined a request already in flight for the same variable
+ */
+@property (nonatomic, readonly) NSUInteger variableReadsCoalesced;
+/**
+ *  getVariable: calls that sent a new cloud request
+ */
+@property (nonatomic, readonly) NSUInteger variableCacheMisses;
 
 /**
  *  Call a function on the device
@@ -143,6 +227,8 @@ typedef NS_ENUM(NSInteger, ParticleDeviceSystemEvent) {
 /**
  *  Request device refresh from cloud
  *  update online status/functions/variables/device name, etc
+ *  Only properties whose value changed are written (KVO notifications are sent for those), the delegate gets them as a
+ *  ParticleDeviceFields mask. appHash and isFlashing are kept - they come from system events, not the cloud device info.
  *
  *  @param completion Completion block called when function completes with NSError object in case of an error or nil if success.
  *
@@ -218,6 +304,70 @@ typedef NS_ENUM(NSInteger, ParticleDeviceSystemEvent) {
 // Internal use
 -(void)__receivedSystemEvent:(ParticleEvent *)event;
 
+// Internal use - take the function and variable lists from device details, a device of the /v1/devices listing has none
+-(void)__setFunctionsAndVariablesWithDetailParams:(NSDictionary *)params;
+
+// Internal use - function call arguments joined and checked against the cloud argument length limit, nil with error if too long
++(nullable NSString *)__functionArgumentWithArguments:(nullable NSArray *)args error:(NSError * _Nullable * _Nullable)error;
+// Internal use - call a function with an already validated argument string
+-(NSURLSessionDataTask *)__callFunction:(NSString *)functionName
+                               argument:(nullable NSString *)argument
+                             completion:(nullable void (^)(NSNumber * _Nullable result, NSError * _Nullable error))completion;
+
+@end
+
+/**
+ *  One getVariable: call. Concurrent calls for the same variable share a single cloud request, a read tracks the call it was
+ *  returned by so it can be cancelled without failing the other calls.
+ */
+@interface ParticleVariableRead : NSObject
+
+@property (nonatomic, strong, readonly) NSString *variableName;
+@property (atomic, strong, nullable, readonly) NSURLSessionDataTask *task;  // cloud request, shared with concurrent reads of the variable - nil if the value was served from cache
+@property (nonatomic, readonly, getter=isFinished) BOOL finished;           // completion was called or the read was cancelled
+
+/**
+ *  Fail this call with NSURLErrorCancelled, the cloud request is cancelled once no other call waits for it
+ */
+-(void)cancel;
+
+@end
+
+/**
+ *  Outcome of a function call on one device of a ParticleCloud fleet function call
+ */
+@interface ParticleFunctionCallResult : NSObject
+
+@property (nonatomic, strong, readonly) NSString *deviceID;
+@property (nonatomic, strong, nullable, readonly) NSNumber *returnValue;    // function return value, nil if the call failed
+@property (nonatomic, strong, nullable, readonly) NSError *error;
+@property (nonatomic, readonly) BOOL timedOut;                              // call was cancelled after the per call timeout
+@property (nonatomic, readonly) NSTimeInterval latency;                     // seconds from sending the call to its result
+
+// Internal use
+-(instancetype)initWithDeviceID:(NSString *)deviceID returnValue:(nullable NSNumber *)returnValue error:(nullable NSError *)error timedOut:(BOOL)timedOut latency:(NSTimeInterval)latency;
+
+@end
+
+/**
+ *  Summary of a ParticleCloud fleet function call
+ */
+@interface ParticleFunctionCallSummary : NSObject
+
+@property (nonatomic, strong, readonly) NSArray<ParticleFunctionCallResult *> *results; // in order of completion
+@property (nonatomic, readonly) NSUInteger succeededCount;
+@property (nonatomic, readonly) NSUInteger failedCount;                     // including timed out calls
+@property (nonatomic, readonly) NSUInteger timedOutCount;
+@property (nonatomic, readonly) NSTimeInterval duration;                    // seconds from the first call sent to the last result
+// latency percentiles of succeeded calls in seconds, 0 if none succeeded
+@property (nonatomic, readonly) NSTimeInterval latencyP50;
+@property (nonatomic, readonly) NSTimeInterval latencyP90;
+@property (nonatomic, readonly) NSTimeInterval latencyP99;
+@property (nonatomic, readonly) NSTimeInterval latencyMax;
+
+// Internal use
+-(instancetype)initWithResults:(NSArray<ParticleFunctionCallResult *> *)results duration:(NSTimeInterval)duration;
+
 @end
 
 NS_ASSUME_NONNULL_END
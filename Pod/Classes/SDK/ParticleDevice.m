@@ -9,14 +9,71 @@
 #import "ParticleDevice.h"
 #import "ParticleCloud.h"
 #import "ParticleEvent.h"
+#import "ParticleTimestamp.h"
+#import "ParticleJSON.h"
 #import <AFNetworking/AFNetworking.h>
-#import <objc/runtime.h>
 
 #define MAX_SPARK_FUNCTION_ARG_LENGTH 63
+#define DEFAULT_MAX_CONCURRENT_VARIABLE_READS   4
+#define ERROR_CODE_DEVICE_NOT_CONNECTED         1001
 
 NS_ASSUME_NONNULL_BEGIN
 
-@interface ParticleDevice()
+static inline BOOL ParticleDeviceValuesEqual(id _Nullable value1, id _Nullable value2)
+{
+    return (value1 == value2) || ([value1 isEqual:value2]);
+}
+
+// cached getVariable: result
+@interface ParticleDeviceCachedVariable : NSObject
+@property (nonatomic, strong) id value;
+@property (nonatomic) NSTimeInterval timestamp; // system uptime
+@end
+
+@implementation ParticleDeviceCachedVariable
+@end
+
+// getVariable: request in flight and the calls waiting for it
+@interface ParticleDeviceVariableRequest : NSObject
+@property (nonatomic, strong) NSString *variableName;
+@property (nonatomic, strong, nullable) NSURLSessionDataTask *task;
+@property (nonatomic, strong) NSMutableArray<ParticleVariableRead *> *reads;
+@end
+
+@implementation ParticleDeviceVariableRequest
+
+-(instancetype)init
+{
+    if (self = [super init])
+    {
+        _reads = [NSMutableArray new];
+    }
+    return self;
+}
+
+@end
+
+@interface ParticleVariableRead ()
+@property (nonatomic, strong, readwrite) NSString *variableName;
+@property (atomic, strong, nullable, readwrite) NSURLSessionDataTask *task;
+@property (nonatomic, weak, nullable) ParticleDevice *device;
+@property (nonatomic, strong) dispatch_queue_t completionQueue;
+@property (atomic, copy, nullable) void (^completion)(id _Nullable result, NSError * _Nullable error);
+
+-(void)finishWithResult:(nullable id)result error:(nullable NSError *)error;
+
+@end
+
+@interface ParticleDevice (VariableRead)
+-(void)detachVariableRead:(ParticleVariableRead *)read;
+@end
+
+@interface ParticleDevice() {
+    // all guarded by @synchronized(self)
+    NSMutableDictionary<NSString *, NSNumber *> *_variableCacheTTLs;
+    NSMutableDictionary<NSString *, ParticleDeviceCachedVariable *> *_variableCache;
+    NSMutableDictionary<NSString *, ParticleDeviceVariableRequest *> *_variableRequests;
+}
 
 @property (strong, nonatomic, nonnull) NSString* id;
 @property (nonatomic) BOOL connected; // might be impossible
@@ -25,7 +82,6 @@ NS_ASSUME_NONNULL_BEGIN
 @property (strong, nonatomic, nullable) NSString *version;
 //@property (nonatomic) ParticleDeviceType type;
 @property (nonatomic) BOOL requiresUpdate;
-@property (nonatomic, strong) AFHTTPSessionManager *manager;
 @property (nonatomic) BOOL isFlashing;
 @property (nonatomic, strong) NSURL *baseURL;
 
@@ -36,168 +92,286 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic) NSUInteger productId;
 @property (strong, nonatomic, nullable) NSString *status;
 @property (strong, nonatomic, nullable) NSString *appHash;
+
+@property (nonatomic, weak, nullable) ParticleCloud *cloud;
+
+@property (nonatomic, readwrite) NSUInteger variableCacheHits;
+@property (nonatomic, readwrite) NSUInteger variableReadsCoalesced;
+@property (nonatomic, readwrite) NSUInteger variableCacheMisses;
+
+-(AFHTTPSessionManager *)manager;
 @end
 
 @implementation ParticleDevice
 
--(nullable instancetype)initWithParams:(NSDictionary *)params
+// value types the device info keys are decoded from, values of other types leave the property at its default
+typedef NS_ENUM(uint8_t, ParticleDeviceParamType) {
+    ParticleDeviceParamTypeAny,
+    ParticleDeviceParamTypeString,
+    ParticleDeviceParamTypeNumber,
+    ParticleDeviceParamTypeBool,        // number or string
+    ParticleDeviceParamTypeArray,
+    ParticleDeviceParamTypeDictionary,
+};
+
+typedef struct {
+    const char *key;
+    NSUInteger keyLength;
+    ParticleDeviceParamType type;
+    void (*set)(ParticleDevice *device, id value);
+    void (* _Nullable setBytes)(ParticleDevice *device, const uint8_t *bytes, NSUInteger length); // unescaped strings straight from JSON bytes
+} ParticleDeviceParam;
+
+// platform ids of the ParticleDeviceType values - the type of a device is its platform id when it is listed here
+static const BOOL ParticleDeviceKnownPlatforms[] = {
+    [ParticleDeviceTypeCore] = YES,
+    [ParticleDeviceTypePhoton] = YES,
+    [ParticleDeviceTypeP1] = YES,
+    [ParticleDeviceTypeElectron] = YES,
+    [ParticleDeviceTypeRaspberryPi] = YES,
+    [ParticleDeviceTypeDigistumpOak] = YES,
+    [ParticleDeviceTypeRedBearDuo] = YES,
+    [ParticleDeviceTypeBluz] = YES,
+};
+
+static inline ParticleDeviceType ParticleDeviceTypeForPlatformId(NSUInteger platformId)
 {
-    if (self = [super init])
+    if ((platformId < sizeof(ParticleDeviceKnownPlatforms) / sizeof(ParticleDeviceKnownPlatforms[0])) && (ParticleDeviceKnownPlatforms[platformId]))
     {
-        _baseURL = [NSURL URLWithString:kParticleAPIBaseURL];
-        if (!_baseURL) {
-            return nil;
-        }
-     
-        _requiresUpdate = NO;
-        
-        _name = nil;
-        if ([params[@"name"] isKindOfClass:[NSString class]])
-        {
-            _name = params[@"name"];
-        }
-        
-        _connected = [params[@"connected"] boolValue] == YES;
-        
-        _functions = params[@"functions"] ?: @[];
-        _variables = params[@"variables"] ?: @{};
-        
-        if (![_functions isKindOfClass:[NSArray class]]) {
-            self.functions = @[];
-        }
-
-        if (![_variables isKindOfClass:[NSDictionary class]]) {
-            _variables = @{};
-        }
-
-        _id = params[@"id"];
+        return (ParticleDeviceType)platformId;
+    }
+    return ParticleDeviceTypeUnknown;
+}
 
-        _type = ParticleDeviceTypeUnknown;
-        if ([params[@"platform_id"] isKindOfClass:[NSNumber class]])
-        {
-            self.platformId = [params[@"platform_id"] intValue];
-            
-            if ([params[@"platform_id"] intValue] == ParticleDeviceTypeCore)
-                _type = ParticleDeviceTypeCore;
+static void ParticleDeviceSetID(ParticleDevice *device, id value)               { device->_id = value; }
+static void ParticleDeviceSetName(ParticleDevice *device, id value)             { device->_name = value; }
+static void ParticleDeviceSetConnected(ParticleDevice *device, id value)        { device->_connected = [value boolValue]; }
+static void ParticleDeviceSetFunctions(ParticleDevice *device, id value)        { device->_functions = value; }
+static void ParticleDeviceSetVariables(ParticleDevice *device, id value)        { device->_variables = value; }
+static void ParticleDeviceSetProductId(ParticleDevice *device, id value)        { device->_productId = [value intValue]; }
+static void ParticleDeviceSetLastIccid(ParticleDevice *device, id value)        { device->_lastIccid = value; }
+static void ParticleDeviceSetImei(ParticleDevice *device, id value)             { device->_imei = value; }
+static void ParticleDeviceSetStatus(ParticleDevice *device, id value)           { device->_status = value; }
+static void ParticleDeviceSetLastIPAddress(ParticleDevice *device, id value)    { device->_lastIPAdress = value; }
+static void ParticleDeviceSetLastApp(ParticleDevice *device, id value)          { device->_lastApp = value; }
+static void ParticleDeviceSetRequiresUpdate(ParticleDevice *device, id value)   { device->_requiresUpdate = YES; } // present at all
+
+static void ParticleDeviceSetPlatformId(ParticleDevice *device, id value)
+{
+    device->_platformId = [value intValue];
+    device->_type = ParticleDeviceTypeForPlatformId(device->_platformId);
+}
 
-            if ([params[@"platform_id"] intValue] == ParticleDeviceTypeElectron)
-                _type = ParticleDeviceTypeElectron;
+static void ParticleDeviceSetLastHeard(ParticleDevice *device, id value)
+{
+    device->_lastHeard = ParticleDateFromTimestamp(value); // "2015-04-18T08:42:22.127Z"
+}
 
-            if ([params[@"platform_id"] intValue] == ParticleDeviceTypePhoton) // or P0 - same id
-                _type = ParticleDeviceTypePhoton;
-            
-            if ([params[@"platform_id"] intValue] == ParticleDeviceTypeP1)
-                _type = ParticleDeviceTypeP1;
+static void ParticleDeviceSetLastHeardBytes(ParticleDevice *device, const uint8_t *bytes, NSUInteger length)
+{
+    device->_lastHeard = ParticleDateFromTimestampBytes((const char *)bytes, length);
+}
 
-            if ([params[@"platform_id"] intValue] == ParticleDeviceTypeRedBearDuo)
-                _type = ParticleDeviceTypeRedBearDuo;
+#define PARTICLE_DEVICE_PARAM(key, type, ...) { key, sizeof(key) - 1, ParticleDeviceParamType##type, __VA_ARGS__ }
+
+static const ParticleDeviceParam ParticleDeviceParams[] = {
+    PARTICLE_DEVICE_PARAM("id",                  Any,        ParticleDeviceSetID),
+    PARTICLE_DEVICE_PARAM("name",                String,     ParticleDeviceSetName),
+    PARTICLE_DEVICE_PARAM("connected",           Bool,       ParticleDeviceSetConnected),
+    PARTICLE_DEVICE_PARAM("functions",           Array,      ParticleDeviceSetFunctions),
+    PARTICLE_DEVICE_PARAM("variables",           Dictionary, ParticleDeviceSetVariables),
+    PARTICLE_DEVICE_PARAM("platform_id",         Number,     ParticleDeviceSetPlatformId),
+    PARTICLE_DEVICE_PARAM("product_id",          Number,     ParticleDeviceSetProductId),
+    PARTICLE_DEVICE_PARAM("last_iccid",          String,     ParticleDeviceSetLastIccid),
+    PARTICLE_DEVICE_PARAM("imei",                String,     ParticleDeviceSetImei),
+    PARTICLE_DEVICE_PARAM("status",              String,     ParticleDeviceSetStatus),
+    PARTICLE_DEVICE_PARAM("last_ip_address",     String,     ParticleDeviceSetLastIPAddress),
+    PARTICLE_DEVICE_PARAM("last_app",            String,     ParticleDeviceSetLastApp),
+    PARTICLE_DEVICE_PARAM("last_heard",          String,     ParticleDeviceSetLastHeard, ParticleDeviceSetLastHeardBytes),
+    PARTICLE_DEVICE_PARAM("device_needs_update", Any,        ParticleDeviceSetRequiresUpdate),
+};
+
+#define PARTICLE_DEVICE_PARAM_COUNT (sizeof(ParticleDeviceParams) / sizeof(ParticleDeviceParams[0]))
+
+// key -> index in ParticleDeviceParams, for decoding dictionaries
+static NSDictionary<NSString *, NSNumber *> *ParticleDeviceParamIndexes;
+
+static inline const ParticleDeviceParam * _Nullable ParticleDeviceParamForKey(ParticleJSONValue key)
+{
+    if (key.escaped)
+    {
+        return NULL; // none of the keys needs escaping
+    }
+    for (NSUInteger i = 0; i < PARTICLE_DEVICE_PARAM_COUNT; i++)
+    {
+        if ((ParticleDeviceParams[i].keyLength == key.length) && (memcmp(ParticleDeviceParams[i].key, key.bytes, key.length) == 0))
+        {
+            return &ParticleDeviceParams[i];
+        }
+    }
+    return NULL;
+}
 
-            if ([params[@"platform_id"] intValue] == ParticleDeviceTypeBluz)
-                _type = ParticleDeviceTypeBluz;
+static inline BOOL ParticleDeviceParamAcceptsObject(ParticleDeviceParamType type, id value)
+{
+    switch (type)
+    {
+        case ParticleDeviceParamTypeAny:        return YES;
+        case ParticleDeviceParamTypeString:     return [value isKindOfClass:[NSString class]];
+        case ParticleDeviceParamTypeNumber:     return [value isKindOfClass:[NSNumber class]];
+        case ParticleDeviceParamTypeBool:       return [value isKindOfClass:[NSNumber class]] || [value isKindOfClass:[NSString class]];
+        case ParticleDeviceParamTypeArray:      return [value isKindOfClass:[NSArray class]];
+        case ParticleDeviceParamTypeDictionary: return [value isKindOfClass:[NSDictionary class]];
+    }
+    return NO;
+}
 
-            if ([params[@"platform_id"] intValue] == ParticleDeviceTypeDigistumpOak)
-                _type = ParticleDeviceTypeDigistumpOak;
-        }
+static inline BOOL ParticleDeviceParamAcceptsJSONType(ParticleDeviceParamType type, ParticleJSONType jsonType)
+{
+    switch (type)
+    {
+        case ParticleDeviceParamTypeAny:        return YES;
+        case ParticleDeviceParamTypeString:     return jsonType == ParticleJSONTypeString;
+        case ParticleDeviceParamTypeNumber:     return (jsonType == ParticleJSONTypeNumber) || (jsonType == ParticleJSONTypeTrue) || (jsonType == ParticleJSONTypeFalse);
+        case ParticleDeviceParamTypeBool:       return (jsonType == ParticleJSONTypeNumber) || (jsonType == ParticleJSONTypeTrue) || (jsonType == ParticleJSONTypeFalse) || (jsonType == ParticleJSONTypeString);
+        case ParticleDeviceParamTypeArray:      return jsonType == ParticleJSONTypeArray;
+        case ParticleDeviceParamTypeDictionary: return jsonType == ParticleJSONTypeObject;
+    }
+    return NO;
+}
 
-        
-        if ([params[@"product_id"] isKindOfClass:[NSNumber class]])
-        {
-            _productId = [params[@"product_id"] intValue];
-        }
-        
-        if ((params[@"last_iccid"]) && ([params[@"last_iccid"] isKindOfClass:[NSString class]]))
++(void)initialize
+{
+    if (self == [ParticleDevice class])
+    {
+        NSMutableDictionary *indexes = [NSMutableDictionary new];
+        for (NSUInteger i = 0; i < PARTICLE_DEVICE_PARAM_COUNT; i++)
         {
-            _lastIccid = params[@"last_iccid"];
+            indexes[@(ParticleDeviceParams[i].key)] = @(i);
         }
+        ParticleDeviceParamIndexes = indexes;
+    }
+}
 
-        if ((params[@"imei"]) && ([params[@"imei"] isKindOfClass:[NSString class]]))
-        {
-            _imei = params[@"imei"];
-        }
+-(nullable instancetype)initWithParams:(NSDictionary *)params
+{
+    return [self initWithParams:params cloud:nil];
+}
 
-        if ((params[@"status"]) && ([params[@"status"] isKindOfClass:[NSString class]]))
+-(nullable instancetype)initWithParams:(NSDictionary *)params cloud:(nullable ParticleCloud *)cloud
+{
+    if (self = [super init])
+    {
+        if (![self setUpWithCloud:cloud])
         {
-            _status = params[@"status"];
+            return nil;
         }
 
-        
-        if ([params[@"last_ip_address"] isKindOfClass:[NSString class]])
-        {
-            _lastIPAdress = params[@"last_ip_address"];
-        }
-        
-        if ([params[@"last_app"] isKindOfClass:[NSString class]])
-        {
-            _lastApp = params[@"last_app"];
-        }
+        // one pass over the keys present instead of a lookup per known key
+        [params enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+            NSNumber *index = ParticleDeviceParamIndexes[key];
+            if (index)
+            {
+                const ParticleDeviceParam *param = &ParticleDeviceParams[index.unsignedIntegerValue];
+                if (ParticleDeviceParamAcceptsObject(param->type, value))
+                {
+                    param->set(self, value);
+                }
+            }
+        }];
+
+        return self;
+    }
 
-        if ([params[@"last_heard"] isKindOfClass:[NSString class]])
+    return nil;
+}
+
+-(nullable instancetype)initWithJSONData:(NSData *)data cloud:(nullable ParticleCloud *)cloud
+{
+    if (self = [super init])
+    {
+        ParticleJSONValue object;
+        NSUInteger length = ParticleJSONScanValue(data.bytes, data.length, &object);
+        if ((![self setUpWithCloud:cloud]) || (length == 0) || (object.type != ParticleJSONTypeObject))
         {
-            // TODO: add to utils class as POSIX time to NSDate
-            NSString *dateString = params[@"last_heard"];// "2015-04-18T08:42:22.127Z"
-            NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
-            [formatter setDateFormat:@"yyyy-MM-dd'T'HH:mm:ss.SSSZ"];
-            NSLocale *posix = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
-            [formatter setLocale:posix];
-            _lastHeard = [formatter dateFromString:dateString];
+            return nil;
         }
 
-        /// WIP
-        /*
-        if (params[@"cc3000_patch_version"]) { // Core only
-            self.systemFirmwareVersion = (params[@"cc3000_patch_version"]);
-        } else if (params[@"current_build_target"]) { // Electron only
-            self.systemFirmwareVersion = params[@"current_build_target"];
-        }
-         */
-        
-            
-        if (params[@"device_needs_update"])
+        // only values of known keys are turned into objects, unescaped timestamps not even that
+        __block BOOL valid = YES;
+        if (!ParticleJSONEnumerateObject(object, ^(ParticleJSONValue key, ParticleJSONValue value, BOOL *stop) {
+            const ParticleDeviceParam *param = ParticleDeviceParamForKey(key);
+            if ((!param) || (!ParticleDeviceParamAcceptsJSONType(param->type, value.type)))
+            {
+                return;
+            }
+            if ((param->setBytes) && (value.type == ParticleJSONTypeString) && (!value.escaped))
+            {
+                param->setBytes(self, value.bytes, value.length);
+                return;
+            }
+            id object = ParticleJSONObject(value);
+            if (!object)
+            {
+                valid = NO;
+                *stop = YES;
+                return;
+            }
+            param->set(self, object);
+        }) || (!valid))
         {
-            _requiresUpdate = YES;
+            return nil;
         }
-        
-        self.manager = [[AFHTTPSessionManager alloc] initWithBaseURL:self.baseURL];
-        self.manager.responseSerializer = [AFJSONResponseSerializer serializer];
 
-        if (!self.manager) return nil;
-        
-         
         return self;
     }
-    
+
     return nil;
 }
 
+// state and defaults shared by the initializers, NO if there is no cloud to talk to
+-(BOOL)setUpWithCloud:(nullable ParticleCloud *)cloud
+{
+    _cloud = cloud;
+    _baseURL = self.cloud.baseURL;
+    if (!_baseURL) {
+        return NO;
+    }
+
+    _variableCacheTTLs = [NSMutableDictionary new];
+    _variableCache = [NSMutableDictionary new];
+    _variableRequests = [NSMutableDictionary new];
+    _maxConcurrentVariableReads = DEFAULT_MAX_CONCURRENT_VARIABLE_READS;
+
+    _requiresUpdate = NO;
+    _connected = NO;
+    _functions = @[];
+    _variables = @{};
+    _type = ParticleDeviceTypeUnknown;
+
+    /// WIP
+    /*
+    if (params[@"cc3000_patch_version"]) { // Core only
+        self.systemFirmwareVersion = (params[@"cc3000_patch_version"]);
+    } else if (params[@"current_build_target"]) { // Electron only
+        self.systemFirmwareVersion = params[@"current_build_target"];
+    }
+     */
+
+    return YES;
+}
+
 
 
 -(NSURLSessionDataTask *)refresh:(nullable ParticleCompletionBlock)completion;
 {
-    return [[ParticleCloud sharedInstance] getDevice:self.id completion:^(ParticleDevice * _Nullable updatedDevice, NSError * _Nullable error) {
+    return [self.cloud getDevice:self.id completion:^(ParticleDevice * _Nullable updatedDevice, NSError * _Nullable error) {
         if (!error)
         {
-            if (updatedDevice)
+            ParticleDeviceFields changedFields = updatedDevice ? [self updateFieldsWithDevice:updatedDevice] : 0;
+            if ((changedFields) && ([self.delegate respondsToSelector:@selector(particleDevice:didUpdateFields:)]))
             {
-                // if we got an updated device from the cloud - overwrite ALL self's properies with the new device properties (except for delegate which should be copied over)
-                NSMutableSet *propNames = [NSMutableSet set];
-                unsigned int outCount, i;
-                objc_property_t *properties = class_copyPropertyList([updatedDevice class], &outCount);
-                for (i = 0; i < outCount; i++) {
-                    objc_property_t property = properties[i];
-                    NSString *propertyName = [[NSString alloc] initWithCString:property_getName(property) encoding:NSStringEncodingConversionAllowLossy];
-                    [propNames addObject:propertyName];
-                }
-                free(properties);
-                
-                if (self.delegate) {
-                    updatedDevice.delegate = self.delegate;
-                }
-                
-                for (NSString *property in propNames)
-                {
-                    id value = [updatedDevice valueForKey:property];
-                    [self setValue:value forKey:property];
-                }
+                [self.delegate particleDevice:self didUpdateFields:changedFields];
             }
             if (completion)
             {
@@ -214,6 +388,94 @@ NS_ASSUME_NONNULL_BEGIN
     }];
 }
 
+// copy the cloud device info properties that differ from device, returns the ones copied.
+// name is written to the ivar - the setter renames the device in the cloud.
+-(ParticleDeviceFields)updateFieldsWithDevice:(ParticleDevice *)device
+{
+    ParticleDeviceFields changedFields = 0;
+    if (device == self)
+    {
+        return changedFields; // details unchanged since this instance was created
+    }
+
+    if (!ParticleDeviceValuesEqual(_name, device.name))
+    {
+        [self willChangeValueForKey:@"name"];
+        _name = device.name;
+        [self didChangeValueForKey:@"name"];
+        changedFields |= ParticleDeviceFieldName;
+    }
+    if (_connected != device.connected)
+    {
+        self.connected = device.connected;
+        changedFields |= ParticleDeviceFieldConnected;
+    }
+    if (!ParticleDeviceValuesEqual(_functions, device.functions))
+    {
+        self.functions = device.functions;
+        changedFields |= ParticleDeviceFieldFunctions;
+    }
+    if (!ParticleDeviceValuesEqual(_variables, device.variables))
+    {
+        self.variables = device.variables;
+        changedFields |= ParticleDeviceFieldVariables;
+    }
+    if (!ParticleDeviceValuesEqual(_lastApp, device.lastApp))
+    {
+        [self willChangeValueForKey:@"lastApp"];
+        _lastApp = device.lastApp;
+        [self didChangeValueForKey:@"lastApp"];
+        changedFields |= ParticleDeviceFieldLastApp;
+    }
+    if (!ParticleDeviceValuesEqual(_lastHeard, device.lastHeard))
+    {
+        [self willChangeValueForKey:@"lastHeard"];
+        _lastHeard = device.lastHeard;
+        [self didChangeValueForKey:@"lastHeard"];
+        changedFields |= ParticleDeviceFieldLastHeard;
+    }
+    if (!ParticleDeviceValuesEqual(_lastIPAdress, device.lastIPAdress))
+    {
+        self.lastIPAdress = device.lastIPAdress;
+        changedFields |= ParticleDeviceFieldLastIPAddress;
+    }
+    if (!ParticleDeviceValuesEqual(_lastIccid, device.lastIccid))
+    {
+        self.lastIccid = device.lastIccid;
+        changedFields |= ParticleDeviceFieldLastIccid;
+    }
+    if (!ParticleDeviceValuesEqual(_imei, device.imei))
+    {
+        self.imei = device.imei;
+        changedFields |= ParticleDeviceFieldImei;
+    }
+    if ((_platformId != device.platformId) || (_type != device.type))
+    {
+        self.platformId = device.platformId;
+        [self willChangeValueForKey:@"type"];
+        _type = device.type;
+        [self didChangeValueForKey:@"type"];
+        changedFields |= ParticleDeviceFieldPlatformId;
+    }
+    if (_productId != device.productId)
+    {
+        self.productId = device.productId;
+        changedFields |= ParticleDeviceFieldProductId;
+    }
+    if (!ParticleDeviceValuesEqual(_status, device.status))
+    {
+        self.status = device.status;
+        changedFields |= ParticleDeviceFieldStatus;
+    }
+    if (_requiresUpdate != device.requiresUpdate)
+    {
+        self.requiresUpdate = device.requiresUpdate;
+        changedFields |= ParticleDeviceFieldRequiresUpdate;
+    }
+
+    return changedFields;
+}
+
 -(void)setName:(nullable NSString *)name
 {
     if (name != nil) {
@@ -221,80 +483,298 @@ NS_ASSUME_NONNULL_BEGIN
     }
 }
 
--(NSURLSessionDataTask *)getVariable:(NSString *)variableName completion:(nullable void(^)(id _Nullable result, NSError* _Nullable error))completion
+-(ParticleVariableRead *)getVariable:(NSString *)variableName completion:(nullable void(^)(id _Nullable result, NSError* _Nullable error))completion
 {
     // TODO: check variable name exists in list
     // TODO: check response of calling a non existant function
     
-    NSURL *url = [self.baseURL URLByAppendingPathComponent:[NSString stringWithFormat:@"v1/devices/%@/%@", self.id, variableName]];
-    
-    [self setAuthHeaderWithAccessToken];
-    
-    NSURLSessionDataTask *task = [self.manager GET:[url description] parameters:nil progress:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
+    ParticleVariableRead *variableRead = [ParticleVariableRead new];
+    variableRead.variableName = variableName;
+    variableRead.device = self;
+    variableRead.completionQueue = self.manager.completionQueue ?: dispatch_get_main_queue();
+    variableRead.completion = completion ?: ^(id _Nullable result, NSError * _Nullable error) {};
+
+    @synchronized(self)
     {
-        if (completion)
+        NSTimeInterval ttl = [self cacheTTLForVariable:variableName];
+        ParticleDeviceCachedVariable *cached = _variableCache[variableName];
+        if ((cached) && (ttl > 0) && ([NSProcessInfo processInfo].systemUptime - cached.timestamp <= ttl))
+        {
+            self.variableCacheHits++;
+            id value = cached.value;
+            // keep completion asynchronous like a real request
+            dispatch_async(variableRead.completionQueue, ^{
+                [variableRead finishWithResult:value error:nil];
+            });
+            return variableRead;
+        }
+
+        ParticleDeviceVariableRequest *request = _variableRequests[variableName];
+        if (request)
+        {
+            // same variable already being read - wait for that request instead of waking the device again
+            self.variableReadsCoalesced++;
+            [request.reads addObject:variableRead];
+            variableRead.task = request.task;
+            return variableRead;
+        }
+
+        self.variableCacheMisses++;
+        request = [ParticleDeviceVariableRequest new];
+        request.variableName = variableName;
+        [request.reads addObject:variableRead];
+        _variableRequests[variableName] = request;
+
+        NSURL *url = [self.baseURL URLByAppendingPathComponent:[NSString stringWithFormat:@"v1/devices/%@/%@", self.id, variableName]];
+        
+        request.task = [self dataTaskWithMethod:@"GET" URL:url parameters:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
         {
             NSDictionary *responseDict = responseObject;
             if (![responseDict[@"coreInfo"][@"connected"] boolValue]) // check response
             {
-                NSError *err = [self makeErrorWithDescription:@"Device is not connected" code:1001];
-                completion(nil,err);
+                NSError *err = [self makeErrorWithDescription:@"Device is not connected" code:ERROR_CODE_DEVICE_NOT_CONNECTED];
+                [self finishVariableRequest:request result:nil error:err];
             }
             else
             {
-                // check
-                completion(responseDict[@"result"], nil);
+                [self finishVariableRequest:request result:responseDict[@"result"] error:nil];
+            }
+        } failure:^(NSURLSessionDataTask * _Nullable task, NSError * _Nonnull error)
+        {
+            [self finishVariableRequest:request result:nil error:error];
+        }];
+        variableRead.task = request.task;
+
+        return variableRead;
+    }
+}
+
+-(void)getVariables:(NSArray<NSString *> *)variableNames completion:(nullable void(^)(NSDictionary<NSString *, id> *results, NSDictionary<NSString *, NSError *> *errors))completion
+{
+    NSArray<NSString *> *names = [NSOrderedSet orderedSetWithArray:variableNames].array;
+    NSMutableDictionary<NSString *, id> *results = [NSMutableDictionary dictionaryWithCapacity:names.count];
+    NSMutableDictionary<NSString *, NSError *> *errors = [NSMutableDictionary new];
+
+    if (names.count == 0)
+    {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (completion)
+            {
+                completion(results, errors);
             }
+        });
+        return;
+    }
+
+    // read at most maxConcurrentVariableReads variables at a time, each finished read starts the next one
+    // (reads are started and completed on the main queue, so the state below is not shared between threads)
+    NSUInteger maxConcurrentReads = (self.maxConcurrentVariableReads > 0) ? self.maxConcurrentVariableReads : names.count;
+    __block NSUInteger nextReadIndex = 0;
+    __block NSUInteger pendingReads = names.count;
+    __block NSError *notConnectedError = nil;
+    __block void (^readNextVariable)(void);
+    readNextVariable = ^{
+        while (nextReadIndex < names.count)
+        {
+            NSString *name = names[nextReadIndex++];
+            if (notConnectedError)
+            {
+                // don't keep knocking on an offline device
+                errors[name] = notConnectedError;
+                pendingReads--;
+                continue;
+            }
+
+            [self getVariable:name completion:^(id _Nullable result, NSError * _Nullable error) {
+                if (error)
+                {
+                    errors[name] = error;
+                    if (([error.domain isEqualToString:@"ParticleAPIError"]) && (error.code == ERROR_CODE_DEVICE_NOT_CONNECTED))
+                    {
+                        notConnectedError = error;
+                    }
+                }
+                else if (result)
+                {
+                    results[name] = result;
+                }
+
+                pendingReads--;
+                readNextVariable();
+            }];
+            return;
         }
-    } failure:^(NSURLSessionDataTask * _Nullable task, NSError * _Nonnull error)
+
+        if (pendingReads == 0)
+        {
+            readNextVariable = nil; // break the block retain cycle
+            if (completion)
+            {
+                completion(results, errors);
+            }
+        }
+    };
+
+    // start the reads on the main queue too, so the state is never touched by the calling thread
+    dispatch_async(dispatch_get_main_queue(), ^{
+        for (NSUInteger i = 0; i < MIN(maxConcurrentReads, names.count); i++)
+        {
+            readNextVariable();
+        }
+    });
+}
+
+-(void)getAllVariables:(nullable void(^)(NSDictionary<NSString *, id> *results, NSDictionary<NSString *, NSError *> *errors))completion
+{
+    [self getVariables:self.variables.allKeys completion:completion];
+}
+
+-(void)finishVariableRequest:(ParticleDeviceVariableRequest *)request result:(nullable id)result error:(nullable NSError *)error
+{
+    NSArray<ParticleVariableRead *> *reads;
+    @synchronized(self)
     {
-        if (completion)
+        NSString *variableName = request.variableName;
+        if (_variableRequests[variableName] != request)
         {
-            completion(nil, error);
+            return; // every call was cancelled, a newer request may be in flight for the variable
         }
-    }];
-    
-    return task;
+        reads = [request.reads copy];
+        [_variableRequests removeObjectForKey:variableName];
+
+        if ((result) && ([self cacheTTLForVariable:variableName] > 0))
+        {
+            ParticleDeviceCachedVariable *cached = [ParticleDeviceCachedVariable new];
+            cached.value = result;
+            cached.timestamp = [NSProcessInfo processInfo].systemUptime;
+            _variableCache[variableName] = cached;
+        }
+        else
+        {
+            [_variableCache removeObjectForKey:variableName];
+        }
+    }
+
+    for (ParticleVariableRead *read in reads)
+    {
+        [read finishWithResult:result error:error];
+    }
+}
+
+-(void)detachVariableRead:(ParticleVariableRead *)read
+{
+    NSURLSessionDataTask *taskToCancel = nil;
+    @synchronized(self)
+    {
+        ParticleDeviceVariableRequest *request = _variableRequests[read.variableName];
+        if ((!request) || (![request.reads containsObject:read]))
+        {
+            return; // served from cache
+        }
+
+        [request.reads removeObject:read];
+        if (request.reads.count == 0)
+        {
+            // nobody waits for the value anymore - the next call starts a new request
+            [_variableRequests removeObjectForKey:read.variableName];
+            taskToCancel = request.task;
+        }
+    }
+
+    [taskToCancel cancel];
+}
+
+-(NSTimeInterval)cacheTTLForVariable:(NSString *)variableName
+{
+    NSNumber *ttl = _variableCacheTTLs[variableName];
+    return ttl ? ttl.doubleValue : self.variableCacheTTL;
+}
+
+-(void)setCacheTTL:(NSTimeInterval)ttl forVariable:(NSString *)variableName
+{
+    @synchronized(self)
+    {
+        if (ttl < 0)
+        {
+            [_variableCacheTTLs removeObjectForKey:variableName];
+        }
+        else
+        {
+            _variableCacheTTLs[variableName] = @(ttl);
+        }
+    }
+}
+
+-(void)clearVariableCache
+{
+    @synchronized(self)
+    {
+        [_variableCache removeAllObjects];
+    }
 }
 
 -(NSURLSessionDataTask *)callFunction:(NSString *)functionName
                         withArguments:(nullable NSArray *)args
                            completion:(nullable void (^)(NSNumber * _Nullable result, NSError * _Nullable error))completion
+{
+    NSError *err = nil;
+    NSString *argument = [ParticleDevice __functionArgumentWithArguments:args error:&err];
+    if (err)
+    {
+        if (completion)
+            completion(nil,err);
+        return nil;
+    }
+
+    return [self __callFunction:functionName argument:argument completion:completion];
+}
+
++(nullable NSString *)__functionArgumentWithArguments:(nullable NSArray *)args error:(NSError * _Nullable * _Nullable)error
+{
+    if (!args) {
+        return nil;
+    }
+
+    NSMutableArray *argsStr = [[NSMutableArray alloc] initWithCapacity:args.count];
+    for (id arg in args)
+    {
+        [argsStr addObject:[arg description]];
+    }
+    NSString *argsValue = [argsStr componentsJoinedByString:@","];
+    if (argsValue.length > MAX_SPARK_FUNCTION_ARG_LENGTH)
+    {
+        // TODO: arrange user error/codes in a list
+        if (error)
+        {
+            *error = [NSError errorWithDomain:@"ParticleAPIError" code:1000 userInfo:@{NSLocalizedDescriptionKey : [NSString stringWithFormat:@"Maximum argument length cannot exceed %d",MAX_SPARK_FUNCTION_ARG_LENGTH]}];
+        }
+        return nil;
+    }
+
+    return argsValue;
+}
+
+-(NSURLSessionDataTask *)__callFunction:(NSString *)functionName
+                               argument:(nullable NSString *)argument
+                             completion:(nullable void (^)(NSNumber * _Nullable result, NSError * _Nullable error))completion
 {
     // TODO: check function name exists in list
     // TODO: check response of calling a non existant function
     NSURL *url = [self.baseURL URLByAppendingPathComponent:[NSString stringWithFormat:@"v1/devices/%@/%@", self.id, functionName]];
     NSMutableDictionary *params = [NSMutableDictionary new]; //[self defaultParams];
 
-    if (args) {
-        NSMutableArray *argsStr = [[NSMutableArray alloc] initWithCapacity:args.count];
-        for (id arg in args)
-        {
-            [argsStr addObject:[arg description]];
-        }
-        NSString *argsValue = [argsStr componentsJoinedByString:@","];
-        if (argsValue.length > MAX_SPARK_FUNCTION_ARG_LENGTH)
-        {
-            // TODO: arrange user error/codes in a list
-            NSError *err = [self makeErrorWithDescription:[NSString stringWithFormat:@"Maximum argument length cannot exceed %d",MAX_SPARK_FUNCTION_ARG_LENGTH] code:1000];
-            if (completion)
-                completion(nil,err);
-            return nil;
-        }
-            
-        params[@"args"] = argsValue;
+    if (argument) {
+        params[@"args"] = argument;
     }
     
-    [self setAuthHeaderWithAccessToken];
-    
-    NSURLSessionDataTask *task = [self.manager POST:[url description] parameters:params progress:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
+    NSURLSessionDataTask *task = [self dataTaskWithMethod:@"POST" URL:url parameters:params success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
     {
         if (completion)
         {
             NSDictionary *responseDict = responseObject;
             if ([responseDict[@"connected"] boolValue]==NO)
             {
-                NSError *err = [self makeErrorWithDescription:@"Device is not connected" code:1001];
+                NSError *err = [self makeErrorWithDescription:@"Device is not connected" code:ERROR_CODE_DEVICE_NOT_CONNECTED];
                 completion(nil,err);
             }
             else
@@ -323,9 +803,7 @@ NS_ASSUME_NONNULL_BEGIN
     NSMutableDictionary *params = [NSMutableDictionary new];
     params[@"signal"] = enable ? @"1" : @"0";
     
-    [self setAuthHeaderWithAccessToken];
-    
-    NSURLSessionDataTask *task = [self.manager PUT:[url description] parameters:params success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject) {
+    NSURLSessionDataTask *task = [self dataTaskWithMethod:@"PUT" URL:url parameters:params success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject) {
         if (completion)
         {
             completion(nil);
@@ -348,9 +826,7 @@ NS_ASSUME_NONNULL_BEGIN
 
 //    NSMutableDictionary *params = [self defaultParams];
 //    params[@"id"] = self.id;
-    [self setAuthHeaderWithAccessToken];
-
-    NSURLSessionDataTask *task = [self.manager DELETE:[url description] parameters:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
+    NSURLSessionDataTask *task = [self dataTaskWithMethod:@"DELETE" URL:url parameters:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
     {
         if (completion)
         {
@@ -379,9 +855,7 @@ NS_ASSUME_NONNULL_BEGIN
     NSMutableDictionary *params = [NSMutableDictionary new];
     params[@"name"] = newName;
 
-    [self setAuthHeaderWithAccessToken];
-    
-    NSURLSessionDataTask *task = [self.manager PUT:[url description] parameters:params success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject) {
+    NSURLSessionDataTask *task = [self dataTaskWithMethod:@"PUT" URL:url parameters:params success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject) {
         _name = newName;
         if (completion)
         {
@@ -400,22 +874,65 @@ NS_ASSUME_NONNULL_BEGIN
 
 
 #pragma mark Internal use methods
+-(ParticleCloud *)cloud
+{
+    return _cloud ?: [ParticleCloud sharedInstance];
+}
+
+-(AFHTTPSessionManager *)manager
+{
+    // all devices share the cloud connection pool instead of a session (and TLS connections) each
+    return [self.cloud __sessionManager];
+}
+
 - (NSMutableDictionary *)defaultParams
 {
     // TODO: change access token to be passed in header not in body
-    if ([ParticleCloud sharedInstance].accessToken)
+    if (self.cloud.accessToken)
     {
-        return [@{@"access_token" : [ParticleCloud sharedInstance].accessToken} mutableCopy];
+        return [@{@"access_token" : self.cloud.accessToken} mutableCopy];
     }
     else return nil;
 }
 
--(void)setAuthHeaderWithAccessToken
+// the request serializer is shared with the cloud and all other devices, each request gets its own Authorization header
+// instead of setting one on the serializer (a concurrent login could otherwise send its Basic auth or none at all)
+-(void)setAuthHeaderWithAccessToken:(NSMutableURLRequest *)request
 {
-    if ([ParticleCloud sharedInstance].accessToken) {
-        NSString *authorization = [NSString stringWithFormat:@"Bearer %@",[ParticleCloud sharedInstance].accessToken];
-        [self.manager.requestSerializer setValue:authorization forHTTPHeaderField:@"Authorization"];
+    NSString *accessToken = self.cloud.accessToken;
+    [request setValue:(accessToken ? [NSString stringWithFormat:@"Bearer %@", accessToken] : nil) forHTTPHeaderField:@"Authorization"];
+}
+
+-(nullable NSURLSessionDataTask *)dataTaskWithMethod:(NSString *)method
+                                        URL:(NSURL *)url
+                                 parameters:(nullable NSDictionary *)parameters
+                                    success:(void (^)(NSURLSessionDataTask *task, id _Nullable responseObject))success
+                                    failure:(void (^)(NSURLSessionDataTask * _Nullable task, NSError *error))failure
+{
+    AFHTTPSessionManager *manager = self.manager;
+    NSError *serializationError = nil;
+    NSMutableURLRequest *request = [manager.requestSerializer requestWithMethod:method URLString:url.absoluteString parameters:parameters error:&serializationError];
+    if (!request)
+    {
+        dispatch_async(manager.completionQueue ?: dispatch_get_main_queue(), ^{
+            failure(nil, serializationError);
+        });
+        return nil;
     }
+    [self setAuthHeaderWithAccessToken:request];
+
+    __block NSURLSessionDataTask *task = [manager dataTaskWithRequest:request completionHandler:^(NSURLResponse * _Nonnull response, id _Nullable responseObject, NSError * _Nullable error) {
+        if (error)
+        {
+            failure(task, error);
+        }
+        else
+        {
+            success(task, responseObject);
+        }
+    }];
+    [task resume];
+    return task;
 }
 
 
@@ -455,9 +972,7 @@ NS_ASSUME_NONNULL_BEGIN
     
     NSMutableDictionary *params = [NSMutableDictionary new];
     params[@"app"] = knownAppName;
-    [self setAuthHeaderWithAccessToken];
-    
-    NSURLSessionDataTask *task = [self.manager PUT:[url description] parameters:params success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
+    NSURLSessionDataTask *task = [self dataTaskWithMethod:@"PUT" URL:url parameters:params success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
     {
         NSDictionary *responseDict = responseObject;
         if (responseDict[@"errors"])
@@ -489,8 +1004,6 @@ NS_ASSUME_NONNULL_BEGIN
 {
     NSURL *url = [self.baseURL URLByAppendingPathComponent:[NSString stringWithFormat:@"v1/devices/%@", self.id]];
     
-    [self setAuthHeaderWithAccessToken];
-    
     NSError *reqError;
     NSMutableURLRequest *request = [self.manager.requestSerializer multipartFormRequestWithMethod:@"PUT" URLString:url.description parameters:@{@"file_type" : @"binary"} constructingBodyWithBlock:^(id<AFMultipartFormData> formData) {
         // check this:
@@ -502,6 +1015,7 @@ NS_ASSUME_NONNULL_BEGIN
     
     if (!reqError)
     {
+        [self setAuthHeaderWithAccessToken:request];
         NSURLSessionDataTask *task = [self.manager dataTaskWithRequest:request completionHandler:^(NSURLResponse * _Nonnull response, id  _Nullable responseObject, NSError * _Nullable error)
         {
             if (error == nil)
@@ -549,12 +1063,12 @@ NS_ASSUME_NONNULL_BEGIN
 
 -(nullable id)subscribeToEventsWithPrefix:(nullable NSString *)eventNamePrefix handler:(nullable ParticleEventHandler)eventHandler
 {
-    return [[ParticleCloud sharedInstance] subscribeToDeviceEventsWithPrefix:eventNamePrefix deviceID:self.name handler:eventHandler]; // DEBUG TODO self.id
+    return [self.cloud subscribeToDeviceEventsWithPrefix:eventNamePrefix deviceID:self.name handler:eventHandler]; // DEBUG TODO self.id
 }
 
 -(void)unsubscribeFromEventWithID:(id)eventListenerID
 {
-    [[ParticleCloud sharedInstance] unsubscribeFromEventWithID:eventListenerID];
+    [self.cloud unsubscribeFromEventWithID:eventListenerID];
 }
 
 -(NSURLSessionDataTask *)getCurrentDataUsage:(nullable void(^)(float dataUsed, NSError* _Nullable error))completion
@@ -571,9 +1085,7 @@ NS_ASSUME_NONNULL_BEGIN
     //curl https://api.particle.io/v1/sims/8934076500002586576/data_usage\?access_token\=5451a5d6c6c54f6b20e3a109ee764596dc38a520
     NSURL *url = [self.baseURL URLByAppendingPathComponent:[NSString stringWithFormat:@"v1/sims/%@/data_usage", self.lastIccid]];
     
-    [self setAuthHeaderWithAccessToken];
-    
-    NSURLSessionDataTask *task = [self.manager GET:[url description] parameters:nil progress:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
+    NSURLSessionDataTask *task = [self dataTaskWithMethod:@"GET" URL:url parameters:nil success:^(NSURLSessionDataTask * _Nonnull task, id  _Nullable responseObject)
                                   {
                                       if (completion)
                                       {
@@ -627,6 +1139,7 @@ NS_ASSUME_NONNULL_BEGIN
         if ([event.data isEqualToString:@"offline"]) {
             self.connected = NO;
             self.isFlashing = NO;
+            [self clearVariableCache];
             if ([self.delegate respondsToSelector:@selector(particleDevice:didReceiveSystemEvent:)]) {
                 [self.delegate particleDevice:self didReceiveSystemEvent:ParticleDeviceSystemEventWentOffline];
             }
@@ -636,6 +1149,7 @@ NS_ASSUME_NONNULL_BEGIN
     if ([event.event isEqualToString:@"spark/flash/status"]) {
         if ([event.data containsString:@"started"]) {
             self.isFlashing = YES;
+            [self clearVariableCache]; // new firmware might expose different values
             if ([self.delegate respondsToSelector:@selector(particleDevice:didReceiveSystemEvent:)]) {
                 [self.delegate particleDevice:self didReceiveSystemEvent:ParticleDeviceSystemEventFlashStarted];
                 
@@ -679,6 +1193,148 @@ NS_ASSUME_NONNULL_BEGIN
     
 }
 
+-(void)__setFunctionsAndVariablesWithDetailParams:(NSDictionary *)params
+{
+    for (NSString *key in @[@"functions", @"variables"])
+    {
+        const ParticleDeviceParam *param = &ParticleDeviceParams[ParticleDeviceParamIndexes[key].unsignedIntegerValue];
+        id value = params[key];
+        if ((value) && (ParticleDeviceParamAcceptsObject(param->type, value)))
+        {
+            param->set(self, value);
+        }
+    }
+}
+
+
+@end
+
+@implementation ParticleVariableRead
+
+-(BOOL)isFinished
+{
+    return self.completion == nil;
+}
+
+-(void)finishWithResult:(nullable id)result error:(nullable NSError *)error
+{
+    void (^completion)(id _Nullable, NSError * _Nullable);
+    @synchronized (self) {
+        completion = self.completion;
+        self.completion = nil;
+    }
+
+    if (completion)
+    {
+        completion(result, error);
+    }
+}
+
+-(void)cancel
+{
+    void (^completion)(id _Nullable, NSError * _Nullable);
+    @synchronized (self) {
+        completion = self.completion;
+        self.completion = nil;
+    }
+    if (!completion)
+    {
+        return; // finished already
+    }
+
+    [self.device detachVariableRead:self];
+    NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:@{NSLocalizedDescriptionKey : @"cancelled"}];
+    dispatch_async(self.completionQueue, ^{
+        completion(nil, error);
+    });
+}
+
+-(NSString *)description
+{
+    return [NSString stringWithFormat:@"<ParticleVariableRead 0x%lx, variable: %@, task: %@, finished: %@>",
+            (unsigned long)self, self.variableName, self.task, self.finished ? @"true" : @"false"];
+}
+
+@end
+
+@implementation ParticleFunctionCallResult
+
+-(instancetype)initWithDeviceID:(NSString *)deviceID returnValue:(nullable NSNumber *)returnValue error:(nullable NSError *)error timedOut:(BOOL)timedOut latency:(NSTimeInterval)latency
+{
+    if (self = [super init])
+    {
+        _deviceID = deviceID;
+        _returnValue = returnValue;
+        _error = error;
+        _timedOut = timedOut;
+        _latency = latency;
+    }
+
+    return self;
+}
+
+-(NSString *)description
+{
+    return [NSString stringWithFormat:@"<FunctionCallResult: %@, return value: %@, error: %@, latency: %.0f ms>",
+            self.deviceID, self.returnValue, self.timedOut ? @"timed out" : self.error.localizedDescription, self.latency * 1000];
+}
+
+@end
+
+@implementation ParticleFunctionCallSummary
+
+-(instancetype)initWithResults:(NSArray<ParticleFunctionCallResult *> *)results duration:(NSTimeInterval)duration
+{
+    if (self = [super init])
+    {
+        _results = [results copy];
+        _duration = duration;
+
+        NSMutableArray<NSNumber *> *latencies = [NSMutableArray arrayWithCapacity:results.count];
+        for (ParticleFunctionCallResult *result in results)
+        {
+            if (result.error)
+            {
+                _failedCount++;
+                if (result.timedOut)
+                {
+                    _timedOutCount++;
+                }
+            }
+            else
+            {
+                _succeededCount++;
+                [latencies addObject:@(result.latency)];
+            }
+        }
+
+        [latencies sortUsingSelector:@selector(compare:)];
+        _latencyP50 = [ParticleFunctionCallSummary percentile:0.50 ofSortedValues:latencies];
+        _latencyP90 = [ParticleFunctionCallSummary percentile:0.90 ofSortedValues:latencies];
+        _latencyP99 = [ParticleFunctionCallSummary percentile:0.99 ofSortedValues:latencies];
+        _latencyMax = latencies.lastObject.doubleValue;
+    }
+
+    return self;
+}
+
+// nearest rank percentile
++(NSTimeInterval)percentile:(double)percentile ofSortedValues:(NSArray<NSNumber *> *)values
+{
+    if (values.count == 0)
+    {
+        return 0;
+    }
+    NSUInteger rank = (NSUInteger)ceil(percentile * values.count);
+    return values[MAX(rank, 1) - 1].doubleValue;
+}
+
+-(NSString *)description
+{
+    return [NSString stringWithFormat:@"<FunctionCallSummary: %lu succeeded, %lu failed (%lu timed out) in %.0f ms, latency p50: %.0f ms, p90: %.0f ms, p99: %.0f ms, max: %.0f ms>",
+            (unsigned long)self.succeededCount, (unsigned long)self.failedCount, (unsigned long)self.timedOutCount, self.duration * 1000,
+            self.latencyP50 * 1000, self.latencyP90 * 1000, self.latencyP99 * 1000, self.latencyMax * 1000];
+}
 
 @end
 
@@ -0,0 +1,70 @@
+//
+//  ParticleDeviceRegistry.h
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class ParticleCloud;
+@class ParticleDevice;
+@class ParticleEvent;
+
+/**
+ *  Devices of the logged in user keyed by device ID, kept up to date by getDevices/getDevice calls and by
+ *  the devices system events stream (online/offline, flashing, app hash) in between.
+ *  Querying the registry never performs network I/O.
+ *
+ *  When snapshotURL is set the devices are saved to a binary property list snapshot after they are fetched and restored from
+ *  it on first access, so an app can show the device list of the previous launch before getDevices returns. Restored devices
+ *  are as of their last fetch - getDevices revalidates the listing and the details of online devices (ETag/Last-Modified).
+ *  A snapshot is restored only for the user it was saved for (logged in username, or access token of an injected session).
+ */
+@interface ParticleDeviceRegistry : NSObject
+
+/**
+ *  File URL of the devices snapshot, nil to not persist devices (default for registries not owned by a ParticleCloud)
+ */
+@property (atomic, strong, nullable) NSURL *snapshotURL;
+
+/**
+ *  Number of known devices
+ */
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ *  Snapshot of all known devices
+ */
+-(NSArray<ParticleDevice *> *)devices;
+
+/**
+ *  Known device by ID
+ *
+ *  @param deviceID Device ID
+ *  @return device, nil if device is not known (getDevices not called yet or not claimed by user)
+ */
+-(nullable ParticleDevice *)deviceWithID:(NSString *)deviceID;
+
+// Internal use
+-(void)setDevice:(ParticleDevice *)device params:(NSDictionary *)params detailed:(BOOL)detailed;
+-(void)setDevice:(ParticleDevice *)device paramsJSON:(NSData *)json;        // listed device created from its JSON
+-(void)setDevice:(ParticleDevice *)device detailParams:(NSDictionary *)params validators:(nullable NSDictionary *)validators; // validators of the GET /v1/devices/:id response
+-(nullable NSDictionary *)detailValidatorsForDeviceID:(NSString *)deviceID;
+-(nullable ParticleDevice *)revalidatedDeviceWithID:(NSString *)deviceID;   // device of the cached details, server says they are unchanged
+-(nullable NSDictionary *)cachedDetailParamsForListedDeviceID:(NSString *)deviceID;  // details a system event did not invalidate since
+-(void)retainOnlyDevicesWithIDs:(NSSet<NSString *> *)deviceIDs;
+-(void)applySystemEvent:(ParticleEvent *)event;
+-(void)removeAllDevices;                                                // logged out - the snapshot is deleted too
+-(void)unloadAllDevices;                                                // session replaced - the snapshot is kept for the next session of the same user
+@property (nonatomic, weak, nullable) ParticleCloud *cloud;             // restored devices are created with it, snapshot is restored only for its logged in user
+-(nullable NSArray<NSData *> *)listing;                                 // JSON of each device of the last GET /v1/devices response
+-(nullable NSDictionary *)listingValidators;
+-(void)setListing:(NSArray<NSData *> *)listing validators:(nullable NSDictionary *)validators;
+-(void)synchronizeSnapshot;                                             // write pending snapshot changes, blocks until written
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,503 @@
+//
+//  ParticleDeviceRegistry.m
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import "ParticleDeviceRegistry.h"
+#import "ParticleDevice.h"
+#import "ParticleEvent.h"
+#import "ParticleCloud.h"
+#import <CommonCrypto/CommonDigest.h>
+
+#define SNAPSHOT_VERSION                4
+#define DEFAULT_SNAPSHOT_WRITE_DELAY    1.0     // coalesces the setDevice calls of a getDevices into one write
+
+NS_ASSUME_NONNULL_BEGIN
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+@interface ParticleDeviceRegistryEntry : NSObject
+
+@property (nonatomic, strong) ParticleDevice *device;
+@property (nonatomic, strong) NSDictionary *params;                 // params the device was created with
+@property (nonatomic, strong, nullable) NSData *paramsJSON;         // params as restored from the snapshot, decoded on first use
+@property (nonatomic) BOOL detailed;                                // device was created from detailParams
+@property (nonatomic, strong, nullable) NSDictionary *detailParams; // last GET /v1/devices/:id response, nil if only listed
+@property (nonatomic, strong, nullable) NSDictionary *detailValidators; // ETag/Last-Modified of detailParams
+@property (nonatomic) BOOL needsDetails;                            // system events say functions/variables might have changed
+
+@end
+
+@implementation ParticleDeviceRegistryEntry
+
+-(NSDictionary *)params
+{
+    if ((!_params) && (_paramsJSON))
+    {
+        _params = [NSJSONSerialization JSONObjectWithData:_paramsJSON options:0 error:nil] ?: @{};
+    }
+    return _params;
+}
+
+-(void)setParams:(NSDictionary *)params
+{
+    _params = params;
+    _paramsJSON = nil;
+}
+
+-(void)setParamsJSON:(nullable NSData *)paramsJSON
+{
+    _paramsJSON = paramsJSON;
+    _params = nil;
+}
+
+// restored details are only kept as params
+-(nullable NSDictionary *)detailParams
+{
+    return _detailParams ?: (self.detailed ? self.params : nil);
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+@interface ParticleDeviceRegistry ()
+
+@property (nonatomic, strong) NSMutableDictionary<NSString *, ParticleDeviceRegistryEntry *> *entries;
+@property (nonatomic, strong, nullable) NSArray<NSData *> *lastListing;
+@property (nonatomic, strong, nullable) NSDictionary *lastListingValidators;
+@property (nonatomic) BOOL snapshotRestored;
+@property (nonatomic) BOOL snapshotWriteScheduled;
+@property (nonatomic, strong) dispatch_queue_t snapshotQueue;
+
+@end
+
+@implementation ParticleDeviceRegistry
+
+@synthesize snapshotURL = _snapshotURL;
+
+-(instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _entries = [NSMutableDictionary new];
+        _snapshotQueue = dispatch_queue_create("io.particle.deviceregistry.snapshot", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+-(nullable NSURL *)snapshotURL
+{
+    @synchronized (self) {
+        return _snapshotURL;
+    }
+}
+
+-(void)setSnapshotURL:(nullable NSURL *)snapshotURL
+{
+    @synchronized (self) {
+        _snapshotURL = snapshotURL;
+        self.snapshotRestored = NO;
+    }
+}
+
+-(NSUInteger)count
+{
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        return self.entries.count;
+    }
+}
+
+-(NSArray<ParticleDevice *> *)devices
+{
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        return [self.entries.allValues valueForKey:@"device"];
+    }
+}
+
+-(nullable ParticleDevice *)deviceWithID:(NSString *)deviceID
+{
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        return self.entries[deviceID].device;
+    }
+}
+
+#pragma mark Internal use methods
+
+-(void)setDevice:(ParticleDevice *)device params:(NSDictionary *)params detailed:(BOOL)detailed
+{
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        ParticleDeviceRegistryEntry *entry = self.entries[device.id];
+        if (!entry)
+        {
+            entry = [ParticleDeviceRegistryEntry new];
+            self.entries[device.id] = entry;
+        }
+
+        if ((entry.device.delegate) && (!device.delegate))
+        {
+            device.delegate = entry.device.delegate; // system events keep reaching the delegate of the replaced instance
+        }
+        entry.device = device;
+        if ((!detailed) && (entry.detailed))
+        {
+            entry.detailParams = entry.detailParams; // keep the details before params are replaced
+        }
+        entry.params = params;
+        entry.detailed = detailed;
+
+        if (detailed)
+        {
+            entry.detailParams = params; // same details merged with a newer listing keep their validators
+            entry.needsDetails = NO;
+        }
+        [self scheduleSnapshotWrite];
+    }
+}
+
+-(void)setDevice:(ParticleDevice *)device paramsJSON:(NSData *)json
+{
+    @synchronized (self) {
+        [self setDevice:device params:@{} detailed:NO];
+        self.entries[device.id].paramsJSON = json; // params decoded only if needed
+    }
+}
+
+-(void)setDevice:(ParticleDevice *)device detailParams:(NSDictionary *)params validators:(nullable NSDictionary *)validators
+{
+    @synchronized (self) {
+        [self setDevice:device params:params detailed:YES];
+        self.entries[device.id].detailValidators = validators;
+    }
+}
+
+-(nullable NSDictionary *)detailValidatorsForDeviceID:(NSString *)deviceID
+{
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        ParticleDeviceRegistryEntry *entry = self.entries[deviceID];
+        return entry.detailParams ? entry.detailValidators : nil;
+    }
+}
+
+-(nullable ParticleDevice *)revalidatedDeviceWithID:(NSString *)deviceID
+{
+    @synchronized (self) {
+        ParticleDeviceRegistryEntry *entry = self.entries[deviceID];
+        if (!entry.detailParams)
+        {
+            return nil;
+        }
+
+        // current device was created from a listing since - it lacks the functions and variables
+        if (!entry.detailed)
+        {
+            ParticleDevice *device = [[ParticleDevice alloc] initWithParams:entry.detailParams cloud:self.cloud];
+            if (!device)
+            {
+                return nil;
+            }
+            device.delegate = entry.device.delegate;
+            entry.device = device;
+            entry.params = entry.detailParams;
+            entry.detailed = YES;
+            [self scheduleSnapshotWrite];
+        }
+        entry.needsDetails = NO;
+        return entry.device;
+    }
+}
+
+-(nullable NSDictionary *)cachedDetailParamsForListedDeviceID:(NSString *)deviceID
+{
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        ParticleDeviceRegistryEntry *entry = self.entries[deviceID];
+
+        // details are refetched only for devices which went through a state change since they were last fetched:
+        // never fetched, came online, got flashed (system events) or came online without us seeing the event
+        if ((!entry.detailParams) || (entry.needsDetails) || (!entry.device.connected))
+        {
+            return nil;
+        }
+        return entry.detailParams;
+    }
+}
+
+-(void)retainOnlyDevicesWithIDs:(NSSet<NSString *> *)deviceIDs
+{
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        for (NSString *deviceID in self.entries.allKeys)
+        {
+            if (![deviceIDs containsObject:deviceID])
+            {
+                [self.entries removeObjectForKey:deviceID]; // unclaimed or transferred
+                [self scheduleSnapshotWrite];
+            }
+        }
+    }
+}
+
+-(void)applySystemEvent:(ParticleEvent *)event
+{
+    ParticleDevice *device;
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        ParticleDeviceRegistryEntry *entry = self.entries[event.deviceID];
+        if (!entry)
+        {
+            return;
+        }
+        device = entry.device;
+
+        // events after which the device might run different firmware (functions/variables)
+        NSString *name = [event.event stringByReplacingOccurrencesOfString:@"particle/" withString:@"spark/" options:NSAnchoredSearch range:NSMakeRange(0, event.event.length)];
+        if ((([name isEqualToString:@"spark/status"]) && ([event.data isEqualToString:@"online"])) ||
+            ([name isEqualToString:@"spark/device/app-hash"]) ||
+            ([name hasPrefix:@"spark/flash/status"]) ||
+            ([name hasPrefix:@"spark/status/safe-mode"]))
+        {
+            entry.needsDetails = YES;
+        }
+    }
+
+    [device __receivedSystemEvent:event];
+}
+
+-(void)unloadAllDevices
+{
+    [self synchronizeSnapshot]; // pending changes belong to the session being replaced
+    @synchronized (self) {
+        [self.entries removeAllObjects];
+        self.lastListing = nil;
+        self.lastListingValidators = nil;
+        self.snapshotWriteScheduled = NO;
+        self.snapshotRestored = NO; // the next session restores the snapshot if it belongs to the same user
+    }
+}
+
+-(void)removeAllDevices
+{
+    @synchronized (self) {
+        [self.entries removeAllObjects];
+        self.lastListing = nil;
+        self.lastListingValidators = nil;
+        self.snapshotWriteScheduled = NO;
+        self.snapshotRestored = NO;
+
+        // logged out - the next user must not see these devices
+        NSURL *snapshotURL = self.snapshotURL;
+        if (snapshotURL)
+        {
+            dispatch_async(self.snapshotQueue, ^{
+                [[NSFileManager defaultManager] removeItemAtURL:snapshotURL error:nil];
+            });
+        }
+    }
+}
+
+-(nullable NSArray<NSData *> *)listing
+{
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        return self.lastListing;
+    }
+}
+
+-(nullable NSDictionary *)listingValidators
+{
+    @synchronized (self) {
+        [self restoreSnapshotIfNeeded];
+        return self.lastListing ? self.lastListingValidators : nil;
+    }
+}
+
+-(void)setListing:(NSArray<NSData *> *)listing validators:(nullable NSDictionary *)validators
+{
+    @synchronized (self) {
+        self.lastListing = listing;
+        self.lastListingValidators = validators;
+        [self scheduleSnapshotWrite];
+    }
+}
+
+-(void)synchronizeSnapshot
+{
+    dispatch_sync(self.snapshotQueue, ^{
+        [self writeSnapshot];
+    });
+}
+
+#pragma mark Snapshot
+
+// user the snapshot belongs to - the username, or a digest of the access token for injected sessions (never the token itself)
+static NSString * _Nullable ParticleDeviceSnapshotOwner(ParticleCloud * _Nullable cloud)
+{
+    if (cloud.loggedInUsername.length > 0)
+    {
+        return [@"user:" stringByAppendingString:cloud.loggedInUsername];
+    }
+
+    NSData *token = [cloud.accessToken dataUsingEncoding:NSUTF8StringEncoding];
+    if (token.length == 0)
+    {
+        return nil;
+    }
+    uint8_t digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(token.bytes, (CC_LONG)token.length, digest);
+    NSMutableString *owner = [NSMutableString stringWithCapacity:6 + CC_SHA256_DIGEST_LENGTH * 2];
+    [owner appendString:@"token:"];
+    for (NSUInteger i = 0; i < CC_SHA256_DIGEST_LENGTH; i++)
+    {
+        [owner appendFormat:@"%02x", digest[i]];
+    }
+    return owner;
+}
+
+// lock must be held
+-(void)restoreSnapshotIfNeeded
+{
+    if ((self.snapshotRestored) || (!self.snapshotURL))
+    {
+        return;
+    }
+
+    // not before a session exists - the snapshot belongs to a user
+    ParticleCloud *cloud = self.cloud;
+    if (!cloud.isAuthenticated)
+    {
+        return;
+    }
+    self.snapshotRestored = YES;
+
+    if ((self.entries.count > 0) || (self.lastListing))
+    {
+        return; // already fetched, newer than the snapshot
+    }
+
+    NSData *data = [NSData dataWithContentsOfURL:self.snapshotURL options:NSDataReadingMappedIfSafe error:nil];
+    if (!data)
+    {
+        return;
+    }
+    NSDictionary *snapshot = [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:nil];
+    if ((![snapshot isKindOfClass:[NSDictionary class]]) || ([snapshot[@"version"] integerValue] != SNAPSHOT_VERSION))
+    {
+        return;
+    }
+    NSString *owner = ParticleDeviceSnapshotOwner(cloud);
+    if (!owner)
+    {
+        return; // no way to tell whose devices these are
+    }
+    if (![snapshot[@"owner"] isEqual:owner])
+    {
+        // another user's devices - this user must not see them later either
+        NSURL *snapshotURL = self.snapshotURL;
+        dispatch_async(self.snapshotQueue, ^{
+            [[NSFileManager defaultManager] removeItemAtURL:snapshotURL error:nil];
+        });
+        return;
+    }
+
+    // devices are decoded from the JSON they were fetched as, their params dictionaries only when needed
+    for (NSDictionary *deviceSnapshot in snapshot[@"devices"])
+    {
+        NSData *json = deviceSnapshot[@"json"];
+        ParticleDevice *device = [json isKindOfClass:[NSData class]] ? [[ParticleDevice alloc] initWithJSONData:json cloud:cloud] : nil;
+        if (![device.id isKindOfClass:[NSString class]])
+        {
+            continue;
+        }
+
+        ParticleDeviceRegistryEntry *entry = [ParticleDeviceRegistryEntry new];
+        entry.device = device;
+        entry.paramsJSON = json;
+        entry.detailed = [deviceSnapshot[@"detailed"] boolValue];
+        entry.detailValidators = deviceSnapshot[@"validators"];
+        entry.needsDetails = YES; // system events of the time the app was not running were missed
+        self.entries[device.id] = entry;
+    }
+
+    if ([snapshot[@"listing"] isKindOfClass:[NSArray class]])
+    {
+        self.lastListing = snapshot[@"listing"];
+        self.lastListingValidators = snapshot[@"listingValidators"];
+    }
+}
+
+// lock must be held
+-(void)scheduleSnapshotWrite
+{
+    if ((!self.snapshotURL) || (self.snapshotWriteScheduled))
+    {
+        return;
+    }
+    self.snapshotWriteScheduled = YES;
+
+    __weak ParticleDeviceRegistry *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(DEFAULT_SNAPSHOT_WRITE_DELAY * NSEC_PER_SEC)), self.snapshotQueue, ^{
+        [weakSelf writeSnapshot];
+    });
+}
+
+// runs on snapshotQueue
+-(void)writeSnapshot
+{
+    NSURL *snapshotURL;
+    NSMutableDictionary *snapshot = [NSMutableDictionary new];
+    NSMutableArray *devices;
+    @synchronized (self) {
+        snapshotURL = self.snapshotURL;
+        if ((!self.snapshotWriteScheduled) || (!snapshotURL))
+        {
+            return;
+        }
+        self.snapshotWriteScheduled = NO;
+
+        // params are kept as JSON (property lists have no null), encoded below outside the lock
+        devices = [NSMutableArray arrayWithCapacity:self.entries.count];
+        for (ParticleDeviceRegistryEntry *entry in self.entries.allValues)
+        {
+            NSMutableDictionary *deviceSnapshot = [@{@"json" : entry.paramsJSON ?: entry.params, @"detailed" : @(entry.detailed)} mutableCopy];
+            deviceSnapshot[@"validators"] = entry.detailed ? entry.detailValidators : nil;
+            [devices addObject:deviceSnapshot];
+        }
+        snapshot[@"version"] = @SNAPSHOT_VERSION;
+        snapshot[@"owner"] = ParticleDeviceSnapshotOwner(self.cloud);
+        if (!snapshot[@"owner"])
+        {
+            return; // nothing to tell whose devices these are on the next launch
+        }
+        snapshot[@"listing"] = self.lastListing;
+        snapshot[@"listingValidators"] = self.lastListingValidators;
+    }
+
+    for (NSMutableDictionary *deviceSnapshot in devices)
+    {
+        if (![deviceSnapshot[@"json"] isKindOfClass:[NSData class]])
+        {
+            deviceSnapshot[@"json"] = [NSJSONSerialization dataWithJSONObject:deviceSnapshot[@"json"] options:0 error:nil];
+        }
+    }
+    snapshot[@"devices"] = devices;
+
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:snapshot format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+    if (data)
+    {
+        [[NSFileManager defaultManager] createDirectoryAtURL:snapshotURL.URLByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:nil];
+        [data writeToURL:snapshotURL options:NSDataWritingAtomic error:nil];
+    }
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -13,7 +13,22 @@ NS_ASSUME_NONNULL_BEGIN
 @class ParticleEvent;
 
 typedef void (^ParticleEventHandler)(ParticleEvent * _Nullable event, NSError * _Nullable error);
+typedef void (^ParticleEventBatchHandler)(NSArray<ParticleEvent *> * _Nullable events, NSError * _Nullable error);
 
+/**
+ *  What a subscription does with a new event when its delivery queue is full (handler slower than the event stream)
+ */
+typedef NS_ENUM(NSInteger, ParticleEventOverflowPolicy) {
+    ParticleEventOverflowPolicyDropOldest=0,    // discard the oldest queued event
+    ParticleEventOverflowPolicyDropNewest,      // discard the new event
+    ParticleEventOverflowPolicyCoalesce,        // keep only the latest queued event per (deviceID, event name), drop oldest if still full
+    ParticleEventOverflowPolicyBlock,           // stop reading event streams until the handler catches up (affects all subscriptions of the cloud instance - its streams are read by one queue)
+};
+
+/**
+ *  Events received from an event stream are decoded lazily: event name and device ID are available right away,
+ *  data, ttl and time are decoded from the raw payload bytes on first access.
+ */
 @interface ParticleEvent : NSObject
 
 @property (nonatomic, strong) NSString *deviceID;   // Event published by this device ID
@@ -21,6 +36,7 @@ typedef void (^ParticleEventHandler)(ParticleEvent * _Nullable event, NSError *
 @property (nonatomic, strong) NSString *event;      // Event name
 @property (nonatomic, strong) NSDate *time;         // Event "published at" time/date UTC
 @property (nonatomic) NSInteger ttl;                // Event time to live (currently unused)
+@property (nonatomic, nullable, readonly) NSData *payload;  // Raw JSON event envelope as received from the event stream, nil if event was created from a dictionary
 
 /**
  *  Particle event handler class initializer which receives a dictionary argument
@@ -29,6 +45,44 @@ typedef void (^ParticleEventHandler)(ParticleEvent * _Nullable event, NSError *
  */
 -(instancetype)initWithEventDict:(NSDictionary *)eventDict;
 
+/**
+ *  Particle event initializer which keeps the raw event stream payload and decodes its fields on demand (internal use)
+ *
+ *  @param eventName    Event name (SSE event: field)
+ *  @param payload      JSON event envelope (SSE data: field) - {"data":..,"ttl":..,"published_at":..,"coreid":..}, retained without copying so must not be mutated
+ *  @return event, nil if payload is not a flat JSON object - fall back to initWithEventDict:
+ */
+-(nullable instancetype)initWithEventName:(nullable NSString *)eventName payload:(NSData *)payload;
+
+@end
+
+/**
+ *  Event subscription delivery counters snapshot, use to size subscription queue depth
+ */
+@interface ParticleEventSubscriptionStats : NSObject
+
+@property (nonatomic, readonly) NSUInteger queueDepth;              // configured delivery queue depth, 0 = unbounded
+@property (nonatomic, readonly) NSUInteger queuedCount;             // events currently waiting for the handler
+@property (nonatomic, readonly) NSUInteger maxQueuedCount;          // queue high water mark
+@property (nonatomic, readonly) unsigned long long deliveredCount;  // events handed to the handler
+@property (nonatomic, readonly) unsigned long long droppedCount;    // events discarded because the queue was full
+@property (nonatomic, readonly) unsigned long long coalescedCount;  // queued events replaced by a newer event of the same device and name
+// event stream the subscription is served by
+@property (nonatomic, readonly) NSUInteger reconnectCount;          // times the stream connection was lost and re-established
+@property (nonatomic, readonly) NSTimeInterval lastRecoveryTime;    // seconds the stream took to reconnect the last time
+@property (nonatomic, readonly) unsigned long long missedEventCount; // events skipped across reconnects, known only if the cloud sends event IDs
+
+// Internal use
+-(instancetype)initWithQueueDepth:(NSUInteger)queueDepth
+                      queuedCount:(NSUInteger)queuedCount
+                   maxQueuedCount:(NSUInteger)maxQueuedCount
+                   deliveredCount:(unsigned long long)deliveredCount
+                     droppedCount:(unsigned long long)droppedCount
+                   coalescedCount:(unsigned long long)coalescedCount
+                   reconnectCount:(NSUInteger)reconnectCount
+                 lastRecoveryTime:(NSTimeInterval)lastRecoveryTime
+                 missedEventCount:(unsigned long long)missedEventCount;
+
 @end
 
 NS_ASSUME_NONNULL_END
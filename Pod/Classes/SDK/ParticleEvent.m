@@ -7,10 +7,189 @@
 //
 
 #import "ParticleEvent.h"
+#import "ParticleTimestamp.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
-@implementation ParticleEvent
+typedef NS_ENUM(uint8_t, ParticleEventValueType) {
+    ParticleEventValueTypeNone=0,       // key not present
+    ParticleEventValueTypeString,       // plain string, range excludes the quotes
+    ParticleEventValueTypeEscapedString,// string with escape sequences, range includes the quotes
+    ParticleEventValueTypeLiteral,      // number, true, false or null
+};
+
+typedef struct {
+    NSRange range;
+    ParticleEventValueType type;
+} ParticleEventValue;
+
+// byte ranges of the fixed Particle event envelope fields
+typedef struct {
+    ParticleEventValue data;
+    ParticleEventValue ttl;
+    ParticleEventValue publishedAt;
+    ParticleEventValue coreID;
+    ParticleEventValue event;
+} ParticleEventEnvelope;
+
+typedef NS_OPTIONS(uint8_t, ParticleEventPendingField) {
+    ParticleEventPendingFieldData = 1 << 0,
+    ParticleEventPendingFieldTTL  = 1 << 1,
+    ParticleEventPendingFieldTime = 1 << 2,
+};
+
+#define PARTICLE_EVENT_KEY_IS(key, length, literal) (((length) == sizeof(literal) - 1) && (memcmp((key), (literal), sizeof(literal) - 1) == 0))
+
+static inline const uint8_t *ParticleEventSkipWhitespace(const uint8_t *p, const uint8_t *end)
+{
+    while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\n') || (*p == '\r')))
+    {
+        p++;
+    }
+    return p;
+}
+
+/**
+ *  Locate the envelope fields in a flat JSON object without building any objects.
+ *  Returns NO for anything outside the fixed envelope shape (nested values, escaped keys, malformed JSON).
+ */
+static BOOL ParticleEventScanEnvelope(const uint8_t *bytes, NSUInteger length, ParticleEventEnvelope *envelope)
+{
+    const uint8_t *end = bytes + length;
+    const uint8_t *p = ParticleEventSkipWhitespace(bytes, end);
+
+    if ((p == end) || (*p != '{'))
+    {
+        return NO;
+    }
+    p = ParticleEventSkipWhitespace(p + 1, end);
+
+    if ((p < end) && (*p == '}'))
+    {
+        return (ParticleEventSkipWhitespace(p + 1, end) == end);
+    }
+
+    while (p < end)
+    {
+        // key
+        if (*p != '"')
+        {
+            return NO;
+        }
+        const uint8_t *key = ++p;
+        while ((p < end) && (*p != '"'))
+        {
+            if (*p == '\\')
+            {
+                return NO;
+            }
+            p++;
+        }
+        if (p == end)
+        {
+            return NO;
+        }
+        NSUInteger keyLength = p - key;
+
+        p = ParticleEventSkipWhitespace(p + 1, end);
+        if ((p == end) || (*p != ':'))
+        {
+            return NO;
+        }
+        p = ParticleEventSkipWhitespace(p + 1, end);
+        if (p == end)
+        {
+            return NO;
+        }
+
+        // value
+        ParticleEventValue value;
+        if (*p == '"')
+        {
+            const uint8_t *start = p;
+            BOOL escaped = NO;
+            p++;
+            while ((p < end) && (*p != '"'))
+            {
+                if (*p == '\\')
+                {
+                    escaped = YES;
+                    p++;
+                }
+                p++;
+            }
+            if (p >= end)
+            {
+                return NO;
+            }
+            p++;
+            value.type = escaped ? ParticleEventValueTypeEscapedString : ParticleEventValueTypeString;
+            value.range = escaped ? NSMakeRange(start - bytes, p - start) : NSMakeRange(start + 1 - bytes, p - start - 2);
+        }
+        else if ((*p == '{') || (*p == '['))
+        {
+            return NO;
+        }
+        else
+        {
+            const uint8_t *start = p;
+            while ((p < end) && (*p != ',') && (*p != '}') && (*p != ' ') && (*p != '\t') && (*p != '\n') && (*p != '\r'))
+            {
+                p++;
+            }
+            value.type = ParticleEventValueTypeLiteral;
+            value.range = NSMakeRange(start - bytes, p - start);
+        }
+
+        if (PARTICLE_EVENT_KEY_IS(key, keyLength, "data"))
+        {
+            envelope->data = value;
+        }
+        else if (PARTICLE_EVENT_KEY_IS(key, keyLength, "ttl"))
+        {
+            envelope->ttl = value;
+        }
+        else if (PARTICLE_EVENT_KEY_IS(key, keyLength, "published_at"))
+        {
+            envelope->publishedAt = value;
+        }
+        else if (PARTICLE_EVENT_KEY_IS(key, keyLength, "coreid"))
+        {
+            envelope->coreID = value;
+        }
+        else if (PARTICLE_EVENT_KEY_IS(key, keyLength, "event"))
+        {
+            envelope->event = value;
+        }
+
+        p = ParticleEventSkipWhitespace(p, end);
+        if (p == end)
+        {
+            return NO;
+        }
+        if (*p == '}')
+        {
+            return (ParticleEventSkipWhitespace(p + 1, end) == end);
+        }
+        if (*p != ',')
+        {
+            return NO;
+        }
+        p = ParticleEventSkipWhitespace(p + 1, end);
+    }
+
+    return NO;
+}
+
+
+@implementation ParticleEvent {
+    ParticleEventEnvelope _envelope;
+    ParticleEventPendingField _pendingFields; // fields not decoded from payload yet
+}
+
+@synthesize data = _data;
+@synthesize ttl = _ttl;
+@synthesize time = _time;
 
 -(instancetype)initWithEventDict:(NSDictionary *)eventDict
 {
@@ -21,18 +200,133 @@ NS_ASSUME_NONNULL_BEGIN
         self.event = eventDict[@"event"];
         NSString *ttl = eventDict[@"ttl"];
         self.ttl = [ttl integerValue];
-        
-        NSString *dateString = eventDict[@"published_at"];// "2015-04-18T08:42:22.127Z"
-        NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
-        [formatter setDateFormat:@"yyyy-MM-dd'T'HH:mm:ss.SSSZ"];
-        NSLocale *posix = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
-        [formatter setLocale:posix];
-        self.time = [formatter dateFromString:dateString];
+        self.time = ParticleDateFromTimestamp(eventDict[@"published_at"]); // "2015-04-18T08:42:22.127Z"
     }
     
     return self;
 }
 
+-(nullable instancetype)initWithEventName:(nullable NSString *)eventName payload:(NSData *)payload
+{
+    if (self = [super init])
+    {
+        if (!ParticleEventScanEnvelope(payload.bytes, payload.length, &_envelope))
+        {
+            return nil;
+        }
+
+        _payload = payload;
+        _pendingFields = ParticleEventPendingFieldData | ParticleEventPendingFieldTTL | ParticleEventPendingFieldTime;
+
+        // needed by every subscription filter - decode now
+        self.deviceID = [self stringValue:_envelope.coreID];
+        self.event = eventName ?: [self stringValue:_envelope.event];
+    }
+
+    return self;
+}
+
+#pragma mark Lazily decoded fields
+
+-(nullable NSString *)data
+{
+    @synchronized (self) {
+        if (_pendingFields & ParticleEventPendingFieldData)
+        {
+            _pendingFields &= ~ParticleEventPendingFieldData;
+            _data = [self stringValue:_envelope.data];
+        }
+        return _data;
+    }
+}
+
+-(void)setData:(nullable NSString *)data
+{
+    @synchronized (self) {
+        _pendingFields &= ~ParticleEventPendingFieldData;
+        _data = data;
+    }
+}
+
+-(NSInteger)ttl
+{
+    @synchronized (self) {
+        if (_pendingFields & ParticleEventPendingFieldTTL)
+        {
+            _pendingFields &= ~ParticleEventPendingFieldTTL;
+            // cloud sends ttl as a string ("60"), integerValue also covers a plain number
+            _ttl = [[self stringValue:_envelope.ttl] integerValue];
+        }
+        return _ttl;
+    }
+}
+
+-(void)setTtl:(NSInteger)ttl
+{
+    @synchronized (self) {
+        _pendingFields &= ~ParticleEventPendingFieldTTL;
+        _ttl = ttl;
+    }
+}
+
+-(NSDate *)time
+{
+    @synchronized (self) {
+        if (_pendingFields & ParticleEventPendingFieldTime)
+        {
+            _pendingFields &= ~ParticleEventPendingFieldTime;
+            if (_envelope.publishedAt.type == ParticleEventValueTypeString)
+            {
+                // straight from the payload bytes, no intermediate string
+                _time = ParticleDateFromTimestampBytes((const char *)self.payload.bytes + _envelope.publishedAt.range.location, _envelope.publishedAt.range.length);
+            }
+            else
+            {
+                _time = ParticleDateFromTimestamp([self stringValue:_envelope.publishedAt]);
+            }
+        }
+        return _time;
+    }
+}
+
+-(void)setTime:(NSDate *)time
+{
+    @synchronized (self) {
+        _pendingFields &= ~ParticleEventPendingFieldTime;
+        _time = time;
+    }
+}
+
+-(nullable NSString *)stringValue:(ParticleEventValue)value
+{
+    const uint8_t *bytes = (const uint8_t *)self.payload.bytes + value.range.location;
+
+    switch (value.type)
+    {
+        case ParticleEventValueTypeString:
+            return [[NSString alloc] initWithBytes:bytes length:value.range.length encoding:NSUTF8StringEncoding];
+
+        case ParticleEventValueTypeEscapedString:
+        {
+            // rare - let NSJSONSerialization deal with \uXXXX, surrogate pairs etc.
+            NSData *quoted = [NSData dataWithBytesNoCopy:(void *)bytes length:value.range.length freeWhenDone:NO];
+            id string = [NSJSONSerialization JSONObjectWithData:quoted options:NSJSONReadingAllowFragments error:nil];
+            return [string isKindOfClass:[NSString class]] ? string : nil;
+        }
+
+        case ParticleEventValueTypeLiteral:
+            if (PARTICLE_EVENT_KEY_IS(bytes, value.range.length, "null"))
+            {
+                return nil;
+            }
+            return [[NSString alloc] initWithBytes:bytes length:value.range.length encoding:NSUTF8StringEncoding];
+
+        case ParticleEventValueTypeNone:
+        default:
+            return nil;
+    }
+}
+
 -(NSString *)description
 {
     return [NSString stringWithFormat:@"<Event: %@, DeviceID: %@, Data: %@, Time: %@, TTL: %ld>",
@@ -41,4 +335,43 @@ NS_ASSUME_NONNULL_BEGIN
 
 @end
 
+
+@implementation ParticleEventSubscriptionStats
+
+-(instancetype)initWithQueueDepth:(NSUInteger)queueDepth
+                      queuedCount:(NSUInteger)queuedCount
+                   maxQueuedCount:(NSUInteger)maxQueuedCount
+                   deliveredCount:(unsigned long long)deliveredCount
+                     droppedCount:(unsigned long long)droppedCount
+                   coalescedCount:(unsigned long long)coalescedCount
+                   reconnectCount:(NSUInteger)reconnectCount
+                 lastRecoveryTime:(NSTimeInterval)lastRecoveryTime
+                 missedEventCount:(unsigned long long)missedEventCount
+{
+    if (self = [super init])
+    {
+        _queueDepth = queueDepth;
+        _queuedCount = queuedCount;
+        _maxQueuedCount = maxQueuedCount;
+        _deliveredCount = deliveredCount;
+        _droppedCount = droppedCount;
+        _coalescedCount = coalescedCount;
+        _reconnectCount = reconnectCount;
+        _lastRecoveryTime = lastRecoveryTime;
+        _missedEventCount = missedEventCount;
+    }
+
+    return self;
+}
+
+-(NSString *)description
+{
+    return [NSString stringWithFormat:@"<SubscriptionStats: depth: %lu, queued: %lu (max %lu), delivered: %llu, dropped: %llu, coalesced: %llu, reconnects: %lu (last %.0f ms), missed: %llu>",
+            (unsigned long)self.queueDepth, (unsigned long)self.queuedCount, (unsigned long)self.maxQueuedCount,
+            self.deliveredCount, self.droppedCount, self.coalescedCount,
+            (unsigned long)self.reconnectCount, self.lastRecoveryTime * 1000, self.missedEventCount];
+}
+
+@end
+
 NS_ASSUME_NONNULL_END
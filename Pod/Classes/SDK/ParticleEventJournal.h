@@ -0,0 +1,128 @@
+//
+//  ParticleEventJournal.h
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class ParticleEvent;
+
+/**
+ *  Replay handler
+ *
+ *  @param event        Journaled event
+ *  @param nextOffset   Offset of the record following the event - pass it to replayEventsFromOffset: to resume after this event
+ *  @param stop         Set to YES to stop the replay
+ */
+typedef void (^ParticleEventJournalReplayHandler)(ParticleEvent *event, unsigned long long nextOffset, BOOL *stop);
+
+/**
+ *  Append-only on-disk log of received events, so events that arrived while the app was in background or offline can be
+ *  replayed later. Attach it to an event subscription with ParticleCloud setEventJournal:forEventListenerID:.
+ *
+ *  Records are stored as received from the event stream (event name, device ID and raw JSON payload), length prefixed, in
+ *  memory mapped segment files in directoryURL. Appends are batched in memory and written on the journal queue, never on
+ *  the thread reading the event stream. The oldest segments are deleted when the journal grows past maxJournalSize or
+ *  their last event is older than maxAge. Segment time and device ID indexes are kept in memory, rebuilt by a sequential
+ *  scan when the journal is opened.
+ *
+ *      ParticleEventJournal *journal = [[ParticleEventJournal alloc] initWithDirectoryURL:url error:&error];
+ *      [journal replayEventsSinceDate:lastSeen deviceID:nil handler:^(ParticleEvent *event, unsigned long long nextOffset, BOOL *stop) {
+ *          ...
+ *      }];
+ */
+@interface ParticleEventJournal : NSObject
+
+/**
+ *  Directory holding the journal segment files
+ */
+@property (nonatomic, strong, readonly) NSURL *directoryURL;
+
+/**
+ *  Size of a segment file (default 4 MB), applies to segments started afterwards
+ */
+@property (atomic) unsigned long long maxSegmentSize;
+
+/**
+ *  Total size segments are trimmed to by deleting the oldest (default 64 MB), 0 for no limit. The segment being written is never deleted.
+ */
+@property (atomic) unsigned long long maxJournalSize;
+
+/**
+ *  Segments whose last event is older than maxAge are deleted (default 7 days), 0 for no limit
+ */
+@property (atomic) NSTimeInterval maxAge;
+
+/**
+ *  Longest time an appended event waits in memory before it is written (default 0.25 s)
+ */
+@property (atomic) NSTimeInterval flushInterval;
+
+/**
+ *  Offset of the oldest record still in the journal
+ */
+@property (nonatomic, readonly) unsigned long long startOffset;
+
+/**
+ *  Offset the next written record goes to, records still waiting in memory are not counted
+ */
+@property (nonatomic, readonly) unsigned long long endOffset;
+
+/**
+ *  Number of segment files
+ */
+@property (nonatomic, readonly) NSUInteger segmentCount;
+
+/**
+ *  Open the journal in a directory, creating it if needed. A directory is used by one journal instance at a time.
+ *
+ *  @param directoryURL File URL of the journal directory
+ *  @param error        File system error if the journal can not be opened
+ */
+-(nullable instancetype)initWithDirectoryURL:(NSURL *)directoryURL error:(NSError **)error NS_DESIGNATED_INITIALIZER;
+-(instancetype)init __attribute__((unavailable("Must use initWithDirectoryURL:error:")));
+
+/**
+ *  Append an event, returns without waiting for the write. The record is time stamped with the current time.
+ */
+-(void)appendEvent:(ParticleEvent *)event;
+
+/**
+ *  Append a raw event stream record (internal use)
+ *
+ *  @param eventName    SSE event: field
+ *  @param deviceID     Publishing device ID
+ *  @param payload      SSE data: field - the JSON event envelope
+ */
+-(void)appendEventWithName:(NSString *)eventName deviceID:(nullable NSString *)deviceID payload:(NSData *)payload;
+
+/**
+ *  Write all appended events and schedule them to be flushed to disk, blocks until written
+ */
+-(void)synchronize;
+
+/**
+ *  Replay journaled events in the order they were appended, on the calling thread. Events still waiting in memory are written first.
+ *
+ *  @param offset   Offset to start at - 0 or a nextOffset handed to an earlier replay handler. Offsets of deleted segments start at the oldest record.
+ *  @param deviceID Replay only events of this device, nil for all
+ *  @param handler  Called for each event
+ */
+-(void)replayEventsFromOffset:(unsigned long long)offset deviceID:(nullable NSString *)deviceID handler:(ParticleEventJournalReplayHandler)handler;
+
+/**
+ *  Replay journaled events received at or after date, on the calling thread
+ *
+ *  @param date     Earliest receive time
+ *  @param deviceID Replay only events of this device, nil for all
+ *  @param handler  Called for each event
+ */
+-(void)replayEventsSinceDate:(NSDate *)date deviceID:(nullable NSString *)deviceID handler:(ParticleEventJournalReplayHandler)handler;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,639 @@
+//
+//  ParticleEventJournal.m
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import "ParticleEventJournal.h"
+#import "ParticleEvent.h"
+#import "ParticleTimestamp.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+#define DEFAULT_JOURNAL_SEGMENT_SIZE        (4 * 1024 * 1024)
+#define DEFAULT_JOURNAL_MAX_SIZE            (64 * 1024 * 1024)
+#define DEFAULT_JOURNAL_MAX_AGE             (7 * 24 * 3600)
+#define DEFAULT_JOURNAL_FLUSH_INTERVAL      0.25
+#define JOURNAL_MAX_PENDING_BYTES           (256 * 1024)    // pending batch is written right away past this size
+#define JOURNAL_TIME_INDEX_INTERVAL         64              // every 64th record of a segment goes into its time index
+
+static NSString *const kJournalSegmentExtension = @"journal";
+
+// record layout (host byte order): header, event name, device ID, payload - all UTF-8, no terminators.
+// Segment files are zero filled past their last record, a zero length ends the records.
+typedef struct __attribute__((packed)) {
+    uint32_t length;            // whole record including the header
+    uint64_t timestamp;         // receive time, milliseconds since 1970
+    uint16_t nameLength;
+    uint16_t deviceIDLength;
+} ParticleEventJournalRecordHeader;
+
+typedef struct {
+    uint64_t timestamp;
+    uint64_t position;
+} ParticleEventJournalTimeIndexEntry;
+
+// header of the record at position, NO past the last record or at a torn record
+static BOOL ParticleEventJournalReadHeader(const uint8_t *bytes, uint64_t length, uint64_t position, ParticleEventJournalRecordHeader *header)
+{
+    if (position + sizeof(ParticleEventJournalRecordHeader) > length)
+    {
+        return NO;
+    }
+
+    memcpy(header, bytes + position, sizeof(ParticleEventJournalRecordHeader));
+    return (header->length >= sizeof(ParticleEventJournalRecordHeader)) &&
+           (position + header->length <= length) &&
+           (sizeof(ParticleEventJournalRecordHeader) + header->nameLength + header->deviceIDLength <= header->length);
+}
+
+static uint64_t ParticleEventJournalNow(void)
+{
+    return (uint64_t)([[NSDate date] timeIntervalSince1970] * 1000);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+/**
+ *  Segment file and its in-memory index. Only the segment being written is mapped, replay maps a copy of the index read only.
+ */
+@interface ParticleEventJournalSegment : NSObject <NSCopying>
+
+@property (nonatomic, strong) NSURL *fileURL;
+@property (nonatomic) uint64_t baseOffset;              // journal offset of the first record, also the file name
+@property (nonatomic) uint64_t length;                  // bytes of records
+@property (nonatomic) uint64_t firstTimestamp;
+@property (nonatomic) uint64_t lastTimestamp;
+@property (nonatomic, strong) NSMutableSet<NSString *> *deviceIDs;
+@property (nonatomic, strong) NSMutableData *timeIndex; // ParticleEventJournalTimeIndexEntry every JOURNAL_TIME_INDEX_INTERVAL records
+@property (nonatomic) NSUInteger recordCount;
+
+// segment being written
+@property (nonatomic) int fd;
+@property (nonatomic, nullable) uint8_t *map;
+@property (nonatomic) uint64_t capacity;
+
+-(void)indexRecordAtPosition:(uint64_t)position header:(ParticleEventJournalRecordHeader)header bytes:(const uint8_t *)bytes;
+-(uint64_t)positionForOffset:(uint64_t)offset timestamp:(uint64_t)timestamp;
+
+@end
+
+@implementation ParticleEventJournalSegment
+
+-(instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _deviceIDs = [NSMutableSet new];
+        _timeIndex = [NSMutableData new];
+        _fd = -1;
+    }
+    return self;
+}
+
+-(id)copyWithZone:(nullable NSZone *)zone
+{
+    ParticleEventJournalSegment *segment = [ParticleEventJournalSegment new];
+    segment.fileURL = self.fileURL;
+    segment.baseOffset = self.baseOffset;
+    segment.length = self.length;
+    segment.firstTimestamp = self.firstTimestamp;
+    segment.lastTimestamp = self.lastTimestamp;
+    segment.deviceIDs = [self.deviceIDs mutableCopy];
+    segment.timeIndex = [self.timeIndex mutableCopy];
+    segment.recordCount = self.recordCount;
+    return segment;
+}
+
+-(void)indexRecordAtPosition:(uint64_t)position header:(ParticleEventJournalRecordHeader)header bytes:(const uint8_t *)bytes
+{
+    if (self.recordCount == 0)
+    {
+        self.firstTimestamp = header.timestamp;
+    }
+    self.lastTimestamp = MAX(self.lastTimestamp, header.timestamp);
+
+    if (self.recordCount % JOURNAL_TIME_INDEX_INTERVAL == 0)
+    {
+        ParticleEventJournalTimeIndexEntry entry = { header.timestamp, position };
+        [self.timeIndex appendBytes:&entry length:sizeof(entry)];
+    }
+    self.recordCount++;
+
+    if (header.deviceIDLength > 0)
+    {
+        NSString *deviceID = [[NSString alloc] initWithBytes:bytes + sizeof(ParticleEventJournalRecordHeader) + header.nameLength length:header.deviceIDLength encoding:NSUTF8StringEncoding];
+        if (deviceID)
+        {
+            [self.deviceIDs addObject:deviceID];
+        }
+    }
+}
+
+// position of the latest indexed record not after the first record at offset received at or after timestamp
+// (receive times are assumed to grow along the segment)
+-(uint64_t)positionForOffset:(uint64_t)offset timestamp:(uint64_t)timestamp
+{
+    const ParticleEventJournalTimeIndexEntry *entries = self.timeIndex.bytes;
+    NSUInteger count = self.timeIndex.length / sizeof(ParticleEventJournalTimeIndexEntry);
+    uint64_t targetPosition = (offset > self.baseOffset) ? offset - self.baseOffset : 0;
+
+    // entries are at or before the target position, then received before timestamp - find the last one that is either
+    NSUInteger low = 0;
+    NSUInteger high = count;
+    while (low < high)
+    {
+        NSUInteger middle = (low + high) / 2;
+        if ((entries[middle].position <= targetPosition) || (entries[middle].timestamp < timestamp))
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return (low > 0) ? entries[low - 1].position : 0;
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+@implementation ParticleEventJournal {
+    dispatch_queue_t _queue;                                // segment writes, rolloff and index updates
+    NSMutableArray<ParticleEventJournalSegment *> *_segments; // oldest first, the last one is written - journal queue only
+    NSMutableData *_pendingRecords;                         // records waiting for the next write - guarded by self
+    BOOL _flushScheduled;
+    BOOL _writeScheduled;
+}
+
+-(nullable instancetype)initWithDirectoryURL:(NSURL *)directoryURL error:(NSError **)error
+{
+    self = [super init];
+    if (self)
+    {
+        _directoryURL = directoryURL;
+        _maxSegmentSize = DEFAULT_JOURNAL_SEGMENT_SIZE;
+        _maxJournalSize = DEFAULT_JOURNAL_MAX_SIZE;
+        _maxAge = DEFAULT_JOURNAL_MAX_AGE;
+        _flushInterval = DEFAULT_JOURNAL_FLUSH_INTERVAL;
+        _queue = dispatch_queue_create("io.particle.eventjournal", DISPATCH_QUEUE_SERIAL);
+        _segments = [NSMutableArray new];
+        _pendingRecords = [NSMutableData new];
+
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        if (![fileManager createDirectoryAtURL:directoryURL withIntermediateDirectories:YES attributes:nil error:error])
+        {
+            return nil;
+        }
+        NSArray<NSURL *> *fileURLs = [fileManager contentsOfDirectoryAtURL:directoryURL includingPropertiesForKeys:nil options:0 error:error];
+        if (!fileURLs)
+        {
+            return nil;
+        }
+
+        for (NSURL *fileURL in fileURLs)
+        {
+            if ([fileURL.pathExtension isEqualToString:kJournalSegmentExtension])
+            {
+                ParticleEventJournalSegment *segment = [self loadSegmentWithURL:fileURL];
+                if (segment)
+                {
+                    [_segments addObject:segment];
+                }
+            }
+        }
+        [_segments sortUsingComparator:^NSComparisonResult(ParticleEventJournalSegment *segment, ParticleEventJournalSegment *otherSegment) {
+            return (segment.baseOffset < otherSegment.baseOffset) ? NSOrderedAscending : (segment.baseOffset > otherSegment.baseOffset);
+        }];
+
+        // keep appending to the last segment
+        ParticleEventJournalSegment *lastSegment = _segments.lastObject;
+        if (((lastSegment) && (![self mapSegment:lastSegment capacity:MAX(lastSegment.length, self.maxSegmentSize) error:error])) ||
+            ((!lastSegment) && (![self startSegmentWithCapacity:self.maxSegmentSize error:error])))
+        {
+            return nil;
+        }
+        [self removeExpiredSegments];
+    }
+    return self;
+}
+
+#pragma mark Properties
+
+-(unsigned long long)startOffset
+{
+    __block unsigned long long offset;
+    dispatch_sync(_queue, ^{
+        offset = self->_segments.firstObject.baseOffset;
+    });
+    return offset;
+}
+
+-(unsigned long long)endOffset
+{
+    __block unsigned long long offset;
+    dispatch_sync(_queue, ^{
+        offset = self->_segments.lastObject.baseOffset + self->_segments.lastObject.length;
+    });
+    return offset;
+}
+
+-(NSUInteger)segmentCount
+{
+    __block NSUInteger count;
+    dispatch_sync(_queue, ^{
+        count = self->_segments.count;
+    });
+    return count;
+}
+
+#pragma mark Appending
+
+-(void)appendEvent:(ParticleEvent *)event
+{
+    NSData *payload = event.payload;
+    if (!payload)
+    {
+        // created from a dictionary - journal the envelope the event stream would have carried
+        NSMutableDictionary *envelope = [NSMutableDictionary new];
+        envelope[@"data"] = event.data ?: [NSNull null];
+        envelope[@"ttl"] = [NSString stringWithFormat:@"%ld", (long)event.ttl];
+        envelope[@"published_at"] = ParticleTimestampFromDate(event.time);
+        envelope[@"coreid"] = event.deviceID;
+        payload = [NSJSONSerialization dataWithJSONObject:envelope options:0 error:nil];
+    }
+
+    [self appendEventWithName:event.event ?: @"" deviceID:event.deviceID payload:payload ?: [NSData data]];
+}
+
+-(void)appendEventWithName:(NSString *)eventName deviceID:(nullable NSString *)deviceID payload:(NSData *)payload
+{
+    const char *name = eventName.UTF8String ?: "";
+    const char *device = deviceID.UTF8String ?: "";
+    ParticleEventJournalRecordHeader header;
+    header.nameLength = (uint16_t)MIN(strlen(name), UINT16_MAX);
+    header.deviceIDLength = (uint16_t)MIN(strlen(device), UINT16_MAX);
+    uint64_t length = sizeof(ParticleEventJournalRecordHeader) + header.nameLength + header.deviceIDLength + payload.length;
+    if (length > UINT32_MAX)
+    {
+        return;
+    }
+    header.length = (uint32_t)length;
+    header.timestamp = ParticleEventJournalNow();
+
+    // only copies the record, the stream reading thread never waits for file I/O
+    BOOL scheduleFlush;
+    BOOL scheduleWrite;
+    @synchronized (self) {
+        [_pendingRecords appendBytes:&header length:sizeof(header)];
+        [_pendingRecords appendBytes:name length:header.nameLength];
+        [_pendingRecords appendBytes:device length:header.deviceIDLength];
+        [_pendingRecords appendData:payload];
+
+        scheduleFlush = !_flushScheduled;
+        _flushScheduled = YES;
+        scheduleWrite = (_pendingRecords.length >= JOURNAL_MAX_PENDING_BYTES) && (!_writeScheduled);
+        _writeScheduled = _writeScheduled || scheduleWrite;
+    }
+
+    // weak - records still pending when the journal goes away are written by dealloc
+    __weak ParticleEventJournal *weakSelf = self;
+    if (scheduleFlush)
+    {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.flushInterval * NSEC_PER_SEC)), _queue, ^{
+            [weakSelf writePendingRecords];
+        });
+    }
+    if (scheduleWrite)
+    {
+        dispatch_async(_queue, ^{
+            [weakSelf writePendingRecords];
+        });
+    }
+}
+
+-(void)synchronize
+{
+    dispatch_sync(_queue, ^{
+        [self writePendingRecords];
+    });
+}
+
+#pragma mark Replay
+
+-(void)replayEventsFromOffset:(unsigned long long)offset deviceID:(nullable NSString *)deviceID handler:(ParticleEventJournalReplayHandler)handler
+{
+    [self replayEventsFromOffset:offset timestamp:0 deviceID:deviceID handler:handler];
+}
+
+-(void)replayEventsSinceDate:(NSDate *)date deviceID:(nullable NSString *)deviceID handler:(ParticleEventJournalReplayHandler)handler
+{
+    [self replayEventsFromOffset:0 timestamp:(uint64_t)MAX(date.timeIntervalSince1970 * 1000, 0) deviceID:deviceID handler:handler];
+}
+
+-(void)replayEventsFromOffset:(uint64_t)offset timestamp:(uint64_t)timestamp deviceID:(nullable NSString *)deviceID handler:(ParticleEventJournalReplayHandler)handler
+{
+    // replay reads index snapshots and its own read only mappings - appends go on, a segment rolled off meanwhile is skipped
+    __block NSArray<ParticleEventJournalSegment *> *segments;
+    dispatch_sync(_queue, ^{
+        [self writePendingRecords];
+        segments = [[NSArray alloc] initWithArray:self->_segments copyItems:YES];
+    });
+
+    const char *device = deviceID.UTF8String;
+    size_t deviceLength = device ? strlen(device) : 0;
+    BOOL stop = NO;
+
+    for (ParticleEventJournalSegment *segment in segments)
+    {
+        if ((stop) ||
+            (segment.length == 0) ||
+            (segment.baseOffset + segment.length <= offset) ||
+            (segment.lastTimestamp < timestamp) ||
+            ((deviceID) && (![segment.deviceIDs containsObject:deviceID])))
+        {
+            continue;
+        }
+
+        int fd = open(segment.fileURL.fileSystemRepresentation, O_RDONLY);
+        if (fd < 0)
+        {
+            continue;
+        }
+        void *map = mmap(NULL, (size_t)segment.length, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            continue;
+        }
+
+        const uint8_t *bytes = map;
+        uint64_t position = [segment positionForOffset:offset timestamp:timestamp];
+        ParticleEventJournalRecordHeader header;
+        while ((!stop) && (ParticleEventJournalReadHeader(bytes, segment.length, position, &header)))
+        {
+            uint64_t recordPosition = position;
+            position += header.length;
+
+            const uint8_t *name = bytes + recordPosition + sizeof(ParticleEventJournalRecordHeader);
+            const uint8_t *recordDevice = name + header.nameLength;
+            if ((segment.baseOffset + recordPosition < offset) || (header.timestamp < timestamp) ||
+                ((device) && ((header.deviceIDLength != deviceLength) || (memcmp(recordDevice, device, deviceLength) != 0))))
+            {
+                continue;
+            }
+
+            @autoreleasepool {
+                const uint8_t *payload = recordDevice + header.deviceIDLength;
+                ParticleEvent *event = [self eventWithName:name length:header.nameLength payload:payload length:header.length - (payload - (bytes + recordPosition))];
+                if (event)
+                {
+                    handler(event, segment.baseOffset + position, &stop);
+                }
+            }
+        }
+
+        munmap(map, (size_t)segment.length);
+    }
+}
+
+#pragma mark Internal use methods
+
+-(nullable ParticleEvent *)eventWithName:(const uint8_t *)name length:(NSUInteger)nameLength payload:(const uint8_t *)payload length:(NSUInteger)payloadLength
+{
+    NSString *eventName = [[NSString alloc] initWithBytes:name length:nameLength encoding:NSUTF8StringEncoding];
+    NSData *payloadData = [NSData dataWithBytes:payload length:payloadLength];
+    ParticleEvent *event = [[ParticleEvent alloc] initWithEventName:eventName payload:payloadData];
+    if (event)
+    {
+        return event;
+    }
+
+    // not the usual flat envelope - same fallback as the event stream
+    NSDictionary *jsonDict = [NSJSONSerialization JSONObjectWithData:payloadData options:0 error:nil];
+    if (![jsonDict isKindOfClass:[NSDictionary class]])
+    {
+        return nil;
+    }
+    NSMutableDictionary *eventDict = [jsonDict mutableCopy];
+    if (eventName)
+    {
+        eventDict[@"event"] = eventName;
+    }
+    return [[ParticleEvent alloc] initWithEventDict:eventDict];
+}
+
+// scans the records of a segment file to rebuild its index
+-(nullable ParticleEventJournalSegment *)loadSegmentWithURL:(NSURL *)fileURL
+{
+    ParticleEventJournalSegment *segment = [ParticleEventJournalSegment new];
+    segment.fileURL = fileURL;
+    segment.baseOffset = strtoull(fileURL.lastPathComponent.stringByDeletingPathExtension.UTF8String, NULL, 16);
+
+    int fd = open(fileURL.fileSystemRepresentation, O_RDONLY);
+    if (fd < 0)
+    {
+        return nil;
+    }
+    struct stat fileStat;
+    if ((fstat(fd, &fileStat) != 0) || (fileStat.st_size == 0))
+    {
+        close(fd);
+        return segment;
+    }
+    void *map = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return nil;
+    }
+
+    const uint8_t *bytes = map;
+    uint64_t position = 0;
+    ParticleEventJournalRecordHeader header;
+    while (ParticleEventJournalReadHeader(bytes, fileStat.st_size, position, &header))
+    {
+        [segment indexRecordAtPosition:position header:header bytes:bytes + position];
+        position += header.length;
+    }
+    segment.length = position;
+
+    munmap(map, (size_t)fileStat.st_size);
+    return segment;
+}
+
+// maps a segment for appending, anything past its last record (a record torn by a crash) is zeroed
+-(BOOL)mapSegment:(ParticleEventJournalSegment *)segment capacity:(uint64_t)capacity error:(NSError **)error
+{
+    int fd = open(segment.fileURL.fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+    if ((fd < 0) || (ftruncate(fd, (off_t)segment.length) != 0) || (ftruncate(fd, (off_t)capacity) != 0))
+    {
+        if (error)
+        {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSFilePathErrorKey : segment.fileURL.path}];
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return NO;
+    }
+
+    void *map = mmap(NULL, (size_t)capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        if (error)
+        {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSFilePathErrorKey : segment.fileURL.path}];
+        }
+        close(fd);
+        return NO;
+    }
+
+    segment.fd = fd;
+    segment.map = map;
+    segment.capacity = capacity;
+    return YES;
+}
+
+// unmaps the segment being written and trims its file to its records
+-(void)closeSegment:(ParticleEventJournalSegment *)segment
+{
+    if (!segment.map)
+    {
+        return;
+    }
+
+    msync(segment.map, (size_t)segment.length, MS_ASYNC);
+    munmap(segment.map, (size_t)segment.capacity);
+    ftruncate(segment.fd, (off_t)segment.length);
+    close(segment.fd);
+    segment.map = NULL;
+    segment.fd = -1;
+    segment.capacity = 0;
+}
+
+-(nullable ParticleEventJournalSegment *)startSegmentWithCapacity:(uint64_t)capacity error:(NSError **)error
+{
+    ParticleEventJournalSegment *lastSegment = _segments.lastObject;
+    [self closeSegment:lastSegment];
+    if ((lastSegment) && (lastSegment.length == 0))
+    {
+        // nothing in it - the new segment starts at the same offset
+        [[NSFileManager defaultManager] removeItemAtURL:lastSegment.fileURL error:nil];
+        [_segments removeLastObject];
+        lastSegment = _segments.lastObject;
+    }
+
+    ParticleEventJournalSegment *segment = [ParticleEventJournalSegment new];
+    segment.baseOffset = lastSegment.baseOffset + lastSegment.length;
+    segment.fileURL = [self.directoryURL URLByAppendingPathComponent:[NSString stringWithFormat:@"%016llx.%@", segment.baseOffset, kJournalSegmentExtension]];
+    if (![self mapSegment:segment capacity:capacity error:error])
+    {
+        return nil;
+    }
+
+    [_segments addObject:segment];
+    return segment;
+}
+
+// journal queue only
+-(void)writePendingRecords
+{
+    NSData *records;
+    @synchronized (self) {
+        records = _pendingRecords;
+        _pendingRecords = [NSMutableData new];
+        _flushScheduled = NO;
+        _writeScheduled = NO;
+    }
+    if (records.length == 0)
+    {
+        return;
+    }
+
+    ParticleEventJournalSegment *segment = _segments.lastObject;
+    uint64_t syncPosition = segment.length;
+    const uint8_t *bytes = records.bytes;
+    uint64_t position = 0;
+    ParticleEventJournalRecordHeader header;
+    while (ParticleEventJournalReadHeader(bytes, records.length, position, &header))
+    {
+        if ((!segment.map) || (segment.length + header.length > segment.capacity))
+        {
+            NSError *error;
+            segment = [self startSegmentWithCapacity:MAX(self.maxSegmentSize, header.length) error:&error];
+            if (!segment)
+            {
+                NSLog(@"ParticleEventJournal: %lu bytes of events not journaled - %@", (unsigned long)(records.length - position), error);
+                break;
+            }
+            syncPosition = 0;
+        }
+
+        // length goes in last, a crash mid-record leaves a zero length ending the records
+        uint8_t *record = segment.map + segment.length;
+        memcpy(record + sizeof(uint32_t), bytes + position + sizeof(uint32_t), header.length - sizeof(uint32_t));
+        memcpy(record, &header.length, sizeof(uint32_t));
+        [segment indexRecordAtPosition:segment.length header:header bytes:record];
+        segment.length += header.length;
+        position += header.length;
+    }
+
+    if ((segment.map) && (segment.length > syncPosition))
+    {
+        // msync wants a page aligned start
+        uint64_t pageSize = (uint64_t)getpagesize();
+        uint64_t syncStart = syncPosition - syncPosition % pageSize;
+        msync(segment.map + syncStart, (size_t)(segment.length - syncStart), MS_ASYNC);
+    }
+
+    [self removeExpiredSegments];
+}
+
+// journal queue only - deletes the oldest segments past maxJournalSize or maxAge, never the segment being written
+-(void)removeExpiredSegments
+{
+    unsigned long long maxJournalSize = self.maxJournalSize;
+    NSTimeInterval maxAge = self.maxAge;
+    uint64_t now = ParticleEventJournalNow();
+    uint64_t oldestTimestamp = ((maxAge > 0) && (now > maxAge * 1000)) ? now - (uint64_t)(maxAge * 1000) : 0;
+
+    uint64_t journalSize = 0;
+    for (ParticleEventJournalSegment *segment in _segments)
+    {
+        journalSize += segment.length;
+    }
+
+    while (_segments.count > 1)
+    {
+        ParticleEventJournalSegment *segment = _segments.firstObject;
+        if (((maxJournalSize == 0) || (journalSize <= maxJournalSize)) && (segment.lastTimestamp >= oldestTimestamp))
+        {
+            break;
+        }
+
+        [[NSFileManager defaultManager] removeItemAtURL:segment.fileURL error:nil];
+        journalSize -= segment.length;
+        [_segments removeObjectAtIndex:0];
+    }
+}
+
+-(void)dealloc
+{
+    // no write can be running on the journal queue any more - it would hold a strong reference
+    [self writePendingRecords];
+    [self closeSegment:_segments.lastObject];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
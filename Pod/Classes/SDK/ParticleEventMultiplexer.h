@@ -0,0 +1,131 @@
+//
+//  ParticleEventMultiplexer.h
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "ParticleEvent.h"
+#import "ParticleEventJournal.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Shares server-sent event streams between event subscriptions (internal use).
+ *  Every subscription is attached to the widest open stream covering it, each incoming event is parsed once per stream
+ *  and fanned out to the subscriptions whose event name prefix / device ID filters match.
+ *  Streams are reference counted and closed only when their last subscription is removed.
+ *  Event names are matched against the subscriptions of a stream with a compiled prefix trie, O(event name length) per event
+ *  however many prefixes are registered.
+ */
+@interface ParticleEventMultiplexer : NSObject
+
+/**
+ *  Number of currently open event streams
+ */
+@property (nonatomic, readonly) NSUInteger openStreamCount;
+
+/**
+ *  Session configuration streams are opened with, nil for the default configuration.
+ *  All streams share one session (one delegate queue reads them all), setting it starts a new session for streams opened afterwards.
+ */
+@property (nonatomic, copy, nullable) NSURLSessionConfiguration *sessionConfiguration;
+
+/**
+ *  Maximum number of cloud filtered streams (path/:event_name) open per path and access token (default 16), 0 for no limit.
+ *  Past it a new server filtered subscription shares a stream filtered by the longest prefix it has in common with an open one,
+ *  which takes over the subscriptions of the streams it covers, the rest of the filtering is done on the client.
+ *  A prefix sharing nothing with the open streams still gets its own stream.
+ */
+@property (nonatomic) NSUInteger maxServerFilteredStreams;
+
+-(instancetype)initWithBaseURL:(NSURL *)baseURL;
+-(instancetype)initWithBaseURL:(NSURL *)baseURL sessionConfiguration:(nullable NSURLSessionConfiguration *)sessionConfiguration NS_DESIGNATED_INITIALIZER;
+-(instancetype)init __attribute__((unavailable("Must use initWithBaseURL:")));
+
+/**
+ *  Add an event subscription
+ *
+ *  @param path             Stream endpoint path: /v1/events, /v1/devices/events or /v1/devices/:device_id/events
+ *  @param eventNamePrefix  Filter only events that match name eventNamePrefix, nil/empty string matches any event
+ *  @param deviceID         Filter only events published by deviceID, nil matches any device
+ *  @param serverFiltered   YES if a newly opened stream should be filtered by eventNamePrefix in the cloud (path/:event_name), NO to open the unfiltered path stream
+ *  @param accessToken      Access token the stream is opened with, streams are shared only between subscriptions of the same token
+ *  @param eventHandler     Event handler called for each matching event
+ *  @return subscription unique ID, pass it to unsubscribeWithID: to remove the subscription
+ */
+-(id)subscribeToPath:(NSString *)path
+     eventNamePrefix:(nullable NSString *)eventNamePrefix
+            deviceID:(nullable NSString *)deviceID
+      serverFiltered:(BOOL)serverFiltered
+         accessToken:(nullable NSString *)accessToken
+             handler:(ParticleEventHandler)eventHandler;
+
+/**
+ *  Add an event subscription with a bounded delivery queue
+ *
+ *  @param queueDepth       Maximum number of events waiting for the handler, 0 for unbounded
+ *  @param overflowPolicy   What to do with a new event when the queue is full
+ *  (other parameters as in subscribeToPath:eventNamePrefix:deviceID:serverFiltered:accessToken:handler:)
+ *  @return subscription unique ID, pass it to unsubscribeWithID: to remove the subscription
+ */
+-(id)subscribeToPath:(NSString *)path
+     eventNamePrefix:(nullable NSString *)eventNamePrefix
+            deviceID:(nullable NSString *)deviceID
+      serverFiltered:(BOOL)serverFiltered
+         accessToken:(nullable NSString *)accessToken
+          queueDepth:(NSUInteger)queueDepth
+      overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy
+             handler:(ParticleEventHandler)eventHandler;
+
+/**
+ *  Add an event subscription delivering matching events in batches. Batches keep the stream order of events.
+ *
+ *  @param maxBatchSize     Batch is delivered as soon as it holds maxBatchSize events
+ *  @param maxLatency       Batch is delivered at most maxLatency seconds after its first event arrived, even if not full
+ *  @param batchHandler     Event batch handler
+ *  (other parameters as in subscribeToPath:eventNamePrefix:deviceID:serverFiltered:accessToken:handler:)
+ *  @return subscription unique ID, pass it to unsubscribeWithID: to remove the subscription. Events of an undelivered batch are discarded on unsubscribe.
+ */
+-(id)subscribeToPath:(NSString *)path
+     eventNamePrefix:(nullable NSString *)eventNamePrefix
+            deviceID:(nullable NSString *)deviceID
+      serverFiltered:(BOOL)serverFiltered
+         accessToken:(nullable NSString *)accessToken
+        maxBatchSize:(NSUInteger)maxBatchSize
+          maxLatency:(NSTimeInterval)maxLatency
+        batchHandler:(ParticleEventBatchHandler)batchHandler;
+
+/**
+ *  Remove an event subscription, the underlying stream is closed if no other subscription uses it
+ *
+ *  @param subscriptionID The subscription unique ID returned by subscribeToPath:
+ */
+-(void)unsubscribeWithID:(id)subscriptionID;
+
+/**
+ *  Check if subscription is registered
+ */
+-(BOOL)hasSubscriptionWithID:(id)subscriptionID;
+
+/**
+ *  Delivery counters of a subscription, nil if not registered
+ */
+-(nullable ParticleEventSubscriptionStats *)statsForSubscriptionWithID:(id)subscriptionID;
+
+/**
+ *  Append the raw stream records of events matching a subscription to a journal, nil to stop
+ *
+ *  @return NO if subscription is not registered
+ */
+-(BOOL)setJournal:(nullable ParticleEventJournal *)journal forSubscriptionWithID:(id)subscriptionID;
+
+@end
+
+/**
+ *  Event name prefix match, treating the "particle" and "spark" system event namespaces as equivalent like the cloud does
+ */
+extern BOOL ParticleEventNameHasPrefix(NSString *eventName, NSString * _Nullable prefix);
+
+NS_ASSUME_NONNULL_END
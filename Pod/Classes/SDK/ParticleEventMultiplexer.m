@@ -0,0 +1,1191 @@
+//
+//  ParticleEventMultiplexer.m
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import "ParticleEventMultiplexer.h"
+#import "EventSource.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#define EVENT_STREAM_TIMEOUT_INTERVAL   300.0f
+#define DEFAULT_MAX_SERVER_FILTERED_STREAMS 16
+#define RECENT_EVENT_COUNT              64      // events per stream remembered to drop their duplicates when a wider stream takes over
+#define MIGRATED_EVENT_INTERVAL         10.0    // seconds the wider stream's events are checked against them
+
+static NSString *const kParticleSystemEventsPrefix = @"particle";
+static NSString *const kSparkSystemEventsPrefix = @"spark";
+
+BOOL ParticleEventNameHasPrefix(NSString *eventName, NSString * _Nullable prefix)
+{
+    if ((!prefix) || (prefix.length == 0))
+    {
+        return YES;
+    }
+
+    if ([eventName hasPrefix:prefix])
+    {
+        return YES;
+    }
+
+    // cloud delivers spark/* system events to "particle" prefixed subscriptions and vice versa
+    if ([prefix hasPrefix:kParticleSystemEventsPrefix])
+    {
+        NSString *sparkPrefix = [kSparkSystemEventsPrefix stringByAppendingString:[prefix substringFromIndex:kParticleSystemEventsPrefix.length]];
+        return [eventName hasPrefix:sparkPrefix];
+    }
+
+    if ([prefix hasPrefix:kSparkSystemEventsPrefix])
+    {
+        NSString *particlePrefix = [kParticleSystemEventsPrefix stringByAppendingString:[prefix substringFromIndex:kSparkSystemEventsPrefix.length]];
+        return [eventName hasPrefix:particlePrefix];
+    }
+
+    return NO;
+}
+
+// widest server filter covering both prefixes, nil if they share none. Never cuts into a system event namespace name -
+// the cloud equates "particle" and "spark" prefixes only when the whole name is given
+static NSString * _Nullable ParticleEventMergedServerPrefix(NSString *prefix, NSString *otherPrefix)
+{
+    NSString *commonPrefix = [prefix commonPrefixWithString:otherPrefix options:NSLiteralSearch];
+    for (NSString *namespacePrefix in @[kParticleSystemEventsPrefix, kSparkSystemEventsPrefix])
+    {
+        if ((([prefix hasPrefix:namespacePrefix]) || ([otherPrefix hasPrefix:namespacePrefix])) && (commonPrefix.length < namespacePrefix.length))
+        {
+            return nil;
+        }
+    }
+    return (commonPrefix.length > 0) ? commonPrefix : nil;
+}
+
+// identity of an event received on two streams - name and payload (device ID, publish time and data). Not the SSE id,
+// the cloud numbers the events of each stream on their own
+static NSData *ParticleEventStreamEventKey(Event *event)
+{
+    NSMutableData *key = [[event.name ?: @"" dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    uint8_t separator = 0;
+    [key appendBytes:&separator length:1];
+    if (event.data)
+    {
+        [key appendData:event.data];
+    }
+    return key;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+@interface ParticleEventSubscription : NSObject
+
+@property (nonatomic, strong) id subscriptionID;
+@property (nonatomic, strong, nullable) NSString *eventNamePrefix;
+@property (nonatomic, strong, nullable) NSString *deviceID;
+@property (nonatomic, copy, nullable) ParticleEventHandler handler;
+@property (atomic, strong, nullable) ParticleEventJournal *journal; // raw records of matching events are appended here
+
+// bounded delivery queue
+@property (nonatomic) NSUInteger queueDepth; // 0 = unbounded
+@property (nonatomic) ParticleEventOverflowPolicy overflowPolicy;
+
+// batched delivery - batch state is only accessed on the subscription delivery queue
+@property (nonatomic, copy, nullable) ParticleEventBatchHandler batchHandler;
+@property (nonatomic) NSUInteger maxBatchSize;
+@property (nonatomic) NSTimeInterval maxLatency;
+
+// events delivered by the narrower stream the subscription was moved from, the wider stream delivers those it received too
+// (see streamDidOpen:) - only accessed on the event session queue
+@property (nonatomic, strong, nullable) NSSet<NSData *> *migratedEventKeys;
+@property (nonatomic) NSTimeInterval migratedEventKeysExpiry; // system uptime
+
+-(BOOL)matchesDeviceID:(nullable NSString *)deviceID;
+-(BOOL)isMigratedEvent:(NSData *)eventKey;
+-(void)enqueueEvent:(ParticleEvent *)event;
+-(void)enqueueError:(NSError *)error;
+-(void)cancel;
+-(ParticleEventSubscriptionStats *)statsWithStreamSource:(nullable EventSource *)source;
+
+@end
+
+@implementation ParticleEventSubscription {
+    NSCondition *_lock;                                     // guards the delivery queue state, signalled when the queue shrinks
+    NSMutableArray *_queuedItems;                           // ParticleEvent / NSError items, coalesce policy queues coalescing keys in place of events
+    NSMutableDictionary<NSString *, ParticleEvent *> *_latestEvents; // coalesce policy - latest event per queued key
+    dispatch_queue_t _deliveryQueue;
+    BOOL _draining;
+    BOOL _cancelled;
+    NSUInteger _maxQueuedCount;
+    unsigned long long _deliveredCount;
+    unsigned long long _droppedCount;
+    unsigned long long _coalescedCount;
+
+    NSMutableArray<ParticleEvent *> *_pendingBatch;
+    NSUInteger _batchGeneration;
+}
+
+-(instancetype)init
+{
+    self = [super init];
+    if (self)
+    {
+        _lock = [NSCondition new];
+        _queuedItems = [NSMutableArray new];
+        _latestEvents = [NSMutableDictionary new];
+        _deliveryQueue = dispatch_queue_create("io.particle.events.subscription", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(_deliveryQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    }
+    return self;
+}
+
+// event name prefix is matched by the stream router
+-(BOOL)matchesDeviceID:(nullable NSString *)deviceID
+{
+    return (!self.deviceID) || ([self.deviceID isEqualToString:deviceID]);
+}
+
+-(BOOL)isMigratedEvent:(NSData *)eventKey
+{
+    if ([NSProcessInfo processInfo].systemUptime > self.migratedEventKeysExpiry)
+    {
+        self.migratedEventKeys = nil;
+        return NO;
+    }
+    return [self.migratedEventKeys containsObject:eventKey];
+}
+
+#pragma mark Delivery queue - called on the thread reading the event stream
+
+-(void)enqueueEvent:(ParticleEvent *)event
+{
+    [_lock lock];
+
+    NSString *coalescingKey = nil;
+    if (self.overflowPolicy == ParticleEventOverflowPolicyCoalesce)
+    {
+        coalescingKey = [NSString stringWithFormat:@"%@/%@", event.deviceID, event.event];
+        if (_latestEvents[coalescingKey])
+        {
+            // newer event of same device and name replaces the queued one, keeping its queue position
+            _latestEvents[coalescingKey] = event;
+            _coalescedCount++;
+            [_lock unlock];
+            return;
+        }
+    }
+
+    if (![self makeRoomForItem])
+    {
+        [_lock unlock];
+        return;
+    }
+
+    if (coalescingKey)
+    {
+        _latestEvents[coalescingKey] = event;
+        [_queuedItems addObject:coalescingKey];
+    }
+    else
+    {
+        [_queuedItems addObject:event];
+    }
+
+    [self scheduleDrain];
+    [_lock unlock];
+}
+
+-(void)enqueueError:(NSError *)error
+{
+    [_lock lock];
+    if ([self makeRoomForItem])
+    {
+        [_queuedItems addObject:error];
+        [self scheduleDrain];
+    }
+    [_lock unlock];
+}
+
+-(void)cancel
+{
+    [_lock lock];
+    _cancelled = YES;
+    [_queuedItems removeAllObjects];
+    [_latestEvents removeAllObjects];
+    [_lock broadcast]; // release a stream reader blocked on this subscription
+    [_lock unlock];
+}
+
+-(ParticleEventSubscriptionStats *)statsWithStreamSource:(nullable EventSource *)source
+{
+    [_lock lock];
+    ParticleEventSubscriptionStats *stats = [[ParticleEventSubscriptionStats alloc] initWithQueueDepth:self.queueDepth
+                                                                                         queuedCount:_queuedItems.count
+                                                                                      maxQueuedCount:_maxQueuedCount
+                                                                                      deliveredCount:_deliveredCount
+                                                                                        droppedCount:_droppedCount
+                                                                                      coalescedCount:_coalescedCount
+                                                                                      reconnectCount:source.reconnectCount
+                                                                                    lastRecoveryTime:source.lastRecoveryTime
+                                                                                    missedEventCount:source.missedEventCount];
+    [_lock unlock];
+    return stats;
+}
+
+// lock must be held, returns NO if the new item should be dropped
+-(BOOL)makeRoomForItem
+{
+    if (_cancelled)
+    {
+        return NO;
+    }
+
+    if ((self.queueDepth == 0) || (_queuedItems.count < self.queueDepth))
+    {
+        return YES;
+    }
+
+    switch (self.overflowPolicy)
+    {
+        case ParticleEventOverflowPolicyDropNewest:
+            _droppedCount++;
+            return NO;
+
+        case ParticleEventOverflowPolicyBlock:
+            while ((!_cancelled) && (_queuedItems.count >= self.queueDepth))
+            {
+                [_lock wait];
+            }
+            return !_cancelled;
+
+        case ParticleEventOverflowPolicyDropOldest:
+        case ParticleEventOverflowPolicyCoalesce:
+        default:
+            [self dequeueItem];
+            _droppedCount++;
+            return YES;
+    }
+}
+
+// lock must be held
+-(nullable id)dequeueItem
+{
+    id item = _queuedItems.firstObject;
+    if (!item)
+    {
+        return nil;
+    }
+
+    [_queuedItems removeObjectAtIndex:0];
+    if ([item isKindOfClass:[NSString class]])
+    {
+        NSString *coalescingKey = item;
+        item = _latestEvents[coalescingKey];
+        [_latestEvents removeObjectForKey:coalescingKey];
+    }
+    return item;
+}
+
+// lock must be held
+-(void)scheduleDrain
+{
+    _maxQueuedCount = MAX(_maxQueuedCount, _queuedItems.count);
+
+    if (!_draining)
+    {
+        _draining = YES;
+        dispatch_async(_deliveryQueue, ^{
+            [self drain];
+        });
+    }
+}
+
+#pragma mark Delivery - called on the subscription delivery queue
+
+-(void)drain
+{
+    while (YES)
+    {
+        [_lock lock];
+        id item = _cancelled ? nil : [self dequeueItem];
+        if (!item)
+        {
+            _draining = NO;
+            [_lock unlock];
+            return;
+        }
+        if ([item isKindOfClass:[ParticleEvent class]])
+        {
+            _deliveredCount++;
+        }
+        [_lock signal];
+        [_lock unlock];
+
+        if ([item isKindOfClass:[NSError class]])
+        {
+            [self deliverError:item];
+        }
+        else
+        {
+            [self deliverEvent:item];
+        }
+    }
+}
+
+-(void)deliverEvent:(ParticleEvent *)event
+{
+    if (!self.batchHandler)
+    {
+        self.handler(event, nil);
+        return;
+    }
+
+    if (!_pendingBatch)
+    {
+        _pendingBatch = [NSMutableArray arrayWithCapacity:self.maxBatchSize];
+    }
+    [_pendingBatch addObject:event];
+
+    if (_pendingBatch.count >= self.maxBatchSize)
+    {
+        [self flushBatch];
+    }
+    else if (_pendingBatch.count == 1)
+    {
+        // first event of a new batch - bound its latency, stale timers of batches already flushed are ignored
+        NSUInteger generation = _batchGeneration;
+        __weak ParticleEventSubscription *weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.maxLatency * NSEC_PER_SEC)), _deliveryQueue, ^{
+            [weakSelf flushBatchWithGeneration:generation];
+        });
+    }
+}
+
+-(void)flushBatchWithGeneration:(NSUInteger)generation
+{
+    if (_batchGeneration == generation)
+    {
+        [self flushBatch];
+    }
+}
+
+-(void)flushBatch
+{
+    NSArray<ParticleEvent *> *batch = _pendingBatch;
+    _pendingBatch = nil;
+    _batchGeneration++;
+
+    // cancelled by unsubscribe on another thread - the pending batch is dropped with the queue
+    [_lock lock];
+    BOOL cancelled = _cancelled;
+    [_lock unlock];
+
+    if ((batch.count > 0) && (!cancelled))
+    {
+        self.batchHandler(batch, nil);
+    }
+}
+
+-(void)deliverError:(NSError *)error
+{
+    if (self.batchHandler)
+    {
+        self.batchHandler(nil, error);
+    }
+    else
+    {
+        self.handler(nil, error);
+    }
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// compiled prefix trie over the UTF-8 event name prefixes of a stream's subscriptions - flat arrays, edges of a node are
+// contiguous and sorted by byte, subscriptions whose prefix ends at a node are listed by the node
+typedef struct {
+    uint32_t firstEdge;
+    uint32_t edgeCount;
+    uint32_t firstMatch;
+    uint32_t matchCount;
+} ParticleEventTrieNode;
+
+typedef struct {
+    uint8_t byte;
+    uint32_t node;
+} ParticleEventTrieEdge;
+
+typedef struct {
+    const uint8_t *bytes;
+    NSUInteger length;
+    uint32_t index;             // index of the subscription in the router subscriptions array
+} ParticleEventTrieEntry;
+
+typedef struct {
+    ParticleEventTrieNode *nodes;
+    uint32_t nodeCount;
+    ParticleEventTrieEdge *edges;
+    uint32_t edgeCount;
+    uint32_t *matches;
+    uint32_t matchCount;
+} ParticleEventTrie;
+
+static int ParticleEventTrieEntryCompare(const void *a, const void *b)
+{
+    const ParticleEventTrieEntry *entryA = a;
+    const ParticleEventTrieEntry *entryB = b;
+    int result = memcmp(entryA->bytes, entryB->bytes, MIN(entryA->length, entryB->length));
+    if (result != 0)
+    {
+        return result;
+    }
+    // shorter prefix first - prefixes ending at a node precede the ones continuing below it
+    return (entryA->length < entryB->length) ? -1 : (entryA->length > entryB->length);
+}
+
+// entries are sorted and share their first depth bytes
+static uint32_t ParticleEventTrieAddNode(ParticleEventTrie *trie, const ParticleEventTrieEntry *entries, NSUInteger count, NSUInteger depth)
+{
+    uint32_t nodeIndex = trie->nodeCount++;
+    ParticleEventTrieNode node = { 0 };
+
+    NSUInteger i = 0;
+    node.firstMatch = trie->matchCount;
+    while ((i < count) && (entries[i].length == depth))
+    {
+        trie->matches[trie->matchCount++] = entries[i].index;
+        i++;
+    }
+    node.matchCount = trie->matchCount - node.firstMatch;
+
+    // reserve this node's edges before adding the child nodes, which reserve their own edges
+    NSUInteger first = i;
+    for (NSUInteger j = first; j < count; j++)
+    {
+        if ((j == first) || (entries[j].bytes[depth] != entries[j - 1].bytes[depth]))
+        {
+            node.edgeCount++;
+        }
+    }
+    node.firstEdge = trie->edgeCount;
+    trie->edgeCount += node.edgeCount;
+
+    uint32_t edgeIndex = node.firstEdge;
+    while (i < count)
+    {
+        uint8_t byte = entries[i].bytes[depth];
+        NSUInteger end = i + 1;
+        while ((end < count) && (entries[end].bytes[depth] == byte))
+        {
+            end++;
+        }
+        uint32_t child = ParticleEventTrieAddNode(trie, entries + i, end - i, depth + 1);
+        trie->edges[edgeIndex++] = (ParticleEventTrieEdge){ byte, child };
+        i = end;
+    }
+
+    trie->nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+static BOOL ParticleEventTrieChild(const ParticleEventTrie *trie, uint32_t nodeIndex, uint8_t byte, uint32_t *child)
+{
+    const ParticleEventTrieNode *node = &trie->nodes[nodeIndex];
+    const ParticleEventTrieEdge *edges = &trie->edges[node->firstEdge];
+    NSUInteger low = 0;
+    NSUInteger high = node->edgeCount;
+    while (low < high)
+    {
+        NSUInteger middle = (low + high) / 2;
+        if (edges[middle].byte == byte)
+        {
+            *child = edges[middle].node;
+            return YES;
+        }
+        if (edges[middle].byte < byte)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return NO;
+}
+
+/**
+ *  Immutable routing snapshot of a stream - its subscriptions plus the prefix trie over their event name prefixes.
+ *  Routing an event costs O(event name length) however many prefixes are registered.
+ *  The trie is compiled on first use: events of a stream are routed only on the serial session queue reading it, so
+ *  compiling needs no lock, and bursts of subscribe/unsubscribe don't compile a trie per change.
+ */
+@interface ParticleEventRouter : NSObject
+
+@property (nonatomic, copy, readonly) NSArray<ParticleEventSubscription *> *subscriptions;
+
+-(instancetype)initWithSubscriptions:(NSArray<ParticleEventSubscription *> *)subscriptions;
+-(void)enumerateSubscriptionsMatchingEvent:(ParticleEvent *)event usingBlock:(void (^)(ParticleEventSubscription *subscription))block;
+
+@end
+
+@implementation ParticleEventRouter {
+    ParticleEventTrie _trie;
+    BOOL _compiled;
+}
+
+-(instancetype)initWithSubscriptions:(NSArray<ParticleEventSubscription *> *)subscriptions
+{
+    self = [super init];
+    if (self)
+    {
+        _subscriptions = [subscriptions copy];
+    }
+    return self;
+}
+
+-(void)compile
+{
+    NSUInteger count = self.subscriptions.count;
+    ParticleEventTrieEntry *entries = malloc(MAX(count, 1) * sizeof(ParticleEventTrieEntry));
+    NSUInteger totalLength = 0;
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        NSString *prefix = self.subscriptions[i].eventNamePrefix ?: @"";
+        entries[i].bytes = (const uint8_t *)prefix.UTF8String;
+        entries[i].length = strlen((const char *)entries[i].bytes);
+        entries[i].index = (uint32_t)i;
+        totalLength += entries[i].length;
+    }
+    qsort(entries, count, sizeof(ParticleEventTrieEntry), ParticleEventTrieEntryCompare);
+
+    // every prefix byte adds at most one node and one edge
+    _trie.nodes = malloc((totalLength + 1) * sizeof(ParticleEventTrieNode));
+    _trie.edges = malloc(MAX(totalLength, 1) * sizeof(ParticleEventTrieEdge));
+    _trie.matches = malloc(MAX(count, 1) * sizeof(uint32_t));
+    ParticleEventTrieAddNode(&_trie, entries, count, 0);
+    free(entries);
+
+    _compiled = YES;
+}
+
+// walks head then tail bytes from the trie root, reporting subscriptions whose prefix ends at depth minDepth or deeper
+-(void)walkHead:(const uint8_t *)head headLength:(NSUInteger)headLength
+           tail:(const uint8_t *)tail tailLength:(NSUInteger)tailLength
+       minDepth:(NSUInteger)minDepth
+      deviceID:(nullable NSString *)deviceID
+     usingBlock:(void (^)(ParticleEventSubscription *subscription))block
+{
+    uint32_t nodeIndex = 0;
+    NSUInteger length = headLength + tailLength;
+    for (NSUInteger depth = 0; ; depth++)
+    {
+        const ParticleEventTrieNode *node = &_trie.nodes[nodeIndex];
+        if (depth >= minDepth)
+        {
+            for (uint32_t i = node->firstMatch; i < node->firstMatch + node->matchCount; i++)
+            {
+                ParticleEventSubscription *subscription = self.subscriptions[_trie.matches[i]];
+                if ([subscription matchesDeviceID:deviceID])
+                {
+                    block(subscription);
+                }
+            }
+        }
+
+        if (depth == length)
+        {
+            return;
+        }
+        uint8_t byte = (depth < headLength) ? head[depth] : tail[depth - headLength];
+        if (!ParticleEventTrieChild(&_trie, nodeIndex, byte, &nodeIndex))
+        {
+            return;
+        }
+    }
+}
+
+-(void)enumerateSubscriptionsMatchingEvent:(ParticleEvent *)event usingBlock:(void (^)(ParticleEventSubscription *subscription))block
+{
+    if (self.subscriptions.count == 0)
+    {
+        return;
+    }
+    if (!_compiled)
+    {
+        [self compile];
+    }
+
+    const uint8_t *name = (const uint8_t *)(event.event.UTF8String ?: "");
+    NSUInteger nameLength = strlen((const char *)name);
+    [self walkHead:name headLength:nameLength tail:NULL tailLength:0 minDepth:0 deviceID:event.deviceID usingBlock:block];
+
+    // cloud delivers spark/* system events to "particle" prefixed subscriptions and vice versa (see ParticleEventNameHasPrefix) -
+    // walk the name again in the other namespace, only prefixes spelling out the whole namespace match there
+    static const char particle[] = "particle";
+    static const char spark[] = "spark";
+    if ((nameLength >= sizeof(spark) - 1) && (memcmp(name, spark, sizeof(spark) - 1) == 0))
+    {
+        [self walkHead:(const uint8_t *)particle headLength:sizeof(particle) - 1 tail:name + sizeof(spark) - 1 tailLength:nameLength - (sizeof(spark) - 1) minDepth:sizeof(particle) - 1 deviceID:event.deviceID usingBlock:block];
+    }
+    else if ((nameLength >= sizeof(particle) - 1) && (memcmp(name, particle, sizeof(particle) - 1) == 0))
+    {
+        [self walkHead:(const uint8_t *)spark headLength:sizeof(spark) - 1 tail:name + sizeof(particle) - 1 tailLength:nameLength - (sizeof(particle) - 1) minDepth:sizeof(spark) - 1 deviceID:event.deviceID usingBlock:block];
+    }
+}
+
+-(void)dealloc
+{
+    free(_trie.nodes);
+    free(_trie.edges);
+    free(_trie.matches);
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+@interface ParticleEventStream : NSObject
+
+@property (nonatomic, strong) NSString *path;
+@property (nonatomic, strong, nullable) NSString *serverPrefix; // nil if stream is not filtered in the cloud
+@property (nonatomic, strong, nullable) NSString *accessToken;
+@property (nonatomic, strong, nullable) EventSource *source;
+// immutable snapshot swapped under the multiplexer lock, routing reads it without locking
+@property (atomic, strong) ParticleEventRouter *router;
+// setter replaces the router. Stream reference count is subscriptions.count
+@property (nonatomic, copy) NSArray<ParticleEventSubscription *> *subscriptions;
+
+-(BOOL)coversPath:(NSString *)path serverPrefix:(nullable NSString *)serverPrefix accessToken:(nullable NSString *)accessToken;
+// last RECENT_EVENT_COUNT events received - only accessed on the event session queue
+-(void)recordEvent:(Event *)event;
+-(NSSet<NSData *> *)recentEventKeys;
+
+@end
+
+@implementation ParticleEventStream {
+    NSMutableArray<Event *> *_recentEvents; // ring buffer
+    NSUInteger _recentEventIndex;
+}
+
+-(void)recordEvent:(Event *)event
+{
+    if (!_recentEvents)
+    {
+        _recentEvents = [NSMutableArray arrayWithCapacity:RECENT_EVENT_COUNT];
+    }
+    if (_recentEvents.count < RECENT_EVENT_COUNT)
+    {
+        [_recentEvents addObject:event];
+    }
+    else
+    {
+        _recentEvents[_recentEventIndex] = event;
+    }
+    _recentEventIndex = (_recentEventIndex + 1) % RECENT_EVENT_COUNT;
+}
+
+-(NSSet<NSData *> *)recentEventKeys
+{
+    NSMutableSet<NSData *> *keys = [NSMutableSet setWithCapacity:_recentEvents.count];
+    for (Event *event in _recentEvents)
+    {
+        [keys addObject:ParticleEventStreamEventKey(event)];
+    }
+    return keys;
+}
+
+-(NSArray<ParticleEventSubscription *> *)subscriptions
+{
+    return self.router.subscriptions;
+}
+
+-(void)setSubscriptions:(NSArray<ParticleEventSubscription *> *)subscriptions
+{
+    self.router = [[ParticleEventRouter alloc] initWithSubscriptions:subscriptions];
+}
+
+-(BOOL)coversPath:(NSString *)path serverPrefix:(nullable NSString *)serverPrefix accessToken:(nullable NSString *)accessToken
+{
+    if (![self.path isEqualToString:path])
+    {
+        return NO;
+    }
+
+    if ((self.accessToken != accessToken) && (![self.accessToken isEqualToString:accessToken]))
+    {
+        return NO;
+    }
+
+    if (!self.serverPrefix)
+    {
+        return YES;
+    }
+
+    return (serverPrefix) && ([serverPrefix hasPrefix:self.serverPrefix]);
+}
+
+@end
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+@interface ParticleEventMultiplexer ()
+
+@property (nonatomic, strong) NSURL *baseURL;
+@property (nonatomic, strong) EventSourceSession *eventSession;
+@property (nonatomic, strong) NSMutableArray<ParticleEventStream *> *streams;
+@property (nonatomic, strong) NSMutableDictionary<id, ParticleEventStream *> *streamsBySubscriptionID;
+
+@end
+
+@implementation ParticleEventMultiplexer
+
+-(instancetype)initWithBaseURL:(NSURL *)baseURL
+{
+    return [self initWithBaseURL:baseURL sessionConfiguration:nil];
+}
+
+-(instancetype)initWithBaseURL:(NSURL *)baseURL sessionConfiguration:(nullable NSURLSessionConfiguration *)sessionConfiguration
+{
+    self = [super init];
+    if (self)
+    {
+        _baseURL = baseURL;
+        _sessionConfiguration = [sessionConfiguration copy];
+        _eventSession = sessionConfiguration ? [[EventSourceSession alloc] initWithConfiguration:sessionConfiguration] : [EventSourceSession sharedSession];
+        _streams = [NSMutableArray new];
+        _streamsBySubscriptionID = [NSMutableDictionary new];
+        _maxServerFilteredStreams = DEFAULT_MAX_SERVER_FILTERED_STREAMS;
+    }
+    return self;
+}
+
+-(void)setSessionConfiguration:(nullable NSURLSessionConfiguration *)sessionConfiguration
+{
+    @synchronized (self) {
+        _sessionConfiguration = [sessionConfiguration copy];
+        // open streams keep their session alive until they are closed
+        self.eventSession = sessionConfiguration ? [[EventSourceSession alloc] initWithConfiguration:sessionConfiguration] : [EventSourceSession sharedSession];
+    }
+}
+
+-(NSUInteger)openStreamCount
+{
+    @synchronized (self) {
+        return self.streams.count;
+    }
+}
+
+-(id)subscribeToPath:(NSString *)path
+     eventNamePrefix:(nullable NSString *)eventNamePrefix
+            deviceID:(nullable NSString *)deviceID
+      serverFiltered:(BOOL)serverFiltered
+         accessToken:(nullable NSString *)accessToken
+             handler:(ParticleEventHandler)eventHandler
+{
+    return [self subscribeToPath:path eventNamePrefix:eventNamePrefix deviceID:deviceID serverFiltered:serverFiltered accessToken:accessToken queueDepth:0 overflowPolicy:ParticleEventOverflowPolicyDropOldest handler:eventHandler];
+}
+
+-(id)subscribeToPath:(NSString *)path
+     eventNamePrefix:(nullable NSString *)eventNamePrefix
+            deviceID:(nullable NSString *)deviceID
+      serverFiltered:(BOOL)serverFiltered
+         accessToken:(nullable NSString *)accessToken
+          queueDepth:(NSUInteger)queueDepth
+      overflowPolicy:(ParticleEventOverflowPolicy)overflowPolicy
+             handler:(ParticleEventHandler)eventHandler
+{
+    ParticleEventSubscription *subscription = [ParticleEventSubscription new];
+    subscription.handler = eventHandler;
+    subscription.queueDepth = queueDepth;
+    subscription.overflowPolicy = overflowPolicy;
+
+    return [self addSubscription:subscription path:path eventNamePrefix:eventNamePrefix deviceID:deviceID serverFiltered:serverFiltered accessToken:accessToken];
+}
+
+-(id)subscribeToPath:(NSString *)path
+     eventNamePrefix:(nullable NSString *)eventNamePrefix
+            deviceID:(nullable NSString *)deviceID
+      serverFiltered:(BOOL)serverFiltered
+         accessToken:(nullable NSString *)accessToken
+        maxBatchSize:(NSUInteger)maxBatchSize
+          maxLatency:(NSTimeInterval)maxLatency
+        batchHandler:(ParticleEventBatchHandler)batchHandler
+{
+    ParticleEventSubscription *subscription = [ParticleEventSubscription new];
+    subscription.batchHandler = batchHandler;
+    subscription.maxBatchSize = MAX(maxBatchSize, 1);
+    subscription.maxLatency = MAX(maxLatency, 0);
+
+    return [self addSubscription:subscription path:path eventNamePrefix:eventNamePrefix deviceID:deviceID serverFiltered:serverFiltered accessToken:accessToken];
+}
+
+-(void)unsubscribeWithID:(id)subscriptionID
+{
+    EventSource *sourceToClose = nil;
+
+    @synchronized (self) {
+        ParticleEventStream *stream = self.streamsBySubscriptionID[subscriptionID];
+        if (!stream)
+        {
+            return;
+        }
+
+        [self.streamsBySubscriptionID removeObjectForKey:subscriptionID];
+        NSUInteger index = [stream.subscriptions indexOfObjectPassingTest:^BOOL(ParticleEventSubscription *subscription, NSUInteger idx, BOOL *stop) {
+            return [subscription.subscriptionID isEqual:subscriptionID];
+        }];
+        if (index != NSNotFound)
+        {
+            NSMutableArray<ParticleEventSubscription *> *subscriptions = [stream.subscriptions mutableCopy];
+            [subscriptions[index] cancel];
+            [subscriptions removeObjectAtIndex:index];
+            stream.subscriptions = subscriptions;
+        }
+
+        if (stream.subscriptions.count == 0) // last reference gone - tear down the stream
+        {
+            sourceToClose = stream.source;
+            stream.source = nil;
+            [self.streams removeObject:stream];
+        }
+    }
+
+    [sourceToClose close];
+}
+
+-(BOOL)hasSubscriptionWithID:(id)subscriptionID
+{
+    @synchronized (self) {
+        return (self.streamsBySubscriptionID[subscriptionID] != nil);
+    }
+}
+
+-(nullable ParticleEventSubscriptionStats *)statsForSubscriptionWithID:(id)subscriptionID
+{
+    EventSource *source;
+    ParticleEventSubscription *subscription = [self subscriptionWithID:subscriptionID source:&source];
+    return [subscription statsWithStreamSource:source];
+}
+
+-(BOOL)setJournal:(nullable ParticleEventJournal *)journal forSubscriptionWithID:(id)subscriptionID
+{
+    ParticleEventSubscription *subscription = [self subscriptionWithID:subscriptionID source:NULL];
+    subscription.journal = journal;
+    return (subscription != nil);
+}
+
+#pragma mark Internal use methods
+
+-(nullable ParticleEventSubscription *)subscriptionWithID:(id)subscriptionID source:(EventSource * _Nullable * _Nullable)source
+{
+    @synchronized (self) {
+        ParticleEventStream *stream = self.streamsBySubscriptionID[subscriptionID];
+        if (source)
+        {
+            *source = stream.source;
+        }
+        for (ParticleEventSubscription *streamSubscription in stream.subscriptions)
+        {
+            if ([streamSubscription.subscriptionID isEqual:subscriptionID])
+            {
+                return streamSubscription;
+            }
+        }
+    }
+    return nil;
+}
+
+-(id)addSubscription:(ParticleEventSubscription *)subscription
+                path:(NSString *)path
+     eventNamePrefix:(nullable NSString *)eventNamePrefix
+            deviceID:(nullable NSString *)deviceID
+      serverFiltered:(BOOL)serverFiltered
+         accessToken:(nullable NSString *)accessToken
+{
+    if (eventNamePrefix.length == 0)
+    {
+        eventNamePrefix = nil;
+    }
+
+    subscription.subscriptionID = [NSUUID UUID];
+    subscription.eventNamePrefix = eventNamePrefix;
+    subscription.deviceID = deviceID;
+
+    NSString *serverPrefix = serverFiltered ? eventNamePrefix : nil;
+    EventSource *deadSource = nil;
+
+    @synchronized (self) {
+        ParticleEventStream *stream = nil;
+        for (ParticleEventStream *openStream in self.streams)
+        {
+            if ([openStream coversPath:path serverPrefix:serverPrefix accessToken:accessToken])
+            {
+                stream = openStream;
+                break;
+            }
+        }
+
+        if (stream.source.closed)
+        {
+            // stream stopped for good (rejected by the server or out of reconnect retries) - reconnect it for the new
+            // subscription, the subscriptions already on it get their events back too
+            deadSource = stream.source;
+            stream.source = [self eventSourceForStream:stream];
+        }
+
+        if (!stream)
+        {
+            stream = [self openStreamWithPath:path serverPrefix:[self serverPrefixForNewStreamWithPath:path serverPrefix:serverPrefix accessToken:accessToken] accessToken:accessToken];
+            [self.streams addObject:stream];
+        }
+
+        stream.subscriptions = [stream.subscriptions arrayByAddingObject:subscription];
+        self.streamsBySubscriptionID[subscription.subscriptionID] = stream;
+    }
+
+    [deadSource close];
+    return subscription.subscriptionID;
+}
+
+// lock must be held. Pushes the subscription filter to the cloud while there are less than maxServerFilteredStreams filtered
+// streams on the path, past that widens it to the longest prefix shared with an open filtered stream - the new stream then
+// takes over the subscriptions of the streams it covers (see streamDidOpen:) and matching moves to the client side trie
+-(nullable NSString *)serverPrefixForNewStreamWithPath:(NSString *)path serverPrefix:(nullable NSString *)serverPrefix accessToken:(nullable NSString *)accessToken
+{
+    if ((!serverPrefix) || (self.maxServerFilteredStreams == 0))
+    {
+        return serverPrefix;
+    }
+
+    NSUInteger filteredStreamCount = 0;
+    NSString *mergedPrefix = nil;
+    for (ParticleEventStream *openStream in self.streams)
+    {
+        if ((!openStream.serverPrefix) || (![openStream.path isEqualToString:path]) ||
+            ((openStream.accessToken != accessToken) && (![openStream.accessToken isEqualToString:accessToken])))
+        {
+            continue;
+        }
+
+        filteredStreamCount++;
+        NSString *prefix = ParticleEventMergedServerPrefix(serverPrefix, openStream.serverPrefix);
+        if (prefix.length > mergedPrefix.length)
+        {
+            mergedPrefix = prefix;
+        }
+    }
+
+    // nothing to share a filter with - /v1/events can't be opened unfiltered, so the subscription gets its own stream
+    return ((filteredStreamCount < self.maxServerFilteredStreams) || (!mergedPrefix)) ? serverPrefix : mergedPrefix;
+}
+
+-(ParticleEventStream *)openStreamWithPath:(NSString *)path serverPrefix:(nullable NSString *)serverPrefix accessToken:(nullable NSString *)accessToken
+{
+    ParticleEventStream *stream = [ParticleEventStream new];
+    stream.path = path;
+    stream.serverPrefix = serverPrefix;
+    stream.accessToken = accessToken;
+    stream.subscriptions = @[];
+    stream.source = [self eventSourceForStream:stream];
+    return stream;
+}
+
+-(EventSource *)eventSourceForStream:(ParticleEventStream *)stream
+{
+    NSString *endpoint = [NSString stringWithFormat:@"%@%@", self.baseURL, stream.path];
+    if (stream.serverPrefix)
+    {
+        // URL encode name prefix
+        NSCharacterSet *set = [NSCharacterSet URLHostAllowedCharacterSet];
+        NSString *encodedEventPrefix = [stream.serverPrefix stringByAddingPercentEncodingWithAllowedCharacters:set];
+        endpoint = [endpoint stringByAppendingFormat:@"/%@", encodedEventPrefix];
+    }
+    if (stream.accessToken)
+    {
+        endpoint = [endpoint stringByAppendingFormat:@"?access_token=%@", stream.accessToken];
+    }
+
+    EventSource *source = [EventSource eventSourceWithURL:[NSURL URLWithString:endpoint] timeoutInterval:EVENT_STREAM_TIMEOUT_INTERVAL queue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0) session:self.eventSession];
+
+    // - event example -
+    // event: Temp
+    // data: {"data":"Temp1 is 41.900002 F, Temp2 is $f F","ttl":"60","published_at":"2015-01-13T01:23:12.269Z","coreid":"53ff6e066667574824151267"}
+
+    __weak ParticleEventMultiplexer *weakSelf = self;
+    __weak ParticleEventStream *weakStream = stream;
+    // parse and route on the session queue reading the stream (keeps stream order), each subscription then hands events
+    // to its handler from its own bounded delivery queue
+    [source addEventListener:MessageEvent handler:^(Event *event) {
+        ParticleEventStream *strongStream = weakStream;
+        if (strongStream)
+        {
+            [weakSelf stream:strongStream didReceiveEvent:event];
+        }
+    } synchronous:YES];
+
+    // a stream that stopped for good (rejected request, out of reconnect retries) fails every subscription of the stream,
+    // in order with the events before it. Lost connections being reconnected only show in the stats (reconnectCount).
+    [source addEventListener:ErrorEvent handler:^(Event *event) {
+        ParticleEventStream *strongStream = weakStream;
+        if ((strongStream) && (event.error) && (event.readyState == kEventStateClosed))
+        {
+            [weakSelf stream:strongStream didFailWithError:event.error];
+        }
+    } synchronous:YES];
+
+    [source addEventListener:OpenEvent handler:^(Event *event) {
+        ParticleEventStream *strongStream = weakStream;
+        if (strongStream)
+        {
+            [weakSelf streamDidOpen:strongStream];
+        }
+    } synchronous:YES];
+
+    return source;
+}
+
+// a wider stream is connected - move over the subscriptions of the narrower streams it covers and close them.
+// They are moved only now so they keep receiving events on their own streams while the wider one connects.
+-(void)streamDidOpen:(ParticleEventStream *)stream
+{
+    NSMutableArray<EventSource *> *sourcesToClose = [NSMutableArray new];
+
+    @synchronized (self) {
+        if (![self.streams containsObject:stream])
+        {
+            return;
+        }
+
+        NSMutableArray<ParticleEventSubscription *> *movedSubscriptions = [NSMutableArray new];
+        for (ParticleEventStream *openStream in [self.streams copy])
+        {
+            if ((openStream == stream) || (![stream coversPath:openStream.path serverPrefix:openStream.serverPrefix accessToken:openStream.accessToken]))
+            {
+                continue;
+            }
+
+            // both streams were connected for a while - the wider one delivers again what the narrower one just did
+            NSSet<NSData *> *recentEventKeys = [openStream recentEventKeys];
+            NSTimeInterval expiry = [NSProcessInfo processInfo].systemUptime + MIGRATED_EVENT_INTERVAL;
+            for (ParticleEventSubscription *subscription in openStream.subscriptions)
+            {
+                self.streamsBySubscriptionID[subscription.subscriptionID] = stream;
+                subscription.migratedEventKeys = (recentEventKeys.count > 0) ? recentEventKeys : nil;
+                subscription.migratedEventKeysExpiry = expiry;
+            }
+            [movedSubscriptions addObjectsFromArray:openStream.subscriptions];
+            openStream.subscriptions = @[];
+            if (openStream.source)
+            {
+                [sourcesToClose addObject:openStream.source];
+            }
+            openStream.source = nil;
+            [self.streams removeObject:openStream];
+        }
+
+        if (movedSubscriptions.count > 0)
+        {
+            stream.subscriptions = [stream.subscriptions arrayByAddingObjectsFromArray:movedSubscriptions];
+        }
+    }
+
+    for (EventSource *source in sourcesToClose)
+    {
+        [source close];
+    }
+}
+
+-(void)stream:(ParticleEventStream *)stream didReceiveEvent:(Event *)event
+{
+    // lock free - subscribe/unsubscribe replace the snapshot, events already routed to a removed subscription are dropped by its cancelled queue
+    ParticleEventRouter *router = stream.router;
+    NSArray<ParticleEventSubscription *> *subscriptions = router.subscriptions;
+
+    if (subscriptions.count == 0)
+    {
+        return;
+    }
+
+    if (event.error)
+    {
+        [self stream:stream didFailWithError:event.error];
+        return;
+    }
+
+    [stream recordEvent:event];
+
+    // decode event once for all subscriptions sharing the stream - only name and device ID, the rest on first access
+    NSError *error;
+    ParticleEvent *particleEvent;
+    if (event.data)
+    {
+        particleEvent = [[ParticleEvent alloc] initWithEventName:event.name payload:event.data];
+        if (!particleEvent)
+        {
+            // not the usual flat envelope - take the general JSON path
+            NSDictionary *jsonDict = [NSJSONSerialization JSONObjectWithData:event.data options:0 error:&error];
+            if ([jsonDict isKindOfClass:[NSDictionary class]])
+            {
+                NSMutableDictionary *eventDict = [jsonDict mutableCopy];
+                if (event.name)
+                {
+                    eventDict[@"event"] = event.name; // add event name to dict
+                }
+                particleEvent = [[ParticleEvent alloc] initWithEventDict:eventDict];
+            }
+        }
+    }
+
+    if (particleEvent)
+    {
+        __block NSMutableArray<ParticleEventJournal *> *journals = nil;
+        __block NSData *eventKey = nil;
+        [router enumerateSubscriptionsMatchingEvent:particleEvent usingBlock:^(ParticleEventSubscription *subscription) {
+            if (subscription.migratedEventKeys)
+            {
+                eventKey = eventKey ?: ParticleEventStreamEventKey(event);
+                if ([subscription isMigratedEvent:eventKey])
+                {
+                    return; // already delivered by the stream it was moved from
+                }
+            }
+            // subscriptions sharing a journal record the event in it once
+            ParticleEventJournal *journal = subscription.journal;
+            if ((journal) && ((!journals) || ([journals indexOfObjectIdenticalTo:journal] == NSNotFound)))
+            {
+                journals = journals ?: [NSMutableArray new];
+                [journals addObject:journal];
+                [journal appendEventWithName:event.name ?: @"" deviceID:particleEvent.deviceID payload:event.data];
+            }
+            [subscription enqueueEvent:particleEvent]; // callback with parsed data
+        }];
+    }
+    else if (error)
+    {
+        for (ParticleEventSubscription *subscription in subscriptions)
+        {
+            [subscription enqueueError:error];
+        }
+    }
+}
+
+-(void)stream:(ParticleEventStream *)stream didFailWithError:(NSError *)error
+{
+    for (ParticleEventSubscription *subscription in stream.router.subscriptions)
+    {
+        [subscription enqueueError:error];
+    }
+}
+
+-(void)dealloc
+{
+    for (ParticleEventStream *stream in self.streams)
+    {
+        [stream.source close];
+    }
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,73 @@
+//
+//  ParticleEventStore.h
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "ParticleEvent.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Rolling in-memory window of events (e.g. the last hour for a chart), kept in compact columns instead of ParticleEvent objects:
+ *  published times as int64 milliseconds, interned device IDs and event names, TTLs and event data bytes in one arena.
+ *  Events are ordered by published time, window queries binary search it. Events older than retentionInterval before
+ *  the newest one are evicted as new events come in. Thread safe.
+ *
+ *      ParticleEventStore *store = [ParticleEventStore new];
+ *      [[ParticleCloud sharedInstance] subscribeToMyDevicesEventsWithPrefix:@"temp" handler:store.eventHandler];
+ *      NSArray *events = [store eventsWithDeviceID:deviceID eventNamePrefix:@"temp" from:[NSDate dateWithTimeIntervalSinceNow:-600] to:[NSDate date]];
+ */
+@interface ParticleEventStore : NSObject
+
+/**
+ *  Window of events kept, measured back from the newest published time (default 1 hour)
+ */
+@property (nonatomic, readonly) NSTimeInterval retentionInterval;
+
+/**
+ *  Number of events in the store
+ */
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+ *  Bytes allocated by the store - columns, data arena and interned strings
+ */
+@property (nonatomic, readonly) NSUInteger memoryFootprint;
+
+/**
+ *  Subscription event handler adding received events to the store, pass to any ParticleCloud/ParticleDevice subscribe method
+ */
+@property (nonatomic, readonly) ParticleEventHandler eventHandler;
+
+-(instancetype)init;
+-(instancetype)initWithRetentionInterval:(NSTimeInterval)retentionInterval NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Add an event, events without a published time are stored at the current time
+ */
+-(void)addEvent:(ParticleEvent *)event;
+
+/**
+ *  Events of a device and name prefix published in [startDate, endDate], oldest first
+ *
+ *  @param deviceID         Device ID, nil for all devices
+ *  @param eventNamePrefix  Event name prefix, nil/empty string for all events. "particle" and "spark" system event prefixes match each other like subscriptions do.
+ *  @param startDate        Earliest published time, nil for the oldest event in the store
+ *  @param endDate          Latest published time, nil for the newest event in the store
+ *  @return new ParticleEvent objects
+ */
+-(NSArray<ParticleEvent *> *)eventsWithDeviceID:(nullable NSString *)deviceID eventNamePrefix:(nullable NSString *)eventNamePrefix from:(nullable NSDate *)startDate to:(nullable NSDate *)endDate;
+
+/**
+ *  Number of events eventsWithDeviceID:eventNamePrefix:from:to: would return, without creating them
+ */
+-(NSUInteger)countOfEventsWithDeviceID:(nullable NSString *)deviceID eventNamePrefix:(nullable NSString *)eventNamePrefix from:(nullable NSDate *)startDate to:(nullable NSDate *)endDate;
+
+-(void)removeAllEvents;
+
+@end
+
+NS_ASSUME_NONNULL_END
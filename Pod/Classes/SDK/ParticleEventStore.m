@@ -0,0 +1,427 @@
+//
+//  ParticleEventStore.m
+//  Particle iOS Cloud SDK
+//
+//  Copyright (c) 2017 Particle. All rights reserved.
+//
+
+#import "ParticleEventStore.h"
+#import "ParticleEventMultiplexer.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+#define DEFAULT_EVENT_STORE_RETENTION_INTERVAL  3600
+#define EVENT_STORE_INITIAL_CAPACITY            1024
+#define EVENT_STORE_INITIAL_ARENA_CAPACITY      (16 * 1024)
+#define EVENT_STORE_INTERNED_STRING_OVERHEAD    64          // approximate bytes per interned string - object, dictionary and array slots
+
+static uint32_t const kEventStoreNoString = UINT32_MAX;    // nil device ID / event name
+static uint32_t const kEventStoreNoData = UINT32_MAX;      // nil event data
+
+static int64_t ParticleEventStoreMilliseconds(NSDate *date)
+{
+    return (int64_t)floor(date.timeIntervalSince1970 * 1000);
+}
+
+@implementation ParticleEventStore {
+    // one column per field, events [_start, _end) are live and ordered by time
+    int64_t *_times;                // published at, milliseconds since 1970
+    uint32_t *_deviceIndexes;       // into _deviceIDs
+    uint32_t *_nameIndexes;         // into _eventNames
+    int32_t *_ttls;
+    uint32_t *_dataOffsets;         // into _arena
+    uint32_t *_dataLengths;
+    NSUInteger _start;
+    NSUInteger _end;
+    NSUInteger _capacity;
+
+    uint8_t *_arena;                // event data UTF-8 bytes
+    NSUInteger _arenaLength;
+    NSUInteger _arenaCapacity;
+
+    NSMutableArray<NSString *> *_deviceIDs;
+    NSMutableDictionary<NSString *, NSNumber *> *_deviceIndexByID;
+    NSMutableArray<NSString *> *_eventNames;
+    NSMutableDictionary<NSString *, NSNumber *> *_nameIndexByName;
+    NSUInteger _internedBytes;
+}
+
+-(instancetype)init
+{
+    return [self initWithRetentionInterval:DEFAULT_EVENT_STORE_RETENTION_INTERVAL];
+}
+
+-(instancetype)initWithRetentionInterval:(NSTimeInterval)retentionInterval
+{
+    self = [super init];
+    if (self)
+    {
+        _retentionInterval = retentionInterval;
+        [self resetStorage];
+    }
+    return self;
+}
+
+-(ParticleEventHandler)eventHandler
+{
+    __weak ParticleEventStore *weakSelf = self;
+    return ^(ParticleEvent * _Nullable event, NSError * _Nullable error) {
+        if (event)
+        {
+            [weakSelf addEvent:event];
+        }
+    };
+}
+
+-(NSUInteger)count
+{
+    @synchronized (self) {
+        return _end - _start;
+    }
+}
+
+-(NSUInteger)memoryFootprint
+{
+    @synchronized (self) {
+        NSUInteger rowSize = sizeof(*_times) + sizeof(*_deviceIndexes) + sizeof(*_nameIndexes) + sizeof(*_ttls) + sizeof(*_dataOffsets) + sizeof(*_dataLengths);
+        return _capacity * rowSize + _arenaCapacity + _internedBytes;
+    }
+}
+
+#pragma mark Adding events
+
+-(void)addEvent:(ParticleEvent *)event
+{
+    int64_t time = ParticleEventStoreMilliseconds(event.time ?: [NSDate date]);
+    int64_t retention = (int64_t)(self.retentionInterval * 1000);
+    NSString *data = event.data;
+    const char *dataBytes = data.UTF8String;
+    NSUInteger dataLength = dataBytes ? strlen(dataBytes) : 0;
+
+    @synchronized (self) {
+        if ((_end > _start) && (time < _times[_end - 1] - retention))
+        {
+            return; // already out of the window
+        }
+
+        if ((![self reserveRow]) || ((dataBytes) && (![self reserveArenaBytes:dataLength])))
+        {
+            return;
+        }
+
+        // events mostly arrive in time order - append, otherwise insert after the last event not newer than this one
+        NSUInteger index = _end;
+        if ((_end > _start) && (time < _times[_end - 1]))
+        {
+            index = [self upperBoundForTime:time];
+            NSUInteger moved = _end - index;
+            memmove(_times + index + 1, _times + index, moved * sizeof(*_times));
+            memmove(_deviceIndexes + index + 1, _deviceIndexes + index, moved * sizeof(*_deviceIndexes));
+            memmove(_nameIndexes + index + 1, _nameIndexes + index, moved * sizeof(*_nameIndexes));
+            memmove(_ttls + index + 1, _ttls + index, moved * sizeof(*_ttls));
+            memmove(_dataOffsets + index + 1, _dataOffsets + index, moved * sizeof(*_dataOffsets));
+            memmove(_dataLengths + index + 1, _dataLengths + index, moved * sizeof(*_dataLengths));
+        }
+
+        _times[index] = time;
+        _deviceIndexes[index] = [self internString:event.deviceID strings:_deviceIDs indexes:_deviceIndexByID];
+        _nameIndexes[index] = [self internString:event.event strings:_eventNames indexes:_nameIndexByName];
+        _ttls[index] = (int32_t)event.ttl;
+        if (dataBytes)
+        {
+            memcpy(_arena + _arenaLength, dataBytes, dataLength);
+            _dataOffsets[index] = (uint32_t)_arenaLength;
+            _dataLengths[index] = (uint32_t)dataLength;
+            _arenaLength += dataLength;
+        }
+        else
+        {
+            _dataOffsets[index] = 0;
+            _dataLengths[index] = kEventStoreNoData;
+        }
+        _end++;
+
+        // evict what fell out of the window
+        _start = [self lowerBoundForTime:_times[_end - 1] - retention];
+    }
+}
+
+-(void)removeAllEvents
+{
+    @synchronized (self) {
+        [self freeStorage];
+        [self resetStorage];
+    }
+}
+
+#pragma mark Queries
+
+-(NSArray<ParticleEvent *> *)eventsWithDeviceID:(nullable NSString *)deviceID eventNamePrefix:(nullable NSString *)eventNamePrefix from:(nullable NSDate *)startDate to:(nullable NSDate *)endDate
+{
+    NSMutableArray<ParticleEvent *> *events = [NSMutableArray new];
+    [self enumerateRowsWithDeviceID:deviceID eventNamePrefix:eventNamePrefix from:startDate to:endDate usingBlock:^(NSUInteger row) {
+        ParticleEvent *event = [[ParticleEvent alloc] initWithEventDict:@{}];
+        event.deviceID = (self->_deviceIndexes[row] != kEventStoreNoString) ? self->_deviceIDs[self->_deviceIndexes[row]] : @"";
+        event.event = (self->_nameIndexes[row] != kEventStoreNoString) ? self->_eventNames[self->_nameIndexes[row]] : @"";
+        event.ttl = self->_ttls[row];
+        event.time = [NSDate dateWithTimeIntervalSince1970:self->_times[row] / 1000.0];
+        if (self->_dataLengths[row] != kEventStoreNoData)
+        {
+            event.data = [[NSString alloc] initWithBytes:self->_arena + self->_dataOffsets[row] length:self->_dataLengths[row] encoding:NSUTF8StringEncoding];
+        }
+        [events addObject:event];
+    }];
+    return events;
+}
+
+-(NSUInteger)countOfEventsWithDeviceID:(nullable NSString *)deviceID eventNamePrefix:(nullable NSString *)eventNamePrefix from:(nullable NSDate *)startDate to:(nullable NSDate *)endDate
+{
+    __block NSUInteger count = 0;
+    [self enumerateRowsWithDeviceID:deviceID eventNamePrefix:eventNamePrefix from:startDate to:endDate usingBlock:^(NSUInteger row) {
+        count++;
+    }];
+    return count;
+}
+
+#pragma mark Internal use methods
+
+// calls block with the lock held
+-(void)enumerateRowsWithDeviceID:(nullable NSString *)deviceID eventNamePrefix:(nullable NSString *)eventNamePrefix from:(nullable NSDate *)startDate to:(nullable NSDate *)endDate usingBlock:(void (^)(NSUInteger row))block
+{
+    int64_t startTime = startDate ? ParticleEventStoreMilliseconds(startDate) : INT64_MIN;
+    int64_t endTime = endDate ? ParticleEventStoreMilliseconds(endDate) : INT64_MAX;
+
+    @synchronized (self) {
+        uint32_t deviceIndex = kEventStoreNoString;
+        if (deviceID)
+        {
+            NSNumber *index = _deviceIndexByID[deviceID];
+            if (!index)
+            {
+                return;
+            }
+            deviceIndex = index.unsignedIntValue;
+        }
+
+        // name prefix is matched once per interned name, not per event
+        NSMutableData *nameMatches = nil;
+        if (eventNamePrefix.length > 0)
+        {
+            nameMatches = [NSMutableData dataWithLength:_eventNames.count];
+            BOOL *matches = nameMatches.mutableBytes;
+            [_eventNames enumerateObjectsUsingBlock:^(NSString *eventName, NSUInteger index, BOOL *stop) {
+                matches[index] = ParticleEventNameHasPrefix(eventName, eventNamePrefix);
+            }];
+        }
+        const BOOL *matches = nameMatches.bytes;
+
+        NSUInteger end = [self upperBoundForTime:endTime];
+        for (NSUInteger row = [self lowerBoundForTime:startTime]; row < end; row++)
+        {
+            if (((deviceID) && (_deviceIndexes[row] != deviceIndex)) ||
+                ((matches) && ((_nameIndexes[row] == kEventStoreNoString) || (!matches[_nameIndexes[row]]))))
+            {
+                continue;
+            }
+            block(row);
+        }
+    }
+}
+
+// first live row with time >= time
+-(NSUInteger)lowerBoundForTime:(int64_t)time
+{
+    NSUInteger low = _start;
+    NSUInteger high = _end;
+    while (low < high)
+    {
+        NSUInteger middle = low + (high - low) / 2;
+        if (_times[middle] < time)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// first live row with time > time
+-(NSUInteger)upperBoundForTime:(int64_t)time
+{
+    NSUInteger low = _start;
+    NSUInteger high = _end;
+    while (low < high)
+    {
+        NSUInteger middle = low + (high - low) / 2;
+        if (_times[middle] <= time)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+-(uint32_t)internString:(nullable NSString *)string strings:(NSMutableArray<NSString *> *)strings indexes:(NSMutableDictionary<NSString *, NSNumber *> *)indexes
+{
+    if (!string)
+    {
+        return kEventStoreNoString;
+    }
+
+    NSNumber *index = indexes[string];
+    if (!index)
+    {
+        index = @(strings.count);
+        string = [string copy];
+        [strings addObject:string];
+        indexes[string] = index;
+        _internedBytes += [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + EVENT_STORE_INTERNED_STRING_OVERHEAD;
+    }
+    return index.unsignedIntValue;
+}
+
+// lock must be held - room for one more row at _end, evicted rows are reclaimed before the columns grow
+-(BOOL)reserveRow
+{
+    if (_end < _capacity)
+    {
+        return YES;
+    }
+
+    NSUInteger count = _end - _start;
+    if (_start > count)
+    {
+        memmove(_times, _times + _start, count * sizeof(*_times));
+        memmove(_deviceIndexes, _deviceIndexes + _start, count * sizeof(*_deviceIndexes));
+        memmove(_nameIndexes, _nameIndexes + _start, count * sizeof(*_nameIndexes));
+        memmove(_ttls, _ttls + _start, count * sizeof(*_ttls));
+        memmove(_dataOffsets, _dataOffsets + _start, count * sizeof(*_dataOffsets));
+        memmove(_dataLengths, _dataLengths + _start, count * sizeof(*_dataLengths));
+        _start = 0;
+        _end = count;
+        return YES;
+    }
+
+    NSUInteger capacity = _capacity * 2;
+    int64_t *times = realloc(_times, capacity * sizeof(*_times));
+    uint32_t *deviceIndexes = realloc(_deviceIndexes, capacity * sizeof(*_deviceIndexes));
+    uint32_t *nameIndexes = realloc(_nameIndexes, capacity * sizeof(*_nameIndexes));
+    int32_t *ttls = realloc(_ttls, capacity * sizeof(*_ttls));
+    uint32_t *dataOffsets = realloc(_dataOffsets, capacity * sizeof(*_dataOffsets));
+    uint32_t *dataLengths = realloc(_dataLengths, capacity * sizeof(*_dataLengths));
+    // a failed realloc leaves the old block in place
+    _times = times ?: _times;
+    _deviceIndexes = deviceIndexes ?: _deviceIndexes;
+    _nameIndexes = nameIndexes ?: _nameIndexes;
+    _ttls = ttls ?: _ttls;
+    _dataOffsets = dataOffsets ?: _dataOffsets;
+    _dataLengths = dataLengths ?: _dataLengths;
+    if ((!times) || (!deviceIndexes) || (!nameIndexes) || (!ttls) || (!dataOffsets) || (!dataLengths))
+    {
+        return NO;
+    }
+    _capacity = capacity;
+    return YES;
+}
+
+// lock must be held - room for length more arena bytes, bytes of evicted rows are reclaimed before the arena grows
+-(BOOL)reserveArenaBytes:(NSUInteger)length
+{
+    if (_arenaLength + length <= _arenaCapacity)
+    {
+        return YES;
+    }
+
+    // rows are in time order, their data in arrival order - live data starts at the lowest live offset
+    NSUInteger liveOffset = _arenaLength;
+    for (NSUInteger row = _start; row < _end; row++)
+    {
+        if (_dataLengths[row] != kEventStoreNoData)
+        {
+            liveOffset = MIN(liveOffset, _dataOffsets[row]);
+        }
+    }
+    if (liveOffset > 0)
+    {
+        memmove(_arena, _arena + liveOffset, _arenaLength - liveOffset);
+        _arenaLength -= liveOffset;
+        for (NSUInteger row = _start; row < _end; row++)
+        {
+            _dataOffsets[row] -= (_dataLengths[row] != kEventStoreNoData) ? (uint32_t)liveOffset : 0;
+        }
+    }
+
+    NSUInteger capacity = _arenaCapacity;
+    while (_arenaLength + length > capacity)
+    {
+        capacity *= 2;
+    }
+    // shrink back once most of the arena is free
+    while ((capacity > EVENT_STORE_INITIAL_ARENA_CAPACITY) && (_arenaLength + length < capacity / 4))
+    {
+        capacity /= 2;
+    }
+    if ((capacity > UINT32_MAX) || (capacity == _arenaCapacity))
+    {
+        return (_arenaLength + length <= _arenaCapacity);
+    }
+
+    uint8_t *arena = realloc(_arena, capacity);
+    if (!arena)
+    {
+        return (_arenaLength + length <= _arenaCapacity);
+    }
+    _arena = arena;
+    _arenaCapacity = capacity;
+    return YES;
+}
+
+-(void)resetStorage
+{
+    _capacity = EVENT_STORE_INITIAL_CAPACITY;
+    _times = malloc(_capacity * sizeof(*_times));
+    _deviceIndexes = malloc(_capacity * sizeof(*_deviceIndexes));
+    _nameIndexes = malloc(_capacity * sizeof(*_nameIndexes));
+    _ttls = malloc(_capacity * sizeof(*_ttls));
+    _dataOffsets = malloc(_capacity * sizeof(*_dataOffsets));
+    _dataLengths = malloc(_capacity * sizeof(*_dataLengths));
+    _start = 0;
+    _end = 0;
+
+    _arenaCapacity = EVENT_STORE_INITIAL_ARENA_CAPACITY;
+    _arena = malloc(_arenaCapacity);
+    _arenaLength = 0;
+
+    _deviceIDs = [NSMutableArray new];
+    _deviceIndexByID = [NSMutableDictionary new];
+    _eventNames = [NSMutableArray new];
+    _nameIndexByName = [NSMutableDictionary new];
+    _internedBytes = 0;
+}
+
+-(void)freeStorage
+{
+    free(_times);
+    free(_deviceIndexes);
+    free(_nameIndexes);
+    free(_ttls);
+    free(_dataOffsets);
+    free(_dataLengths);
+    free(_arena);
+}
+
+-(void)dealloc
+{
+    [self freeStorage];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
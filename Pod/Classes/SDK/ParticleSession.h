@@ -73,10 +73,19 @@ NS_ASSUME_NONNULL_BEGIN
  */
 -(nullable instancetype)initWithSavedSession;
 
+/**
+ *  Session is stored in (and removed from) the keychain, only the session of ParticleCloud sharedInstance is
+ */
+@property (nonatomic, readonly) BOOL persistent;
+
+// Internal use - sessions of ParticleCloud instances other than sharedInstance are kept in memory only
+-(nullable instancetype)initWithNewSession:(NSDictionary *)loginResponseDict persistent:(BOOL)persistent;
+-(nullable instancetype)initWithToken:(NSString *)token expiryDate:(nullable NSDate *)expiryDate refreshToken:(nullable NSString *)refreshToken persistent:(BOOL)persistent;
+
 -(instancetype)init __attribute__((unavailable("Must use initWithNewSession: / initWithSavedSession: or one of the initWithToken initializers")));
 
 /**
- *  Remove access token session data from keychain
+ *  Remove access token session data (from keychain too if persistent)
  */
 -(void)removeSession;
 
@@ -36,6 +36,11 @@ NSString *const kParticleSessionUsernameStringKey = @"kParticleSessionUsernameSt
 @implementation ParticleSession
 
 -(nullable instancetype)initWithNewSession:(NSDictionary *)loginResponseDict
+{
+    return [self initWithNewSession:loginResponseDict persistent:YES];
+}
+
+-(nullable instancetype)initWithNewSession:(NSDictionary *)loginResponseDict persistent:(BOOL)persistent
 {
     self = [super init];
     if (self)
@@ -63,6 +68,7 @@ NSString *const kParticleSessionUsernameStringKey = @"kParticleSessionUsernameSt
         if (![loginResponseDict[@"token_type"] isEqualToString:@"bearer"])
             return nil;
 
+        _persistent = persistent;
         [self storeSessionInKeychainAndSetExpiryTimer];
         
         return self;
@@ -74,22 +80,7 @@ NSString *const kParticleSessionUsernameStringKey = @"kParticleSessionUsernameSt
 
 -(nullable instancetype)initWithToken:(NSString *)token
 {
-    self = [super init];
-    if (self)
-    {
-        if (!token)
-            return nil;
-        
-        self.accessToken = token;
-        self.expiryDate = [NSDate distantFuture];
-        self.refreshToken = nil;
-
-        [self storeSessionInKeychainAndSetExpiryTimer];
-        
-        return self;
-    }
-    
-    return nil;
+    return [self initWithToken:token expiryDate:nil refreshToken:nil persistent:YES];
 }
 
 -(void)storeSessionInKeychainAndSetExpiryTimer
@@ -99,6 +90,9 @@ NSString *const kParticleSessionUsernameStringKey = @"kParticleSessionUsernameSt
         [[NSRunLoop currentRunLoop] addTimer:self.expiryTimer forMode:NSDefaultRunLoopMode];
     }
     
+    if (!self.persistent)
+        return;
+    
     NSMutableDictionary *accessTokenDict = [NSMutableDictionary new];
     accessTokenDict[kParticleSessionAccessTokenStringKey] = self.accessToken;
     accessTokenDict[kParticleSessionExpiryDateKey] = self.expiryDate;
@@ -117,46 +111,37 @@ NSString *const kParticleSessionUsernameStringKey = @"kParticleSessionUsernameSt
 
 -(nullable instancetype)initWithToken:(NSString *)token andExpiryDate:(NSDate *)expiryDate
 {
-    self = [super init];
-    if (self)
-    {
-        if (!expiryDate)
-            return nil;
-        
-        if (!token)
-            return nil;
-        
-        self.expiryDate = expiryDate;
-        self.accessToken = token;
-        self.refreshToken = nil;
-        self.username = nil;
-        
-        [self storeSessionInKeychainAndSetExpiryTimer];
-        return self;
-    }
+    if (!expiryDate)
+        return nil;
     
-    return nil;
+    return [self initWithToken:token expiryDate:expiryDate refreshToken:nil persistent:YES];
 }
 
 -(nullable instancetype)initWithToken:(NSString *)token withExpiryDate:(NSDate *)expiryDate withRefreshToken:(NSString *)refreshToken
+{
+    if (!expiryDate)
+        return nil;
+    
+    if (!refreshToken)
+        return nil;
+    
+    return [self initWithToken:token expiryDate:expiryDate refreshToken:refreshToken persistent:YES];
+}
+
+-(nullable instancetype)initWithToken:(NSString *)token expiryDate:(nullable NSDate *)expiryDate refreshToken:(nullable NSString *)refreshToken persistent:(BOOL)persistent
 {
     self = [super init];
     if (self)
     {
-        if (!expiryDate)
-            return nil;
-        
         if (!token)
             return nil;
         
-        if (!refreshToken)
-            return nil;
-        
-        self.expiryDate = expiryDate;
+        self.expiryDate = expiryDate ?: [NSDate distantFuture];
         self.accessToken = token;
         self.refreshToken = refreshToken;
         self.username = nil;
         
+        _persistent = persistent;
         [self storeSessionInKeychainAndSetExpiryTimer];
         return self;
     }
@@ -170,6 +155,7 @@ NSString *const kParticleSessionUsernameStringKey = @"kParticleSessionUsernameSt
     self = [super init];
     if (self)
     {
+        _persistent = YES;
         KeychainItemWrapper *keychainTokenItem = [[KeychainItemWrapper alloc] initWithIdentifier:kParticleSessionKeychainEntry accessGroup:nil];
         NSData *keychainData = [keychainTokenItem objectForKey:(__bridge id)(kSecValueData)];
         NSDictionary *accessTokenDict;
@@ -241,8 +227,11 @@ NSString *const kParticleSessionUsernameStringKey = @"kParticleSessionUsernameSt
 
 -(void)removeSession
 {
-    KeychainItemWrapper *keychainTokenItem = [[KeychainItemWrapper alloc] initWithIdentifier:kParticleSessionKeychainEntry accessGroup:nil];
-    [keychainTokenItem resetKeychainItem];
+    if (self.persistent)
+    {
+        KeychainItemWrapper *keychainTokenItem = [[KeychainItemWrapper alloc] initWithIdentifier:kParticleSessionKeychainEntry accessGroup:nil];
+        [keychainTokenItem resetKeychainItem];
+    }
     self.accessToken = nil;
     self.username = nil;
     self.refreshToken = nil;